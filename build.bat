@@ -3,7 +3,10 @@
 if not exist build mkdir build
 pushd build
 
-rem clang -g -O0 -Wall -Wno-unused-variable -Wno-unused-function -Wno-unused-but-set-variable ../dwrite_text_to_glyphs_example.cpp -o main.exe -luser32.lib
+clang -g -O0 -Wall -Wno-unused-variable -Wno-unused-function -Wno-unused-but-set-variable ../dwrite_text_to_glyphs_example.cpp -o dwrite_example.exe -luser32.lib
 clang -g -O0 -Wall -Wno-unused-variable -Wno-unused-function -Wno-unused-but-set-variable ../d2d_text_rendering_example.cpp -o main.exe -luser32.lib
+clang -g -O2 -Wall -Wno-unused-variable -Wno-unused-function -Wno-unused-but-set-variable ../text_to_glyphs_benchmark.cpp -o benchmark.exe
+clang -g -O2 -Wall -Wno-unused-variable -Wno-unused-function -Wno-unused-but-set-variable ../software_rasterizer_benchmark.cpp -o software_rasterizer_benchmark.exe
+clang -g -O2 -Wall -Wno-unused-variable -Wno-unused-function -Wno-unused-but-set-variable ../glyph_metrics_benchmark.cpp -o glyph_metrics_benchmark.exe
 
 popd  
\ No newline at end of file
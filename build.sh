@@ -0,0 +1,11 @@
+#!/bin/sh
+
+mkdir -p build
+cd build
+
+clang++ -g -O2 -Wall -Wno-unused-variable -Wno-unused-function -Wno-unused-but-set-variable ../text_to_glyphs_benchmark.cpp -o benchmark -lpthread
+clang++ -g -O2 -Wall -Wno-unused-variable -Wno-unused-function -Wno-unused-but-set-variable ../software_rasterizer_benchmark.cpp -o software_rasterizer_benchmark -DSOFTWARE_RASTERIZER_BENCHMARK_FREETYPE=1 $(pkg-config --cflags --libs freetype2 fontconfig) -lpthread
+clang++ -g -O2 -Wall -Wno-unused-variable -Wno-unused-function -Wno-unused-but-set-variable ../glyph_metrics_benchmark.cpp -o glyph_metrics_benchmark -lpthread
+clang++ -g -O2 -Wall -Wno-unused-variable -Wno-unused-function -Wno-unused-but-set-variable ../freetype_text_to_glyphs_example.cpp -o freetype_example $(pkg-config --cflags --libs freetype2 fontconfig) -lpthread
+
+cd ..
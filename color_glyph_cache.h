@@ -0,0 +1,303 @@
+#ifndef COLOR_GLYPH_CACHE_H
+#define COLOR_GLYPH_CACHE_H
+
+#include "draw_list.h"
+
+////////////////////////////////////////////////////////////
+// hampus: color glyph cache
+
+// NOTE(hampus): Remembers which fonts have color glyphs at all, and how each
+// color glyph breaks down into layers, so that a run only has to be handed to
+// the backend the first time one of its glyphs is seen. Fonts without color
+// tables are skipped after a single check.
+//
+// The layers of a glyph don't depend on the em size or the position, so the
+// key is just (font face, glyph index). Nothing is ever evicted, since a font
+// has a bounded number of glyphs and a glyph only a few layers.
+//
+// color_glyph_cache_translate_run() is a DrawListTranslateColorFunction, with
+// the cache as its user data.
+
+struct ColorGlyphLayer
+{
+  uint16_t glyph_index;
+  DrawListRunKind kind;
+  uint32_t image_format;
+  bool uses_foreground_color;
+  DrawListColor color;
+};
+
+// NOTE(hampus): Returns whether the font has any color glyphs.
+typedef bool ColorFontFunction(void *user_data, ShapingFontFace *font_face);
+
+// NOTE(hampus): Splits one glyph into its layers, bottom first, and pushes
+// them onto `arena`. Returns false if the glyph has no color.
+typedef bool ColorGlyphDecomposeFunction(void *user_data, Arena *arena, ShapingFontFace *font_face, uint16_t glyph_index, ColorGlyphLayer **layers, uint32_t *layer_count);
+
+struct ColorGlyphCacheFont
+{
+  ColorGlyphCacheFont *hash_next;
+  ShapingFontFace *font_face;
+  bool has_color_glyphs;
+};
+
+struct ColorGlyphCacheEntry
+{
+  ColorGlyphCacheEntry *hash_next;
+  ShapingFontFace *font_face;
+  uint16_t glyph_index;
+
+  // NOTE(hampus): 0 for glyphs without color
+  uint32_t layer_count;
+  ColorGlyphLayer *layers;
+};
+
+struct ColorGlyphCacheStats
+{
+  uint64_t run_count;
+  uint64_t color_run_count;
+  uint64_t glyph_lookup_count;
+  uint64_t glyph_hit_count;
+  uint64_t decompose_count;
+};
+
+struct ColorGlyphCache
+{
+  Arena *arena;
+
+  const ShapingBackendFunctions *backend_functions;
+  ColorFontFunction *is_color_font;
+  ColorGlyphDecomposeFunction *decompose;
+  void *user_data;
+
+  uint32_t font_slot_count;
+  ColorGlyphCacheFont **font_slots;
+
+  uint32_t glyph_slot_count;
+  ColorGlyphCacheEntry **glyph_slots;
+
+  ColorGlyphCacheStats stats;
+};
+
+static ColorGlyphCache *
+color_glyph_cache_alloc(const ShapingBackendFunctions *backend_functions, ColorFontFunction *is_color_font, ColorGlyphDecomposeFunction *decompose, void *user_data)
+{
+  ColorGlyphCache *cache = (ColorGlyphCache *)memory_alloc_zero(sizeof(ColorGlyphCache));
+  cache->arena = arena_alloc();
+  cache->backend_functions = backend_functions;
+  cache->is_color_font = is_color_font;
+  cache->decompose = decompose;
+  cache->user_data = user_data;
+  cache->font_slot_count = 64;
+  cache->font_slots = push_array(cache->arena, ColorGlyphCacheFont *, cache->font_slot_count);
+  cache->glyph_slot_count = 4096;
+  cache->glyph_slots = push_array(cache->arena, ColorGlyphCacheEntry *, cache->glyph_slot_count);
+  return cache;
+}
+
+static void
+color_glyph_cache_release(ColorGlyphCache *cache)
+{
+  // NOTE(hampus): Only the fonts hold a reference, every glyph entry belongs
+  // to one of them.
+  for(uint32_t slot_idx = 0; slot_idx < cache->font_slot_count; ++slot_idx)
+  {
+    for(ColorGlyphCacheFont *font = cache->font_slots[slot_idx]; font != 0; font = font->hash_next)
+    {
+      cache->backend_functions->release_font_face(font->font_face);
+    }
+  }
+  arena_release(cache->arena);
+  memory_free(cache);
+}
+
+static uint64_t
+color_glyph_cache_hash(ShapingFontFace *font_face, uint16_t glyph_index)
+{
+  uint64_t hash = (uint64_t)(uintptr_t)font_face;
+  hash = (hash ^ glyph_index) * 0x100000001B3ull;
+  return hash ^ (hash >> 29);
+}
+
+static ColorGlyphCacheFont *
+color_glyph_cache_font_from_font_face(ColorGlyphCache *cache, ShapingFontFace *font_face)
+{
+  uint64_t slot_idx = color_glyph_cache_hash(font_face, 0) & (cache->font_slot_count - 1);
+  ColorGlyphCacheFont *font = cache->font_slots[slot_idx];
+  for(; font != 0; font = font->hash_next)
+  {
+    if(font->font_face == font_face)
+    {
+      break;
+    }
+  }
+
+  if(font == 0)
+  {
+    font = push_array(cache->arena, ColorGlyphCacheFont, 1);
+    font->font_face = font_face;
+    font->has_color_glyphs = cache->is_color_font(cache->user_data, font_face);
+    cache->backend_functions->add_ref_font_face(font_face);
+    font->hash_next = cache->font_slots[slot_idx];
+    cache->font_slots[slot_idx] = font;
+  }
+  return font;
+}
+
+static ColorGlyphCacheEntry *
+color_glyph_cache_entry_from_glyph(ColorGlyphCache *cache, ShapingFontFace *font_face, uint16_t glyph_index)
+{
+  // NOTE(hampus): The font has to be in the cache already
+  cache->stats.glyph_lookup_count += 1;
+  uint64_t slot_idx = color_glyph_cache_hash(font_face, glyph_index) & (cache->glyph_slot_count - 1);
+  ColorGlyphCacheEntry *entry = cache->glyph_slots[slot_idx];
+  for(; entry != 0; entry = entry->hash_next)
+  {
+    if(entry->font_face == font_face && entry->glyph_index == glyph_index)
+    {
+      break;
+    }
+  }
+
+  if(entry != 0)
+  {
+    cache->stats.glyph_hit_count += 1;
+  }
+  else
+  {
+    entry = push_array(cache->arena, ColorGlyphCacheEntry, 1);
+    entry->font_face = font_face;
+    entry->glyph_index = glyph_index;
+    cache->stats.decompose_count += 1;
+    if(!cache->decompose(cache->user_data, cache->arena, font_face, glyph_index, &entry->layers, &entry->layer_count))
+    {
+      entry->layers = 0;
+      entry->layer_count = 0;
+    }
+    entry->hash_next = cache->glyph_slots[slot_idx];
+    cache->glyph_slots[slot_idx] = entry;
+  }
+  return entry;
+}
+
+static bool
+color_glyph_cache_translate_run(void *user_data, Arena *arena, const DrawListRun *run, DrawListRun **layers, uint32_t *layer_count)
+{
+  // NOTE(hampus): Each glyph is replaced by its cached layers, and glyphs
+  // without color by themselves in the foreground color. Neighbouring pieces
+  // that are drawn the same way are joined into one run. The layer runs are
+  // always left to right, with the advances set so that every piece lands
+  // where its glyph would have been drawn.
+  ColorGlyphCache *cache = (ColorGlyphCache *)user_data;
+  cache->stats.run_count += 1;
+
+  ColorGlyphCacheFont *font = color_glyph_cache_font_from_font_face(cache, run->font_face);
+  if(!font->has_color_glyphs)
+  {
+    return false;
+  }
+
+  //----------------------------------------------------------
+  // hampus: look up the glyphs
+
+  ColorGlyphCacheEntry **entries = push_array_no_zero(arena, ColorGlyphCacheEntry *, run->glyph_count);
+  uint64_t piece_count = 0;
+  bool has_color = false;
+  for(uint64_t glyph_idx = 0; glyph_idx < run->glyph_count; ++glyph_idx)
+  {
+    ColorGlyphCacheEntry *entry = color_glyph_cache_entry_from_glyph(cache, run->font_face, run->glyph_indices[glyph_idx]);
+    entries[glyph_idx] = entry;
+    piece_count += entry->layer_count != 0 ? entry->layer_count : 1;
+    has_color = has_color || entry->layer_count != 0;
+  }
+  if(!has_color)
+  {
+    return false;
+  }
+  cache->stats.color_run_count += 1;
+
+  //----------------------------------------------------------
+  // hampus: emit the pieces
+
+  uint16_t *glyph_indices = push_array_no_zero(arena, uint16_t, piece_count);
+  float *glyph_advances = push_array_no_zero(arena, float, piece_count);
+  GlyphOffset *glyph_offsets = push_array_no_zero(arena, GlyphOffset, piece_count);
+  DrawListRun *result = push_array_no_zero(arena, DrawListRun, piece_count);
+  uint32_t result_count = 0;
+
+  bool is_right_to_left = (run->bidi_level & 1) != 0;
+  float *pen_positions = push_array_no_zero(arena, float, run->glyph_count);
+  glyph_positions_from_advances(run->glyph_advances, 0.0f, pen_positions, run->glyph_count);
+  float last_x = 0;
+  uint64_t piece_idx = 0;
+  for(uint64_t glyph_idx = 0; glyph_idx < run->glyph_count; ++glyph_idx)
+  {
+    // NOTE(hampus): Where the glyph's origin ends up, the same way
+    // glyph_atlas_quads_from_glyphs() works it out
+    float glyph_x = 0;
+    float glyph_advance = run->glyph_advances[glyph_idx];
+    GlyphOffset glyph_offset = run->glyph_offsets[glyph_idx];
+    if(is_right_to_left)
+    {
+      glyph_x = run->baseline_x - pen_positions[glyph_idx] - glyph_advance - glyph_offset.advance_offset;
+    }
+    else
+    {
+      glyph_x = run->baseline_x + pen_positions[glyph_idx] + glyph_offset.advance_offset;
+    }
+
+    ColorGlyphCacheEntry *entry = entries[glyph_idx];
+    ColorGlyphLayer no_color_layer = {};
+    no_color_layer.glyph_index = run->glyph_indices[glyph_idx];
+    no_color_layer.kind = run->kind;
+    no_color_layer.image_format = run->image_format;
+    no_color_layer.uses_foreground_color = true;
+    ColorGlyphLayer *glyph_layers = entry->layer_count != 0 ? entry->layers : &no_color_layer;
+    uint32_t glyph_layer_count = entry->layer_count != 0 ? entry->layer_count : 1;
+
+    for(uint32_t layer_idx = 0; layer_idx < glyph_layer_count; ++layer_idx)
+    {
+      ColorGlyphLayer *layer = &glyph_layers[layer_idx];
+      DrawListRun *current = result_count != 0 ? &result[result_count - 1] : 0;
+      bool joins_current = (current != 0 &&
+                            current->kind == layer->kind &&
+                            current->image_format == layer->image_format &&
+                            current->uses_foreground_color == layer->uses_foreground_color &&
+                            (layer->uses_foreground_color || memory_match(&current->color, &layer->color, sizeof(DrawListColor))));
+      if(joins_current)
+      {
+        glyph_advances[piece_idx - 1] = glyph_x - last_x;
+        current->glyph_count += 1;
+      }
+      else
+      {
+        current = &result[result_count];
+        result_count += 1;
+        *current = *run;
+        current->kind = layer->kind;
+        current->image_format = layer->image_format;
+        current->uses_foreground_color = layer->uses_foreground_color;
+        current->color = layer->color;
+        current->bidi_level = 0;
+        current->baseline_x = glyph_x;
+        current->glyph_count = 1;
+        current->glyph_indices = glyph_indices + piece_idx;
+        current->glyph_advances = glyph_advances + piece_idx;
+        current->glyph_offsets = glyph_offsets + piece_idx;
+      }
+
+      glyph_indices[piece_idx] = layer->glyph_index;
+      glyph_advances[piece_idx] = glyph_advance;
+      glyph_offsets[piece_idx].advance_offset = 0;
+      glyph_offsets[piece_idx].ascender_offset = glyph_offset.ascender_offset;
+      piece_idx += 1;
+      last_x = glyph_x;
+    }
+  }
+
+  *layers = result;
+  *layer_count = result_count;
+  return true;
+}
+
+#endif // COLOR_GLYPH_CACHE_H
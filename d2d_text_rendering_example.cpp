@@ -11,7 +11,15 @@
 #pragma comment(lib, "dwrite.lib")
 #pragma comment(lib, "d2d1.lib")
 
-#include "dwrite_text_to_glyphs.h"
+#include "dwrite_glyph_atlas.h"
+#include "dwrite_draw_list.h"
+#include "frame_scheduler.h"
+
+#define GLYPH_ATLAS_PAGE_SIZE 1024
+#define GLYPH_ATLAS_PAGE_COUNT 2
+
+// NOTE(hampus): How often to check whether an occluded window shows again
+#define OCCLUSION_TEST_INTERVAL_NS (100ull * 1000 * 1000)
 
 ////////////////////////////////////////////////////////////
 // hampus: window proc callback
@@ -19,6 +27,9 @@
 static LRESULT CALLBACK
 window_proc(HWND hwnd, UINT message, WPARAM wparam, LPARAM lparam)
 {
+  // NOTE(hampus): The frame scheduler is set on the window after it has been
+  // created. Until then it already starts out invalid.
+  FrameScheduler *frame_scheduler = (FrameScheduler *)GetWindowLongPtrW(hwnd, GWLP_USERDATA);
   LRESULT result = 0;
   switch(message)
   {
@@ -27,6 +38,40 @@ window_proc(HWND hwnd, UINT message, WPARAM wparam, LPARAM lparam)
       PostQuitMessage(0);
     }
     break;
+    case WM_SIZE:
+    {
+      if(frame_scheduler != 0)
+      {
+        frame_scheduler_invalidate(frame_scheduler, FrameInvalidation_Size);
+      }
+    }
+    break;
+    case WM_DPICHANGED:
+    {
+      if(frame_scheduler != 0)
+      {
+        frame_scheduler_invalidate(frame_scheduler, FrameInvalidation_Dpi);
+      }
+      RECT *suggested_rect = (RECT *)lparam;
+      SetWindowPos(hwnd, 0,
+                   suggested_rect->left, suggested_rect->top,
+                   suggested_rect->right - suggested_rect->left, suggested_rect->bottom - suggested_rect->top,
+                   SWP_NOZORDER | SWP_NOACTIVATE);
+    }
+    break;
+    case WM_PAINT:
+    {
+      // NOTE(hampus): Validate the window so it stops sending WM_PAINT, and
+      // draw in the main loop.
+      PAINTSTRUCT paint_struct = {};
+      BeginPaint(hwnd, &paint_struct);
+      EndPaint(hwnd, &paint_struct);
+      if(frame_scheduler != 0)
+      {
+        frame_scheduler_invalidate(frame_scheduler, FrameInvalidation_Expose);
+      }
+    }
+    break;
     default:
     {
       result = DefWindowProcW(hwnd, message, wparam, lparam);
@@ -36,6 +81,228 @@ window_proc(HWND hwnd, UINT message, WPARAM wparam, LPARAM lparam)
   return result;
 }
 
+////////////////////////////////////////////////////////////
+// hampus: glyph atlas upload
+
+static void
+upload_glyph_atlas_pages(GlyphAtlas *glyph_atlas, ID2D1Bitmap1 **bitmaps, Arena *scratch)
+{
+  // NOTE(hampus): Copies the parts of the pages that changed since the last
+  // upload to their bitmaps. The bitmaps are white with the coverage as
+  // alpha, premultiplied, so that the sprite color tints them. Must be
+  // called before BeginDraw(), since every copy in between draws makes
+  // Direct2D flush what it has batched up so far.
+  for(uint32_t page_idx = 0; page_idx < glyph_atlas->page_count; ++page_idx)
+  {
+    GlyphAtlasPage *page = &glyph_atlas->pages[page_idx];
+    if(page->dirty_x1 > page->dirty_x0 && page->dirty_y1 > page->dirty_y0)
+    {
+      uint32_t width = page->dirty_x1 - page->dirty_x0;
+      uint32_t height = page->dirty_y1 - page->dirty_y0;
+      uint64_t scratch_pos = arena_pos(scratch);
+      uint32_t *pixels = push_array_no_zero(scratch, uint32_t, (uint64_t)width * height);
+      for(uint32_t y = 0; y < height; ++y)
+      {
+        uint8_t *src = page->pixels + (uint64_t)(page->dirty_y0 + y) * glyph_atlas->page_size + page->dirty_x0;
+        uint32_t *dst = pixels + (uint64_t)y * width;
+        for(uint32_t x = 0; x < width; ++x)
+        {
+          dst[x] = src[x] * 0x01010101u;
+        }
+      }
+      D2D1_RECT_U dirty_rect = {page->dirty_x0, page->dirty_y0, page->dirty_x1, page->dirty_y1};
+      HRESULT hr = bitmaps[page_idx]->CopyFromMemory(&dirty_rect, pixels, width * sizeof(uint32_t));
+      ASSERT_HR(hr);
+      glyph_atlas_page_clear_dirty(page);
+      arena_pop_to(scratch, scratch_pos);
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////
+// hampus: draw list target
+
+// NOTE(hampus): A frame is replayed twice. The first replay, before
+// BeginDraw(), looks up the atlas glyphs of every plain run, so that all of
+// the frame's new glyphs can be uploaded at once. The second one draws. The
+// atlas glyphs are added to one sprite batch per page, and every batch is
+// drawn with a single DrawSpriteBatch() once something else has to be drawn
+// on top of them, or at the end of the frame.
+
+struct D2DAtlasRun
+{
+  D2DAtlasRun *next;
+  uint32_t sprite_count;
+  uint32_t *page_indices;
+  D2D1_RECT_F *destination_rects;
+  D2D1_RECT_U *source_rects;
+};
+
+struct D2DDrawListTarget
+{
+  ID2D1DeviceContext4 *device_context;
+  ID2D1SolidColorBrush *foreground_brush;
+  D2D1_COLOR_F foreground_color;
+  GlyphAtlas *glyph_atlas;
+  ID2D1Bitmap1 **glyph_atlas_bitmaps;
+  ID2D1SpriteBatch **glyph_atlas_sprite_batches;
+  float pixels_per_dip;
+  Arena *frame_arena;
+
+  // NOTE(hampus): The atlas runs of the frame in draw order. The first
+  // replay appends to the list, the second one takes them off the front.
+  D2DAtlasRun *first_atlas_run;
+  D2DAtlasRun *last_atlas_run;
+};
+
+static bool
+d2d_run_uses_glyph_atlas(const DrawListRun *run)
+{
+  // NOTE(hampus): Plain text is drawn from our own atlas
+  return run->kind == DrawListRunKind_Outline && run->uses_foreground_color;
+}
+
+static void
+d2d_prepare_run(void *state, const DrawListRun *run)
+{
+  D2DDrawListTarget *target = (D2DDrawListTarget *)state;
+  if(!d2d_run_uses_glyph_atlas(run))
+  {
+    return;
+  }
+
+  uint32_t quad_count = 0;
+  GlyphAtlasQuad *quads = glyph_atlas_quads_from_glyphs(target->glyph_atlas,
+                                                        target->frame_arena,
+                                                        &dwrite_shaping_backend_functions,
+                                                        run->font_face,
+                                                        run->em_size,
+                                                        (run->bidi_level & 1) != 0,
+                                                        run->glyph_indices,
+                                                        run->glyph_advances,
+                                                        run->glyph_offsets,
+                                                        run->glyph_count,
+                                                        run->baseline_x,
+                                                        run->baseline_y,
+                                                        target->pixels_per_dip,
+                                                        &quad_count);
+
+  // NOTE(hampus): The quads are in pixels and the device context draws in
+  // DIPs, so scale them back. They still land on whole pixels.
+  float dips_per_pixel = 1.0f / target->pixels_per_dip;
+  D2DAtlasRun *atlas_run = push_array(target->frame_arena, D2DAtlasRun, 1);
+  atlas_run->sprite_count = quad_count;
+  atlas_run->page_indices = push_array_no_zero(target->frame_arena, uint32_t, quad_count);
+  atlas_run->destination_rects = push_array_no_zero(target->frame_arena, D2D1_RECT_F, quad_count);
+  atlas_run->source_rects = push_array_no_zero(target->frame_arena, D2D1_RECT_U, quad_count);
+  for(uint32_t quad_idx = 0; quad_idx < quad_count; ++quad_idx)
+  {
+    GlyphAtlasQuad &quad = quads[quad_idx];
+    atlas_run->page_indices[quad_idx] = quad.page_idx;
+    atlas_run->destination_rects[quad_idx] = {quad.x0 * dips_per_pixel, quad.y0 * dips_per_pixel, quad.x1 * dips_per_pixel, quad.y1 * dips_per_pixel};
+    atlas_run->source_rects[quad_idx] = {(UINT32)(quad.u0 * GLYPH_ATLAS_PAGE_SIZE + 0.5f), (UINT32)(quad.v0 * GLYPH_ATLAS_PAGE_SIZE + 0.5f), (UINT32)(quad.u1 * GLYPH_ATLAS_PAGE_SIZE + 0.5f), (UINT32)(quad.v1 * GLYPH_ATLAS_PAGE_SIZE + 0.5f)};
+  }
+
+  if(target->last_atlas_run == 0)
+  {
+    target->first_atlas_run = target->last_atlas_run = atlas_run;
+  }
+  else
+  {
+    target->last_atlas_run->next = atlas_run;
+    target->last_atlas_run = atlas_run;
+  }
+}
+
+static void
+d2d_flush_sprite_batches(D2DDrawListTarget *target)
+{
+  for(uint32_t page_idx = 0; page_idx < GLYPH_ATLAS_PAGE_COUNT; ++page_idx)
+  {
+    ID2D1SpriteBatch *sprite_batch = target->glyph_atlas_sprite_batches[page_idx];
+    UINT32 sprite_count = sprite_batch->GetSpriteCount();
+    if(sprite_count != 0)
+    {
+      target->device_context->DrawSpriteBatch(sprite_batch, 0, sprite_count, target->glyph_atlas_bitmaps[page_idx], D2D1_BITMAP_INTERPOLATION_MODE_NEAREST_NEIGHBOR, D2D1_SPRITE_OPTIONS_NONE);
+      sprite_batch->Clear();
+    }
+  }
+}
+
+static void
+d2d_draw_run(void *state, const DrawListRun *run)
+{
+  D2DDrawListTarget *target = (D2DDrawListTarget *)state;
+
+  if(d2d_run_uses_glyph_atlas(run))
+  {
+    D2DAtlasRun *atlas_run = target->first_atlas_run;
+    ASSERT(atlas_run != 0);
+    target->first_atlas_run = atlas_run->next;
+
+    // NOTE(hampus): The glyphs of a run are nearly always on one page, so
+    // add them in as few calls as possible.
+    for(uint32_t sprite_idx = 0; sprite_idx < atlas_run->sprite_count;)
+    {
+      uint32_t page_idx = atlas_run->page_indices[sprite_idx];
+      uint32_t sprite_opl = sprite_idx + 1;
+      while(sprite_opl < atlas_run->sprite_count && atlas_run->page_indices[sprite_opl] == page_idx)
+      {
+        sprite_opl += 1;
+      }
+      HRESULT hr = target->glyph_atlas_sprite_batches[page_idx]->AddSprites(sprite_opl - sprite_idx,
+                                                                            atlas_run->destination_rects + sprite_idx,
+                                                                            atlas_run->source_rects + sprite_idx,
+                                                                            &target->foreground_color,
+                                                                            0,
+                                                                            sizeof(D2D1_RECT_F),
+                                                                            sizeof(D2D1_RECT_U),
+                                                                            0,
+                                                                            0);
+      ASSERT_HR(hr);
+      sprite_idx = sprite_opl;
+    }
+    return;
+  }
+
+  // NOTE(hampus): Everything else is drawn straight away, so the glyphs
+  // batched up so far have to be drawn first to keep them underneath.
+  d2d_flush_sprite_batches(target);
+
+  DWRITE_GLYPH_RUN dwrite_glyph_run = dwrite_glyph_run_from_draw_list_run(run);
+  D2D1_POINT_2F baseline = {run->baseline_x, run->baseline_y};
+
+  if(run->uses_foreground_color)
+  {
+    target->foreground_brush->SetColor(target->foreground_color);
+  }
+  else
+  {
+    target->foreground_brush->SetColor({run->color.r, run->color.g, run->color.b, run->color.a});
+  }
+
+  switch(run->kind)
+  {
+    case DrawListRunKind_Outline:
+    {
+      target->device_context->DrawGlyphRun(baseline, &dwrite_glyph_run, 0, target->foreground_brush, DWRITE_MEASURING_MODE_NATURAL);
+    }
+    break;
+    case DrawListRunKind_Bitmap:
+    {
+      ASSERT(!"Not tested");
+      target->device_context->DrawColorBitmapGlyphRun((DWRITE_GLYPH_IMAGE_FORMATS)run->image_format, baseline, &dwrite_glyph_run, DWRITE_MEASURING_MODE_NATURAL, D2D1_COLOR_BITMAP_GLYPH_SNAP_OPTION_DEFAULT);
+    }
+    break;
+    case DrawListRunKind_Svg:
+    {
+      ASSERT(!"Not tested");
+      target->device_context->DrawSvgGlyphRun(baseline, &dwrite_glyph_run, target->foreground_brush, 0, 0, DWRITE_MEASURING_MODE_NATURAL);
+    }
+    break;
+  }
+}
+
 ////////////////////////////////////////////////////////////
 // hampus: entry point
 
@@ -254,43 +521,63 @@ WinMain(HINSTANCE instance, HINSTANCE prev_instance, PSTR command_line, int show
 
   const wchar_t *font = L"Fira Code";
 
+  DWriteShapingBackend dwrite_backend = {};
+  dwrite_shaping_backend_init(&dwrite_backend, font_fallback1, font_collection, text_analyzer1);
+
   MapTextToGlyphsResult text_to_glyphs_results[] =
   {
-    // dwrite_map_text_to_glyphs(font_fallback1, font_collection, text_analyzer1, &locale[0], font, 50.0f, ligatures_text, wcslen(ligatures_text)),
-    dwrite_map_text_to_glyphs(font_fallback1, font_collection, text_analyzer1, &locale[0], font, 50.0f, emojis_text, wcslen(emojis_text)),
-    // dwrite_map_text_to_glyphs(font_fallback1, font_collection, text_analyzer1, &locale[0], font, 50.0f, text, wcslen(text)),
-    // dwrite_map_text_to_glyphs(font_fallback1, font_collection, text_analyzer1, &locale[0], font, 50.0f, arabic_text, wcslen(arabic_text)),
+    // dwrite_map_text_to_glyphs(&dwrite_backend, &locale[0], font, 50.0f, ligatures_text, wcslen(ligatures_text)),
+    dwrite_map_text_to_glyphs(&dwrite_backend, &locale[0], font, 50.0f, emojis_text, wcslen(emojis_text)),
+    // dwrite_map_text_to_glyphs(&dwrite_backend, &locale[0], font, 50.0f, text, wcslen(text)),
+    // dwrite_map_text_to_glyphs(&dwrite_backend, &locale[0], font, 50.0f, arabic_text, wcslen(arabic_text)),
   };
 
-  wchar_t filePaths[8][MAX_PATH] = {};
-  int filePathsCount = 0;
-
-  for(TextToGlyphsSegmentNode *n = text_to_glyphs_results[0].first_segment; n != 0; n = n->next)
+  wchar_t file_paths[8][MAX_PATH] = {};
+  uint32_t file_path_count = 0;
+  for(uint64_t segment_idx = 0; segment_idx < text_to_glyphs_results[0].segment_count && file_path_count < 8; ++segment_idx)
   {
-    UINT32 numberOfFiles;
-    n->v.font_face->GetFiles(&numberOfFiles, nullptr);
-    IDWriteFontFile *fontFiles[8] = {};
-    n->v.font_face->GetFiles(&numberOfFiles, &fontFiles[0]);
-
-    IDWriteFontFileLoader *loader = nullptr;
-    fontFiles[0]->GetLoader(&loader);
-
-    void const *fontFileReferenceKey;
-    UINT32 fontFileReferenceKeySize;
-    fontFiles[0]->GetReferenceKey(&fontFileReferenceKey, &fontFileReferenceKeySize);
-
-    IDWriteLocalFontFileLoader *localLoader = nullptr;
-    loader->QueryInterface(&localLoader);
-    if(localLoader)
+    IDWriteFontFace5 *segment_font_face = dwrite_font_face_from_segment(&text_to_glyphs_results[0], &text_to_glyphs_results[0].segments[segment_idx]);
+    if(dwrite_font_file_path_from_font_face(segment_font_face, file_paths[file_path_count], MAX_PATH))
     {
-      UINT32 filePathLength;
-      localLoader->GetFilePathLengthFromKey(fontFileReferenceKey, fontFileReferenceKeySize, &filePathLength);
-      filePathLength++;
-      localLoader->GetFilePathFromKey(fontFileReferenceKey, fontFileReferenceKeySize, &filePaths[filePathsCount][0], filePathLength);
-      filePathsCount++;
+      file_path_count += 1;
     }
   }
 
+  //----------------------------------------------------------
+  // hampus: create glyph atlas
+
+  // NOTE(hampus): Glyphs without color are drawn from our own atlas, one
+  // sprite batch per page. The pages are mirrored in bitmaps that are
+  // recreated together with the device context, along with the batches.
+
+  DWriteGlyphRasterizer glyph_rasterizer = {dwrite_factory};
+  GlyphAtlas *glyph_atlas = glyph_atlas_alloc(GLYPH_ATLAS_PAGE_SIZE, GLYPH_ATLAS_PAGE_COUNT, dwrite_rasterize_glyph, &glyph_rasterizer);
+  ID2D1Bitmap1 *glyph_atlas_bitmaps[GLYPH_ATLAS_PAGE_COUNT] = {};
+  ID2D1SpriteBatch *glyph_atlas_sprite_batches[GLYPH_ATLAS_PAGE_COUNT] = {};
+  Arena *frame_arena = arena_alloc();
+
+  //----------------------------------------------------------
+  // hampus: create draw list
+
+  // NOTE(hampus): The layout and the color layers of the text are worked out
+  // once into the draw list, and every frame just replays it. It is rebuilt
+  // when the window changes size or DPI. The color glyph cache keeps the
+  // rebuilds from enumerating the layers of every emoji again.
+
+  DWriteColorGlyphDecomposer color_glyph_decomposer = {dwrite_factory};
+  ColorGlyphCache *color_glyph_cache = color_glyph_cache_alloc(&dwrite_shaping_backend_functions, dwrite_is_color_font, dwrite_decompose_color_glyph, &color_glyph_decomposer);
+  DrawList draw_list = {};
+  UINT draw_list_dpi = 0;
+
+  //----------------------------------------------------------
+  // hampus: create frame scheduler
+
+  // NOTE(hampus): Frames are only drawn when something changed. The rest of
+  // the time the main loop sleeps on the message queue.
+
+  FrameScheduler frame_scheduler = frame_scheduler_make(OCCLUSION_TEST_INTERVAL_NS);
+  SetWindowLongPtrW(hwnd, GWLP_USERDATA, (LONG_PTR)&frame_scheduler);
+
   ShowWindow(hwnd, SW_SHOWDEFAULT);
 
   ID2D1SolidColorBrush *foreground_brush = 0;
@@ -315,6 +602,28 @@ WinMain(HINSTANCE instance, HINSTANCE prev_instance, PSTR command_line, int show
       TranslateMessage(&message);
       DispatchMessageW(&message);
     }
+    if(!running)
+    {
+      break;
+    }
+
+    // hampus: ask the scheduler what to do
+
+    uint32_t invalidation_flags = 0;
+    uint64_t timeout_ns = 0;
+    FrameSchedulerAction action = frame_scheduler_next(&frame_scheduler, os_now_ns(), &invalidation_flags, &timeout_ns);
+    if(action == FrameSchedulerAction_Wait)
+    {
+      DWORD timeout_ms = timeout_ns == FRAME_SCHEDULER_WAIT_FOREVER ? INFINITE : (DWORD)((timeout_ns + 999999) / 1000000);
+      MsgWaitForMultipleObjectsEx(0, 0, timeout_ms, QS_ALLINPUT, MWMO_INPUTAVAILABLE);
+      continue;
+    }
+    if(action == FrameSchedulerAction_TestOcclusion)
+    {
+      hr = swap_chain->Present(0, DXGI_PRESENT_TEST);
+      frame_scheduler_occlusion_tested(&frame_scheduler, os_now_ns(), hr == DXGI_STATUS_OCCLUDED);
+      continue;
+    }
 
     RECT rect = {};
     GetClientRect(hwnd, &rect);
@@ -325,8 +634,15 @@ WinMain(HINSTANCE instance, HINSTANCE prev_instance, PSTR command_line, int show
 
     if(render_target_view == 0 || width != current_width || height != current_height)
     {
+      draw_list_release(&draw_list);
+
       if(d2d_device_context != 0)
       {
+        for(uint32_t page_idx = 0; page_idx < GLYPH_ATLAS_PAGE_COUNT; ++page_idx)
+        {
+          glyph_atlas_sprite_batches[page_idx]->Release();
+          glyph_atlas_bitmaps[page_idx]->Release();
+        }
         d2d_device_context->Release();
         foreground_brush->Release();
       }
@@ -400,6 +716,28 @@ WinMain(HINSTANCE instance, HINSTANCE prev_instance, PSTR command_line, int show
       hr = d2d_device_context->CreateSolidColorBrush(&foreground_color, 0, &foreground_brush);
       ASSERT_HR(hr);
 
+      // NOTE(hampus): DrawSpriteBatch() tints the bitmap with the sprite
+      // color, so the pages are kept as white with coverage alpha rather
+      // than as A8 masks. Sprite source rectangles are in pixels, so the DPI
+      // of the bitmaps doesn't matter.
+      D2D1_BITMAP_PROPERTIES1 glyph_atlas_bitmap_properties = {};
+      glyph_atlas_bitmap_properties.pixelFormat.format = DXGI_FORMAT_B8G8R8A8_UNORM;
+      glyph_atlas_bitmap_properties.pixelFormat.alphaMode = D2D1_ALPHA_MODE_PREMULTIPLIED;
+      glyph_atlas_bitmap_properties.dpiX = 96;
+      glyph_atlas_bitmap_properties.dpiY = 96;
+      for(uint32_t page_idx = 0; page_idx < GLYPH_ATLAS_PAGE_COUNT; ++page_idx)
+      {
+        hr = d2d_device_context->CreateBitmap({GLYPH_ATLAS_PAGE_SIZE, GLYPH_ATLAS_PAGE_SIZE}, 0, 0, &glyph_atlas_bitmap_properties, &glyph_atlas_bitmaps[page_idx]);
+        ASSERT_HR(hr);
+        hr = d2d_device_context->CreateSpriteBatch(&glyph_atlas_sprite_batches[page_idx]);
+        ASSERT_HR(hr);
+
+        // NOTE(hampus): The new bitmap is empty, upload the whole page again
+        GlyphAtlasPage *page = &glyph_atlas->pages[page_idx];
+        page->dirty_x0 = page->dirty_y0 = 0;
+        page->dirty_x1 = page->dirty_y1 = GLYPH_ATLAS_PAGE_SIZE;
+      }
+
       bitmap->Release();
       surface->Release();
       backbuffer->Release();
@@ -408,6 +746,17 @@ WinMain(HINSTANCE instance, HINSTANCE prev_instance, PSTR command_line, int show
       current_height = height;
     }
 
+    // hampus: rebuild draw list if text, layout, size or dpi changed
+
+    UINT window_dpi = GetDpiForWindow(hwnd);
+    bool text_changed = (invalidation_flags & (FrameInvalidation_Text | FrameInvalidation_Layout)) != 0;
+    if(draw_list.arena == 0 || text_changed || window_dpi != draw_list_dpi)
+    {
+      draw_list_release(&draw_list);
+      draw_list = draw_list_build(text_to_glyphs_results, ARRAYSIZE(text_to_glyphs_results), 50, 50, color_glyph_cache_translate_run, color_glyph_cache);
+      draw_list_dpi = window_dpi;
+    }
+
     // hampus: draw
 
     // NOTE(hampus): This won't draw arabic sentences correctly if our base
@@ -420,156 +769,70 @@ WinMain(HINSTANCE instance, HINSTANCE prev_instance, PSTR command_line, int show
 
     if(render_target_view)
     {
+      D2DDrawListTarget d2d_target = {};
+      d2d_target.device_context = d2d_device_context;
+      d2d_target.foreground_brush = foreground_brush;
+      d2d_target.foreground_color = {1, 1, 1, 1};
+      d2d_target.glyph_atlas = glyph_atlas;
+      d2d_target.glyph_atlas_bitmaps = glyph_atlas_bitmaps;
+      d2d_target.glyph_atlas_sprite_batches = glyph_atlas_sprite_batches;
+      d2d_target.pixels_per_dip = (float)window_dpi / 96.0f;
+      d2d_target.frame_arena = frame_arena;
+
+      // hampus: rasterize the frame's new glyphs and upload them in one go
+
+      glyph_atlas_begin_generation(glyph_atlas);
+      DrawListTarget prepare_target = {d2d_prepare_run, &d2d_target};
+      draw_list_replay(&draw_list, &prepare_target);
+      upload_glyph_atlas_pages(glyph_atlas, glyph_atlas_bitmaps, frame_arena);
+
+      // NOTE(hampus): The layout is in DIPs. DrawSpriteBatch() only works
+      // with aliased antialiasing, which doesn't affect text drawn with
+      // DrawGlyphRun(), so it is set once for the whole frame.
+      d2d_device_context->SetDpi((float)window_dpi, (float)window_dpi);
+      d2d_device_context->SetAntialiasMode(D2D1_ANTIALIAS_MODE_ALIASED);
+
       d2d_device_context->BeginDraw();
       D2D1_COLOR_F clear_color = {0.392f, 0.584f, 0.929f, 1.f};
       d2d_device_context->Clear(clear_color);
-      float advance_x = 0;
-      float advance_y = 0;
-      for(int result_idx = 0; result_idx < ARRAYSIZE(text_to_glyphs_results); ++result_idx)
-      {
-        const MapTextToGlyphsResult &result = text_to_glyphs_results[result_idx];
-        float max_advance_for_this_result = 0;
-        for(TextToGlyphsSegmentNode *n = result.first_segment; n != 0; n = n->next)
-        {
-          TextToGlyphsSegment &segment = n->v;
-          DWRITE_GLYPH_RUN dwrite_glyph_run = {};
-          dwrite_glyph_run.glyphCount = segment.glyph_count;
-          dwrite_glyph_run.fontEmSize = segment.font_size_em;
-          dwrite_glyph_run.fontFace = segment.font_face;
-          dwrite_glyph_run.bidiLevel = segment.bidi_level;
-
-          dwrite_glyph_run.glyphAdvances = segment.glyph_advances;
-          dwrite_glyph_run.glyphIndices = segment.glyph_indices;
-          dwrite_glyph_run.glyphOffsets = segment.glyph_offsets;
-
-          if(segment.bidi_level != 0)
-          {
-            // NOTE(hampus): The segment is right to left. We will advance
-            // beforehand so the lower-left corner of the text is the baseline.
-            // Otherwise the lower-right corner of the text would be the baseline
-            // which would render into our left to right text before it if we had any.
-            for(int glyph_idx = 0; glyph_idx < segment.glyph_count; ++glyph_idx)
-            {
-              advance_x += segment.glyph_advances[glyph_idx];
-            }
-          }
-
-          D2D1_POINT_2F baseline = {};
-          baseline.x = 50 + advance_x;
-          baseline.y = 50 + advance_y;
-
-          D2D1_RECT_F glyph_world_bounds = {};
-          d2d_device_context->GetGlyphRunWorldBounds(baseline, &dwrite_glyph_run, DWRITE_MEASURING_MODE_NATURAL, &glyph_world_bounds);
-          bool is_whitespace = !(glyph_world_bounds.right > glyph_world_bounds.left && glyph_world_bounds.bottom > glyph_world_bounds.top);
-
-          IDWriteColorGlyphRunEnumerator1 *run_enumerator = 0;
-          const DWRITE_GLYPH_IMAGE_FORMATS desired_glyph_image_formats = DWRITE_GLYPH_IMAGE_FORMATS_TRUETYPE |
-                                                                         DWRITE_GLYPH_IMAGE_FORMATS_CFF |
-                                                                         DWRITE_GLYPH_IMAGE_FORMATS_COLR |
-                                                                         DWRITE_GLYPH_IMAGE_FORMATS_SVG |
-                                                                         DWRITE_GLYPH_IMAGE_FORMATS_PNG |
-                                                                         DWRITE_GLYPH_IMAGE_FORMATS_JPEG |
-                                                                         DWRITE_GLYPH_IMAGE_FORMATS_TIFF |
-                                                                         DWRITE_GLYPH_IMAGE_FORMATS_PREMULTIPLIED_B8G8R8A8;
-          hr = dwrite_factory->TranslateColorGlyphRun(baseline, &dwrite_glyph_run, 0, desired_glyph_image_formats, DWRITE_MEASURING_MODE_NATURAL, 0, 0, &run_enumerator);
-          if(hr == DWRITE_E_NOCOLOR)
-          {
-            // NOTE(hampus): There was no colored glyph. We can draw them as normal
-
-            foreground_brush->SetColor({1, 1, 1, 1});
-            d2d_device_context->DrawGlyphRun(baseline, &dwrite_glyph_run, foreground_brush, DWRITE_MEASURING_MODE_NATURAL);
-          }
-          else
-          {
-            // NOTE(hampus): There was colored glyph. We have to draw them differently
-            for(;;)
-            {
-              BOOL have_run = FALSE;
-              hr = run_enumerator->MoveNext(&have_run);
-              ASSERT_HR(hr);
-              if(!have_run)
-              {
-                break;
-              }
-
-              const DWRITE_COLOR_GLYPH_RUN1 *color_glyph_run = 0;
-              hr = run_enumerator->GetCurrentRun(&color_glyph_run);
-              ASSERT_HR(hr);
-
-              foreground_brush->SetColor(color_glyph_run->runColor);
-
-              switch(color_glyph_run->glyphImageFormat)
-              {
-                case DWRITE_GLYPH_IMAGE_FORMATS_NONE:
-                {
-                  // NOTE(hampus): Do nothing
-                  // TODO(hampus): Find out when this is the case.
-                }
-                break;
-                case DWRITE_GLYPH_IMAGE_FORMATS_PNG:
-                case DWRITE_GLYPH_IMAGE_FORMATS_JPEG:
-                case DWRITE_GLYPH_IMAGE_FORMATS_TIFF:
-                case DWRITE_GLYPH_IMAGE_FORMATS_PREMULTIPLIED_B8G8R8A8:
-                {
-                  ASSERT(!"Not tested");
-                  d2d_device_context->DrawColorBitmapGlyphRun(color_glyph_run->glyphImageFormat, {color_glyph_run->baselineOriginX, color_glyph_run->baselineOriginY}, &color_glyph_run->glyphRun, color_glyph_run->measuringMode, D2D1_COLOR_BITMAP_GLYPH_SNAP_OPTION_DEFAULT);
-                }
-                break;
-                case DWRITE_GLYPH_IMAGE_FORMATS_SVG:
-                {
-                  ASSERT(!"Not tested");
-                  d2d_device_context->DrawSvgGlyphRun({color_glyph_run->baselineOriginX, color_glyph_run->baselineOriginY}, &color_glyph_run->glyphRun, foreground_brush, 0, 0, color_glyph_run->measuringMode);
-                }
-                break;
-                default:
-                {
-                  d2d_device_context->DrawGlyphRun({color_glyph_run->baselineOriginX, color_glyph_run->baselineOriginY}, &color_glyph_run->glyphRun, color_glyph_run->glyphRunDescription, foreground_brush, color_glyph_run->measuringMode);
-                }
-                break;
-              }
-
-              ASSERT_HR(hr);
-            }
-          }
-
-          // hampus: advance
-
-          DWRITE_FONT_METRICS font_metrics = {};
-          segment.font_face->GetMetrics(&font_metrics);
-          float advance_y_for_this = (font_metrics.ascent + font_metrics.descent + font_metrics.lineGap) * segment.font_size_em / font_metrics.designUnitsPerEm;
-          max_advance_for_this_result = max(max_advance_for_this_result, advance_y_for_this);
-
-          if(segment.bidi_level == 0)
-          {
-            for(int glyph_idx = 0; glyph_idx < segment.glyph_count; ++glyph_idx)
-            {
-              advance_x += segment.glyph_advances[glyph_idx];
-            }
-          }
-        }
-        advance_y += max_advance_for_this_result;
-        advance_x = 0;
-      }
+
+      DrawListTarget target = {d2d_draw_run, &d2d_target};
+      draw_list_replay(&draw_list, &target);
+      d2d_flush_sprite_batches(&d2d_target);
+
       hr = d2d_device_context->EndDraw();
       ASSERT_HR(hr);
+      arena_clear(frame_arena);
     }
 
     // hampus: present
 
     BOOL vsync = TRUE;
     hr = swap_chain->Present(vsync ? 1 : 0, 0);
-    if(hr == DXGI_STATUS_OCCLUDED)
-    {
-      if(vsync)
-      {
-        Sleep(10);
-      }
-    }
-    else if(FAILED(hr))
+    bool was_occluded = hr == DXGI_STATUS_OCCLUDED;
+    if(!was_occluded && FAILED(hr))
     {
       ASSERT("Failed to present swap chain! Device lost?");
     }
+    frame_scheduler_frame_presented(&frame_scheduler, os_now_ns(), was_occluded);
+  }
+
+  draw_list_release(&draw_list);
+  color_glyph_cache_release(color_glyph_cache);
+
+  for(int result_idx = 0; result_idx < ARRAYSIZE(text_to_glyphs_results); ++result_idx)
+  {
+    free_map_text_to_glyphs_result(&text_to_glyphs_results[result_idx]);
+  }
+  dwrite_shaping_backend_release(&dwrite_backend);
+
+  for(uint32_t page_idx = 0; page_idx < GLYPH_ATLAS_PAGE_COUNT; ++page_idx)
+  {
+    glyph_atlas_sprite_batches[page_idx]->Release();
+    glyph_atlas_bitmaps[page_idx]->Release();
   }
+  arena_release(frame_arena);
+  glyph_atlas_release(glyph_atlas);
 
   foreground_brush->Release();
   d2d_device_context->Release();
@@ -0,0 +1,279 @@
+#ifndef DRAW_LIST_H
+#define DRAW_LIST_H
+
+#include "text_to_glyphs.h"
+
+////////////////////////////////////////////////////////////
+// hampus: draw list
+
+// NOTE(hampus): Everything needed to draw a block of shaped lines, worked out
+// once: where each segment's baseline goes, how high each line is, how wide
+// each run is, and which runs have to be split into color layers. Drawing a
+// frame is then just handing the runs to a DrawListTarget in order. Build it
+// again when the text, the DPI or the layout size changes.
+//
+// Plain runs point straight into the MapTextToGlyphsResults the list was
+// built from, so those have to outlive the list. Color layers are copied into
+// the list's arena.
+
+enum DrawListRunKind
+{
+  // NOTE(hampus): Glyph outlines filled with a single color
+  DrawListRunKind_Outline,
+
+  // NOTE(hampus): Glyphs that carry their own image. image_format says which
+  // kind, in the backend's terms.
+  DrawListRunKind_Bitmap,
+  DrawListRunKind_Svg,
+};
+
+struct DrawListColor
+{
+  float r;
+  float g;
+  float b;
+  float a;
+};
+
+struct DrawListRun
+{
+  DrawListRunKind kind;
+  uint32_t image_format;
+
+  // NOTE(hampus): Runs that aren't color layers, and color layers that the
+  // font leaves to the text color, are drawn with the foreground color.
+  bool uses_foreground_color;
+  DrawListColor color;
+
+  ShapingFontFace *font_face;
+  float em_size;
+  uint32_t bidi_level;
+
+  // NOTE(hampus): The origin DrawGlyphRun expects, which is the right end of
+  // the run for right to left runs.
+  float baseline_x;
+  float baseline_y;
+  float width;
+
+  uint64_t glyph_count;
+  const uint16_t *glyph_indices;
+  const float *glyph_advances;
+  const GlyphOffset *glyph_offsets;
+};
+
+struct DrawListLine
+{
+  float baseline_y;
+  float height;
+  float width;
+  uint32_t first_run;
+  uint32_t run_count;
+};
+
+// NOTE(hampus): Splits a run into the color layers it should be drawn as,
+// pushed onto `arena`, with the glyph arrays copied there as well. Returns
+// false if the run has no color glyphs, in which case it's drawn as is.
+typedef bool DrawListTranslateColorFunction(void *user_data, Arena *arena, const DrawListRun *run, DrawListRun **layers, uint32_t *layer_count);
+
+struct DrawList
+{
+  // NOTE(hampus): Owns the lines and the color layers, and holds a reference
+  // to the font face of every run.
+  Arena *arena;
+  const ShapingBackendFunctions *backend_functions;
+
+  uint32_t line_count;
+  DrawListLine *lines;
+
+  uint32_t run_count;
+  uint32_t run_capacity;
+  DrawListRun *runs;
+
+  float width;
+  float height;
+};
+
+struct DrawListTarget
+{
+  void (*draw_run)(void *state, const DrawListRun *run);
+  void *state;
+};
+
+static void
+draw_list_push_run(DrawList *list, const DrawListRun *run)
+{
+  if(list->run_count == list->run_capacity)
+  {
+    uint32_t new_capacity = list->run_capacity != 0 ? list->run_capacity * 2 : 64;
+    DrawListRun *new_runs = (DrawListRun *)memory_alloc(sizeof(DrawListRun) * new_capacity);
+    if(list->run_count != 0)
+    {
+      memory_copy_typed(new_runs, list->runs, list->run_count);
+    }
+    memory_free(list->runs);
+    list->runs = new_runs;
+    list->run_capacity = new_capacity;
+  }
+  list->runs[list->run_count] = *run;
+  list->run_count += 1;
+  list->backend_functions->add_ref_font_face(run->font_face);
+}
+
+static void
+draw_list_visual_order(const MapTextToGlyphsResult *result, uint64_t *order)
+{
+  // NOTE(hampus): The segments of a line in the order they're drawn from left
+  // to right (UAX #9 rule L2). Going from the highest level down to the
+  // lowest odd one, every stretch of segments at that level or above is
+  // reversed. The glyphs within a segment are already in visual order.
+  uint32_t highest_level = 0;
+  uint32_t lowest_odd_level = UINT32_MAX;
+  for(uint64_t segment_idx = 0; segment_idx < result->segment_count; ++segment_idx)
+  {
+    uint32_t bidi_level = result->segments[segment_idx].bidi_level;
+    order[segment_idx] = segment_idx;
+    highest_level = bidi_level > highest_level ? bidi_level : highest_level;
+    if((bidi_level & 1) != 0 && bidi_level < lowest_odd_level)
+    {
+      lowest_odd_level = bidi_level;
+    }
+  }
+
+  for(uint32_t level = highest_level; level >= lowest_odd_level && level > 0; --level)
+  {
+    uint64_t segment_idx = 0;
+    while(segment_idx < result->segment_count)
+    {
+      if(result->segments[order[segment_idx]].bidi_level < level)
+      {
+        segment_idx += 1;
+        continue;
+      }
+      uint64_t first = segment_idx;
+      while(segment_idx < result->segment_count && result->segments[order[segment_idx]].bidi_level >= level)
+      {
+        segment_idx += 1;
+      }
+      for(uint64_t low = first, high = segment_idx - 1; low < high; ++low, --high)
+      {
+        uint64_t swap = order[low];
+        order[low] = order[high];
+        order[high] = swap;
+      }
+    }
+  }
+}
+
+static DrawList
+draw_list_build(const MapTextToGlyphsResult *results, uint32_t result_count, float origin_x, float origin_y, DrawListTranslateColorFunction *translate_color, void *translate_color_user_data)
+{
+  // NOTE(hampus): Lays out each result as one line, going down from
+  // (origin_x, origin_y), which is where the first line's baseline starts.
+  // translate_color may be 0 to draw everything as outlines.
+  DrawList list = {};
+  list.arena = arena_alloc();
+  list.lines = push_array(list.arena, DrawListLine, result_count);
+  list.line_count = result_count;
+
+  uint64_t max_segment_count = 0;
+  for(uint32_t result_idx = 0; result_idx < result_count; ++result_idx)
+  {
+    max_segment_count = results[result_idx].segment_count > max_segment_count ? results[result_idx].segment_count : max_segment_count;
+  }
+  uint64_t *visual_order = (uint64_t *)memory_alloc(sizeof(uint64_t) * (max_segment_count != 0 ? max_segment_count : 1));
+
+  float baseline_y = origin_y;
+  for(uint32_t result_idx = 0; result_idx < result_count; ++result_idx)
+  {
+    const MapTextToGlyphsResult *result = &results[result_idx];
+    DrawListLine *line = &list.lines[result_idx];
+    line->baseline_y = baseline_y;
+    line->first_run = list.run_count;
+    if(result->segment_count != 0)
+    {
+      ASSERT(list.backend_functions == 0 || list.backend_functions == result->backend_functions);
+      list.backend_functions = result->backend_functions;
+    }
+
+    // NOTE(hampus): Runs are placed, and pushed, in visual order
+    draw_list_visual_order(result, visual_order);
+    float pen_x = origin_x;
+    for(uint64_t visual_idx = 0; visual_idx < result->segment_count; ++visual_idx)
+    {
+      const TextToGlyphsSegment *segment = &result->segments[visual_order[visual_idx]];
+      const ShapingFontInfo *font_info = shaping_font_info_from_segment(result, segment);
+
+      DrawListRun run = {};
+      run.kind = DrawListRunKind_Outline;
+      run.uses_foreground_color = true;
+      run.font_face = font_info->font_face;
+      run.em_size = segment->font_size_em;
+      run.bidi_level = segment->bidi_level;
+      run.glyph_count = segment->glyph_count;
+      run.glyph_indices = result->glyph_indices + segment->first_glyph;
+      run.glyph_advances = result->glyph_advances + segment->first_glyph;
+      run.glyph_offsets = result->glyph_offsets + segment->first_glyph;
+      run.width = segment->run_width;
+
+      // NOTE(hampus): Right to left runs are drawn leftwards from their
+      // origin, so put the origin at their right end to keep them from
+      // overlapping the text before them.
+      run.baseline_x = (segment->bidi_level & 1) != 0 ? pen_x + run.width : pen_x;
+      run.baseline_y = baseline_y;
+      pen_x += run.width;
+
+      const ShapingFontMetrics *font_metrics = &font_info->metrics;
+      float segment_height = (float)(font_metrics->ascent + font_metrics->descent + font_metrics->line_gap) * segment->font_size_em / (float)font_metrics->design_units_per_em;
+      line->height = segment_height > line->height ? segment_height : line->height;
+
+      DrawListRun *layers = 0;
+      uint32_t layer_count = 0;
+      if(translate_color != 0 && translate_color(translate_color_user_data, list.arena, &run, &layers, &layer_count))
+      {
+        for(uint32_t layer_idx = 0; layer_idx < layer_count; ++layer_idx)
+        {
+          draw_list_push_run(&list, &layers[layer_idx]);
+        }
+      }
+      else
+      {
+        draw_list_push_run(&list, &run);
+      }
+    }
+
+    line->run_count = list.run_count - line->first_run;
+    line->width = pen_x - origin_x;
+    list.width = line->width > list.width ? line->width : list.width;
+    list.height += line->height;
+    baseline_y += line->height;
+  }
+
+  memory_free(visual_order);
+  return list;
+}
+
+static void
+draw_list_release(DrawList *list)
+{
+  for(uint32_t run_idx = 0; run_idx < list->run_count; ++run_idx)
+  {
+    list->backend_functions->release_font_face(list->runs[run_idx].font_face);
+  }
+  memory_free(list->runs);
+  if(list->arena != 0)
+  {
+    arena_release(list->arena);
+  }
+  *list = {};
+}
+
+static void
+draw_list_replay(const DrawList *list, const DrawListTarget *target)
+{
+  for(uint32_t run_idx = 0; run_idx < list->run_count; ++run_idx)
+  {
+    target->draw_run(target->state, &list->runs[run_idx]);
+  }
+}
+
+#endif // DRAW_LIST_H
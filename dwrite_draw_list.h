@@ -0,0 +1,164 @@
+#ifndef DWRITE_DRAW_LIST_H
+#define DWRITE_DRAW_LIST_H
+
+#include "dwrite_text_to_glyphs.h"
+#include "color_glyph_cache.h"
+
+////////////////////////////////////////////////////////////
+// hampus: directwrite color glyphs
+
+// NOTE(hampus): The ColorFontFunction and ColorGlyphDecomposeFunction of a
+// ColorGlyphCache on top of TranslateColorGlyphRun. Glyphs are translated one
+// at a time, so each one only ever has to be enumerated once.
+
+struct DWriteColorGlyphDecomposer
+{
+  IDWriteFactory4 *factory;
+};
+
+static DWRITE_GLYPH_RUN
+dwrite_glyph_run_from_draw_list_run(const DrawListRun *run)
+{
+  DWRITE_GLYPH_RUN glyph_run = {};
+  glyph_run.fontFace = dwrite_font_face_from_shaping_font_face(run->font_face);
+  glyph_run.fontEmSize = run->em_size;
+  glyph_run.glyphCount = (UINT32)run->glyph_count;
+  glyph_run.glyphIndices = run->glyph_indices;
+  glyph_run.glyphAdvances = run->glyph_advances;
+  glyph_run.glyphOffsets = (const DWRITE_GLYPH_OFFSET *)run->glyph_offsets;
+  glyph_run.bidiLevel = run->bidi_level;
+  return glyph_run;
+}
+
+static bool
+dwrite_is_color_font(void *user_data, ShapingFontFace *font_face)
+{
+  return dwrite_font_face_from_shaping_font_face(font_face)->IsColorFont() != FALSE;
+}
+
+static bool
+dwrite_decompose_color_glyph(void *user_data, Arena *arena, ShapingFontFace *font_face, uint16_t glyph_index, ColorGlyphLayer **layers, uint32_t *layer_count)
+{
+  DWriteColorGlyphDecomposer *decomposer = (DWriteColorGlyphDecomposer *)user_data;
+  HRESULT hr = 0;
+
+  // NOTE(hampus): The layers don't depend on the em size, any size will do
+  FLOAT glyph_advance = 0;
+  DWRITE_GLYPH_OFFSET glyph_offset = {};
+  DWRITE_GLYPH_RUN glyph_run = {};
+  glyph_run.fontFace = dwrite_font_face_from_shaping_font_face(font_face);
+  glyph_run.fontEmSize = 16.0f;
+  glyph_run.glyphCount = 1;
+  glyph_run.glyphIndices = &glyph_index;
+  glyph_run.glyphAdvances = &glyph_advance;
+  glyph_run.glyphOffsets = &glyph_offset;
+
+  IDWriteColorGlyphRunEnumerator1 *run_enumerator = 0;
+  const DWRITE_GLYPH_IMAGE_FORMATS desired_glyph_image_formats = DWRITE_GLYPH_IMAGE_FORMATS_TRUETYPE |
+                                                                 DWRITE_GLYPH_IMAGE_FORMATS_CFF |
+                                                                 DWRITE_GLYPH_IMAGE_FORMATS_COLR |
+                                                                 DWRITE_GLYPH_IMAGE_FORMATS_SVG |
+                                                                 DWRITE_GLYPH_IMAGE_FORMATS_PNG |
+                                                                 DWRITE_GLYPH_IMAGE_FORMATS_JPEG |
+                                                                 DWRITE_GLYPH_IMAGE_FORMATS_TIFF |
+                                                                 DWRITE_GLYPH_IMAGE_FORMATS_PREMULTIPLIED_B8G8R8A8;
+  hr = decomposer->factory->TranslateColorGlyphRun({0, 0}, &glyph_run, 0, desired_glyph_image_formats, DWRITE_MEASURING_MODE_NATURAL, 0, 0, &run_enumerator);
+  if(hr == DWRITE_E_NOCOLOR)
+  {
+    return false;
+  }
+  ASSERT_HR(hr);
+
+  // NOTE(hampus): The enumerator doesn't say how many layers there are up
+  // front, so collect them in a list first.
+  struct LayerNode
+  {
+    LayerNode *next;
+    ColorGlyphLayer layer;
+  };
+  LayerNode *first_layer = 0;
+  LayerNode *last_layer = 0;
+  uint32_t count = 0;
+
+  for(;;)
+  {
+    BOOL have_run = FALSE;
+    hr = run_enumerator->MoveNext(&have_run);
+    ASSERT_HR(hr);
+    if(!have_run)
+    {
+      break;
+    }
+
+    const DWRITE_COLOR_GLYPH_RUN1 *color_glyph_run = 0;
+    hr = run_enumerator->GetCurrentRun(&color_glyph_run);
+    ASSERT_HR(hr);
+
+    ColorGlyphLayer layer = {};
+    switch(color_glyph_run->glyphImageFormat)
+    {
+      case DWRITE_GLYPH_IMAGE_FORMATS_NONE:
+      {
+        // NOTE(hampus): Nothing to draw
+        // TODO(hampus): Find out when this is the case.
+        continue;
+      }
+      break;
+      case DWRITE_GLYPH_IMAGE_FORMATS_PNG:
+      case DWRITE_GLYPH_IMAGE_FORMATS_JPEG:
+      case DWRITE_GLYPH_IMAGE_FORMATS_TIFF:
+      case DWRITE_GLYPH_IMAGE_FORMATS_PREMULTIPLIED_B8G8R8A8:
+      {
+        layer.kind = DrawListRunKind_Bitmap;
+      }
+      break;
+      case DWRITE_GLYPH_IMAGE_FORMATS_SVG:
+      {
+        layer.kind = DrawListRunKind_Svg;
+      }
+      break;
+      default:
+      {
+        layer.kind = DrawListRunKind_Outline;
+      }
+      break;
+    }
+    if(color_glyph_run->glyphRun.glyphCount == 0)
+    {
+      continue;
+    }
+
+    layer.glyph_index = color_glyph_run->glyphRun.glyphIndices[0];
+    layer.image_format = (uint32_t)color_glyph_run->glyphImageFormat;
+    layer.uses_foreground_color = color_glyph_run->paletteIndex == 0xFFFF;
+    layer.color = {color_glyph_run->runColor.r, color_glyph_run->runColor.g, color_glyph_run->runColor.b, color_glyph_run->runColor.a};
+
+    LayerNode *node = push_array(arena, LayerNode, 1);
+    node->layer = layer;
+    if(last_layer != 0)
+    {
+      last_layer->next = node;
+    }
+    else
+    {
+      first_layer = node;
+    }
+    last_layer = node;
+    count += 1;
+  }
+
+  run_enumerator->Release();
+
+  ColorGlyphLayer *result = push_array_no_zero(arena, ColorGlyphLayer, count);
+  uint32_t layer_idx = 0;
+  for(LayerNode *node = first_layer; node != 0; node = node->next)
+  {
+    result[layer_idx] = node->layer;
+    layer_idx += 1;
+  }
+  *layers = result;
+  *layer_count = count;
+  return count != 0;
+}
+
+#endif // DWRITE_DRAW_LIST_H
@@ -0,0 +1,75 @@
+#ifndef DWRITE_GLYPH_ATLAS_H
+#define DWRITE_GLYPH_ATLAS_H
+
+#include "dwrite_text_to_glyphs.h"
+#include "glyph_atlas.h"
+
+////////////////////////////////////////////////////////////
+// hampus: directwrite glyph rasterizer
+
+// NOTE(hampus): Rasterizes glyphs for the glyph atlas with a glyph run
+// analysis. Grayscale antialiasing makes the 1x1 alpha texture hold 8-bit
+// coverage instead of aliased 0/255 values. The em size is in pixels, which
+// glyph_atlas_quads_from_glyphs() has already scaled by the DPI.
+
+struct DWriteGlyphRasterizer
+{
+  IDWriteFactory2 *factory;
+};
+
+static bool
+dwrite_rasterize_glyph(void *user_data, Arena *scratch, ShapingFontFace *font_face, float em_size, uint16_t glyph_index, float subpixel_x, GlyphBitmap *bitmap)
+{
+  DWriteGlyphRasterizer *rasterizer = (DWriteGlyphRasterizer *)user_data;
+  HRESULT hr = 0;
+  *bitmap = {};
+
+  FLOAT glyph_advance = 0;
+  DWRITE_GLYPH_OFFSET glyph_offset = {};
+  DWRITE_GLYPH_RUN glyph_run = {};
+  glyph_run.fontFace = dwrite_font_face_from_shaping_font_face(font_face);
+  glyph_run.fontEmSize = em_size;
+  glyph_run.glyphCount = 1;
+  glyph_run.glyphIndices = &glyph_index;
+  glyph_run.glyphAdvances = &glyph_advance;
+  glyph_run.glyphOffsets = &glyph_offset;
+
+  IDWriteGlyphRunAnalysis *glyph_run_analysis = 0;
+  hr = rasterizer->factory->CreateGlyphRunAnalysis(&glyph_run,
+                                                   0,
+                                                   DWRITE_RENDERING_MODE_NATURAL_SYMMETRIC,
+                                                   DWRITE_MEASURING_MODE_NATURAL,
+                                                   DWRITE_GRID_FIT_MODE_DEFAULT,
+                                                   DWRITE_TEXT_ANTIALIAS_MODE_GRAYSCALE,
+                                                   subpixel_x,
+                                                   0.0f,
+                                                   &glyph_run_analysis);
+  if(FAILED(hr))
+  {
+    return false;
+  }
+
+  RECT bounds = {};
+  hr = glyph_run_analysis->GetAlphaTextureBounds(DWRITE_TEXTURE_ALIASED_1x1, &bounds);
+  if(SUCCEEDED(hr) && bounds.right > bounds.left && bounds.bottom > bounds.top)
+  {
+    uint32_t width = (uint32_t)(bounds.right - bounds.left);
+    uint32_t height = (uint32_t)(bounds.bottom - bounds.top);
+    uint8_t *coverage = push_array_no_zero(scratch, uint8_t, width * height);
+    hr = glyph_run_analysis->CreateAlphaTexture(DWRITE_TEXTURE_ALIASED_1x1, &bounds, coverage, width * height);
+    if(SUCCEEDED(hr))
+    {
+      bitmap->width = width;
+      bitmap->height = height;
+      bitmap->left = bounds.left;
+      bitmap->top = bounds.top;
+      bitmap->pitch = width;
+      bitmap->coverage = coverage;
+    }
+  }
+
+  glyph_run_analysis->Release();
+  return SUCCEEDED(hr);
+}
+
+#endif // DWRITE_GLYPH_ATLAS_H
@@ -0,0 +1,90 @@
+#ifndef DWRITE_SHAPING_DISK_CACHE_H
+#define DWRITE_SHAPING_DISK_CACHE_H
+
+#include "dwrite_text_to_glyphs.h"
+#include "shaping_disk_cache.h"
+
+////////////////////////////////////////////////////////////
+// hampus: directwrite font files
+
+// NOTE(hampus): The ShapingFontFileFunctions for the disk cache. Font faces
+// are named by the path the local font file loader has for them, so results
+// that use fonts loaded from memory aren't cached, and are recreated from
+// the file with the same face index and simulations.
+
+struct DWriteFontFiles
+{
+  IDWriteFactory *factory;
+};
+
+static bool
+dwrite_font_file_from_face(void *user_data, Arena *arena, ShapingFontFace *font_face, ShapingFontFile *file)
+{
+  IDWriteFontFace5 *dwrite_font_face = dwrite_font_face_from_shaping_font_face(font_face);
+  wchar_t path[MAX_PATH] = {};
+  if(!dwrite_font_file_path_from_font_face(dwrite_font_face, path, MAX_PATH))
+  {
+    return false;
+  }
+
+  int path_size = WideCharToMultiByte(CP_UTF8, 0, path, -1, 0, 0, 0, 0);
+  if(path_size == 0)
+  {
+    return false;
+  }
+  file->path = push_array_no_zero(arena, char, path_size);
+  WideCharToMultiByte(CP_UTF8, 0, path, -1, file->path, path_size, 0, 0);
+  file->face_index = dwrite_font_face->GetIndex();
+  file->simulations = (uint32_t)dwrite_font_face->GetSimulations();
+  return true;
+}
+
+static ShapingFontFace *
+dwrite_font_face_from_file(void *user_data, const ShapingFontFile *file)
+{
+  DWriteFontFiles *font_files = (DWriteFontFiles *)user_data;
+  HRESULT hr = 0;
+
+  wchar_t path[MAX_PATH] = {};
+  if(MultiByteToWideChar(CP_UTF8, 0, file->path, -1, path, MAX_PATH) == 0)
+  {
+    return 0;
+  }
+
+  IDWriteFontFile *font_file = 0;
+  hr = font_files->factory->CreateFontFileReference(path, 0, &font_file);
+  if(FAILED(hr))
+  {
+    return 0;
+  }
+
+  BOOL is_supported = FALSE;
+  DWRITE_FONT_FILE_TYPE file_type = DWRITE_FONT_FILE_TYPE_UNKNOWN;
+  DWRITE_FONT_FACE_TYPE face_type = DWRITE_FONT_FACE_TYPE_UNKNOWN;
+  UINT32 face_count = 0;
+  hr = font_file->Analyze(&is_supported, &file_type, &face_type, &face_count);
+
+  IDWriteFontFace *font_face = 0;
+  if(SUCCEEDED(hr) && is_supported && file->face_index < face_count)
+  {
+    hr = font_files->factory->CreateFontFace(face_type, 1, &font_file, file->face_index, (DWRITE_FONT_SIMULATIONS)file->simulations, &font_face);
+  }
+
+  IDWriteFontFace5 *result = 0;
+  if(font_face != 0)
+  {
+    font_face->QueryInterface(&result);
+    font_face->Release();
+  }
+  font_file->Release();
+  return (ShapingFontFace *)result;
+}
+
+static const ShapingFontFileFunctions dwrite_font_file_functions =
+{
+  dwrite_font_file_from_face,
+  shaping_font_file_version_from_disk,
+  dwrite_font_face_from_file,
+};
+
+#endif // DWRITE_SHAPING_DISK_CACHE_H
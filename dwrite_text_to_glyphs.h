@@ -2,68 +2,22 @@
 #define DWRITE_TEXT_TO_GLYPHS_H
 
 #include <dwrite_3.h>
-#include <stdint.h>
 
-#define ASSERT(expr)        \
-  if(!(expr))               \
-  {                         \
-    *(volatile int *)0 = 0; \
-  }
+#include "text_to_glyphs.h"
 
 #define ASSERT_HR(hr) ASSERT(SUCCEEDED(hr))
 
-#define memory_copy(dst, src, size) memcpy((uint8_t *)(dst), (uint8_t *)(src), (size))
-#define memory_copy_typed(dst, src, count) memcpy((uint8_t *)(dst), (uint8_t *)(src), sizeof(*(dst)) * (count))
-
-struct GlyphArrayChunk;
-
-struct GlyphArray
-{
-  uint64_t count;
-  uint16_t *indices;
-  float *advances;
-  DWRITE_GLYPH_OFFSET *offsets;
-};
-
-struct GlyphArrayChunk
-{
-  GlyphArrayChunk *next;
-  GlyphArrayChunk *prev;
-  uint64_t total_glyph_count;
-  uint64_t count;
-  GlyphArray v[512];
-};
-
-struct TextToGlyphsSegment
-{
-  // per segment data
-  IDWriteFontFace5 *font_face;
-  uint32_t bidi_level;
-  FLOAT font_size_em;
-  uint64_t glyph_count;
-
-  // per glyph data
-  uint16_t *glyph_indices;
-  float *glyph_advances;
-  DWRITE_GLYPH_OFFSET *glyph_offsets;
-};
-
-struct TextToGlyphsSegmentNode
-{
-  TextToGlyphsSegmentNode *next;
-  TextToGlyphsSegmentNode *prev;
-  TextToGlyphsSegment v;
-};
+static_assert(sizeof(GlyphOffset) == sizeof(DWRITE_GLYPH_OFFSET) &&
+              offsetof(GlyphOffset, advance_offset) == offsetof(DWRITE_GLYPH_OFFSET, advanceOffset) &&
+              offsetof(GlyphOffset, ascender_offset) == offsetof(DWRITE_GLYPH_OFFSET, ascenderOffset),
+              "GlyphOffset must match DWRITE_GLYPH_OFFSET so results can be drawn without copying");
 
-struct MapTextToGlyphsResult
-{
-  // NOTE(hampus): One of these segments for every time the fallback font doesn't match the
-  // previous one. For example, if a font contained all the characters, there would just be
-  // one segment in the list.
+static_assert(sizeof(LineBreakpoint) == sizeof(DWRITE_LINE_BREAKPOINT) &&
+              (int)LineBreakCondition_MustBreak == (int)DWRITE_BREAK_CONDITION_MUST_BREAK,
+              "LineBreakpoint must match DWRITE_LINE_BREAKPOINT so breakpoints can be copied straight from the analyzer");
 
-  TextToGlyphsSegmentNode *first_segment;
-  TextToGlyphsSegmentNode *last_segment;
-};
+////////////////////////////////////////////////////////////
+// hampus: analysis source and sink
 
 struct TextAnalysisSource final : IDWriteTextAnalysisSource
 {
@@ -143,27 +97,29 @@ private:
   const UINT32 _text_length;
 };
 
+// NOTE(hampus): Script analysis and bidi levels come in as separate ranges,
+// which don't line up with each other.
 struct TextAnalysisSinkResult
 {
   uint32_t text_position;
   uint32_t text_length;
+  bool is_bidi_level;
   DWRITE_SCRIPT_ANALYSIS analysis;
   uint32_t resolved_bidi_level;
   uint32_t explicit_bidi_level;
 };
 
-struct TextAnalysisSinkResultChunk
-{
-  TextAnalysisSinkResultChunk *next;
-  TextAnalysisSinkResultChunk *prev;
-  uint64_t count;
-  TextAnalysisSinkResult v[512];
-};
-
 struct TextAnalysisSink final : IDWriteTextAnalysisSink
 {
-  TextAnalysisSinkResultChunk *first_result_chunk;
-  TextAnalysisSinkResultChunk *last_result_chunk;
+  // NOTE(hampus): The results are one array on the arena, which doubles
+  // when it runs out. The caller pops the arena, so a sink never frees.
+  Arena *arena;
+  uint32_t result_count;
+  uint32_t result_capacity;
+  TextAnalysisSinkResult *results;
+
+  // NOTE(hampus): Where AnalyzeLineBreakpoints writes to, one per character
+  LineBreakpoint *line_breakpoints;
 
   ULONG STDMETHODCALLTYPE
   AddRef() noexcept override
@@ -186,47 +142,55 @@ struct TextAnalysisSink final : IDWriteTextAnalysisSink
       return S_OK;
     }
 
-    object = 0;
+    *object = 0;
     return E_NOINTERFACE;
   }
 
-  HRESULT STDMETHODCALLTYPE
-  SetScriptAnalysis(UINT32 text_pos, UINT32 text_length, const DWRITE_SCRIPT_ANALYSIS *script_analysis) noexcept override
+  TextAnalysisSinkResult &
+  push_result(UINT32 text_pos, UINT32 text_length) noexcept
   {
-    TextAnalysisSinkResultChunk *chunk = last_result_chunk;
-    if(chunk == 0 || chunk->count == ARRAYSIZE(chunk->v))
+    if(result_count == result_capacity)
     {
-      chunk = (TextAnalysisSinkResultChunk *)calloc(1, sizeof(TextAnalysisSinkResultChunk));
-      if(first_result_chunk == 0)
-      {
-        first_result_chunk = last_result_chunk = chunk;
-      }
-      else
-      {
-        last_result_chunk->next = chunk;
-        last_result_chunk = first_result_chunk;
-      }
+      uint32_t capacity = result_capacity == 0 ? 64 : result_capacity * 2;
+      TextAnalysisSinkResult *new_results = push_array_no_zero(arena, TextAnalysisSinkResult, capacity);
+      memory_copy_typed(new_results, results, result_count);
+      results = new_results;
+      result_capacity = capacity;
     }
-    TextAnalysisSinkResult &result = chunk->v[chunk->count];
+    TextAnalysisSinkResult &result = results[result_count];
+    result = {};
     result.text_position = text_pos;
     result.text_length = text_length;
+    result_count += 1;
+    return result;
+  }
+
+  HRESULT STDMETHODCALLTYPE
+  SetScriptAnalysis(UINT32 text_pos, UINT32 text_length, const DWRITE_SCRIPT_ANALYSIS *script_analysis) noexcept override
+  {
+    TextAnalysisSinkResult &result = push_result(text_pos, text_length);
     result.analysis = *script_analysis;
-    chunk->count += 1;
     return S_OK;
   }
 
   HRESULT STDMETHODCALLTYPE
   SetLineBreakpoints(UINT32 text_pos, UINT32 text_length, const DWRITE_LINE_BREAKPOINT *line_breakpoints) noexcept override
   {
-    return E_NOTIMPL;
+    if(this->line_breakpoints == 0)
+    {
+      return E_NOTIMPL;
+    }
+    memory_copy_typed(this->line_breakpoints + text_pos, line_breakpoints, text_length);
+    return S_OK;
   }
 
   HRESULT STDMETHODCALLTYPE
   SetBidiLevel(UINT32 text_pos, UINT32 text_length, UINT8 explicit_level, UINT8 resolved_level) noexcept override
   {
-    // TODO(hampus): Is this correct?
-    last_result_chunk->v[last_result_chunk->count - 1].explicit_bidi_level = explicit_level;
-    last_result_chunk->v[last_result_chunk->count - 1].resolved_bidi_level = resolved_level;
+    TextAnalysisSinkResult &result = push_result(text_pos, text_length);
+    result.is_bidi_level = true;
+    result.explicit_bidi_level = explicit_level;
+    result.resolved_bidi_level = resolved_level;
     return S_OK;
   }
 
@@ -235,427 +199,556 @@ struct TextAnalysisSink final : IDWriteTextAnalysisSink
   {
     return E_NOTIMPL;
   }
+};
 
-  ~TextAnalysisSink()
-  {
-    TextAnalysisSinkResultChunk *next_chunk = 0;
-    for(TextAnalysisSinkResultChunk *chunk = first_result_chunk; chunk != 0; chunk = next_chunk)
-    {
-      next_chunk = chunk->next;
-      free(chunk);
-    }
-  }
+////////////////////////////////////////////////////////////
+// hampus: directwrite shaping backend
+
+// NOTE(hampus): The font faces handed to the core are IDWriteFontFace5
+// pointers, so they can be drawn straight from a segment.
+
+struct DWriteShapingBackend
+{
+  IDWriteFontFallback1 *font_fallback;
+  IDWriteFontCollection *font_collection;
+  IDWriteTextAnalyzer1 *text_analyzer;
+
+  // NOTE(hampus): Shared by every call made with the backend, so a face is
+  // only interned and asked about its metrics once
+  ShapingFontRegistry *font_registry;
 };
 
-static GlyphArray *
-allocate_and_push_back_glyph_array(GlyphArrayChunk **first_chunk, GlyphArrayChunk **last_chunk)
+static IDWriteFontFace5 *
+dwrite_font_face_from_shaping_font_face(ShapingFontFace *font_face)
 {
-  GlyphArray *glyph_array = 0;
-  GlyphArrayChunk *glyph_array_chunk = *last_chunk;
-  {
-    if(glyph_array_chunk == 0 || glyph_array_chunk->count == ARRAYSIZE(glyph_array_chunk->v))
-    {
-      glyph_array_chunk = (GlyphArrayChunk *)calloc(1, sizeof(GlyphArrayChunk));
-      if(*first_chunk == 0)
-      {
-        *first_chunk = *last_chunk = glyph_array_chunk;
-      }
-      else
-      {
-        (*last_chunk)->next = glyph_array_chunk;
-        glyph_array_chunk->prev = *last_chunk;
-        *last_chunk = glyph_array_chunk;
-      }
-    }
-    glyph_array = &glyph_array_chunk->v[glyph_array_chunk->count];
-    glyph_array_chunk->count += 1;
-  }
-  return glyph_array;
+  return (IDWriteFontFace5 *)font_face;
 }
 
-static TextToGlyphsSegmentNode *
-allocate_and_push_back_segment_node(TextToGlyphsSegmentNode **first_segment, TextToGlyphsSegmentNode **last_segment)
+static void
+dwrite_add_ref_font_face(ShapingFontFace *font_face)
 {
-  TextToGlyphsSegmentNode *segment_node = (TextToGlyphsSegmentNode *)calloc(1, sizeof(TextToGlyphsSegmentNode));
-  if(*first_segment == 0)
-  {
-    *first_segment = *last_segment = segment_node;
-  }
-  else
-  {
-    (*last_segment)->next = segment_node;
-    segment_node->prev = *last_segment;
-    *last_segment = segment_node;
-  }
-  return segment_node;
+  dwrite_font_face_from_shaping_font_face(font_face)->AddRef();
 }
 
 static void
-fill_segment_with_glyph_array_chunks(TextToGlyphsSegment *segment, GlyphArrayChunk *first_chunk, GlyphArrayChunk *last_chunk)
+dwrite_release_font_face(ShapingFontFace *font_face)
 {
-  uint64_t total_glyph_count = 0;
-  for(GlyphArrayChunk *chunk = first_chunk; chunk != 0; chunk = chunk->next)
-  {
-    total_glyph_count += chunk->total_glyph_count;
-  }
+  dwrite_font_face_from_shaping_font_face(font_face)->Release();
+}
 
-  segment->glyph_count = total_glyph_count;
-  segment->glyph_indices = (uint16_t *)calloc(segment->glyph_count, sizeof(uint16_t));
-  segment->glyph_advances = (float *)calloc(segment->glyph_count, sizeof(float));
-  segment->glyph_offsets = (DWRITE_GLYPH_OFFSET *)calloc(segment->glyph_count, sizeof(DWRITE_GLYPH_OFFSET));
-  uint64_t glyph_idx_offset = 0;
-  GlyphArrayChunk *next_chunk = 0;
-  for(GlyphArrayChunk *chunk = first_chunk; chunk != 0; chunk = next_chunk)
-  {
-    next_chunk = chunk->next;
-    for(uint64_t glyph_array_idx = 0; glyph_array_idx < chunk->count; ++glyph_array_idx)
-    {
-      GlyphArray &glyph_array = chunk->v[glyph_array_idx];
-      memory_copy_typed(segment->glyph_indices + glyph_idx_offset, glyph_array.indices, glyph_array.count);
-      memory_copy_typed(segment->glyph_advances + glyph_idx_offset, glyph_array.advances, glyph_array.count);
-      memory_copy_typed(segment->glyph_offsets + glyph_idx_offset, glyph_array.offsets, glyph_array.count);
+static uint16_t
+dwrite_get_design_units_per_em(ShapingFontFace *font_face)
+{
+  DWRITE_FONT_METRICS1 font_metrics = {};
+  dwrite_font_face_from_shaping_font_face(font_face)->GetMetrics(&font_metrics);
+  return font_metrics.designUnitsPerEm;
+}
 
-      free(glyph_array.indices);
-      free(glyph_array.advances);
-      free(glyph_array.offsets);
+static void
+dwrite_get_design_font_metrics(ShapingFontFace *font_face, ShapingFontMetrics *metrics)
+{
+  DWRITE_FONT_METRICS1 font_metrics = {};
+  dwrite_font_face_from_shaping_font_face(font_face)->GetMetrics(&font_metrics);
+  metrics->design_units_per_em = font_metrics.designUnitsPerEm;
+  metrics->ascent = font_metrics.ascent;
+  metrics->descent = font_metrics.descent;
+  metrics->line_gap = font_metrics.lineGap;
+}
 
-      glyph_idx_offset += glyph_array.count;
-    }
-    free(chunk);
-  }
+static void
+dwrite_get_font_properties(ShapingFontFace *font_face, ShapingFontProperties *properties)
+{
+  IDWriteFontFace5 *dwrite_font_face = dwrite_font_face_from_shaping_font_face(font_face);
+  properties->glyph_count = dwrite_font_face->GetGlyphCount();
+  properties->flags = 0;
+  properties->flags |= dwrite_font_face->IsMonospacedFont() ? ShapingFontFlag_Monospace : 0;
+  properties->flags |= dwrite_font_face->IsColorFont() ? ShapingFontFlag_Color : 0;
 }
 
-static MapTextToGlyphsResult
-dwrite_map_text_to_glyphs(IDWriteFontFallback1 *font_fallback, IDWriteFontCollection *font_collection, IDWriteTextAnalyzer1 *text_analyzer, const wchar_t *locale, const wchar_t *base_family, const float font_size, const wchar_t *text, const uint32_t text_length)
+static void
+dwrite_get_glyph_indices(ShapingFontFace *font_face, const uint32_t *codepoints, uint32_t count, uint16_t *glyph_indices)
 {
-  MapTextToGlyphsResult result = {};
+  HRESULT hr = dwrite_font_face_from_shaping_font_face(font_face)->GetGlyphIndices(codepoints, count, glyph_indices);
+  ASSERT_HR(hr);
+}
 
-  HRESULT hr = 0;
+static void
+dwrite_get_design_glyph_advances(ShapingFontFace *font_face, const uint16_t *glyph_indices, uint32_t count, int32_t *design_advances)
+{
+  HRESULT hr = dwrite_font_face_from_shaping_font_face(font_face)->GetDesignGlyphAdvances(count, glyph_indices, design_advances);
+  ASSERT_HR(hr);
+}
 
-  struct MappedText
-  {
-    MappedText *next;
-    MappedText *prev;
+static ShapingFontFace *
+dwrite_map_characters(void *state, const utf16_char *locale, const utf16_char *base_family, const utf16_char *text, uint32_t text_length, uint32_t *mapped_length, float *scale)
+{
+  DWriteShapingBackend *backend = (DWriteShapingBackend *)state;
+
+  // NOTE(hampus): We need an analysis source that holds the text and the locale
+  TextAnalysisSource analysis_source{locale, text, text_length};
+
+  IDWriteFontFace5 *mapped_font_face = 0;
+  HRESULT hr = backend->font_fallback->MapCharacters(&analysis_source,
+                                                     0,
+                                                     text_length,
+                                                     backend->font_collection,
+                                                     base_family,
+                                                     0,
+                                                     0,
+                                                     mapped_length,
+                                                     scale,
+                                                     &mapped_font_face);
+  ASSERT_HR(hr);
+  return (ShapingFontFace *)mapped_font_face;
+}
 
-    IDWriteFontFace5 *font_face;
-    uint32_t text_offset;
-    uint32_t text_length;
-  };
+static bool
+dwrite_get_text_complexity(void *state, ShapingFontFace *font_face, const utf16_char *text, uint32_t text_length, uint32_t *mapped_length, uint16_t *glyph_indices)
+{
+  DWriteShapingBackend *backend = (DWriteShapingBackend *)state;
+  BOOL is_simple = FALSE;
+  HRESULT hr = backend->text_analyzer->GetTextComplexity(text,
+                                                         text_length,
+                                                         dwrite_font_face_from_shaping_font_face(font_face),
+                                                         &is_simple,
+                                                         mapped_length,
+                                                         glyph_indices);
+  ASSERT_HR(hr);
+  return is_simple != FALSE;
+}
 
-  MappedText *first_mapping = 0;
-  MappedText *last_mapping = 0;
+static ShapingScriptRun *
+dwrite_analyze_script_and_bidi(void *state, Arena *arena, const utf16_char *locale, const utf16_char *text, uint32_t text_length, uint32_t *run_count)
+{
+  // NOTE(hampus): The core hands this a whole paragraph at a time, which is
+  // what AnalyzeBidi wants.
+  DWriteShapingBackend *backend = (DWriteShapingBackend *)state;
+  HRESULT hr = 0;
 
-  for(uint32_t fallback_offset = 0; fallback_offset < text_length;)
-  {
-    MappedText *mapping = (MappedText *)calloc(1, sizeof(MappedText));
+  TextAnalysisSource analysis_source{locale, text, text_length};
+  TextAnalysisSink analysis_sink = {};
+  analysis_sink.arena = arena;
+
+  hr = backend->text_analyzer->AnalyzeScript(&analysis_source, 0, text_length, &analysis_sink);
+  ASSERT_HR(hr);
+
+  hr = backend->text_analyzer->AnalyzeBidi(&analysis_source, 0, text_length, &analysis_sink);
+  ASSERT_HR(hr);
 
-    //----------------------------------------------------------
-    // hampus: get mapped font and length
+  //----------------------------------------------------------
+  // hampus: split the results into script ranges and bidi ranges
 
-    IDWriteFontFace5 *mapped_font_face = 0;
-    uint32_t mapped_text_length = 0;
+  trace_begin(copy);
+  uint32_t result_count = analysis_sink.result_count;
+  uint32_t bidi_count = 0;
+  for(uint32_t result_idx = 0; result_idx < result_count; ++result_idx)
+  {
+    bidi_count += analysis_sink.results[result_idx].is_bidi_level ? 1 : 0;
+  }
+  uint32_t script_count = result_count - bidi_count;
+
+  // NOTE(hampus): The sink's results and the ranges only get read below, and
+  // are popped off the arena together with the runs
+  ShapingScriptRun *runs = push_array_no_zero(arena, ShapingScriptRun, result_count);
+  TextAnalysisSinkResult **scripts = push_array_no_zero(arena, TextAnalysisSinkResult *, script_count);
+  TextAnalysisSinkResult **bidis = push_array_no_zero(arena, TextAnalysisSinkResult *, bidi_count);
+  uint32_t script_idx = 0;
+  uint32_t bidi_idx = 0;
+  for(uint32_t result_idx = 0; result_idx < result_count; ++result_idx)
+  {
+    TextAnalysisSinkResult *result = &analysis_sink.results[result_idx];
+    if(result->is_bidi_level)
     {
-      // NOTE(hampus): We need an analysis source that holds the text and the locale
-      TextAnalysisSource analysis_source{locale, text+fallback_offset, text_length-fallback_offset};
-
-      // NOTE(hampus): This get the appropiate font required for rendering the text
-      float scale = 0;
-      hr = font_fallback->MapCharacters(&analysis_source,
-                                        0,
-                                        text_length-fallback_offset,
-                                        font_collection,
-                                        base_family,
-                                        0,
-                                        0,
-                                        &mapped_text_length,
-                                        &scale,
-                                        &mapped_font_face);
-      ASSERT_HR(hr);
-      if(mapped_font_face == 0)
-      {
-        // NOTE(hampus): This means that no font was available for this character.
-        // mapped_text_length is the number of characters to skip.
-        // Should be replaced by a missing glyph, typically glyph index 0 in fonts.
-      }
+      bidis[bidi_idx++] = result;
     }
+    else
+    {
+      scripts[script_idx++] = result;
+    }
+  }
 
-    mapping->text_offset = fallback_offset;
-    mapping->text_length = mapped_text_length;
-    mapping->font_face = mapped_font_face;
+  //----------------------------------------------------------
+  // hampus: one run for every overlap of a script range and a bidi range
 
-    BOOL insert = TRUE;
-    if(last_mapping != 0)
+  // NOTE(hampus): Both kinds of ranges come in text order and cover the
+  // text, so this walks them side by side. Text without a bidi level is
+  // left to right.
+  uint32_t count = 0;
+  bidi_idx = 0;
+  for(script_idx = 0; script_idx < script_count; ++script_idx)
+  {
+    TextAnalysisSinkResult *script = scripts[script_idx];
+    uint32_t position = script->text_position;
+    uint32_t script_end = script->text_position + script->text_length;
+    while(position < script_end)
     {
-      if(last_mapping->font_face == mapped_font_face)
+      while(bidi_idx < bidi_count && bidis[bidi_idx]->text_position + bidis[bidi_idx]->text_length <= position)
       {
-        last_mapping->text_length += mapping->text_length;
-        insert = FALSE;
+        bidi_idx += 1;
       }
-    }
-
-    if(insert)
-    {
-      if(first_mapping == 0)
+      uint32_t end = script_end;
+      uint32_t bidi_level = 0;
+      if(bidi_idx < bidi_count && bidis[bidi_idx]->text_position <= position)
       {
-        first_mapping = last_mapping = mapping;
+        uint32_t bidi_end = bidis[bidi_idx]->text_position + bidis[bidi_idx]->text_length;
+        end = bidi_end < end ? bidi_end : end;
+        bidi_level = bidis[bidi_idx]->resolved_bidi_level;
       }
-      else
+      else if(bidi_idx < bidi_count && bidis[bidi_idx]->text_position < end)
       {
-        mapping->prev = last_mapping;
-        last_mapping->next = mapping;
-        last_mapping = mapping;
+        end = bidis[bidi_idx]->text_position;
       }
-    }
-    else
-    {
-      free(mapping);
-      mapping = 0;
-    }
 
-    fallback_offset += mapped_text_length;
+      ShapingScriptRun *run = &runs[count];
+      run->text_position = position;
+      run->text_length = end - position;
+      run->analysis.script = script->analysis.script;
+      run->analysis.shapes = (uint32_t)script->analysis.shapes;
+      run->bidi_level = bidi_level;
+      count += 1;
+      position = end;
+    }
   }
+  ASSERT(count <= result_count);
+  trace_end(copy, TracePhase_CopyAnalysis, text_length, 0);
+
+  *run_count = count;
+  return runs;
+}
 
-  for(MappedText *mapping = first_mapping; mapping != 0; mapping = mapping->next)
+static void
+dwrite_analyze_line_breakpoints(void *state, const utf16_char *locale, const utf16_char *text, uint32_t text_length, LineBreakpoint *breakpoints)
+{
+  DWriteShapingBackend *backend = (DWriteShapingBackend *)state;
+  TextAnalysisSource analysis_source{locale, text, text_length};
+  TextAnalysisSink analysis_sink = {};
+  analysis_sink.line_breakpoints = breakpoints;
+  HRESULT hr = backend->text_analyzer->AnalyzeLineBreakpoints(&analysis_source, 0, text_length, &analysis_sink);
+  ASSERT_HR(hr);
+}
+
+static bool
+dwrite_shape_run(void *state, Arena *scratch, ShapingFontFace *font_face, const float font_size, const ShapingScriptAnalysis *analysis, bool is_right_to_left, const utf16_char *locale, const utf16_char *text, const uint32_t text_length, uint32_t max_glyph_count, uint16_t *cluster_map, uint16_t *glyph_indices, float *glyph_advances, GlyphOffset *glyph_offsets, uint32_t *glyph_count)
+{
+  DWriteShapingBackend *backend = (DWriteShapingBackend *)state;
+  IDWriteFontFace5 *dwrite_font_face = dwrite_font_face_from_shaping_font_face(font_face);
+  HRESULT hr = 0;
+  uint64_t scratch_pos = arena_pos(scratch);
+
+  DWRITE_SCRIPT_ANALYSIS dwrite_analysis = {};
+  dwrite_analysis.script = (UINT16)analysis->script;
+  dwrite_analysis.shapes = (DWRITE_SCRIPT_SHAPES)analysis->shapes;
+
+  DWRITE_SHAPING_GLYPH_PROPERTIES *glyph_props = push_array_no_zero(scratch, DWRITE_SHAPING_GLYPH_PROPERTIES, max_glyph_count);
+  DWRITE_SHAPING_TEXT_PROPERTIES *text_props = push_array_no_zero(scratch, DWRITE_SHAPING_TEXT_PROPERTIES, text_length);
+
+  trace_begin(get_glyphs);
+  hr = backend->text_analyzer->GetGlyphs(text,
+                                         text_length,
+                                         dwrite_font_face,
+                                         false,
+                                         is_right_to_left,
+                                         &dwrite_analysis,
+                                         locale,
+                                         0,
+                                         0,
+                                         0,
+                                         0,
+                                         max_glyph_count,
+                                         cluster_map,
+                                         text_props,
+                                         glyph_indices,
+                                         glyph_props,
+                                         glyph_count);
+
+  bool fits = hr != HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+  trace_end(get_glyphs, TracePhase_GetGlyphs, text_length, fits ? *glyph_count : 0);
+  if(fits)
   {
-    if(mapping->font_face == 0)
-    {
-      continue;
-    }
+    ASSERT_HR(hr);
+    trace_begin(placements);
+    hr = backend->text_analyzer->GetGlyphPlacements(text,
+                                                    cluster_map,
+                                                    text_props,
+                                                    text_length,
+                                                    glyph_indices,
+                                                    glyph_props,
+                                                    *glyph_count,
+                                                    dwrite_font_face,
+                                                    font_size,
+                                                    false,
+                                                    is_right_to_left,
+                                                    &dwrite_analysis,
+                                                    locale,
+                                                    0,
+                                                    0,
+                                                    0,
+                                                    glyph_advances,
+                                                    (DWRITE_GLYPH_OFFSET *)glyph_offsets);
+    trace_end(placements, TracePhase_GetGlyphPlacements, text_length, *glyph_count);
+    ASSERT_HR(hr);
+  }
 
-    TextToGlyphsSegment *segment = 0;
-    GlyphArrayChunk *first_glyph_array_chunk = 0;
-    GlyphArrayChunk *last_glyph_array_chunk = 0;
+  arena_pop_to(scratch, scratch_pos);
+  return fits;
+}
 
-    //----------------------------------------------------------
-    // hampus: get glyph array list with both simple and complex glyphs
+static const ShapingBackendFunctions dwrite_shaping_backend_functions =
+{
+  dwrite_add_ref_font_face,
+  dwrite_release_font_face,
+  dwrite_get_design_units_per_em,
+  dwrite_get_design_font_metrics,
+  dwrite_get_font_properties,
+  dwrite_get_glyph_indices,
+  dwrite_get_design_glyph_advances,
+  dwrite_map_characters,
+  dwrite_get_text_complexity,
+  dwrite_analyze_script_and_bidi,
+  dwrite_analyze_line_breakpoints,
+  dwrite_shape_run,
+};
 
-    // NOTE(hampus): Each simple and complex text will get their own GlyphArray.
-    // In the end a long contigous array will be allocated and the glyph runs
-    // will be memcpy'd into that. That is because DWRITE_GLYPH_RUN expcets
-    // one large array of glyph indices. So these chunks are only temporary.
+static void
+dwrite_shaping_backend_init(DWriteShapingBackend *backend, IDWriteFontFallback1 *font_fallback, IDWriteFontCollection *font_collection, IDWriteTextAnalyzer1 *text_analyzer)
+{
+  // NOTE(hampus): Doesn't take references to the DirectWrite objects, so
+  // they have to outlive the backend.
+  *backend = {};
+  backend->font_fallback = font_fallback;
+  backend->font_collection = font_collection;
+  backend->text_analyzer = text_analyzer;
+  backend->font_registry = shaping_font_registry_alloc(&dwrite_shaping_backend_functions);
+}
 
-    // TODO(hampus): Is chunking really necessary? Since this memory is just temporary and
-    // if we know the upper limits, we could just preallocate GlyphArray and not having to deal with
-    // chunks.
+static void
+dwrite_shaping_backend_release(DWriteShapingBackend *backend)
+{
+  // NOTE(hampus): Results that are still around keep the font faces alive
+  shaping_font_registry_release(backend->font_registry);
+  backend->font_registry = 0;
+}
 
-    const wchar_t *fallback_ptr = text + mapping->text_offset;
-    const wchar_t *fallback_opl = fallback_ptr + mapping->text_length;
-    while(fallback_ptr < fallback_opl)
-    {
-      uint32_t fallback_remaining = (uint32_t)(fallback_opl - fallback_ptr);
-
-      uint64_t max_glyph_indices_count = (3 * mapping->text_length) / 2 + 16;
-      uint16_t *glyph_indices = (uint16_t *)calloc(max_glyph_indices_count, sizeof(uint16_t));
-      BOOL is_simple = FALSE;
-      uint32_t complex_mapped_length = 0;
-
-      hr = text_analyzer->GetTextComplexity(fallback_ptr,
-                                            fallback_remaining,
-                                            mapping->font_face,
-                                            &is_simple,
-                                            &complex_mapped_length,
-                                            glyph_indices);
-      ASSERT_HR(hr);
-
-      if(is_simple)
-      {
-        // NOTE(hampus): This text was simple. This means we can just use
-        // the indices directly without having to do any more shaping work.
-
-        if(segment != 0)
-        {
-          if(segment->bidi_level != 0)
-          {
-            fill_segment_with_glyph_array_chunks(segment, first_glyph_array_chunk, last_glyph_array_chunk);
-            first_glyph_array_chunk = 0;
-            last_glyph_array_chunk = 0;
-            segment = 0;
-          }
-        }
-
-        if(segment == 0)
-        {
-          TextToGlyphsSegmentNode *segment_node = allocate_and_push_back_segment_node(&result.first_segment, &result.last_segment);
-          segment = &segment_node->v;
-          segment->font_face = mapping->font_face;
-          segment->font_size_em = font_size;
-        }
-
-        // hampus: get a new glyph array
-
-        GlyphArray *glyph_array = allocate_and_push_back_glyph_array(&first_glyph_array_chunk, &last_glyph_array_chunk);
-
-        // hampus: allocate the arrays in the glyph array
-
-        DWRITE_FONT_METRICS1 font_metrics = {};
-        mapping->font_face->GetMetrics(&font_metrics);
-        glyph_array->count = complex_mapped_length;
-        glyph_array->advances = (float *)calloc(glyph_array->count, sizeof(float));
-        glyph_array->offsets = (DWRITE_GLYPH_OFFSET *)calloc(glyph_array->count, sizeof(DWRITE_GLYPH_OFFSET));
-        glyph_array->indices = (uint16_t *)calloc(glyph_array->count, sizeof(uint16_t));
-
-        // hampus: fill in indices
-
-        memory_copy_typed(glyph_array->indices, glyph_indices, glyph_array->count);
-
-        // hampus: fill in advances
-
-        {
-          int32_t *design_advances = (int32_t *)calloc(glyph_array->count, sizeof(int32_t));
-          hr = mapping->font_face->GetDesignGlyphAdvances(glyph_array->count, glyph_array->indices, design_advances);
-          float scale = font_size / (float)font_metrics.designUnitsPerEm;
-          for(uint64_t idx = 0; idx < glyph_array->count; idx++)
-          {
-            glyph_array->advances[idx] = (float)design_advances[idx] * scale;
-          }
-          free(design_advances);
-        }
-
-        last_glyph_array_chunk->total_glyph_count += glyph_array->count;
-      }
-      else
-      {
+static ShapingBackend
+dwrite_shaping_backend(DWriteShapingBackend *backend)
+{
+  // NOTE(hampus): Everything created from a shared DirectWrite factory is
+  // thread safe, so one backend can be used by any number of threads.
+  ShapingBackend result = {};
+  result.functions = &dwrite_shaping_backend_functions;
+  result.state = backend;
+  result.font_registry = backend->font_registry;
+  return result;
+}
 
-        // NOTE(hampus): This text was not simple. We have to do extra work. :(
-
-        TextAnalysisSource analysis_source{locale, fallback_ptr, complex_mapped_length};
-        TextAnalysisSink analysis_sink = {};
-
-        hr = text_analyzer->AnalyzeScript(&analysis_source, 0, complex_mapped_length, &analysis_sink);
-        ASSERT_HR(hr);
-
-        // NOTE(hampus): The text range given to AnalyzeBidi should not split a paragraph.
-        // It is meant for one paragraph as a whole or multiple paragraphs.
-        // TODO(hampus): What to do about it? What is a paragraph?
-        hr = text_analyzer->AnalyzeBidi(&analysis_source, 0, complex_mapped_length, &analysis_sink);
-        ASSERT_HR(hr);
-
-        DWRITE_SHAPING_GLYPH_PROPERTIES *glyph_props = (DWRITE_SHAPING_GLYPH_PROPERTIES *)calloc(max_glyph_indices_count, sizeof(DWRITE_SHAPING_GLYPH_PROPERTIES));
-
-        for(TextAnalysisSinkResultChunk *chunk = analysis_sink.first_result_chunk; chunk != 0; chunk = chunk->next)
-        {
-          for(uint64_t text_analysis_sink_result_idx = 0; text_analysis_sink_result_idx < chunk->count; ++text_analysis_sink_result_idx)
-          {
-            TextAnalysisSinkResult &analysis_result = chunk->v[text_analysis_sink_result_idx];
-
-            if(segment != 0)
-            {
-              if(segment->bidi_level != analysis_result.resolved_bidi_level)
-              {
-                fill_segment_with_glyph_array_chunks(segment, first_glyph_array_chunk, last_glyph_array_chunk);
-                first_glyph_array_chunk = 0;
-                last_glyph_array_chunk = 0;
-                segment = 0;
-              }
-            }
-
-            if(segment == 0)
-            {
-              TextToGlyphsSegmentNode *segment_node = allocate_and_push_back_segment_node(&result.first_segment, &result.last_segment);
-              segment = &segment_node->v;
-              segment->font_face = mapping->font_face;
-              segment->font_size_em = font_size;
-              segment->bidi_level = analysis_result.resolved_bidi_level;
-            }
-
-            uint16_t *cluster_map = (uint16_t *)calloc(analysis_result.text_length, sizeof(uint16_t));
-            DWRITE_SHAPING_TEXT_PROPERTIES *text_props = (DWRITE_SHAPING_TEXT_PROPERTIES *)calloc(analysis_result.text_length, sizeof(DWRITE_SHAPING_TEXT_PROPERTIES));
-
-            uint32_t actual_glyph_count = 0;
-
-            GlyphArray *glyph_array = allocate_and_push_back_glyph_array(&first_glyph_array_chunk, &last_glyph_array_chunk);
-
-            glyph_array->indices = (uint16_t *)calloc(max_glyph_indices_count, sizeof(uint16_t));
-            BOOL is_right_to_left = (BOOL)(analysis_result.resolved_bidi_level & 1);
-            for(int retry = 0;;)
-            {
-              hr = text_analyzer->GetGlyphs(fallback_ptr + analysis_result.text_position,
-                                            analysis_result.text_length,
-                                            mapping->font_face,
-                                            false,
-                                            is_right_to_left,
-                                            &analysis_result.analysis,
-                                            locale,
-                                            0,
-                                            0,
-                                            0,
-                                            0,
-                                            max_glyph_indices_count,
-                                            cluster_map,
-                                            text_props,
-                                            glyph_indices,
-                                            glyph_props,
-                                            &actual_glyph_count);
-
-              if(hr == HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER) && ++retry < 8)
-              {
-                // TODO(hampus): Test this codepath.
-                max_glyph_indices_count *= 2;
-                glyph_indices = (uint16_t *)realloc(glyph_indices, max_glyph_indices_count * sizeof(uint16_t));
-                glyph_props = (DWRITE_SHAPING_GLYPH_PROPERTIES *)realloc(glyph_props, max_glyph_indices_count * sizeof(DWRITE_SHAPING_GLYPH_PROPERTIES));
-              }
-
-              ASSERT_HR(hr);
-              break;
-            }
-
-            glyph_array->count = actual_glyph_count;
-            glyph_array->indices = (uint16_t *)calloc(glyph_array->count, sizeof(uint16_t));
-            glyph_array->advances = (float *)calloc(glyph_array->count, sizeof(float));
-            glyph_array->offsets = (DWRITE_GLYPH_OFFSET *)calloc(glyph_array->count, sizeof(DWRITE_GLYPH_OFFSET));
-
-            memory_copy_typed(glyph_array->indices, glyph_indices, actual_glyph_count);
-
-            hr = text_analyzer->GetGlyphPlacements(fallback_ptr + analysis_result.text_position,
-                                                   cluster_map,
-                                                   text_props,
-                                                   analysis_result.text_length,
-                                                   glyph_array->indices,
-                                                   glyph_props,
-                                                   actual_glyph_count,
-                                                   mapping->font_face,
-                                                   font_size,
-                                                   false,
-                                                   is_right_to_left,
-                                                   &analysis_result.analysis,
-                                                   locale,
-                                                   0,
-                                                   0,
-                                                   0,
-                                                   glyph_array->advances,
-                                                   glyph_array->offsets);
-            ASSERT_HR(hr);
-
-            free(text_props);
-            free(cluster_map);
-
-            last_glyph_array_chunk->total_glyph_count += glyph_array->count;
-          }
-        }
-
-        free(glyph_props);
-      }
+static IDWriteFontFace5 *
+dwrite_font_face_from_segment(const MapTextToGlyphsResult *result, const TextToGlyphsSegment *segment)
+{
+  return dwrite_font_face_from_shaping_font_face(shaping_font_face_from_segment(result, segment));
+}
 
-      free(glyph_indices);
+static DWRITE_GLYPH_RUN
+dwrite_glyph_run_from_segment(const MapTextToGlyphsResult *result, const TextToGlyphsSegment *segment)
+{
+  DWRITE_GLYPH_RUN glyph_run = {};
+  glyph_run.fontFace = dwrite_font_face_from_segment(result, segment);
+  glyph_run.fontEmSize = segment->font_size_em;
+  glyph_run.glyphCount = (UINT32)segment->glyph_count;
+  glyph_run.glyphIndices = result->glyph_indices + segment->first_glyph;
+  glyph_run.glyphAdvances = result->glyph_advances + segment->first_glyph;
+  glyph_run.glyphOffsets = (const DWRITE_GLYPH_OFFSET *)(result->glyph_offsets + segment->first_glyph);
+  glyph_run.bidiLevel = segment->bidi_level;
+  return glyph_run;
+}
 
-      fallback_ptr += complex_mapped_length;
-    }
+static bool
+dwrite_font_file_path_from_font_face(IDWriteFontFace *font_face, wchar_t *path, uint32_t capacity)
+{
+  // NOTE(hampus): Only works for fonts loaded from a file on disk, which
+  // includes the system fonts. Returns false for the rest, e.g. fonts loaded
+  // from memory, or if the path doesn't fit.
+  HRESULT hr = 0;
+  UINT32 file_count = 1;
+  IDWriteFontFile *font_file = 0;
+  hr = font_face->GetFiles(&file_count, &font_file);
+  if(FAILED(hr) || font_file == 0)
+  {
+    return false;
+  }
 
-    //----------------------------------------------------------
-    // hampus: convert our list of glyph arrays into one big array
+  const void *reference_key = 0;
+  UINT32 reference_key_size = 0;
+  IDWriteFontFileLoader *loader = 0;
+  IDWriteLocalFontFileLoader *local_loader = 0;
+  hr = font_file->GetReferenceKey(&reference_key, &reference_key_size);
+  if(SUCCEEDED(hr))
+  {
+    hr = font_file->GetLoader(&loader);
+  }
+  if(SUCCEEDED(hr))
+  {
+    hr = loader->QueryInterface(&local_loader);
+  }
 
-    fill_segment_with_glyph_array_chunks(segment, first_glyph_array_chunk, last_glyph_array_chunk);
+  UINT32 path_length = 0;
+  if(SUCCEEDED(hr))
+  {
+    hr = local_loader->GetFilePathLengthFromKey(reference_key, reference_key_size, &path_length);
   }
+  bool result = SUCCEEDED(hr) && path_length < capacity;
+  if(result)
+  {
+    result = SUCCEEDED(local_loader->GetFilePathFromKey(reference_key, reference_key_size, path, path_length + 1));
+  }
+
+  if(local_loader != 0)
+  {
+    local_loader->Release();
+  }
+  if(loader != 0)
+  {
+    loader->Release();
+  }
+  font_file->Release();
+  return result;
+}
+
+////////////////////////////////////////////////////////////
+// hampus: map text to glyphs
+
+// NOTE(hampus): The DirectWrite versions of the core entry points in
+// text_to_glyphs.h. Results refer to their fonts through the backend's
+// registry, so font IDs can be compared between results from the same
+// backend.
+
+static MapTextToGlyphsResult
+dwrite_map_text_to_glyphs_with_scratch(Arena *arena, Arena *scratch, DWriteShapingBackend *dwrite_backend, const wchar_t *locale, const wchar_t *base_family, const float font_size, const wchar_t *text, const uint32_t text_length, ShapingCaches *caches, uint32_t flags)
+{
+  ShapingBackend backend = dwrite_shaping_backend(dwrite_backend);
+  return map_text_to_glyphs_with_scratch(arena, scratch, &backend, locale, base_family, font_size, text, text_length, caches, flags);
+}
+
+static MapTextToGlyphsResult
+dwrite_map_text_to_glyphs(DWriteShapingBackend *dwrite_backend, const wchar_t *locale, const wchar_t *base_family, const float font_size, const wchar_t *text, const uint32_t text_length, ShapingCaches *caches = 0, uint32_t flags = 0, ShapingContext *context = 0)
+{
+  ShapingBackend backend = dwrite_shaping_backend(dwrite_backend);
+  return map_text_to_glyphs(&backend, locale, base_family, font_size, text, text_length, caches, flags, context);
+}
+
+static MapTextToGlyphsResult
+dwrite_map_utf8_text_to_glyphs(DWriteShapingBackend *dwrite_backend, const wchar_t *locale, const wchar_t *base_family, const float font_size, const char *text, const uint32_t text_size, ShapingCaches *caches = 0, uint32_t flags = 0, ShapingContext *context = 0)
+{
+  ShapingBackend backend = dwrite_shaping_backend(dwrite_backend);
+  return map_utf8_text_to_glyphs(&backend, locale, base_family, font_size, text, text_size, caches, flags, context);
+}
+
+static void
+dwrite_remap_text_to_glyphs_after_edit(MapTextToGlyphsResult *result, DWriteShapingBackend *dwrite_backend, const wchar_t *locale, const wchar_t *base_family, const float font_size, const wchar_t *text, const uint32_t text_length, const TextEdit *edit, ShapingCaches *caches = 0, uint32_t flags = 0, ShapingContext *context = 0)
+{
+  ShapingBackend backend = dwrite_shaping_backend(dwrite_backend);
+  remap_text_to_glyphs_after_edit(result, &backend, locale, base_family, font_size, text, text_length, edit, caches, flags, context);
+}
+
+static void
+dwrite_map_text_stream_to_glyphs(DWriteShapingBackend *dwrite_backend, const wchar_t *locale, const wchar_t *base_family, const float font_size, TextStreamReadFunction *read, void *read_user_data, TextToGlyphsSegmentCallback *emit, void *emit_user_data, uint32_t window_capacity = 1 << 16, ShapingCaches *caches = 0, uint32_t flags = 0, ShapingContext *context = 0)
+{
+  ShapingBackend backend = dwrite_shaping_backend(dwrite_backend);
+  map_text_stream_to_glyphs(&backend, locale, base_family, font_size, read, read_user_data, emit, emit_user_data, window_capacity, caches, flags, context);
+}
+
+static void
+dwrite_map_text_to_glyphs_batch(ShapingThreadPool *pool, DWriteShapingBackend *dwrite_backend, const MapTextToGlyphsJob *jobs, const uint32_t job_count, MapTextToGlyphsResult *results)
+{
+  ShapingBackend backend = dwrite_shaping_backend(dwrite_backend);
+  map_text_to_glyphs_batch(pool, &backend, jobs, job_count, results);
+}
+
+//----------------------------------------------------------
+// hampus: entry points that take the DirectWrite objects
+
+// NOTE(hampus): The signatures the entry points had before there was a
+// DWriteShapingBackend. Each set of DirectWrite objects gets one backend the
+// first time it's used, so these calls share a font registry like calls
+// through an explicit backend do. The backends are never released, so the
+// DirectWrite objects must outlive every call that uses them.
+
+struct DWriteSharedShapingBackend
+{
+  DWriteSharedShapingBackend *next;
+  DWriteShapingBackend backend;
+};
+
+// NOTE(hampus): A zeroed SRWLOCK is an initialized one
+static OS_Mutex dwrite_shared_shaping_backends_mutex;
+static DWriteSharedShapingBackend *dwrite_first_shared_shaping_backend;
 
+static DWriteShapingBackend *
+dwrite_shared_shaping_backend(IDWriteFontFallback1 *font_fallback, IDWriteFontCollection *font_collection, IDWriteTextAnalyzer1 *text_analyzer)
+{
+  os_mutex_lock(&dwrite_shared_shaping_backends_mutex);
+  DWriteShapingBackend *result = 0;
+  for(DWriteSharedShapingBackend *shared = dwrite_first_shared_shaping_backend; shared != 0; shared = shared->next)
   {
-    MappedText *next_mapping = 0;
-    for(MappedText *mapping = first_mapping; mapping != 0; mapping = next_mapping)
+    if(shared->backend.font_fallback == font_fallback &&
+       shared->backend.font_collection == font_collection &&
+       shared->backend.text_analyzer == text_analyzer)
     {
-      next_mapping = mapping->next;
-      free(mapping);
+      result = &shared->backend;
+      break;
     }
   }
+  if(result == 0)
+  {
+    DWriteSharedShapingBackend *shared = (DWriteSharedShapingBackend *)memory_alloc_zero(sizeof(DWriteSharedShapingBackend));
+    dwrite_shaping_backend_init(&shared->backend, font_fallback, font_collection, text_analyzer);
+    shared->next = dwrite_first_shared_shaping_backend;
+    dwrite_first_shared_shaping_backend = shared;
+    result = &shared->backend;
+  }
+  os_mutex_unlock(&dwrite_shared_shaping_backends_mutex);
   return result;
 }
 
-#endif // DWRITE_TEXT_TO_GLYPHS_H
\ No newline at end of file
+static MapTextToGlyphsResult
+dwrite_map_text_to_glyphs_with_scratch(Arena *arena, Arena *scratch, IDWriteFontFallback1 *font_fallback, IDWriteFontCollection *font_collection, IDWriteTextAnalyzer1 *text_analyzer, const wchar_t *locale, const wchar_t *base_family, const float font_size, const wchar_t *text, const uint32_t text_length, ShapingCaches *caches, uint32_t flags)
+{
+  DWriteShapingBackend *dwrite_backend = dwrite_shared_shaping_backend(font_fallback, font_collection, text_analyzer);
+  return dwrite_map_text_to_glyphs_with_scratch(arena, scratch, dwrite_backend, locale, base_family, font_size, text, text_length, caches, flags);
+}
+
+static MapTextToGlyphsResult
+dwrite_map_text_to_glyphs(IDWriteFontFallback1 *font_fallback, IDWriteFontCollection *font_collection, IDWriteTextAnalyzer1 *text_analyzer, const wchar_t *locale, const wchar_t *base_family, const float font_size, const wchar_t *text, const uint32_t text_length, ShapingCaches *caches = 0, uint32_t flags = 0, ShapingContext *context = 0)
+{
+  DWriteShapingBackend *dwrite_backend = dwrite_shared_shaping_backend(font_fallback, font_collection, text_analyzer);
+  return dwrite_map_text_to_glyphs(dwrite_backend, locale, base_family, font_size, text, text_length, caches, flags, context);
+}
+
+static MapTextToGlyphsResult
+dwrite_map_utf8_text_to_glyphs(IDWriteFontFallback1 *font_fallback, IDWriteFontCollection *font_collection, IDWriteTextAnalyzer1 *text_analyzer, const wchar_t *locale, const wchar_t *base_family, const float font_size, const char *text, const uint32_t text_size, ShapingCaches *caches = 0, uint32_t flags = 0, ShapingContext *context = 0)
+{
+  DWriteShapingBackend *dwrite_backend = dwrite_shared_shaping_backend(font_fallback, font_collection, text_analyzer);
+  return dwrite_map_utf8_text_to_glyphs(dwrite_backend, locale, base_family, font_size, text, text_size, caches, flags, context);
+}
+
+static void
+dwrite_remap_text_to_glyphs_after_edit(MapTextToGlyphsResult *result, IDWriteFontFallback1 *font_fallback, IDWriteFontCollection *font_collection, IDWriteTextAnalyzer1 *text_analyzer, const wchar_t *locale, const wchar_t *base_family, const float font_size, const wchar_t *text, const uint32_t text_length, const TextEdit *edit, ShapingCaches *caches = 0, uint32_t flags = 0, ShapingContext *context = 0)
+{
+  DWriteShapingBackend *dwrite_backend = dwrite_shared_shaping_backend(font_fallback, font_collection, text_analyzer);
+  dwrite_remap_text_to_glyphs_after_edit(result, dwrite_backend, locale, base_family, font_size, text, text_length, edit, caches, flags, context);
+}
+
+static void
+dwrite_map_text_stream_to_glyphs(IDWriteFontFallback1 *font_fallback, IDWriteFontCollection *font_collection, IDWriteTextAnalyzer1 *text_analyzer, const wchar_t *locale, const wchar_t *base_family, const float font_size, TextStreamReadFunction *read, void *read_user_data, TextToGlyphsSegmentCallback *emit, void *emit_user_data, uint32_t window_capacity = 1 << 16, ShapingCaches *caches = 0, uint32_t flags = 0, ShapingContext *context = 0)
+{
+  DWriteShapingBackend *dwrite_backend = dwrite_shared_shaping_backend(font_fallback, font_collection, text_analyzer);
+  dwrite_map_text_stream_to_glyphs(dwrite_backend, locale, base_family, font_size, read, read_user_data, emit, emit_user_data, window_capacity, caches, flags, context);
+}
+
+static void
+dwrite_map_text_to_glyphs_batch(ShapingThreadPool *pool, IDWriteFontFallback1 *font_fallback, IDWriteFontCollection *font_collection, IDWriteTextAnalyzer1 *text_analyzer, const MapTextToGlyphsJob *jobs, const uint32_t job_count, MapTextToGlyphsResult *results)
+{
+  DWriteShapingBackend *dwrite_backend = dwrite_shared_shaping_backend(font_fallback, font_collection, text_analyzer);
+  dwrite_map_text_to_glyphs_batch(pool, dwrite_backend, jobs, job_count, results);
+}
+
+#endif // DWRITE_TEXT_TO_GLYPHS_H
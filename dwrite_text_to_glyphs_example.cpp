@@ -5,7 +5,7 @@
 
 #pragma comment(lib, "dwrite.lib")
 
-#include "dwrite_text_to_glyphs.h"
+#include "dwrite_shaping_disk_cache.h"
 
 int APIENTRY
 WinMain(HINSTANCE instance, HINSTANCE prev_instance, PSTR command_line, int show_code)
@@ -59,7 +59,27 @@ WinMain(HINSTANCE instance, HINSTANCE prev_instance, PSTR command_line, int show
     memcpy(&locale[0], L"en-US", sizeof(L"en-US"));
   }
 
-  MapTextToGlyphsResult map_text_to_glyphs_result = dwrite_map_text_to_glyphs(font_fallback1, font_collection, text_analyzer1, &locale[0], L"Fira Code", 16.0f, L"Hello->world", wcslen(L"Hello->world"));
+  DWriteShapingBackend dwrite_backend = {};
+  dwrite_shaping_backend_init(&dwrite_backend, font_fallback1, font_collection, text_analyzer1);
+
+  MapTextToGlyphsResult map_text_to_glyphs_result = dwrite_map_text_to_glyphs(&dwrite_backend, &locale[0], L"Fira Code", 16.0f, L"Hello->world", wcslen(L"Hello->world"));
+
+  free_map_text_to_glyphs_result(&map_text_to_glyphs_result);
+
+  //----------------------------------------------------------
+  // hampus: shape through a disk cache
+
+  // NOTE(hampus): The second time the example runs, the text comes from the file
+  ShapingBackend backend = dwrite_shaping_backend(&dwrite_backend);
+  DWriteFontFiles font_files = {};
+  font_files.factory = dwrite_factory;
+  ShapingDiskCache *disk_cache = shaping_disk_cache_open("dwrite_example.shaping_cache", &backend, &dwrite_font_file_functions, &font_files);
+  MapTextToGlyphsResult cached_result = map_text_to_glyphs_with_disk_cache(disk_cache, &backend, &locale[0], L"Fira Code", 16.0f, L"Hello->world", wcslen(L"Hello->world"));
+  free_map_text_to_glyphs_result(&cached_result);
+  shaping_disk_cache_save(disk_cache);
+  shaping_disk_cache_close(disk_cache);
+
+  dwrite_shaping_backend_release(&dwrite_backend);
 
   return 0;
 }
\ No newline at end of file
@@ -0,0 +1,155 @@
+#ifndef FRAME_SCHEDULER_H
+#define FRAME_SCHEDULER_H
+
+#include <stdint.h>
+
+////////////////////////////////////////////////////////////
+// hampus: frame scheduler
+
+// NOTE(hampus): Decides when a frame has to be drawn, instead of drawing on
+// every vsync. Whatever changes the picture invalidates the scheduler, and
+// frame_scheduler_next() only asks for a frame when something is invalid.
+// Otherwise the host should block on its event queue until something
+// happens, so a screen of static text costs nothing.
+//
+// While the window is occluded, frames are held back, and the host is asked
+// now and then to test whether presenting would succeed again.
+//
+// The scheduler doesn't know about windows, swap chains or clocks. The host
+// passes in the time and reports how presenting went, so it can be driven by
+// a fake clock and a fake presenter as well.
+
+enum FrameInvalidationFlags
+{
+  FrameInvalidation_Text = (1 << 0),
+  FrameInvalidation_Layout = (1 << 1),
+  FrameInvalidation_Size = (1 << 2),
+  FrameInvalidation_Dpi = (1 << 3),
+
+  // NOTE(hampus): The window system lost what was presented, e.g. WM_PAINT
+  FrameInvalidation_Expose = (1 << 4),
+};
+
+enum FrameSchedulerAction
+{
+  // NOTE(hampus): Block until an event arrives or the timeout runs out
+  FrameSchedulerAction_Wait,
+
+  // NOTE(hampus): Draw and present a frame, then call
+  // frame_scheduler_frame_presented()
+  FrameSchedulerAction_Draw,
+
+  // NOTE(hampus): Test whether the window is still occluded without drawing,
+  // then call frame_scheduler_occlusion_tested()
+  FrameSchedulerAction_TestOcclusion,
+};
+
+#define FRAME_SCHEDULER_WAIT_FOREVER UINT64_MAX
+
+struct FrameSchedulerStats
+{
+  uint64_t frame_count;
+  uint64_t occluded_frame_count;
+  uint64_t occlusion_test_count;
+  uint64_t wait_count;
+};
+
+struct FrameScheduler
+{
+  uint32_t invalidation_flags;
+
+  // NOTE(hampus): The flags of the frame being drawn, which are put back if
+  // the frame couldn't be presented.
+  uint32_t drawing_flags;
+
+  bool is_occluded;
+  uint64_t occlusion_test_interval_ns;
+  uint64_t next_occlusion_test_ns;
+
+  FrameSchedulerStats stats;
+};
+
+static FrameScheduler
+frame_scheduler_make(uint64_t occlusion_test_interval_ns)
+{
+  // NOTE(hampus): Starts out invalid, to draw the first frame
+  FrameScheduler scheduler = {};
+  scheduler.invalidation_flags = FrameInvalidation_Text | FrameInvalidation_Layout | FrameInvalidation_Size | FrameInvalidation_Dpi;
+  scheduler.occlusion_test_interval_ns = occlusion_test_interval_ns;
+  return scheduler;
+}
+
+static void
+frame_scheduler_invalidate(FrameScheduler *scheduler, uint32_t flags)
+{
+  scheduler->invalidation_flags |= flags;
+}
+
+static FrameSchedulerAction
+frame_scheduler_next(FrameScheduler *scheduler, uint64_t now_ns, uint32_t *flags, uint64_t *timeout_ns)
+{
+  // NOTE(hampus): For Draw, `flags` says what changed since the last frame
+  // that made it to the screen. For Wait, `timeout_ns` says how long to
+  // block, or FRAME_SCHEDULER_WAIT_FOREVER.
+  FrameSchedulerAction action = FrameSchedulerAction_Wait;
+  *flags = 0;
+  *timeout_ns = FRAME_SCHEDULER_WAIT_FOREVER;
+
+  if(scheduler->is_occluded)
+  {
+    if(now_ns >= scheduler->next_occlusion_test_ns)
+    {
+      action = FrameSchedulerAction_TestOcclusion;
+      scheduler->stats.occlusion_test_count += 1;
+    }
+    else
+    {
+      *timeout_ns = scheduler->next_occlusion_test_ns - now_ns;
+    }
+  }
+  else if(scheduler->invalidation_flags != 0)
+  {
+    action = FrameSchedulerAction_Draw;
+    *flags = scheduler->invalidation_flags;
+    scheduler->drawing_flags = scheduler->invalidation_flags;
+    scheduler->invalidation_flags = 0;
+    scheduler->stats.frame_count += 1;
+  }
+
+  if(action == FrameSchedulerAction_Wait)
+  {
+    scheduler->stats.wait_count += 1;
+  }
+  return action;
+}
+
+static void
+frame_scheduler_frame_presented(FrameScheduler *scheduler, uint64_t now_ns, bool was_occluded)
+{
+  if(was_occluded)
+  {
+    // NOTE(hampus): Nobody saw the frame, so it still has to be drawn once
+    // the window shows up again.
+    scheduler->invalidation_flags |= scheduler->drawing_flags;
+    scheduler->is_occluded = true;
+    scheduler->next_occlusion_test_ns = now_ns + scheduler->occlusion_test_interval_ns;
+    scheduler->stats.occluded_frame_count += 1;
+  }
+  scheduler->drawing_flags = 0;
+}
+
+static void
+frame_scheduler_occlusion_tested(FrameScheduler *scheduler, uint64_t now_ns, bool is_occluded)
+{
+  scheduler->is_occluded = is_occluded;
+  if(is_occluded)
+  {
+    scheduler->next_occlusion_test_ns = now_ns + scheduler->occlusion_test_interval_ns;
+  }
+  else
+  {
+    scheduler->invalidation_flags |= FrameInvalidation_Expose;
+  }
+}
+
+#endif // FRAME_SCHEDULER_H
@@ -0,0 +1,48 @@
+#ifndef FREETYPE_SHAPING_DISK_CACHE_H
+#define FREETYPE_SHAPING_DISK_CACHE_H
+
+#include "freetype_text_to_glyphs.h"
+#include "shaping_disk_cache.h"
+
+////////////////////////////////////////////////////////////
+// hampus: freetype font files
+
+// NOTE(hampus): The ShapingFontFileFunctions for the disk cache. Every face
+// the backend loads comes from a file that fontconfig named, so all results
+// can be cached, and faces are found again by path and face index.
+// user_data is the backend.
+
+static bool
+freetype_font_file_from_face(void *user_data, Arena *arena, ShapingFontFace *font_face, ShapingFontFile *file)
+{
+  FreeTypeFontFace *freetype_font_face = freetype_font_face_from_shaping_font_face(font_face);
+  uint64_t path_size = strlen(freetype_font_face->file_path) + 1;
+  file->path = push_array_no_zero(arena, char, path_size);
+  memory_copy(file->path, freetype_font_face->file_path, path_size);
+  file->face_index = (uint32_t)freetype_font_face->face_index;
+  file->simulations = 0;
+  return true;
+}
+
+static ShapingFontFace *
+freetype_font_face_from_file(void *user_data, const ShapingFontFile *file)
+{
+  FreeTypeShapingBackend *backend = (FreeTypeShapingBackend *)user_data;
+  os_mutex_lock(&backend->mutex);
+  FreeTypeFontFace *result = freetype_font_face_from_path(backend, file->path, (int)file->face_index);
+  if(result != 0)
+  {
+    freetype_add_ref_font_face((ShapingFontFace *)result);
+  }
+  os_mutex_unlock(&backend->mutex);
+  return (ShapingFontFace *)result;
+}
+
+static const ShapingFontFileFunctions freetype_font_file_functions =
+{
+  freetype_font_file_from_face,
+  shaping_font_file_version_from_disk,
+  freetype_font_face_from_file,
+};
+
+#endif // FREETYPE_SHAPING_DISK_CACHE_H
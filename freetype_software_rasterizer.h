@@ -0,0 +1,156 @@
+#ifndef FREETYPE_SOFTWARE_RASTERIZER_H
+#define FREETYPE_SOFTWARE_RASTERIZER_H
+
+#include "freetype_text_to_glyphs.h"
+#include "software_rasterizer.h"
+
+#include FT_OUTLINE_H
+
+////////////////////////////////////////////////////////////
+// hampus: freetype glyph outlines
+
+// NOTE(hampus): A GlyphOutlineFunction for the faces of the FreeType
+// backend. The outline is loaded unscaled and unhinted, so the face's size
+// is left alone, and the curves are flattened into more lines the further
+// they bend away from their chord, up to 16 per curve.
+
+struct FreeTypeOutlineContext
+{
+  float scale;
+  float last_x;
+  float last_y;
+
+  // NOTE(hampus): lines is 0 while counting
+  uint32_t line_count;
+  GlyphOutlineLine *lines;
+};
+
+static void
+freetype_outline_push_line(FreeTypeOutlineContext *context, float x, float y)
+{
+  if(context->lines != 0)
+  {
+    GlyphOutlineLine *line = &context->lines[context->line_count];
+    line->x0 = context->last_x;
+    line->y0 = context->last_y;
+    line->x1 = x;
+    line->y1 = y;
+  }
+  context->line_count += 1;
+  context->last_x = x;
+  context->last_y = y;
+}
+
+static uint32_t
+freetype_outline_segment_count(float x0, float y0, float x1, float y1, float x2, float y2)
+{
+  float control_dx = x1 - (x0 + x2) * 0.5f;
+  float control_dy = y1 - (y0 + y2) * 0.5f;
+  float deviation = control_dx * control_dx + control_dy * control_dy;
+  uint32_t count = 1 + (uint32_t)(deviation * 0.25f);
+  return count < 16 ? count : 16;
+}
+
+static int
+freetype_outline_move_to(const FT_Vector *to, void *user)
+{
+  FreeTypeOutlineContext *context = (FreeTypeOutlineContext *)user;
+  context->last_x = (float)to->x * context->scale;
+  context->last_y = -(float)to->y * context->scale;
+  return 0;
+}
+
+static int
+freetype_outline_line_to(const FT_Vector *to, void *user)
+{
+  FreeTypeOutlineContext *context = (FreeTypeOutlineContext *)user;
+  freetype_outline_push_line(context, (float)to->x * context->scale, -(float)to->y * context->scale);
+  return 0;
+}
+
+static int
+freetype_outline_conic_to(const FT_Vector *control, const FT_Vector *to, void *user)
+{
+  FreeTypeOutlineContext *context = (FreeTypeOutlineContext *)user;
+  float x0 = context->last_x;
+  float y0 = context->last_y;
+  float x1 = (float)control->x * context->scale;
+  float y1 = -(float)control->y * context->scale;
+  float x2 = (float)to->x * context->scale;
+  float y2 = -(float)to->y * context->scale;
+  uint32_t segment_count = freetype_outline_segment_count(x0, y0, x1, y1, x2, y2);
+  for(uint32_t segment_idx = 1; segment_idx <= segment_count; ++segment_idx)
+  {
+    float t = (float)segment_idx / (float)segment_count;
+    float u = 1.0f - t;
+    freetype_outline_push_line(context,
+                               u * u * x0 + 2 * u * t * x1 + t * t * x2,
+                               u * u * y0 + 2 * u * t * y1 + t * t * y2);
+  }
+  return 0;
+}
+
+static int
+freetype_outline_cubic_to(const FT_Vector *control0, const FT_Vector *control1, const FT_Vector *to, void *user)
+{
+  FreeTypeOutlineContext *context = (FreeTypeOutlineContext *)user;
+  float x0 = context->last_x;
+  float y0 = context->last_y;
+  float x1 = (float)control0->x * context->scale;
+  float y1 = -(float)control0->y * context->scale;
+  float x2 = (float)control1->x * context->scale;
+  float y2 = -(float)control1->y * context->scale;
+  float x3 = (float)to->x * context->scale;
+  float y3 = -(float)to->y * context->scale;
+  uint32_t segment_count = freetype_outline_segment_count(x0, y0, (x1 + x2) * 0.5f, (y1 + y2) * 0.5f, x3, y3);
+  for(uint32_t segment_idx = 1; segment_idx <= segment_count; ++segment_idx)
+  {
+    float t = (float)segment_idx / (float)segment_count;
+    float u = 1.0f - t;
+    freetype_outline_push_line(context,
+                               u * u * u * x0 + 3 * u * u * t * x1 + 3 * u * t * t * x2 + t * t * t * x3,
+                               u * u * u * y0 + 3 * u * u * t * y1 + 3 * u * t * t * y2 + t * t * t * y3);
+  }
+  return 0;
+}
+
+static bool
+freetype_glyph_outline(void *user_data, Arena *arena, ShapingFontFace *shaping_font_face, float em_size, uint16_t glyph_index, GlyphOutlineLine **lines, uint32_t *line_count)
+{
+  // NOTE(hampus): The glyph slot belongs to the face, so it's only used
+  // with the face's lock held.
+  FreeTypeFontFace *font_face = freetype_font_face_from_shaping_font_face(shaping_font_face);
+  FT_Face ft_face = font_face->ft_face;
+  os_mutex_lock(&font_face->mutex);
+
+  bool result = false;
+  FT_Error error = FT_Load_Glyph(ft_face, glyph_index, FT_LOAD_NO_SCALE | FT_LOAD_NO_HINTING | FT_LOAD_NO_BITMAP);
+  if(error == 0 && ft_face->glyph->format == FT_GLYPH_FORMAT_OUTLINE)
+  {
+    FT_Outline_Funcs funcs = {};
+    funcs.move_to = freetype_outline_move_to;
+    funcs.line_to = freetype_outline_line_to;
+    funcs.conic_to = freetype_outline_conic_to;
+    funcs.cubic_to = freetype_outline_cubic_to;
+
+    // NOTE(hampus): Decompose once to count the lines and once to store
+    // them. FreeType closes every contour with a line back to its start.
+    FreeTypeOutlineContext context = {};
+    context.scale = em_size / (float)font_face->design_units_per_em;
+    FT_Outline_Decompose(&ft_face->glyph->outline, &funcs, &context);
+    if(context.line_count != 0)
+    {
+      context.lines = push_array_no_zero(arena, GlyphOutlineLine, context.line_count);
+      context.line_count = 0;
+      FT_Outline_Decompose(&ft_face->glyph->outline, &funcs, &context);
+      *lines = context.lines;
+      *line_count = context.line_count;
+      result = true;
+    }
+  }
+
+  os_mutex_unlock(&font_face->mutex);
+  return result;
+}
+
+#endif // FREETYPE_SOFTWARE_RASTERIZER_H
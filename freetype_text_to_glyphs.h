@@ -0,0 +1,1618 @@
+#ifndef FREETYPE_TEXT_TO_GLYPHS_H
+#define FREETYPE_TEXT_TO_GLYPHS_H
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include FT_TRUETYPE_TAGS_H
+#include FT_TRUETYPE_TABLES_H
+#include FT_ADVANCES_H
+#include <fontconfig/fontconfig.h>
+
+#include "text_to_glyphs.h"
+
+////////////////////////////////////////////////////////////
+// hampus: freetype shaping backend
+
+// NOTE(hampus): Finds fonts and fallback fonts with fontconfig, loads them
+// with FreeType, and produces the same segments and glyphs as the DirectWrite
+// backend for the scripts it knows. All values are in the same units as
+// DirectWrite, so font_size is the em size and advances come out in the same
+// space as the font size.
+//
+// There is no HarfBuzz here, so the backend shapes by itself, without the
+// font's GSUB and GPOS tables:
+//
+// - One glyph per codepoint from the cmap, with advances from hmtx and pairs
+//   kerned with the legacy kern table.
+// - Arabic letters join through the presentation forms in the cmap, and lam
+//   alef becomes the ligature from the presentation forms too.
+// - Combining marks join the cluster of the character before them and sit
+//   on it where the font draws them, without mark positioning.
+// - Right to left runs mirror brackets, and default ignorables become a
+//   space glyph with no advance, like HarfBuzz does by default.
+// - Bidi levels come from the Unicode bidi algorithm, for a left-to-right
+//   paragraph like the DirectWrite backend. Bidi classes and scripts are
+//   taken from the Unicode blocks, which gets the common ones right.
+//
+// Scripts that need reordering or conjuncts, like the Indic scripts, come out
+// as their nominal glyphs. Text is simple when none of the above changes it,
+// i.e. it maps to a glyph of its own that isn't in any kerning pair.
+//
+// Fonts are loaded once per file and kept by the backend until it is
+// released. Results and caches hold their own references, so they can
+// outlive the backend. Each font face has its own FreeType library so it
+// can be used and freed from any thread.
+
+struct FreeTypeKernPair
+{
+  // NOTE(hampus): Left glyph in the high half, right glyph in the low half
+  uint32_t glyph_pair;
+  int32_t value;
+};
+
+struct FreeTypeFontFace
+{
+  FreeTypeFontFace *next;
+  volatile int32_t reference_count;
+
+  char *file_path;
+  int face_index;
+
+  uint16_t design_units_per_em;
+  uint32_t glyph_count;
+
+  // NOTE(hampus): Read once when the face is loaded, so advances and
+  // kerning don't need FreeType or the lock while shaping.
+  int32_t *design_advances;
+  FreeTypeKernPair *kern_pairs;
+  uint32_t kern_pair_count;
+  uint8_t *kerned_glyphs;
+
+  // NOTE(hampus): FreeType faces are not thread safe, so every use of
+  // ft_face after loading takes the lock.
+  OS_Mutex mutex;
+  FT_Library ft_library;
+  FT_Face ft_face;
+};
+
+struct FreeTypeFontFamily
+{
+  FreeTypeFontFamily *next;
+  utf16_char *base_family;
+  utf16_char *locale;
+
+  // NOTE(hampus): Every font that could be used for this family in
+  // fallback order, the family itself first. Faces are loaded the first
+  // time they are picked.
+  FcFontSet *font_set;
+  FreeTypeFontFace **font_faces;
+};
+
+struct FreeTypeShapingBackend
+{
+  // NOTE(hampus): Guards the families and the list of loaded faces. Shaping
+  // itself doesn't touch either, so it runs without taking the lock.
+  OS_Mutex mutex;
+  FcConfig *config;
+  FreeTypeFontFace *first_font_face;
+  FreeTypeFontFamily *first_family;
+
+  ShapingFontRegistry *font_registry;
+};
+
+static void
+freetype_utf8_from_utf16(char *buffer, uint64_t capacity, const utf16_char *string)
+{
+  // NOTE(hampus): For family and locale names, which are short.
+  uint64_t length = 0;
+  uint64_t string_length = utf16_length(string);
+  for(uint64_t idx = 0; idx < string_length;)
+  {
+    uint32_t codepoint = 0;
+    idx += decode_utf16(string + idx, (uint32_t)(string_length - idx), &codepoint);
+    uint8_t bytes[4];
+    uint32_t byte_count = 0;
+    if(codepoint < 0x80)
+    {
+      bytes[byte_count++] = (uint8_t)codepoint;
+    }
+    else if(codepoint < 0x800)
+    {
+      bytes[byte_count++] = (uint8_t)(0xC0 | (codepoint >> 6));
+      bytes[byte_count++] = (uint8_t)(0x80 | (codepoint & 0x3F));
+    }
+    else if(codepoint < 0x10000)
+    {
+      bytes[byte_count++] = (uint8_t)(0xE0 | (codepoint >> 12));
+      bytes[byte_count++] = (uint8_t)(0x80 | ((codepoint >> 6) & 0x3F));
+      bytes[byte_count++] = (uint8_t)(0x80 | (codepoint & 0x3F));
+    }
+    else
+    {
+      bytes[byte_count++] = (uint8_t)(0xF0 | (codepoint >> 18));
+      bytes[byte_count++] = (uint8_t)(0x80 | ((codepoint >> 12) & 0x3F));
+      bytes[byte_count++] = (uint8_t)(0x80 | ((codepoint >> 6) & 0x3F));
+      bytes[byte_count++] = (uint8_t)(0x80 | (codepoint & 0x3F));
+    }
+    ASSERT(length + byte_count < capacity);
+    memory_copy(buffer + length, bytes, byte_count);
+    length += byte_count;
+  }
+  buffer[length] = 0;
+}
+
+//----------------------------------------------------------
+// hampus: unicode properties
+
+// NOTE(hampus): Scripts by Unicode block. Everything that isn't in one of
+// the blocks below counts as Common.
+enum FreeTypeScript
+{
+  FreeTypeScript_Common,
+  FreeTypeScript_Latin,
+  FreeTypeScript_Greek,
+  FreeTypeScript_Cyrillic,
+  FreeTypeScript_Armenian,
+  FreeTypeScript_Hebrew,
+  FreeTypeScript_Arabic,
+  FreeTypeScript_Syriac,
+  FreeTypeScript_Thaana,
+  FreeTypeScript_NKo,
+  FreeTypeScript_Devanagari,
+  FreeTypeScript_Bengali,
+  FreeTypeScript_Gurmukhi,
+  FreeTypeScript_Gujarati,
+  FreeTypeScript_Oriya,
+  FreeTypeScript_Tamil,
+  FreeTypeScript_Telugu,
+  FreeTypeScript_Kannada,
+  FreeTypeScript_Malayalam,
+  FreeTypeScript_Sinhala,
+  FreeTypeScript_Thai,
+  FreeTypeScript_Lao,
+  FreeTypeScript_Tibetan,
+  FreeTypeScript_Myanmar,
+  FreeTypeScript_Georgian,
+  FreeTypeScript_Hangul,
+  FreeTypeScript_Ethiopic,
+  FreeTypeScript_Khmer,
+  FreeTypeScript_Mongolian,
+  FreeTypeScript_Hiragana,
+  FreeTypeScript_Katakana,
+  FreeTypeScript_Bopomofo,
+  FreeTypeScript_Han,
+};
+
+struct FreeTypeScriptRange
+{
+  uint32_t first;
+  uint32_t last;
+  FreeTypeScript script;
+};
+
+// NOTE(hampus): Sorted, for a binary search
+static const FreeTypeScriptRange freetype_script_ranges[] =
+{
+  {0x0041, 0x005A, FreeTypeScript_Latin},
+  {0x0061, 0x007A, FreeTypeScript_Latin},
+  {0x00AA, 0x00AA, FreeTypeScript_Latin},
+  {0x00BA, 0x00BA, FreeTypeScript_Latin},
+  {0x00C0, 0x00D6, FreeTypeScript_Latin},
+  {0x00D8, 0x00F6, FreeTypeScript_Latin},
+  {0x00F8, 0x02AF, FreeTypeScript_Latin},
+  {0x0370, 0x03FF, FreeTypeScript_Greek},
+  {0x0400, 0x052F, FreeTypeScript_Cyrillic},
+  {0x0530, 0x058F, FreeTypeScript_Armenian},
+  {0x0590, 0x05FF, FreeTypeScript_Hebrew},
+  {0x0600, 0x06FF, FreeTypeScript_Arabic},
+  {0x0700, 0x074F, FreeTypeScript_Syriac},
+  {0x0750, 0x077F, FreeTypeScript_Arabic},
+  {0x0780, 0x07BF, FreeTypeScript_Thaana},
+  {0x07C0, 0x07FF, FreeTypeScript_NKo},
+  {0x08A0, 0x08FF, FreeTypeScript_Arabic},
+  {0x0900, 0x097F, FreeTypeScript_Devanagari},
+  {0x0980, 0x09FF, FreeTypeScript_Bengali},
+  {0x0A00, 0x0A7F, FreeTypeScript_Gurmukhi},
+  {0x0A80, 0x0AFF, FreeTypeScript_Gujarati},
+  {0x0B00, 0x0B7F, FreeTypeScript_Oriya},
+  {0x0B80, 0x0BFF, FreeTypeScript_Tamil},
+  {0x0C00, 0x0C7F, FreeTypeScript_Telugu},
+  {0x0C80, 0x0CFF, FreeTypeScript_Kannada},
+  {0x0D00, 0x0D7F, FreeTypeScript_Malayalam},
+  {0x0D80, 0x0DFF, FreeTypeScript_Sinhala},
+  {0x0E00, 0x0E7F, FreeTypeScript_Thai},
+  {0x0E80, 0x0EFF, FreeTypeScript_Lao},
+  {0x0F00, 0x0FFF, FreeTypeScript_Tibetan},
+  {0x1000, 0x109F, FreeTypeScript_Myanmar},
+  {0x10A0, 0x10FF, FreeTypeScript_Georgian},
+  {0x1100, 0x11FF, FreeTypeScript_Hangul},
+  {0x1200, 0x139F, FreeTypeScript_Ethiopic},
+  {0x1780, 0x17FF, FreeTypeScript_Khmer},
+  {0x1800, 0x18AF, FreeTypeScript_Mongolian},
+  {0x1E00, 0x1EFF, FreeTypeScript_Latin},
+  {0x1F00, 0x1FFF, FreeTypeScript_Greek},
+  {0x2C60, 0x2C7F, FreeTypeScript_Latin},
+  {0x2D00, 0x2D2F, FreeTypeScript_Georgian},
+  {0x2DE0, 0x2DFF, FreeTypeScript_Cyrillic},
+  {0x2E80, 0x2FDF, FreeTypeScript_Han},
+  {0x3005, 0x3007, FreeTypeScript_Han},
+  {0x3041, 0x3098, FreeTypeScript_Hiragana},
+  {0x309D, 0x309F, FreeTypeScript_Hiragana},
+  {0x30A0, 0x30FA, FreeTypeScript_Katakana},
+  {0x30FD, 0x30FF, FreeTypeScript_Katakana},
+  {0x3100, 0x312F, FreeTypeScript_Bopomofo},
+  {0x3130, 0x318F, FreeTypeScript_Hangul},
+  {0x31A0, 0x31BF, FreeTypeScript_Bopomofo},
+  {0x31F0, 0x31FF, FreeTypeScript_Katakana},
+  {0x3400, 0x4DBF, FreeTypeScript_Han},
+  {0x4E00, 0x9FFF, FreeTypeScript_Han},
+  {0xA640, 0xA69F, FreeTypeScript_Cyrillic},
+  {0xA720, 0xA7FF, FreeTypeScript_Latin},
+  {0xA960, 0xA97F, FreeTypeScript_Hangul},
+  {0xAB30, 0xAB6F, FreeTypeScript_Latin},
+  {0xAC00, 0xD7FF, FreeTypeScript_Hangul},
+  {0xF900, 0xFAFF, FreeTypeScript_Han},
+  {0xFB00, 0xFB06, FreeTypeScript_Latin},
+  {0xFB13, 0xFB17, FreeTypeScript_Armenian},
+  {0xFB1D, 0xFB4F, FreeTypeScript_Hebrew},
+  {0xFB50, 0xFDFF, FreeTypeScript_Arabic},
+  {0xFE70, 0xFEFE, FreeTypeScript_Arabic},
+  {0xFF21, 0xFF3A, FreeTypeScript_Latin},
+  {0xFF41, 0xFF5A, FreeTypeScript_Latin},
+  {0xFF66, 0xFF9F, FreeTypeScript_Katakana},
+  {0xFFA0, 0xFFDC, FreeTypeScript_Hangul},
+  {0x20000, 0x3FFFF, FreeTypeScript_Han},
+};
+
+static FreeTypeScript
+freetype_script_from_codepoint(uint32_t codepoint)
+{
+  FreeTypeScript result = FreeTypeScript_Common;
+  uint32_t low = 0;
+  uint32_t high = sizeof(freetype_script_ranges) / sizeof(freetype_script_ranges[0]);
+  while(low < high)
+  {
+    uint32_t mid = (low + high) / 2;
+    const FreeTypeScriptRange *range = &freetype_script_ranges[mid];
+    if(codepoint < range->first)
+    {
+      high = mid;
+    }
+    else if(codepoint > range->last)
+    {
+      low = mid + 1;
+    }
+    else
+    {
+      result = range->script;
+      break;
+    }
+  }
+  return result;
+}
+
+static bool
+freetype_is_simple_script(FreeTypeScript script)
+{
+  // NOTE(hampus): Scripts that are shaped one glyph per character, left to
+  // right. Common covers spaces, digits and punctuation.
+  return (script == FreeTypeScript_Common ||
+          script == FreeTypeScript_Latin ||
+          script == FreeTypeScript_Greek ||
+          script == FreeTypeScript_Cyrillic ||
+          script == FreeTypeScript_Armenian ||
+          script == FreeTypeScript_Georgian ||
+          script == FreeTypeScript_Han ||
+          script == FreeTypeScript_Hiragana ||
+          script == FreeTypeScript_Katakana ||
+          script == FreeTypeScript_Bopomofo);
+}
+
+static bool
+freetype_is_mark(uint32_t codepoint)
+{
+  // NOTE(hampus): The nonspacing marks of the scripts the backend shapes,
+  // and the combining marks that go with any script.
+  return ((0x0300 <= codepoint && codepoint <= 0x036F) ||
+          (0x0483 <= codepoint && codepoint <= 0x0489) ||
+          (0x0591 <= codepoint && codepoint <= 0x05BD) ||
+          codepoint == 0x05BF ||
+          codepoint == 0x05C1 || codepoint == 0x05C2 ||
+          codepoint == 0x05C4 || codepoint == 0x05C5 ||
+          codepoint == 0x05C7 ||
+          (0x0610 <= codepoint && codepoint <= 0x061A) ||
+          (0x064B <= codepoint && codepoint <= 0x065F) ||
+          codepoint == 0x0670 ||
+          (0x06D6 <= codepoint && codepoint <= 0x06DC) ||
+          (0x06DF <= codepoint && codepoint <= 0x06E4) ||
+          codepoint == 0x06E7 || codepoint == 0x06E8 ||
+          (0x06EA <= codepoint && codepoint <= 0x06ED) ||
+          (0x1AB0 <= codepoint && codepoint <= 0x1AFF) ||
+          (0x1DC0 <= codepoint && codepoint <= 0x1DFF) ||
+          (0x20D0 <= codepoint && codepoint <= 0x20FF) ||
+          codepoint == 0xFB1E ||
+          (0xFE20 <= codepoint && codepoint <= 0xFE2F));
+}
+
+static bool
+freetype_is_default_ignorable(uint32_t codepoint)
+{
+  return (codepoint == 0x00AD ||
+          codepoint == 0x034F ||
+          codepoint == 0x061C ||
+          codepoint == 0x115F || codepoint == 0x1160 ||
+          codepoint == 0x17B4 || codepoint == 0x17B5 ||
+          (0x180B <= codepoint && codepoint <= 0x180F) ||
+          (0x200B <= codepoint && codepoint <= 0x200F) ||
+          (0x202A <= codepoint && codepoint <= 0x202E) ||
+          (0x2060 <= codepoint && codepoint <= 0x206F) ||
+          codepoint == 0x3164 ||
+          (0xFE00 <= codepoint && codepoint <= 0xFE0F) ||
+          codepoint == 0xFEFF ||
+          codepoint == 0xFFA0 ||
+          (0x1BCA0 <= codepoint && codepoint <= 0x1BCA3) ||
+          (0x1D173 <= codepoint && codepoint <= 0x1D17A) ||
+          (0xE0000 <= codepoint && codepoint <= 0xE0FFF));
+}
+
+static uint32_t
+freetype_mirrored_codepoint(uint32_t codepoint)
+{
+  // NOTE(hampus): The brackets that right to left text draws mirrored
+  static const uint32_t pairs[][2] =
+  {
+    {'(', ')'}, {'<', '>'}, {'[', ']'}, {'{', '}'},
+    {0x00AB, 0x00BB}, {0x2039, 0x203A}, {0x2045, 0x2046},
+    {0x2264, 0x2265}, {0x2329, 0x232A}, {0x27E8, 0x27E9},
+    {0x3008, 0x3009}, {0x300A, 0x300B}, {0x300C, 0x300D},
+    {0x300E, 0x300F}, {0x3010, 0x3011}, {0xFF08, 0xFF09},
+  };
+  uint32_t result = codepoint;
+  for(uint32_t pair_idx = 0; pair_idx < sizeof(pairs) / sizeof(pairs[0]); ++pair_idx)
+  {
+    if(pairs[pair_idx][0] == codepoint)
+    {
+      result = pairs[pair_idx][1];
+      break;
+    }
+    if(pairs[pair_idx][1] == codepoint)
+    {
+      result = pairs[pair_idx][0];
+      break;
+    }
+  }
+  return result;
+}
+
+//----------------------------------------------------------
+// hampus: font faces
+
+static FreeTypeFontFace *
+freetype_font_face_from_shaping_font_face(ShapingFontFace *font_face)
+{
+  return (FreeTypeFontFace *)font_face;
+}
+
+static int
+freetype_compare_kern_pairs(const void *a, const void *b)
+{
+  uint32_t first = ((const FreeTypeKernPair *)a)->glyph_pair;
+  uint32_t second = ((const FreeTypeKernPair *)b)->glyph_pair;
+  return first < second ? -1 : first > second ? 1 : 0;
+}
+
+static uint16_t
+freetype_read_u16(const uint8_t *data)
+{
+  return (uint16_t)((data[0] << 8) | data[1]);
+}
+
+static void
+freetype_load_kern_pairs(FreeTypeFontFace *font_face)
+{
+  // NOTE(hampus): The horizontal format 0 subtables of the legacy kern
+  // table, which is what FreeType reads for FT_Get_Kerning too. Pairs from
+  // several subtables add up.
+  FT_ULong table_size = 0;
+  if(FT_Load_Sfnt_Table(font_face->ft_face, TTAG_kern, 0, 0, &table_size) != 0 || table_size < 4)
+  {
+    return;
+  }
+  uint8_t *table = (uint8_t *)memory_alloc(table_size);
+  FT_Load_Sfnt_Table(font_face->ft_face, TTAG_kern, 0, table, &table_size);
+
+  uint32_t pair_capacity = 0;
+  uint32_t subtable_count = freetype_read_u16(table + 2);
+  uint64_t subtable_offset = 4;
+  for(int pass = 0; pass < 2; ++pass)
+  {
+    subtable_offset = 4;
+    for(uint32_t subtable_idx = 0; subtable_idx < subtable_count && subtable_offset + 14 <= table_size; ++subtable_idx)
+    {
+      const uint8_t *subtable = table + subtable_offset;
+      uint16_t length = freetype_read_u16(subtable + 2);
+      uint16_t coverage = freetype_read_u16(subtable + 4);
+      uint32_t pair_count = freetype_read_u16(subtable + 6);
+
+      // NOTE(hampus): Horizontal, not minimum values, not cross stream
+      bool is_usable = (coverage >> 8) == 0 && (coverage & 0x7) == 0x1;
+      if(is_usable && subtable_offset + 14 + pair_count * 6 <= table_size)
+      {
+        if(pass == 0)
+        {
+          pair_capacity += pair_count;
+        }
+        else
+        {
+          const uint8_t *pairs = subtable + 14;
+          for(uint32_t pair_idx = 0; pair_idx < pair_count; ++pair_idx)
+          {
+            FreeTypeKernPair *pair = &font_face->kern_pairs[font_face->kern_pair_count++];
+            pair->glyph_pair = ((uint32_t)freetype_read_u16(pairs + pair_idx * 6) << 16) | freetype_read_u16(pairs + pair_idx * 6 + 2);
+            pair->value = (int16_t)freetype_read_u16(pairs + pair_idx * 6 + 4);
+          }
+        }
+      }
+      // NOTE(hampus): The length field is 16 bits, which big format 0
+      // subtables overflow, so those are measured by their pair count
+      subtable_offset += (coverage >> 8) == 0 ? 14 + (uint64_t)pair_count * 6 : (length != 0 ? length : table_size);
+    }
+    if(pass == 0)
+    {
+      if(pair_capacity == 0)
+      {
+        break;
+      }
+      font_face->kern_pairs = (FreeTypeKernPair *)memory_alloc(pair_capacity * sizeof(FreeTypeKernPair));
+    }
+  }
+  memory_free(table);
+
+  if(font_face->kern_pair_count != 0)
+  {
+    qsort(font_face->kern_pairs, font_face->kern_pair_count, sizeof(FreeTypeKernPair), freetype_compare_kern_pairs);
+
+    uint32_t merged_count = 1;
+    for(uint32_t pair_idx = 1; pair_idx < font_face->kern_pair_count; ++pair_idx)
+    {
+      FreeTypeKernPair *last = &font_face->kern_pairs[merged_count - 1];
+      if(font_face->kern_pairs[pair_idx].glyph_pair == last->glyph_pair)
+      {
+        last->value += font_face->kern_pairs[pair_idx].value;
+      }
+      else
+      {
+        font_face->kern_pairs[merged_count++] = font_face->kern_pairs[pair_idx];
+      }
+    }
+    font_face->kern_pair_count = merged_count;
+
+    font_face->kerned_glyphs = (uint8_t *)memory_alloc_zero((font_face->glyph_count + 7) / 8);
+    for(uint32_t pair_idx = 0; pair_idx < font_face->kern_pair_count; ++pair_idx)
+    {
+      uint32_t left = font_face->kern_pairs[pair_idx].glyph_pair >> 16;
+      uint32_t right = font_face->kern_pairs[pair_idx].glyph_pair & 0xffff;
+      if(left < font_face->glyph_count && right < font_face->glyph_count)
+      {
+        font_face->kerned_glyphs[left / 8] |= (uint8_t)(1 << (left % 8));
+        font_face->kerned_glyphs[right / 8] |= (uint8_t)(1 << (right % 8));
+      }
+    }
+  }
+}
+
+static int32_t
+freetype_design_kerning(FreeTypeFontFace *font_face, uint16_t left, uint16_t right)
+{
+  int32_t result = 0;
+  uint32_t glyph_pair = ((uint32_t)left << 16) | right;
+  uint32_t low = 0;
+  uint32_t high = font_face->kern_pair_count;
+  while(low < high)
+  {
+    uint32_t mid = (low + high) / 2;
+    if(font_face->kern_pairs[mid].glyph_pair < glyph_pair)
+    {
+      low = mid + 1;
+    }
+    else
+    {
+      high = mid;
+    }
+  }
+  if(low < font_face->kern_pair_count && font_face->kern_pairs[low].glyph_pair == glyph_pair)
+  {
+    result = font_face->kern_pairs[low].value;
+  }
+  return result;
+}
+
+static bool
+freetype_is_kerned_glyph(FreeTypeFontFace *font_face, uint16_t glyph)
+{
+  return (font_face->kerned_glyphs != 0 &&
+          glyph < font_face->glyph_count &&
+          (font_face->kerned_glyphs[glyph / 8] & (1 << (glyph % 8))) != 0);
+}
+
+static int32_t
+freetype_design_advance(FreeTypeFontFace *font_face, uint16_t glyph)
+{
+  return glyph < font_face->glyph_count ? font_face->design_advances[glyph] : 0;
+}
+
+static uint16_t
+freetype_glyph_from_codepoint(FreeTypeFontFace *font_face, uint32_t codepoint)
+{
+  // NOTE(hampus): Call with the face's lock held
+  FT_UInt glyph = FT_Get_Char_Index(font_face->ft_face, codepoint);
+  return glyph <= 0xffff ? (uint16_t)glyph : 0;
+}
+
+static FreeTypeFontFace *
+freetype_font_face_alloc(const char *file_path, int face_index)
+{
+  FreeTypeFontFace *font_face = (FreeTypeFontFace *)memory_alloc_zero(sizeof(FreeTypeFontFace));
+  font_face->reference_count = 1;
+  uint64_t file_path_size = strlen(file_path) + 1;
+  font_face->file_path = (char *)memory_alloc(file_path_size);
+  memory_copy(font_face->file_path, file_path, file_path_size);
+  font_face->face_index = face_index;
+
+  FT_Error error = FT_Init_FreeType(&font_face->ft_library);
+  ASSERT(error == 0);
+  error = FT_New_Face(font_face->ft_library, file_path, face_index, &font_face->ft_face);
+  if(error == 0 && !FT_IS_SCALABLE(font_face->ft_face))
+  {
+    FT_Done_Face(font_face->ft_face);
+    error = FT_Err_Unknown_File_Format;
+  }
+  if(error != 0)
+  {
+    // NOTE(hampus): The file is gone or isn't a font, e.g. a font that was
+    // uninstalled after a disk cache was written
+    FT_Done_FreeType(font_face->ft_library);
+    memory_free(font_face->file_path);
+    memory_free(font_face);
+    return 0;
+  }
+
+  os_mutex_init(&font_face->mutex);
+  font_face->design_units_per_em = (uint16_t)font_face->ft_face->units_per_EM;
+  font_face->glyph_count = (uint32_t)font_face->ft_face->num_glyphs;
+
+  FT_Fixed *advances = (FT_Fixed *)memory_alloc(font_face->glyph_count * sizeof(FT_Fixed));
+  font_face->design_advances = (int32_t *)memory_alloc_zero(font_face->glyph_count * sizeof(int32_t));
+  if(FT_Get_Advances(font_face->ft_face, 0, font_face->glyph_count, FT_LOAD_NO_SCALE, advances) == 0)
+  {
+    for(uint32_t glyph = 0; glyph < font_face->glyph_count; ++glyph)
+    {
+      font_face->design_advances[glyph] = (int32_t)advances[glyph];
+    }
+  }
+  memory_free(advances);
+
+  freetype_load_kern_pairs(font_face);
+
+  return font_face;
+}
+
+static void
+freetype_add_ref_font_face(ShapingFontFace *font_face)
+{
+  atomic_s32_increment(&freetype_font_face_from_shaping_font_face(font_face)->reference_count);
+}
+
+static void
+freetype_release_font_face(ShapingFontFace *shaping_font_face)
+{
+  FreeTypeFontFace *font_face = freetype_font_face_from_shaping_font_face(shaping_font_face);
+  if(atomic_s32_decrement(&font_face->reference_count) == 0)
+  {
+    FT_Done_Face(font_face->ft_face);
+    FT_Done_FreeType(font_face->ft_library);
+    os_mutex_destroy(&font_face->mutex);
+    memory_free(font_face->kerned_glyphs);
+    memory_free(font_face->kern_pairs);
+    memory_free(font_face->design_advances);
+    memory_free(font_face->file_path);
+    memory_free(font_face);
+  }
+}
+
+static uint16_t
+freetype_get_design_units_per_em(ShapingFontFace *font_face)
+{
+  return freetype_font_face_from_shaping_font_face(font_face)->design_units_per_em;
+}
+
+static void
+freetype_get_design_font_metrics(ShapingFontFace *font_face, ShapingFontMetrics *metrics)
+{
+  // NOTE(hampus): These are read when the face is loaded and never change,
+  // so they don't need the lock.
+  FT_Face ft_face = freetype_font_face_from_shaping_font_face(font_face)->ft_face;
+  metrics->design_units_per_em = freetype_font_face_from_shaping_font_face(font_face)->design_units_per_em;
+  metrics->ascent = (uint16_t)ft_face->ascender;
+  metrics->descent = (uint16_t)-ft_face->descender;
+  metrics->line_gap = (int16_t)(ft_face->height - (ft_face->ascender - ft_face->descender));
+}
+
+static void
+freetype_get_font_properties(ShapingFontFace *font_face, ShapingFontProperties *properties)
+{
+  // NOTE(hampus): FreeType counts COLR, CBDT and sbix fonts as color fonts
+  FT_Face ft_face = freetype_font_face_from_shaping_font_face(font_face)->ft_face;
+  properties->glyph_count = (uint32_t)ft_face->num_glyphs;
+  properties->flags = 0;
+  properties->flags |= FT_IS_FIXED_WIDTH(ft_face) ? ShapingFontFlag_Monospace : 0;
+  properties->flags |= FT_HAS_COLOR(ft_face) ? ShapingFontFlag_Color : 0;
+}
+
+static void
+freetype_get_glyph_indices(ShapingFontFace *shaping_font_face, const uint32_t *codepoints, uint32_t count, uint16_t *glyph_indices)
+{
+  FreeTypeFontFace *font_face = freetype_font_face_from_shaping_font_face(shaping_font_face);
+  os_mutex_lock(&font_face->mutex);
+  for(uint32_t idx = 0; idx < count; ++idx)
+  {
+    glyph_indices[idx] = freetype_glyph_from_codepoint(font_face, codepoints[idx]);
+  }
+  os_mutex_unlock(&font_face->mutex);
+}
+
+static void
+freetype_get_design_glyph_advances(ShapingFontFace *shaping_font_face, const uint16_t *glyph_indices, uint32_t count, int32_t *design_advances)
+{
+  FreeTypeFontFace *font_face = freetype_font_face_from_shaping_font_face(shaping_font_face);
+  for(uint32_t idx = 0; idx < count; ++idx)
+  {
+    design_advances[idx] = freetype_design_advance(font_face, glyph_indices[idx]);
+  }
+}
+
+//----------------------------------------------------------
+// hampus: font fallback
+
+static FreeTypeFontFace *
+freetype_font_face_from_path(FreeTypeShapingBackend *backend, const char *file_path, int face_index)
+{
+  // NOTE(hampus): Call with the mutex held. The backend keeps the face.
+  // Returns 0 if the file can't be loaded.
+  FreeTypeFontFace *result = 0;
+  for(FreeTypeFontFace *font_face = backend->first_font_face; font_face != 0; font_face = font_face->next)
+  {
+    if(font_face->face_index == face_index && strcmp(font_face->file_path, file_path) == 0)
+    {
+      result = font_face;
+      break;
+    }
+  }
+  if(result == 0)
+  {
+    result = freetype_font_face_alloc(file_path, face_index);
+    if(result != 0)
+    {
+      result->next = backend->first_font_face;
+      backend->first_font_face = result;
+    }
+  }
+  return result;
+}
+
+static FreeTypeFontFace *
+freetype_font_face_from_pattern(FreeTypeShapingBackend *backend, FcPattern *pattern)
+{
+  FcChar8 *file_path = 0;
+  int face_index = 0;
+  if(FcPatternGetString(pattern, FC_FILE, 0, &file_path) != FcResultMatch)
+  {
+    return 0;
+  }
+  FcPatternGetInteger(pattern, FC_INDEX, 0, &face_index);
+  return freetype_font_face_from_path(backend, (const char *)file_path, face_index);
+}
+
+static FreeTypeFontFamily *
+freetype_font_family_from_key(FreeTypeShapingBackend *backend, const utf16_char *base_family, const utf16_char *locale)
+{
+  FreeTypeFontFamily *result = 0;
+  for(FreeTypeFontFamily *family = backend->first_family; family != 0; family = family->next)
+  {
+    if(utf16_match(family->base_family, base_family) && utf16_match(family->locale, locale))
+    {
+      result = family;
+      break;
+    }
+  }
+  if(result == 0)
+  {
+    char family_name[256];
+    char language[64];
+    freetype_utf8_from_utf16(family_name, sizeof(family_name), base_family);
+    freetype_utf8_from_utf16(language, sizeof(language), locale);
+
+    FcPattern *pattern = FcPatternCreate();
+    FcPatternAddString(pattern, FC_FAMILY, (const FcChar8 *)family_name);
+    if(language[0] != 0)
+    {
+      FcPatternAddString(pattern, FC_LANG, (const FcChar8 *)language);
+    }
+    FcConfigSubstitute(backend->config, pattern, FcMatchPattern);
+    FcDefaultSubstitute(pattern);
+
+    FcResult fc_result = FcResultMatch;
+    result = (FreeTypeFontFamily *)memory_alloc_zero(sizeof(FreeTypeFontFamily));
+    result->base_family = utf16_copy(base_family);
+    result->locale = utf16_copy(locale);
+    result->font_set = FcFontSort(backend->config, pattern, FcTrue, 0, &fc_result);
+    if(result->font_set != 0)
+    {
+      result->font_faces = (FreeTypeFontFace **)memory_alloc_zero((result->font_set->nfont + 1) * sizeof(FreeTypeFontFace *));
+    }
+    FcPatternDestroy(pattern);
+
+    result->next = backend->first_family;
+    backend->first_family = result;
+  }
+  return result;
+}
+
+static FreeTypeFontFace *
+freetype_font_face_from_codepoint(FreeTypeShapingBackend *backend, FreeTypeFontFamily *family, uint32_t codepoint)
+{
+  // NOTE(hampus): The first font in fallback order that has the codepoint
+  FreeTypeFontFace *result = 0;
+  if(family->font_set != 0)
+  {
+    for(int font_idx = 0; font_idx < family->font_set->nfont; ++font_idx)
+    {
+      FcCharSet *char_set = 0;
+      if(FcPatternGetCharSet(family->font_set->fonts[font_idx], FC_CHARSET, 0, &char_set) == FcResultMatch &&
+         FcCharSetHasChar(char_set, codepoint))
+      {
+        if(family->font_faces[font_idx] == 0)
+        {
+          family->font_faces[font_idx] = freetype_font_face_from_pattern(backend, family->font_set->fonts[font_idx]);
+        }
+        result = family->font_faces[font_idx];
+        if(result != 0)
+        {
+          break;
+        }
+      }
+    }
+  }
+  return result;
+}
+
+static bool
+freetype_font_face_has_codepoint(FreeTypeFontFace *font_face, uint32_t codepoint)
+{
+  os_mutex_lock(&font_face->mutex);
+  bool result = freetype_glyph_from_codepoint(font_face, codepoint) != 0;
+  os_mutex_unlock(&font_face->mutex);
+  return result;
+}
+
+static ShapingFontFace *
+freetype_map_characters(void *state, const utf16_char *locale, const utf16_char *base_family, const utf16_char *text, uint32_t text_length, uint32_t *mapped_length, float *scale)
+{
+  // NOTE(hampus): Like MapCharacters, takes the font of the first character
+  // and keeps going for as long as the same font is picked. Cluster extenders
+  // stay with the font of the character before them, and common codepoints
+  // stay in the run before them when its font has them.
+  FreeTypeShapingBackend *backend = (FreeTypeShapingBackend *)state;
+  os_mutex_lock(&backend->mutex);
+
+  FreeTypeFontFamily *family = freetype_font_family_from_key(backend, base_family, locale);
+
+  uint32_t codepoint = 0;
+  uint32_t length = decode_utf16(text, text_length, &codepoint);
+  FreeTypeFontFace *font_face = freetype_font_face_from_codepoint(backend, family, codepoint);
+  while(length < text_length)
+  {
+    uint32_t codepoint_length = decode_utf16(text + length, text_length - length, &codepoint);
+    bool stays_in_run = (is_cluster_extender(codepoint) ||
+                         (font_face != 0 && is_common_or_inherited_codepoint(codepoint) && freetype_font_face_has_codepoint(font_face, codepoint)) ||
+                         freetype_font_face_from_codepoint(backend, family, codepoint) == font_face);
+    if(!stays_in_run)
+    {
+      break;
+    }
+    length += codepoint_length;
+  }
+
+  if(font_face != 0)
+  {
+    freetype_add_ref_font_face((ShapingFontFace *)font_face);
+  }
+
+  os_mutex_unlock(&backend->mutex);
+
+  *mapped_length = length;
+  *scale = 1.0f;
+  return (ShapingFontFace *)font_face;
+}
+
+//----------------------------------------------------------
+// hampus: analysis
+
+static bool
+freetype_is_simple_codepoint(FreeTypeFontFace *font_face, uint32_t codepoint, uint16_t *glyph)
+{
+  // NOTE(hampus): Call with the face's lock held. Anything that shaping
+  // would give another glyph, advance or offset than its nominal ones isn't
+  // simple.
+  *glyph = 0;
+  if(is_cluster_extender(codepoint) ||
+     freetype_is_mark(codepoint) ||
+     freetype_is_default_ignorable(codepoint) ||
+     !freetype_is_simple_script(freetype_script_from_codepoint(codepoint)))
+  {
+    return false;
+  }
+  *glyph = freetype_glyph_from_codepoint(font_face, codepoint);
+  return *glyph != 0 && !freetype_is_kerned_glyph(font_face, *glyph);
+}
+
+static bool
+freetype_is_simple_text(FreeTypeFontFace *font_face, const utf16_char *text, uint32_t text_length, uint32_t *codepoint_length, uint16_t *glyph)
+{
+  // NOTE(hampus): Simple text has one glyph per UTF-16 character, so
+  // surrogate pairs, and lone surrogates, are always complex.
+  uint32_t codepoint = 0;
+  *codepoint_length = decode_utf16(text, text_length, &codepoint);
+  return (*codepoint_length == 1 &&
+          !(0xD800 <= codepoint && codepoint <= 0xDFFF) &&
+          freetype_is_simple_codepoint(font_face, codepoint, glyph));
+}
+
+static bool
+freetype_get_text_complexity(void *state, ShapingFontFace *shaping_font_face, const utf16_char *text, uint32_t text_length, uint32_t *mapped_length, uint16_t *glyph_indices)
+{
+  // NOTE(hampus): Like GetTextComplexity, the length of the leading run of
+  // text that is either all simple or all complex.
+  FreeTypeFontFace *font_face = freetype_font_face_from_shaping_font_face(shaping_font_face);
+  os_mutex_lock(&font_face->mutex);
+
+  uint16_t glyph = 0;
+  uint32_t codepoint_length = 0;
+  bool is_simple = freetype_is_simple_text(font_face, text, text_length, &codepoint_length, &glyph);
+  uint32_t length = 0;
+  while(length < text_length && freetype_is_simple_text(font_face, text + length, text_length - length, &codepoint_length, &glyph) == is_simple)
+  {
+    if(is_simple)
+    {
+      glyph_indices[length] = glyph;
+    }
+    length += codepoint_length;
+  }
+
+  os_mutex_unlock(&font_face->mutex);
+
+  *mapped_length = length;
+  return is_simple;
+}
+
+// NOTE(hampus): Bidi classes of the Unicode bidi algorithm, worked out from
+// the blocks like the scripts are. Explicit embeddings, overrides and
+// isolates are not supported, their codepoints count as neutral.
+enum FreeTypeBidiClass
+{
+  FreeTypeBidiClass_L,
+  FreeTypeBidiClass_R,
+  FreeTypeBidiClass_AL,
+  FreeTypeBidiClass_EN,
+  FreeTypeBidiClass_ES,
+  FreeTypeBidiClass_ET,
+  FreeTypeBidiClass_AN,
+  FreeTypeBidiClass_CS,
+  FreeTypeBidiClass_NSM,
+  FreeTypeBidiClass_B,
+  FreeTypeBidiClass_S,
+  FreeTypeBidiClass_WS,
+  FreeTypeBidiClass_ON,
+};
+
+static FreeTypeBidiClass
+freetype_bidi_class_from_codepoint(uint32_t codepoint)
+{
+  if(codepoint == 0x0A || codepoint == 0x0D || (0x1C <= codepoint && codepoint <= 0x1E) || codepoint == 0x85 || codepoint == 0x2029)
+  {
+    return FreeTypeBidiClass_B;
+  }
+  if(codepoint == 0x09 || codepoint == 0x0B || codepoint == 0x1F)
+  {
+    return FreeTypeBidiClass_S;
+  }
+  if(codepoint == 0x0C || codepoint == ' ' || codepoint == 0x1680 || (0x2000 <= codepoint && codepoint <= 0x200A) ||
+     codepoint == 0x2028 || codepoint == 0x205F || codepoint == 0x3000)
+  {
+    return FreeTypeBidiClass_WS;
+  }
+  if(codepoint == '+' || codepoint == '-' || codepoint == 0x2212)
+  {
+    return FreeTypeBidiClass_ES;
+  }
+  if(codepoint == ',' || codepoint == '.' || codepoint == '/' || codepoint == ':' || codepoint == 0xA0 || codepoint == 0x060C)
+  {
+    return FreeTypeBidiClass_CS;
+  }
+  if(codepoint == '#' || codepoint == '$' || codepoint == '%' || (0xA2 <= codepoint && codepoint <= 0xA5) ||
+     codepoint == 0xB0 || codepoint == 0xB1 || codepoint == 0x2030 || codepoint == 0x066A ||
+     (0x20A0 <= codepoint && codepoint <= 0x20CF))
+  {
+    return FreeTypeBidiClass_ET;
+  }
+  if((0x0660 <= codepoint && codepoint <= 0x0669) || codepoint == 0x066B || codepoint == 0x066C)
+  {
+    return FreeTypeBidiClass_AN;
+  }
+  if(('0' <= codepoint && codepoint <= '9') || codepoint == 0xB2 || codepoint == 0xB3 || codepoint == 0xB9 ||
+     (0x06F0 <= codepoint && codepoint <= 0x06F9) || codepoint == 0x2070 || (0x2074 <= codepoint && codepoint <= 0x2079) ||
+     (0x2080 <= codepoint && codepoint <= 0x2089) || (0xFF10 <= codepoint && codepoint <= 0xFF19))
+  {
+    return FreeTypeBidiClass_EN;
+  }
+  if(freetype_is_mark(codepoint))
+  {
+    return FreeTypeBidiClass_NSM;
+  }
+  if(codepoint == 0x200E)
+  {
+    return FreeTypeBidiClass_L;
+  }
+  if(codepoint == 0x200F)
+  {
+    return FreeTypeBidiClass_R;
+  }
+  if(codepoint == 0x061C)
+  {
+    return FreeTypeBidiClass_AL;
+  }
+
+  FreeTypeBidiClass result = FreeTypeBidiClass_L;
+  FreeTypeScript script = freetype_script_from_codepoint(codepoint);
+  if(script == FreeTypeScript_Arabic || script == FreeTypeScript_Syriac || script == FreeTypeScript_Thaana)
+  {
+    result = FreeTypeBidiClass_AL;
+  }
+  else if(script == FreeTypeScript_Hebrew || script == FreeTypeScript_NKo ||
+          (0x0800 <= codepoint && codepoint <= 0x085F) ||
+          (0x10800 <= codepoint && codepoint <= 0x10FFF) ||
+          (0x1E800 <= codepoint && codepoint <= 0x1EFFF))
+  {
+    result = FreeTypeBidiClass_R;
+  }
+  else if(script == FreeTypeScript_Common &&
+          (is_common_or_inherited_codepoint(codepoint) ||
+           (0x2100 <= codepoint && codepoint <= 0x2BFF) ||
+           (0x1F000 <= codepoint && codepoint <= 0x1FAFF) ||
+           freetype_is_default_ignorable(codepoint)))
+  {
+    // NOTE(hampus): Punctuation, symbols and emoji
+    result = FreeTypeBidiClass_ON;
+  }
+  return result;
+}
+
+static bool
+freetype_bidi_class_is_neutral(FreeTypeBidiClass bidi_class)
+{
+  return (bidi_class == FreeTypeBidiClass_B || bidi_class == FreeTypeBidiClass_S ||
+          bidi_class == FreeTypeBidiClass_WS || bidi_class == FreeTypeBidiClass_ON);
+}
+
+static void
+freetype_resolve_bidi_levels(const utf16_char *text, uint32_t text_length, uint8_t *classes, uint8_t *levels)
+{
+  // NOTE(hampus): The weak, neutral and implicit rules of the Unicode bidi
+  // algorithm for a paragraph at level 0, one class and level per UTF-16
+  // character. The second half of a surrogate pair gets the class of the
+  // first. Paragraph separators inside the text end one paragraph and
+  // start the next at level 0 again, which the rules below give for free.
+  for(uint32_t idx = 0; idx < text_length;)
+  {
+    uint32_t codepoint = 0;
+    uint32_t codepoint_length = decode_utf16(text + idx, text_length - idx, &codepoint);
+    FreeTypeBidiClass bidi_class = freetype_bidi_class_from_codepoint(codepoint);
+    for(uint32_t unit_idx = 0; unit_idx < codepoint_length; ++unit_idx)
+    {
+      classes[idx + unit_idx] = (uint8_t)bidi_class;
+    }
+    idx += codepoint_length;
+  }
+
+  // hampus: W1-W3, marks take the class before them, European numbers after
+  // Arabic letters become Arabic numbers, and Arabic letters become R
+
+  FreeTypeBidiClass last_class = FreeTypeBidiClass_L;
+  FreeTypeBidiClass last_strong = FreeTypeBidiClass_L;
+  for(uint32_t idx = 0; idx < text_length; ++idx)
+  {
+    FreeTypeBidiClass bidi_class = (FreeTypeBidiClass)classes[idx];
+    if(bidi_class == FreeTypeBidiClass_NSM)
+    {
+      bidi_class = last_class;
+    }
+    if(bidi_class == FreeTypeBidiClass_L || bidi_class == FreeTypeBidiClass_R || bidi_class == FreeTypeBidiClass_AL)
+    {
+      last_strong = bidi_class;
+    }
+    else if(bidi_class == FreeTypeBidiClass_B)
+    {
+      last_strong = FreeTypeBidiClass_L;
+    }
+    if(bidi_class == FreeTypeBidiClass_EN && last_strong == FreeTypeBidiClass_AL)
+    {
+      bidi_class = FreeTypeBidiClass_AN;
+    }
+    last_class = bidi_class;
+    classes[idx] = (uint8_t)(bidi_class == FreeTypeBidiClass_AL ? FreeTypeBidiClass_R : bidi_class);
+  }
+
+  // hampus: W4, a single separator between two numbers of the same kind
+
+  for(uint32_t idx = 1; idx + 1 < text_length; ++idx)
+  {
+    uint8_t before = classes[idx - 1];
+    uint8_t after = classes[idx + 1];
+    if(before == after &&
+       ((classes[idx] == FreeTypeBidiClass_ES && before == FreeTypeBidiClass_EN) ||
+        (classes[idx] == FreeTypeBidiClass_CS && (before == FreeTypeBidiClass_EN || before == FreeTypeBidiClass_AN))))
+    {
+      classes[idx] = before;
+    }
+  }
+
+  // hampus: W5-W6, terminators next to European numbers join them, and the
+  // separators and terminators left over are neutral
+
+  for(uint32_t idx = 0; idx < text_length;)
+  {
+    if(classes[idx] != FreeTypeBidiClass_ET)
+    {
+      idx += 1;
+      continue;
+    }
+    uint32_t opl = idx;
+    while(opl < text_length && classes[opl] == FreeTypeBidiClass_ET)
+    {
+      opl += 1;
+    }
+    bool is_number = ((idx != 0 && classes[idx - 1] == FreeTypeBidiClass_EN) ||
+                      (opl < text_length && classes[opl] == FreeTypeBidiClass_EN));
+    for(; idx < opl; ++idx)
+    {
+      classes[idx] = (uint8_t)(is_number ? FreeTypeBidiClass_EN : FreeTypeBidiClass_ON);
+    }
+  }
+  for(uint32_t idx = 0; idx < text_length; ++idx)
+  {
+    if(classes[idx] == FreeTypeBidiClass_ES || classes[idx] == FreeTypeBidiClass_CS)
+    {
+      classes[idx] = FreeTypeBidiClass_ON;
+    }
+  }
+
+  // hampus: W7, European numbers after left-to-right text are left to right
+
+  last_strong = FreeTypeBidiClass_L;
+  for(uint32_t idx = 0; idx < text_length; ++idx)
+  {
+    if(classes[idx] == FreeTypeBidiClass_L || classes[idx] == FreeTypeBidiClass_R)
+    {
+      last_strong = (FreeTypeBidiClass)classes[idx];
+    }
+    else if(classes[idx] == FreeTypeBidiClass_B)
+    {
+      last_strong = FreeTypeBidiClass_L;
+    }
+    else if(classes[idx] == FreeTypeBidiClass_EN && last_strong == FreeTypeBidiClass_L)
+    {
+      classes[idx] = FreeTypeBidiClass_L;
+    }
+  }
+
+  // hampus: N1-N2, neutrals between text of one direction take that
+  // direction, the rest take the paragraph's. Numbers count as right to left.
+
+  for(uint32_t idx = 0; idx < text_length;)
+  {
+    if(!freetype_bidi_class_is_neutral((FreeTypeBidiClass)classes[idx]))
+    {
+      idx += 1;
+      continue;
+    }
+    uint32_t opl = idx;
+    while(opl < text_length && freetype_bidi_class_is_neutral((FreeTypeBidiClass)classes[opl]) && classes[opl] != FreeTypeBidiClass_B)
+    {
+      opl += 1;
+    }
+    bool before_is_rtl = idx != 0 && classes[idx - 1] != FreeTypeBidiClass_L && classes[idx - 1] != FreeTypeBidiClass_B;
+    bool after_is_rtl = opl < text_length && classes[opl] != FreeTypeBidiClass_L && classes[opl] != FreeTypeBidiClass_B;
+    uint8_t direction = (before_is_rtl && after_is_rtl) ? FreeTypeBidiClass_R : FreeTypeBidiClass_L;
+    for(uint32_t neutral_idx = idx; neutral_idx < opl; ++neutral_idx)
+    {
+      levels[neutral_idx] = direction == FreeTypeBidiClass_R ? 1 : 0;
+    }
+    if(opl < text_length && classes[opl] == FreeTypeBidiClass_B)
+    {
+      levels[opl] = 0;
+      opl += 1;
+    }
+    idx = opl;
+  }
+
+  // hampus: I1, levels of the rest
+
+  for(uint32_t idx = 0; idx < text_length; ++idx)
+  {
+    switch(classes[idx])
+    {
+      case FreeTypeBidiClass_L:  levels[idx] = 0; break;
+      case FreeTypeBidiClass_R:  levels[idx] = 1; break;
+      case FreeTypeBidiClass_EN:
+      case FreeTypeBidiClass_AN: levels[idx] = 2; break;
+      default: break;
+    }
+  }
+
+  // hampus: L1, separators and the whitespace before them, or at the end of
+  // the text, go back to the paragraph level
+
+  bool is_before_line_end = true;
+  for(uint32_t idx = text_length; idx > 0; --idx)
+  {
+    FreeTypeBidiClass bidi_class = freetype_bidi_class_from_codepoint((uint32_t)text[idx - 1]);
+    if(bidi_class == FreeTypeBidiClass_S || bidi_class == FreeTypeBidiClass_B)
+    {
+      levels[idx - 1] = 0;
+      is_before_line_end = true;
+    }
+    else if(bidi_class == FreeTypeBidiClass_WS && is_before_line_end)
+    {
+      levels[idx - 1] = 0;
+    }
+    else
+    {
+      is_before_line_end = false;
+    }
+  }
+}
+
+static ShapingScriptRun *
+freetype_analyze_script_and_bidi(void *state, Arena *arena, const utf16_char *locale, const utf16_char *text, uint32_t text_length, uint32_t *run_count)
+{
+  uint8_t *classes = push_array_no_zero(arena, uint8_t, text_length);
+  uint8_t *levels = push_array_no_zero(arena, uint8_t, text_length);
+  freetype_resolve_bidi_levels(text, text_length, classes, levels);
+
+  // NOTE(hampus): At most one run per character
+  ShapingScriptRun *runs = push_array_no_zero(arena, ShapingScriptRun, text_length);
+  uint32_t count = 0;
+
+  for(uint32_t idx = 0; idx < text_length;)
+  {
+    uint32_t codepoint = 0;
+    uint32_t codepoint_length = decode_utf16(text + idx, text_length - idx, &codepoint);
+    FreeTypeScript script = freetype_script_from_codepoint(codepoint);
+    bool is_neutral = script == FreeTypeScript_Common || freetype_is_mark(codepoint);
+
+    // NOTE(hampus): Runs also end where the bidi level changes
+    ShapingScriptRun *run = count != 0 ? &runs[count - 1] : 0;
+    if(run != 0 && run->bidi_level != levels[idx])
+    {
+      run = 0;
+    }
+    if(run != 0 && (is_neutral || run->analysis.script == (uint32_t)script))
+    {
+      run->text_length += codepoint_length;
+    }
+    else if(run != 0 && run->analysis.script == (uint32_t)FreeTypeScript_Common)
+    {
+      // NOTE(hampus): Neutral characters at the start take the first
+      // real script after them.
+      run->analysis.script = (uint32_t)script;
+      run->text_length += codepoint_length;
+    }
+    else
+    {
+      run = &runs[count];
+      count += 1;
+      run->text_position = idx;
+      run->text_length = codepoint_length;
+      run->analysis.script = is_neutral ? (uint32_t)FreeTypeScript_Common : (uint32_t)script;
+      run->analysis.shapes = 0;
+      run->bidi_level = levels[idx];
+    }
+    idx += codepoint_length;
+  }
+
+  *run_count = count;
+  return runs;
+}
+
+//----------------------------------------------------------
+// hampus: arabic joining
+
+enum FreeTypeJoiningType
+{
+  FreeTypeJoiningType_None,
+  FreeTypeJoiningType_Right,
+  FreeTypeJoiningType_Dual,
+  FreeTypeJoiningType_Causing,
+  FreeTypeJoiningType_Transparent,
+};
+
+struct FreeTypeArabicLetter
+{
+  uint16_t codepoint;
+
+  // NOTE(hampus): The isolated form, followed by the final, initial and
+  // medial forms for as many as the letter has
+  uint16_t first_form;
+  uint16_t form_count;
+};
+
+// NOTE(hampus): The letters that have presentation forms, sorted. Tatweel
+// joins on both sides but has no forms of its own.
+static const FreeTypeArabicLetter freetype_arabic_letters[] =
+{
+  {0x0621, 0xFE80, 1}, {0x0622, 0xFE81, 2}, {0x0623, 0xFE83, 2}, {0x0624, 0xFE85, 2},
+  {0x0625, 0xFE87, 2}, {0x0626, 0xFE89, 4}, {0x0627, 0xFE8D, 2}, {0x0628, 0xFE8F, 4},
+  {0x0629, 0xFE93, 2}, {0x062A, 0xFE95, 4}, {0x062B, 0xFE99, 4}, {0x062C, 0xFE9D, 4},
+  {0x062D, 0xFEA1, 4}, {0x062E, 0xFEA5, 4}, {0x062F, 0xFEA9, 2}, {0x0630, 0xFEAB, 2},
+  {0x0631, 0xFEAD, 2}, {0x0632, 0xFEAF, 2}, {0x0633, 0xFEB1, 4}, {0x0634, 0xFEB5, 4},
+  {0x0635, 0xFEB9, 4}, {0x0636, 0xFEBD, 4}, {0x0637, 0xFEC1, 4}, {0x0638, 0xFEC5, 4},
+  {0x0639, 0xFEC9, 4}, {0x063A, 0xFECD, 4}, {0x0640, 0x0000, 0}, {0x0641, 0xFED1, 4},
+  {0x0642, 0xFED5, 4}, {0x0643, 0xFED9, 4}, {0x0644, 0xFEDD, 4}, {0x0645, 0xFEE1, 4},
+  {0x0646, 0xFEE5, 4}, {0x0647, 0xFEE9, 4}, {0x0648, 0xFEED, 2}, {0x0649, 0xFEEF, 2},
+  {0x064A, 0xFEF1, 4}, {0x067E, 0xFB56, 4}, {0x0686, 0xFB7A, 4}, {0x0698, 0xFB8A, 2},
+  {0x06A9, 0xFB8E, 4}, {0x06AF, 0xFB92, 4}, {0x06CC, 0xFBFC, 4},
+};
+
+static const FreeTypeArabicLetter *
+freetype_arabic_letter_from_codepoint(uint32_t codepoint)
+{
+  const FreeTypeArabicLetter *result = 0;
+  uint32_t low = 0;
+  uint32_t high = sizeof(freetype_arabic_letters) / sizeof(freetype_arabic_letters[0]);
+  while(low < high)
+  {
+    uint32_t mid = (low + high) / 2;
+    if(freetype_arabic_letters[mid].codepoint < codepoint)
+    {
+      low = mid + 1;
+    }
+    else
+    {
+      high = mid;
+    }
+  }
+  if(low < sizeof(freetype_arabic_letters) / sizeof(freetype_arabic_letters[0]) && freetype_arabic_letters[low].codepoint == codepoint)
+  {
+    result = &freetype_arabic_letters[low];
+  }
+  return result;
+}
+
+static FreeTypeJoiningType
+freetype_joining_type_from_codepoint(uint32_t codepoint)
+{
+  FreeTypeJoiningType result = FreeTypeJoiningType_None;
+  const FreeTypeArabicLetter *letter = freetype_arabic_letter_from_codepoint(codepoint);
+  if(freetype_is_mark(codepoint))
+  {
+    result = FreeTypeJoiningType_Transparent;
+  }
+  else if(codepoint == 0x200D)
+  {
+    result = FreeTypeJoiningType_Causing;
+  }
+  else if(letter != 0)
+  {
+    result = (letter->form_count == 0 || letter->form_count == 4) ? FreeTypeJoiningType_Dual :
+             letter->form_count == 2 ? FreeTypeJoiningType_Right : FreeTypeJoiningType_None;
+  }
+  return result;
+}
+
+static uint16_t
+freetype_lam_alef_ligature(uint32_t alef)
+{
+  // NOTE(hampus): The isolated form, the final form comes right after it
+  uint16_t result = 0;
+  switch(alef)
+  {
+    case 0x0622: result = 0xFEF5; break;
+    case 0x0623: result = 0xFEF7; break;
+    case 0x0625: result = 0xFEF9; break;
+    case 0x0627: result = 0xFEFB; break;
+    default: break;
+  }
+  return result;
+}
+
+static void
+freetype_apply_arabic_joining(FreeTypeFontFace *font_face, const uint32_t *codepoints, uint32_t codepoint_count, uint16_t *glyphs, bool *is_ligated)
+{
+  // NOTE(hampus): Call with the face's lock held. Picks the form of every
+  // letter from whether it joins the letters around it, skipping the marks
+  // between them. A lam followed by an alef becomes one ligature glyph, and
+  // the alef is marked as ligated into it.
+  for(uint32_t idx = 0; idx < codepoint_count; ++idx)
+  {
+    FreeTypeJoiningType type = freetype_joining_type_from_codepoint(codepoints[idx]);
+    if(type == FreeTypeJoiningType_Transparent || is_ligated[idx])
+    {
+      continue;
+    }
+
+    FreeTypeJoiningType before = FreeTypeJoiningType_None;
+    for(uint32_t before_idx = idx; before_idx > 0; --before_idx)
+    {
+      FreeTypeJoiningType before_type = freetype_joining_type_from_codepoint(codepoints[before_idx - 1]);
+      if(before_type != FreeTypeJoiningType_Transparent)
+      {
+        before = before_type;
+        break;
+      }
+    }
+    uint32_t after_idx = idx + 1;
+    FreeTypeJoiningType after = FreeTypeJoiningType_None;
+    for(; after_idx < codepoint_count; ++after_idx)
+    {
+      FreeTypeJoiningType after_type = freetype_joining_type_from_codepoint(codepoints[after_idx]);
+      if(after_type != FreeTypeJoiningType_Transparent)
+      {
+        after = after_type;
+        break;
+      }
+    }
+
+    bool joins_before = (type != FreeTypeJoiningType_None &&
+                         (before == FreeTypeJoiningType_Dual || before == FreeTypeJoiningType_Causing));
+    bool joins_after = ((type == FreeTypeJoiningType_Dual || type == FreeTypeJoiningType_Causing) &&
+                        after != FreeTypeJoiningType_None);
+
+    uint16_t ligature = 0;
+    if(codepoints[idx] == 0x0644 && idx + 1 < codepoint_count)
+    {
+      ligature = freetype_lam_alef_ligature(codepoints[idx + 1]);
+      ligature = ligature != 0 ? freetype_glyph_from_codepoint(font_face, ligature + (joins_before ? 1 : 0)) : 0;
+    }
+
+    if(ligature != 0)
+    {
+      glyphs[idx] = ligature;
+      is_ligated[idx + 1] = true;
+    }
+    else
+    {
+      const FreeTypeArabicLetter *letter = freetype_arabic_letter_from_codepoint(codepoints[idx]);
+      if(letter != 0 && letter->form_count >= 2)
+      {
+        uint32_t form = 0;
+        if(joins_before && joins_after && letter->form_count == 4)
+        {
+          form = 3;
+        }
+        else if(joins_after && letter->form_count == 4)
+        {
+          form = 2;
+        }
+        else if(joins_before)
+        {
+          form = 1;
+        }
+        uint16_t glyph = freetype_glyph_from_codepoint(font_face, letter->first_form + form);
+        if(glyph != 0)
+        {
+          glyphs[idx] = glyph;
+        }
+      }
+    }
+  }
+}
+
+//----------------------------------------------------------
+// hampus: shaping
+
+static bool
+freetype_shape_run(void *state, Arena *scratch, ShapingFontFace *shaping_font_face, const float font_size, const ShapingScriptAnalysis *analysis, bool is_right_to_left, const utf16_char *locale, const utf16_char *text, const uint32_t text_length, uint32_t max_glyph_count, uint16_t *cluster_map, uint16_t *glyph_indices, float *glyph_advances, GlyphOffset *glyph_offsets, uint32_t *glyph_count)
+{
+  FreeTypeFontFace *font_face = freetype_font_face_from_shaping_font_face(shaping_font_face);
+
+  // hampus: codepoints and their glyphs
+
+  uint32_t *codepoints = push_array_no_zero(scratch, uint32_t, text_length);
+  uint32_t *codepoint_positions = push_array_no_zero(scratch, uint32_t, text_length + 1);
+  uint16_t *glyphs = push_array_no_zero(scratch, uint16_t, text_length);
+  bool *is_ligated = push_array(scratch, bool, text_length);
+  uint32_t codepoint_count = 0;
+  for(uint32_t idx = 0; idx < text_length;)
+  {
+    codepoint_positions[codepoint_count] = idx;
+    idx += decode_utf16(text + idx, text_length - idx, &codepoints[codepoint_count]);
+    codepoint_count += 1;
+  }
+  codepoint_positions[codepoint_count] = text_length;
+
+  os_mutex_lock(&font_face->mutex);
+  uint16_t space_glyph = freetype_glyph_from_codepoint(font_face, ' ');
+  for(uint32_t idx = 0; idx < codepoint_count; ++idx)
+  {
+    uint32_t codepoint = is_right_to_left ? freetype_mirrored_codepoint(codepoints[idx]) : codepoints[idx];
+    glyphs[idx] = freetype_is_default_ignorable(codepoint) ? space_glyph : freetype_glyph_from_codepoint(font_face, codepoint);
+  }
+  if(analysis->script == (uint32_t)FreeTypeScript_Arabic)
+  {
+    freetype_apply_arabic_joining(font_face, codepoints, codepoint_count, glyphs, is_ligated);
+  }
+  os_mutex_unlock(&font_face->mutex);
+
+  // hampus: glyphs, clusters and positions
+
+  // NOTE(hampus): Marks join the cluster before them, and so does the alef
+  // of a lam alef ligature. Pairs of glyphs that aren't marks are kerned,
+  // and the kerning goes on the advance of the first glyph in logical order.
+  float scale = font_size / (float)font_face->design_units_per_em;
+  uint32_t count = 0;
+  uint32_t cluster_glyph = 0;
+  uint32_t base_glyph = 0;
+  bool has_base_glyph = false;
+  for(uint32_t idx = 0; idx < codepoint_count; ++idx)
+  {
+    uint32_t codepoint = codepoints[idx];
+    bool is_mark = count != 0 && freetype_is_mark(codepoint);
+    if(!is_ligated[idx])
+    {
+      if(count == max_glyph_count)
+      {
+        *glyph_count = count + 1;
+        return false;
+      }
+
+      uint16_t glyph = glyphs[idx];
+      int32_t design_advance = freetype_is_default_ignorable(codepoint) ? 0 : freetype_design_advance(font_face, glyph);
+      glyph_indices[count] = glyph;
+      glyph_advances[count] = (float)design_advance * scale;
+      glyph_offsets[count] = {};
+
+      // NOTE(hampus): Marks have no advance and fonts draw them where the
+      // pen is after their base, which is the right edge of a left-to-right
+      // base and the left edge, i.e. the origin, of a right-to-left one. So
+      // they sit on their base without an offset in either direction.
+      if(!is_mark)
+      {
+        if(has_base_glyph && font_face->kern_pair_count != 0)
+        {
+          uint16_t left = is_right_to_left ? glyph : glyph_indices[base_glyph];
+          uint16_t right = is_right_to_left ? glyph_indices[base_glyph] : glyph;
+          glyph_advances[base_glyph] += (float)freetype_design_kerning(font_face, left, right) * scale;
+        }
+        cluster_glyph = count;
+        base_glyph = count;
+        has_base_glyph = true;
+      }
+      count += 1;
+    }
+
+    for(uint32_t position = codepoint_positions[idx]; position < codepoint_positions[idx + 1]; ++position)
+    {
+      cluster_map[position] = (uint16_t)cluster_glyph;
+    }
+  }
+
+  *glyph_count = count;
+  return true;
+}
+
+static const ShapingBackendFunctions freetype_shaping_backend_functions =
+{
+  freetype_add_ref_font_face,
+  freetype_release_font_face,
+  freetype_get_design_units_per_em,
+  freetype_get_design_font_metrics,
+  freetype_get_font_properties,
+  freetype_get_glyph_indices,
+  freetype_get_design_glyph_advances,
+  freetype_map_characters,
+  freetype_get_text_complexity,
+  freetype_analyze_script_and_bidi,
+  default_analyze_line_breakpoints,
+  freetype_shape_run,
+};
+
+//----------------------------------------------------------
+// hampus: backend
+
+static FreeTypeShapingBackend *
+freetype_shaping_backend_alloc(void)
+{
+  FreeTypeShapingBackend *backend = (FreeTypeShapingBackend *)memory_alloc_zero(sizeof(FreeTypeShapingBackend));
+  os_mutex_init(&backend->mutex);
+  backend->config = FcInitLoadConfigAndFonts();
+  ASSERT(backend->config != 0);
+  backend->font_registry = shaping_font_registry_alloc(&freetype_shaping_backend_functions);
+  return backend;
+}
+
+static void
+freetype_shaping_backend_release(FreeTypeShapingBackend *backend)
+{
+  FreeTypeFontFamily *next_family = 0;
+  for(FreeTypeFontFamily *family = backend->first_family; family != 0; family = next_family)
+  {
+    next_family = family->next;
+    if(family->font_set != 0)
+    {
+      FcFontSetDestroy(family->font_set);
+    }
+    memory_free(family->font_faces);
+    memory_free(family->base_family);
+    memory_free(family->locale);
+    memory_free(family);
+  }
+
+  // NOTE(hampus): Faces still used by results or caches stay alive until
+  // those let go of them.
+  FreeTypeFontFace *next_font_face = 0;
+  for(FreeTypeFontFace *font_face = backend->first_font_face; font_face != 0; font_face = next_font_face)
+  {
+    next_font_face = font_face->next;
+    freetype_release_font_face((ShapingFontFace *)font_face);
+  }
+  shaping_font_registry_release(backend->font_registry);
+
+  FcConfigDestroy(backend->config);
+  os_mutex_destroy(&backend->mutex);
+  memory_free(backend);
+}
+
+static ShapingBackend
+freetype_shaping_backend(FreeTypeShapingBackend *backend)
+{
+  ShapingBackend result = {};
+  result.functions = &freetype_shaping_backend_functions;
+  result.state = backend;
+  result.font_registry = backend->font_registry;
+  return result;
+}
+
+static FreeTypeFontFace *
+freetype_font_face_from_segment(const MapTextToGlyphsResult *result, const TextToGlyphsSegment *segment)
+{
+  return freetype_font_face_from_shaping_font_face(shaping_font_face_from_segment(result, segment));
+}
+
+////////////////////////////////////////////////////////////
+// hampus: map text to glyphs
+
+// NOTE(hampus): The FreeType versions of the core entry points in
+// text_to_glyphs.h, like the ones in dwrite_text_to_glyphs.h.
+
+static MapTextToGlyphsResult
+freetype_map_text_to_glyphs(FreeTypeShapingBackend *freetype_backend, const utf16_char *locale, const utf16_char *base_family, const float font_size, const utf16_char *text, const uint32_t text_length, ShapingCaches *caches = 0, uint32_t flags = 0, ShapingContext *context = 0)
+{
+  ShapingBackend backend = freetype_shaping_backend(freetype_backend);
+  return map_text_to_glyphs(&backend, locale, base_family, font_size, text, text_length, caches, flags, context);
+}
+
+static MapTextToGlyphsResult
+freetype_map_utf8_text_to_glyphs(FreeTypeShapingBackend *freetype_backend, const utf16_char *locale, const utf16_char *base_family, const float font_size, const char *text, const uint32_t text_size, ShapingCaches *caches = 0, uint32_t flags = 0, ShapingContext *context = 0)
+{
+  ShapingBackend backend = freetype_shaping_backend(freetype_backend);
+  return map_utf8_text_to_glyphs(&backend, locale, base_family, font_size, text, text_size, caches, flags, context);
+}
+
+static void
+freetype_map_text_to_glyphs_batch(ShapingThreadPool *pool, FreeTypeShapingBackend *freetype_backend, const MapTextToGlyphsJob *jobs, const uint32_t job_count, MapTextToGlyphsResult *results)
+{
+  ShapingBackend backend = freetype_shaping_backend(freetype_backend);
+  map_text_to_glyphs_batch(pool, &backend, jobs, job_count, results);
+}
+
+#endif // FREETYPE_TEXT_TO_GLYPHS_H
@@ -0,0 +1,158 @@
+#include <stdio.h>
+
+#include "freetype_shaping_disk_cache.h"
+#include "freetype_software_rasterizer.h"
+
+static void
+print_map_text_to_glyphs_result(const char *name, const MapTextToGlyphsResult *result)
+{
+  printf("%s: %llu segments, %llu glyphs\n", name, (unsigned long long)result->segment_count, (unsigned long long)result->glyph_count);
+  for(uint64_t segment_idx = 0; segment_idx < result->segment_count; ++segment_idx)
+  {
+    TextToGlyphsSegment *segment = &result->segments[segment_idx];
+    FreeTypeFontFace *font_face = freetype_font_face_from_segment(result, segment);
+    printf("  text [%u, %u) level %u width %.2f %s\n",
+           segment->text_offset,
+           segment->text_offset + segment->text_length,
+           segment->bidi_level,
+           segment->run_width,
+           font_face->file_path);
+    printf("   ");
+    for(uint64_t glyph_idx = segment->first_glyph; glyph_idx < segment->first_glyph + segment->glyph_count; ++glyph_idx)
+    {
+      printf(" %u:%.2f", result->glyph_indices[glyph_idx], result->glyph_advances[glyph_idx]);
+      if(result->glyph_offsets[glyph_idx].advance_offset != 0.0f)
+      {
+        printf("@%.2f", result->glyph_offsets[glyph_idx].advance_offset);
+      }
+    }
+    printf("\n");
+  }
+}
+
+static void
+visual_segment_order(const MapTextToGlyphsResult *result, uint32_t *order)
+{
+  // NOTE(hampus): L2 of the bidi algorithm on whole segments, for one line:
+  // from the highest level down, reverse every run of segments at that level
+  // or higher.
+  uint32_t max_level = 0;
+  for(uint32_t segment_idx = 0; segment_idx < result->segment_count; ++segment_idx)
+  {
+    order[segment_idx] = segment_idx;
+    max_level = result->segments[segment_idx].bidi_level > max_level ? result->segments[segment_idx].bidi_level : max_level;
+  }
+  for(uint32_t level = max_level; level > 0; --level)
+  {
+    for(uint32_t first = 0; first < result->segment_count;)
+    {
+      if(result->segments[order[first]].bidi_level < level)
+      {
+        first += 1;
+        continue;
+      }
+      uint32_t opl = first;
+      while(opl < result->segment_count && result->segments[order[opl]].bidi_level >= level)
+      {
+        opl += 1;
+      }
+      for(uint32_t low = first, high = opl - 1; low < high; ++low, --high)
+      {
+        uint32_t swap = order[low];
+        order[low] = order[high];
+        order[high] = swap;
+      }
+      first = opl;
+    }
+  }
+}
+
+int
+main(int argument_count, char **arguments)
+{
+  //----------------------------------------------------------
+  // hampus: create freetype backend
+
+  FreeTypeShapingBackend *freetype_backend = freetype_shaping_backend_alloc();
+
+  // NOTE(hampus): Left to right with kerning, Hebrew with a point, Arabic
+  // with joining letters and a lam alef, and all of them mixed with numbers
+  // and brackets. The base family falls back to other fonts for the scripts
+  // it doesn't have.
+  struct ExampleText
+  {
+    const char *name;
+    const utf16_char *text;
+  };
+  ExampleText texts[] =
+  {
+    {"latin", u"AVATAR Wave, Tokyo"},
+    {"hebrew", u"שָׁלוֹם עוֹלָם"},
+    {"arabic", u"السلام عليكم"},
+    {"mixed", u"Hello שלום (123) مرحبا!"},
+  };
+
+  const uint32_t text_count = sizeof(texts) / sizeof(texts[0]);
+
+  //----------------------------------------------------------
+  // hampus: shape and draw the texts with the software rasterizer
+
+  const float font_size = 32.0f;
+  SoftwareRasterizer *rasterizer = software_rasterizer_alloc(freetype_glyph_outline, 0);
+  SoftwareBitmap bitmap = software_bitmap_alloc(SoftwareBitmapFormat_A8, 512, (uint32_t)(font_size * 1.5f) * text_count + 16);
+  SoftwareColor color = {1.0f, 1.0f, 1.0f, 1.0f};
+  for(uint32_t text_idx = 0; text_idx < text_count; ++text_idx)
+  {
+    const utf16_char *text = texts[text_idx].text;
+    MapTextToGlyphsResult result = freetype_map_text_to_glyphs(freetype_backend, u"en-US", u"DejaVu Serif", font_size, text, (uint32_t)utf16_length(text));
+    print_map_text_to_glyphs_result(texts[text_idx].name, &result);
+
+    uint32_t order[64];
+    ASSERT(result.segment_count <= 64);
+    visual_segment_order(&result, order);
+    float pen_x = 8.0f;
+    float baseline_y = font_size * (1.5f * text_idx + 1.25f);
+    for(uint64_t order_idx = 0; order_idx < result.segment_count; ++order_idx)
+    {
+      TextToGlyphsSegment *segment = &result.segments[order[order_idx]];
+      float baseline_x = (segment->bidi_level & 1) != 0 ? pen_x + segment->run_width : pen_x;
+      software_rasterize_segment(rasterizer, &bitmap, &result, segment, baseline_x, baseline_y, color);
+      pen_x += segment->run_width;
+    }
+    free_map_text_to_glyphs_result(&result);
+  }
+  software_bitmap_write_png(&bitmap, "freetype_example.png");
+  software_bitmap_release(&bitmap);
+  software_rasterizer_release(rasterizer);
+
+  //----------------------------------------------------------
+  // hampus: shape through a disk cache
+
+  // NOTE(hampus): The second time the example runs, the texts come from the
+  // file, with their fonts found again from their paths. Either way they
+  // have to match shaping them directly.
+  ShapingBackend backend = freetype_shaping_backend(freetype_backend);
+  ShapingDiskCache *disk_cache = shaping_disk_cache_open("freetype_example.shaping_cache", &backend, &freetype_font_file_functions, freetype_backend);
+  for(uint32_t text_idx = 0; text_idx < text_count; ++text_idx)
+  {
+    const utf16_char *text = texts[text_idx].text;
+    uint32_t text_length = (uint32_t)utf16_length(text);
+    MapTextToGlyphsResult expected = freetype_map_text_to_glyphs(freetype_backend, u"en-US", u"DejaVu Serif", font_size, text, text_length);
+    MapTextToGlyphsResult cached = map_text_to_glyphs_with_disk_cache(disk_cache, &backend, u"en-US", u"DejaVu Serif", font_size, text, text_length);
+    ASSERT(cached.segment_count == expected.segment_count && cached.glyph_count == expected.glyph_count);
+    for(uint64_t segment_idx = 0; segment_idx < cached.segment_count; ++segment_idx)
+    {
+      ASSERT(freetype_font_face_from_segment(&cached, &cached.segments[segment_idx]) == freetype_font_face_from_segment(&expected, &expected.segments[segment_idx]));
+    }
+    ASSERT(memory_match(cached.glyph_indices, expected.glyph_indices, cached.glyph_count * sizeof(uint16_t)));
+    free_map_text_to_glyphs_result(&cached);
+    free_map_text_to_glyphs_result(&expected);
+  }
+  printf("disk cache: %llu hits, %llu misses\n", (unsigned long long)disk_cache->stats.hit_count, (unsigned long long)disk_cache->stats.miss_count);
+  shaping_disk_cache_save(disk_cache);
+  shaping_disk_cache_close(disk_cache);
+
+  freetype_shaping_backend_release(freetype_backend);
+
+  return 0;
+}
@@ -0,0 +1,609 @@
+#ifndef GLYPH_ATLAS_H
+#define GLYPH_ATLAS_H
+
+#include "text_to_glyphs.h"
+
+////////////////////////////////////////////////////////////
+// hampus: glyph atlas
+
+// NOTE(hampus): A cache of rasterized glyphs. Each glyph is rasterized once
+// per (font face, em size, glyph index, subpixel x offset) into an 8-bit
+// coverage bitmap, which is packed into one of a fixed number of square
+// pages with a skyline packer. When no page has room left, the page that was
+// used least recently is emptied and reused. A page that has been used
+// during the current generation is never evicted, so the quads of one frame
+// stay valid until the frame is drawn. Call glyph_atlas_begin_generation()
+// once per frame.
+//
+// The atlas doesn't know how to rasterize. It calls a GlyphRasterizeFunction,
+// which can be backed by DirectWrite, FreeType or a software stub.
+//
+// The renderer uploads the pixels of each page's dirty rectangle to the GPU
+// and then calls glyph_atlas_page_clear_dirty().
+
+#define GLYPH_ATLAS_SUBPIXEL_COUNT 4
+
+struct GlyphBitmap
+{
+  // NOTE(hampus): left and top are the offset, in pixels, from the glyph
+  // origin on the baseline to the top-left corner of the bitmap, with y going
+  // down. coverage holds height rows of pitch bytes, one byte per pixel.
+  uint32_t width;
+  uint32_t height;
+  int32_t left;
+  int32_t top;
+  uint32_t pitch;
+  const uint8_t *coverage;
+};
+
+// NOTE(hampus): Rasterizes one glyph with its origin at (subpixel_x, 0).
+// The coverage only needs to stay alive until the function is called again,
+// and may be pushed onto `scratch`. An empty bitmap is fine, e.g. for spaces.
+// Returns false if the glyph couldn't be rasterized.
+typedef bool GlyphRasterizeFunction(void *user_data, Arena *scratch, ShapingFontFace *font_face, float em_size, uint16_t glyph_index, float subpixel_x, GlyphBitmap *bitmap);
+
+#define GLYPH_ATLAS_NO_PAGE 0xFFFFFFFF
+
+struct GlyphAtlasEntry
+{
+  GlyphAtlasEntry *hash_next;
+  GlyphAtlasEntry *page_next;
+
+  // hampus: key
+
+  ShapingFontFace *font_face;
+  float em_size;
+  uint16_t glyph_index;
+  uint8_t subpixel_x;
+
+  // NOTE(hampus): GLYPH_ATLAS_NO_PAGE for glyphs with an empty bitmap, which
+  // are cached too so that they are only rasterized once.
+  uint32_t page_idx;
+  uint16_t x;
+  uint16_t y;
+  uint16_t width;
+  uint16_t height;
+  int16_t left;
+  int16_t top;
+};
+
+struct GlyphAtlasSkylineNode
+{
+  uint16_t x;
+  uint16_t y;
+  uint16_t width;
+};
+
+struct GlyphAtlasPage
+{
+  uint8_t *pixels;
+
+  // NOTE(hampus): The skyline is the top edge of everything packed so far,
+  // as a list of horizontal segments ordered by x that cover the whole width.
+  uint32_t node_count;
+  GlyphAtlasSkylineNode *nodes;
+
+  GlyphAtlasEntry *first_entry;
+  uint32_t entry_count;
+  uint64_t last_used_generation;
+
+  // NOTE(hampus): The rectangle [dirty_x0, dirty_x1) x [dirty_y0, dirty_y1)
+  // has changed since the renderer last uploaded the page.
+  uint32_t dirty_x0;
+  uint32_t dirty_y0;
+  uint32_t dirty_x1;
+  uint32_t dirty_y1;
+};
+
+struct GlyphAtlasQuad
+{
+  uint32_t page_idx;
+
+  // NOTE(hampus): Pixel rectangle to draw to, and the matching rectangle of
+  // the page in normalized texture coordinates.
+  float x0;
+  float y0;
+  float x1;
+  float y1;
+  float u0;
+  float v0;
+  float u1;
+  float v1;
+};
+
+struct GlyphAtlasStats
+{
+  uint64_t lookup_count;
+  uint64_t hit_count;
+  uint64_t rasterize_count;
+  uint64_t eviction_count;
+
+  // NOTE(hampus): Glyphs that didn't fit anywhere, because they were larger
+  // than a page or every page was in use this generation.
+  uint64_t failed_count;
+};
+
+struct GlyphAtlas
+{
+  Arena *arena;
+  Arena *scratch;
+
+  const ShapingBackendFunctions *backend_functions;
+  GlyphRasterizeFunction *rasterize;
+  void *rasterize_user_data;
+
+  uint32_t page_size;
+  uint32_t page_count;
+  GlyphAtlasPage *pages;
+
+  uint32_t slot_count;
+  GlyphAtlasEntry **slots;
+  GlyphAtlasEntry *first_free_entry;
+
+  uint64_t generation;
+  GlyphAtlasStats stats;
+};
+
+static GlyphAtlas *
+glyph_atlas_alloc(uint32_t page_size, uint32_t page_count, GlyphRasterizeFunction *rasterize, void *rasterize_user_data)
+{
+  // NOTE(hampus): The atlas allocates page_count * page_size^2 bytes of
+  // pixels up front and never more than that.
+  ASSERT(page_size != 0 && page_size <= 0xFFFF && page_count != 0);
+  GlyphAtlas *atlas = (GlyphAtlas *)memory_alloc_zero(sizeof(GlyphAtlas));
+  atlas->arena = arena_alloc();
+  atlas->scratch = arena_alloc();
+  atlas->rasterize = rasterize;
+  atlas->rasterize_user_data = rasterize_user_data;
+  atlas->page_size = page_size;
+  atlas->page_count = page_count;
+  atlas->pages = push_array(atlas->arena, GlyphAtlasPage, page_count);
+  for(uint32_t page_idx = 0; page_idx < page_count; ++page_idx)
+  {
+    GlyphAtlasPage *page = &atlas->pages[page_idx];
+    page->pixels = (uint8_t *)memory_alloc_zero((uint64_t)page_size * page_size);
+    page->nodes = push_array(atlas->arena, GlyphAtlasSkylineNode, page_size);
+    page->node_count = 1;
+    page->nodes[0].width = (uint16_t)page_size;
+    page->dirty_x1 = page_size;
+    page->dirty_y1 = page_size;
+  }
+  atlas->slot_count = 4096;
+  atlas->slots = push_array(atlas->arena, GlyphAtlasEntry *, atlas->slot_count);
+  atlas->generation = 1;
+  return atlas;
+}
+
+static void
+glyph_atlas_release(GlyphAtlas *atlas)
+{
+  for(uint32_t slot_idx = 0; slot_idx < atlas->slot_count; ++slot_idx)
+  {
+    for(GlyphAtlasEntry *entry = atlas->slots[slot_idx]; entry != 0; entry = entry->hash_next)
+    {
+      atlas->backend_functions->release_font_face(entry->font_face);
+    }
+  }
+  for(uint32_t page_idx = 0; page_idx < atlas->page_count; ++page_idx)
+  {
+    memory_free(atlas->pages[page_idx].pixels);
+  }
+  arena_release(atlas->scratch);
+  arena_release(atlas->arena);
+  memory_free(atlas);
+}
+
+static void
+glyph_atlas_begin_generation(GlyphAtlas *atlas)
+{
+  atlas->generation += 1;
+}
+
+static void
+glyph_atlas_page_clear_dirty(GlyphAtlasPage *page)
+{
+  page->dirty_x0 = page->dirty_y0 = page->dirty_x1 = page->dirty_y1 = 0;
+}
+
+static uint64_t
+glyph_atlas_hash(ShapingFontFace *font_face, float em_size, uint16_t glyph_index, uint8_t subpixel_x)
+{
+  uint32_t em_size_bits = 0;
+  memory_copy(&em_size_bits, &em_size, sizeof(em_size_bits));
+  uint64_t hash = (uint64_t)(uintptr_t)font_face;
+  hash = (hash ^ em_size_bits) * 0x100000001B3ull;
+  hash = (hash ^ ((uint64_t)glyph_index << 8 | subpixel_x)) * 0x100000001B3ull;
+  return hash ^ (hash >> 29);
+}
+
+//----------------------------------------------------------
+// hampus: skyline packing
+
+static bool
+glyph_atlas_skyline_fit(GlyphAtlasPage *page, uint32_t page_size, uint32_t node_idx, uint32_t width, uint32_t height, uint32_t *y)
+{
+  // NOTE(hampus): Finds the lowest y at which a width wide rectangle can sit
+  // with its left edge at the start of node_idx.
+  uint32_t x = page->nodes[node_idx].x;
+  if(x + width > page_size)
+  {
+    return false;
+  }
+  uint32_t max_y = 0;
+  uint32_t width_left = width;
+  for(uint32_t idx = node_idx; width_left > 0; ++idx)
+  {
+    GlyphAtlasSkylineNode *node = &page->nodes[idx];
+    max_y = node->y > max_y ? node->y : max_y;
+    if(max_y + height > page_size)
+    {
+      return false;
+    }
+    width_left = node->width >= width_left ? 0 : width_left - node->width;
+  }
+  *y = max_y;
+  return true;
+}
+
+static bool
+glyph_atlas_skyline_pack(GlyphAtlasPage *page, uint32_t page_size, uint32_t width, uint32_t height, uint32_t *x, uint32_t *y)
+{
+  // NOTE(hampus): Bottom-left: put the rectangle where its bottom edge ends
+  // up lowest, breaking ties by the narrowest node so wide gaps are kept for
+  // wide glyphs.
+  uint32_t best_node_idx = 0;
+  uint32_t best_bottom = UINT32_MAX;
+  uint32_t best_width = UINT32_MAX;
+  uint32_t best_y = 0;
+  for(uint32_t node_idx = 0; node_idx < page->node_count; ++node_idx)
+  {
+    uint32_t fit_y = 0;
+    if(glyph_atlas_skyline_fit(page, page_size, node_idx, width, height, &fit_y))
+    {
+      uint32_t bottom = fit_y + height;
+      uint32_t node_width = page->nodes[node_idx].width;
+      if(bottom < best_bottom || (bottom == best_bottom && node_width < best_width))
+      {
+        best_node_idx = node_idx;
+        best_bottom = bottom;
+        best_width = node_width;
+        best_y = fit_y;
+      }
+    }
+  }
+  if(best_bottom == UINT32_MAX)
+  {
+    return false;
+  }
+
+  // hampus: raise the skyline under the new rectangle
+
+  GlyphAtlasSkylineNode new_node = {};
+  new_node.x = page->nodes[best_node_idx].x;
+  new_node.y = (uint16_t)(best_y + height);
+  new_node.width = (uint16_t)width;
+
+  uint32_t right = new_node.x + width;
+  uint32_t end_idx = best_node_idx;
+  while(end_idx < page->node_count && page->nodes[end_idx].x + page->nodes[end_idx].width <= right)
+  {
+    end_idx += 1;
+  }
+  if(end_idx < page->node_count && page->nodes[end_idx].x < right)
+  {
+    // NOTE(hampus): The last node is only partly covered, keep its right part
+    GlyphAtlasSkylineNode *node = &page->nodes[end_idx];
+    node->width = (uint16_t)(node->x + node->width - right);
+    node->x = (uint16_t)right;
+  }
+
+  // NOTE(hampus): Replace [best_node_idx, end_idx) with the new node
+  uint32_t removed_count = end_idx - best_node_idx;
+  if(removed_count == 0)
+  {
+    memmove(page->nodes + best_node_idx + 1, page->nodes + best_node_idx, sizeof(GlyphAtlasSkylineNode) * (page->node_count - best_node_idx));
+    page->node_count += 1;
+  }
+  else if(removed_count > 1)
+  {
+    memmove(page->nodes + best_node_idx + 1, page->nodes + end_idx, sizeof(GlyphAtlasSkylineNode) * (page->node_count - end_idx));
+    page->node_count -= removed_count - 1;
+  }
+  page->nodes[best_node_idx] = new_node;
+  ASSERT(page->node_count <= page_size);
+
+  // hampus: merge neighbours of the same height
+
+  for(uint32_t node_idx = 0; node_idx + 1 < page->node_count;)
+  {
+    GlyphAtlasSkylineNode *node = &page->nodes[node_idx];
+    GlyphAtlasSkylineNode *next = &page->nodes[node_idx + 1];
+    if(node->y == next->y)
+    {
+      node->width = (uint16_t)(node->width + next->width);
+      memmove(next, next + 1, sizeof(GlyphAtlasSkylineNode) * (page->node_count - node_idx - 2));
+      page->node_count -= 1;
+    }
+    else
+    {
+      node_idx += 1;
+    }
+  }
+
+  *x = new_node.x;
+  *y = best_y;
+  return true;
+}
+
+//----------------------------------------------------------
+// hampus: eviction
+
+static void
+glyph_atlas_page_evict(GlyphAtlas *atlas, uint32_t page_idx)
+{
+  GlyphAtlasPage *page = &atlas->pages[page_idx];
+  GlyphAtlasEntry *next = 0;
+  for(GlyphAtlasEntry *entry = page->first_entry; entry != 0; entry = next)
+  {
+    next = entry->page_next;
+
+    uint64_t slot_idx = glyph_atlas_hash(entry->font_face, entry->em_size, entry->glyph_index, entry->subpixel_x) & (atlas->slot_count - 1);
+    GlyphAtlasEntry **link = &atlas->slots[slot_idx];
+    while(*link != entry)
+    {
+      link = &(*link)->hash_next;
+    }
+    *link = entry->hash_next;
+
+    atlas->backend_functions->release_font_face(entry->font_face);
+    entry->hash_next = atlas->first_free_entry;
+    atlas->first_free_entry = entry;
+  }
+
+  page->first_entry = 0;
+  page->entry_count = 0;
+  page->node_count = 1;
+  page->nodes[0] = {};
+  page->nodes[0].width = (uint16_t)atlas->page_size;
+  memset(page->pixels, 0, (uint64_t)atlas->page_size * atlas->page_size);
+  page->dirty_x0 = page->dirty_y0 = 0;
+  page->dirty_x1 = page->dirty_y1 = atlas->page_size;
+  atlas->stats.eviction_count += 1;
+}
+
+static bool
+glyph_atlas_place(GlyphAtlas *atlas, uint32_t width, uint32_t height, uint32_t *page_idx, uint32_t *x, uint32_t *y)
+{
+  // NOTE(hampus): Leave a pixel of padding to the right of and below every
+  // glyph so that filtering never picks up a neighbour.
+  uint32_t padded_width = width + 1;
+  uint32_t padded_height = height + 1;
+  if(padded_width > atlas->page_size || padded_height > atlas->page_size)
+  {
+    return false;
+  }
+
+  for(uint32_t idx = 0; idx < atlas->page_count; ++idx)
+  {
+    if(glyph_atlas_skyline_pack(&atlas->pages[idx], atlas->page_size, padded_width, padded_height, x, y))
+    {
+      *page_idx = idx;
+      return true;
+    }
+  }
+
+  // NOTE(hampus): Every page is full, evict the least recently used one
+  // that the current generation hasn't touched.
+  uint32_t lru_page_idx = GLYPH_ATLAS_NO_PAGE;
+  uint64_t lru_generation = atlas->generation;
+  for(uint32_t idx = 0; idx < atlas->page_count; ++idx)
+  {
+    if(atlas->pages[idx].last_used_generation < lru_generation)
+    {
+      lru_generation = atlas->pages[idx].last_used_generation;
+      lru_page_idx = idx;
+    }
+  }
+  if(lru_page_idx == GLYPH_ATLAS_NO_PAGE)
+  {
+    return false;
+  }
+
+  glyph_atlas_page_evict(atlas, lru_page_idx);
+  bool packed = glyph_atlas_skyline_pack(&atlas->pages[lru_page_idx], atlas->page_size, padded_width, padded_height, x, y);
+  ASSERT(packed);
+  *page_idx = lru_page_idx;
+  return true;
+}
+
+//----------------------------------------------------------
+// hampus: lookup
+
+static GlyphAtlasEntry *
+glyph_atlas_entry_from_glyph(GlyphAtlas *atlas, const ShapingBackendFunctions *backend_functions, ShapingFontFace *font_face, float em_size, uint16_t glyph_index, uint8_t subpixel_x)
+{
+  // NOTE(hampus): Returns the glyph's entry, rasterizing and packing it if
+  // it isn't in the atlas yet. Returns 0 if it couldn't be placed.
+  ASSERT(atlas->backend_functions == 0 || atlas->backend_functions == backend_functions);
+  atlas->backend_functions = backend_functions;
+  atlas->stats.lookup_count += 1;
+
+  uint64_t slot_idx = glyph_atlas_hash(font_face, em_size, glyph_index, subpixel_x) & (atlas->slot_count - 1);
+  GlyphAtlasEntry *entry = atlas->slots[slot_idx];
+  for(; entry != 0; entry = entry->hash_next)
+  {
+    if(entry->font_face == font_face && entry->em_size == em_size && entry->glyph_index == glyph_index && entry->subpixel_x == subpixel_x)
+    {
+      break;
+    }
+  }
+
+  if(entry != 0)
+  {
+    atlas->stats.hit_count += 1;
+  }
+  else
+  {
+    uint64_t scratch_pos = arena_pos(atlas->scratch);
+    GlyphBitmap bitmap = {};
+    float subpixel_offset = (float)subpixel_x / (float)GLYPH_ATLAS_SUBPIXEL_COUNT;
+    bool rasterized = atlas->rasterize(atlas->rasterize_user_data, atlas->scratch, font_face, em_size, glyph_index, subpixel_offset, &bitmap);
+    atlas->stats.rasterize_count += 1;
+
+    uint32_t page_idx = GLYPH_ATLAS_NO_PAGE;
+    uint32_t x = 0;
+    uint32_t y = 0;
+    bool is_empty = bitmap.width == 0 || bitmap.height == 0;
+    if(!rasterized || (!is_empty && !glyph_atlas_place(atlas, bitmap.width, bitmap.height, &page_idx, &x, &y)))
+    {
+      atlas->stats.failed_count += 1;
+      arena_pop_to(atlas->scratch, scratch_pos);
+      return 0;
+    }
+
+    entry = atlas->first_free_entry;
+    if(entry != 0)
+    {
+      atlas->first_free_entry = entry->hash_next;
+    }
+    else
+    {
+      entry = push_array_no_zero(atlas->arena, GlyphAtlasEntry, 1);
+    }
+    *entry = {};
+    entry->font_face = font_face;
+    entry->em_size = em_size;
+    entry->glyph_index = glyph_index;
+    entry->subpixel_x = subpixel_x;
+    entry->page_idx = page_idx;
+    entry->x = (uint16_t)x;
+    entry->y = (uint16_t)y;
+    entry->width = (uint16_t)bitmap.width;
+    entry->height = (uint16_t)bitmap.height;
+    entry->left = (int16_t)bitmap.left;
+    entry->top = (int16_t)bitmap.top;
+    backend_functions->add_ref_font_face(font_face);
+
+    entry->hash_next = atlas->slots[slot_idx];
+    atlas->slots[slot_idx] = entry;
+
+    if(page_idx != GLYPH_ATLAS_NO_PAGE)
+    {
+      GlyphAtlasPage *page = &atlas->pages[page_idx];
+      entry->page_next = page->first_entry;
+      page->first_entry = entry;
+      page->entry_count += 1;
+
+      for(uint32_t row = 0; row < bitmap.height; ++row)
+      {
+        memory_copy(page->pixels + (uint64_t)(y + row) * atlas->page_size + x, bitmap.coverage + (uint64_t)row * bitmap.pitch, bitmap.width);
+      }
+
+      if(page->dirty_x1 == 0)
+      {
+        page->dirty_x0 = x;
+        page->dirty_y0 = y;
+        page->dirty_x1 = x + bitmap.width;
+        page->dirty_y1 = y + bitmap.height;
+      }
+      else
+      {
+        page->dirty_x0 = x < page->dirty_x0 ? x : page->dirty_x0;
+        page->dirty_y0 = y < page->dirty_y0 ? y : page->dirty_y0;
+        page->dirty_x1 = x + bitmap.width > page->dirty_x1 ? x + bitmap.width : page->dirty_x1;
+        page->dirty_y1 = y + bitmap.height > page->dirty_y1 ? y + bitmap.height : page->dirty_y1;
+      }
+    }
+    arena_pop_to(atlas->scratch, scratch_pos);
+  }
+
+  if(entry->page_idx != GLYPH_ATLAS_NO_PAGE)
+  {
+    atlas->pages[entry->page_idx].last_used_generation = atlas->generation;
+  }
+  return entry;
+}
+
+static GlyphAtlasQuad *
+glyph_atlas_quads_from_glyphs(GlyphAtlas *atlas, Arena *arena, const ShapingBackendFunctions *backend_functions, ShapingFontFace *font_face, float em_size, bool is_right_to_left, const uint16_t *glyph_indices, const float *glyph_advances, const GlyphOffset *glyph_offsets, uint64_t glyph_count, float baseline_x, float baseline_y, float pixels_per_dip, uint32_t *quad_count)
+{
+  // NOTE(hampus): One quad per visible glyph of the run, pushed onto
+  // `arena`. The baseline origin is the same one DrawGlyphRun would get, so
+  // for right to left runs it is the right end of the run. Glyphs with
+  // nothing to draw, or that didn't fit in the atlas, get no quad.
+  //
+  // The em size, advances, offsets and baseline are in DIPs. The glyphs are
+  // rasterized and the quads placed in pixels, pixels_per_dip to the DIP,
+  // so that text stays sharp on high DPI displays.
+  GlyphAtlasQuad *quads = push_array_no_zero(arena, GlyphAtlasQuad, glyph_count);
+  uint32_t count = 0;
+  float inverse_page_size = 1.0f / (float)atlas->page_size;
+
+  float *pen_positions = push_array_no_zero(arena, float, glyph_count);
+  glyph_positions_from_advances(glyph_advances, 0.0f, pen_positions, glyph_count);
+  for(uint64_t glyph_idx = 0; glyph_idx < glyph_count; ++glyph_idx)
+  {
+    float glyph_x = 0;
+    if(is_right_to_left)
+    {
+      glyph_x = baseline_x - pen_positions[glyph_idx] - glyph_advances[glyph_idx] - glyph_offsets[glyph_idx].advance_offset;
+    }
+    else
+    {
+      glyph_x = baseline_x + pen_positions[glyph_idx] + glyph_offsets[glyph_idx].advance_offset;
+    }
+    float glyph_y = baseline_y - glyph_offsets[glyph_idx].ascender_offset;
+    glyph_x *= pixels_per_dip;
+    glyph_y *= pixels_per_dip;
+
+    // NOTE(hampus): Snap to whole pixels, and rasterize the fraction of x
+    // into the glyph
+    float floor_x = (float)(int32_t)glyph_x;
+    floor_x -= floor_x > glyph_x ? 1.0f : 0.0f;
+    uint8_t subpixel_x = (uint8_t)((glyph_x - floor_x) * GLYPH_ATLAS_SUBPIXEL_COUNT);
+    subpixel_x = subpixel_x < GLYPH_ATLAS_SUBPIXEL_COUNT ? subpixel_x : GLYPH_ATLAS_SUBPIXEL_COUNT - 1;
+    float floor_y = (float)(int32_t)(glyph_y + 0.5f);
+
+    GlyphAtlasEntry *entry = glyph_atlas_entry_from_glyph(atlas, backend_functions, font_face, em_size * pixels_per_dip, glyph_indices[glyph_idx], subpixel_x);
+    if(entry == 0 || entry->page_idx == GLYPH_ATLAS_NO_PAGE)
+    {
+      continue;
+    }
+
+    GlyphAtlasQuad *quad = &quads[count];
+    count += 1;
+    quad->page_idx = entry->page_idx;
+    quad->x0 = floor_x + entry->left;
+    quad->y0 = floor_y + entry->top;
+    quad->x1 = quad->x0 + entry->width;
+    quad->y1 = quad->y0 + entry->height;
+    quad->u0 = entry->x * inverse_page_size;
+    quad->v0 = entry->y * inverse_page_size;
+    quad->u1 = (entry->x + entry->width) * inverse_page_size;
+    quad->v1 = (entry->y + entry->height) * inverse_page_size;
+  }
+
+  *quad_count = count;
+  return quads;
+}
+
+static GlyphAtlasQuad *
+glyph_atlas_quads_from_segment(GlyphAtlas *atlas, Arena *arena, const MapTextToGlyphsResult *result, const TextToGlyphsSegment *segment, float baseline_x, float baseline_y, float pixels_per_dip, uint32_t *quad_count)
+{
+  return glyph_atlas_quads_from_glyphs(atlas,
+                                       arena,
+                                       result->backend_functions,
+                                       shaping_font_face_from_segment(result, segment),
+                                       segment->font_size_em,
+                                       (segment->bidi_level & 1) != 0,
+                                       result->glyph_indices + segment->first_glyph,
+                                       result->glyph_advances + segment->first_glyph,
+                                       result->glyph_offsets + segment->first_glyph,
+                                       segment->glyph_count,
+                                       baseline_x,
+                                       baseline_y,
+                                       pixels_per_dip,
+                                       quad_count);
+}
+
+#endif // GLYPH_ATLAS_H
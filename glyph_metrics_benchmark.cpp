@@ -0,0 +1,258 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "text_to_glyphs.h"
+
+////////////////////////////////////////////////////////////
+// hampus: inputs
+
+struct GlyphMetricsInput
+{
+  uint64_t glyph_count;
+  int32_t *design_advances;
+  float *advances;
+  float *expected;
+  float *actual;
+
+  // NOTE(hampus): Two points per glyph, like the lines of an outline
+  float *points;
+};
+
+static uint32_t
+glyph_metrics_random(uint32_t *state)
+{
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+  return x;
+}
+
+static GlyphMetricsInput
+glyph_metrics_input_alloc(uint64_t glyph_count)
+{
+  // NOTE(hampus): Advances between 200 and 1400 design units, the spread of
+  // a proportional latin font
+  GlyphMetricsInput input = {};
+  input.glyph_count = glyph_count;
+  input.design_advances = (int32_t *)memory_alloc(sizeof(int32_t) * glyph_count);
+  input.advances = (float *)memory_alloc(sizeof(float) * glyph_count);
+  input.expected = (float *)memory_alloc(sizeof(float) * glyph_count);
+  input.actual = (float *)memory_alloc(sizeof(float) * glyph_count);
+  input.points = (float *)memory_alloc(sizeof(float) * glyph_count * 4);
+  uint32_t random_state = 0x9E3779B9u;
+  for(uint64_t idx = 0; idx < glyph_count; ++idx)
+  {
+    input.design_advances[idx] = 200 + (int32_t)(glyph_metrics_random(&random_state) % 1200);
+    input.advances[idx] = (float)input.design_advances[idx] * (16.0f / 2048.0f);
+  }
+  for(uint64_t idx = 0; idx < glyph_count * 4; ++idx)
+  {
+    input.points[idx] = (float)(int32_t)(glyph_metrics_random(&random_state) % 4096) * 0.01f - 20.0f;
+  }
+  return input;
+}
+
+static void
+glyph_metrics_input_release(GlyphMetricsInput *input)
+{
+  memory_free(input->points);
+  memory_free(input->actual);
+  memory_free(input->expected);
+  memory_free(input->advances);
+  memory_free(input->design_advances);
+}
+
+static float
+glyph_metrics_max_difference(const float *a, const float *b, uint64_t count)
+{
+  float max_difference = 0;
+  for(uint64_t idx = 0; idx < count; ++idx)
+  {
+    float difference = a[idx] > b[idx] ? a[idx] - b[idx] : b[idx] - a[idx];
+    max_difference = difference > max_difference ? difference : max_difference;
+  }
+  return max_difference;
+}
+
+static void
+glyph_metrics_print(const char *name, uint64_t glyph_count, uint32_t iteration_count, uint64_t scalar_ns, uint64_t kernel_ns, float max_difference)
+{
+  double glyphs = (double)glyph_count * iteration_count;
+  printf("%-10s %8llu %14.3f %14.3f %8.2fx %12.3g\n",
+         name,
+         (unsigned long long)glyph_count,
+         (double)scalar_ns / glyphs,
+         (double)kernel_ns / glyphs,
+         (double)scalar_ns / (double)(kernel_ns != 0 ? kernel_ns : 1),
+         (double)max_difference);
+}
+
+// NOTE(hampus): Keeps the compiler from throwing away sums nobody reads
+static volatile float glyph_metrics_sink;
+
+////////////////////////////////////////////////////////////
+// hampus: kernels
+
+static void
+benchmark_design_scale(GlyphMetricsInput *input, uint32_t iteration_count)
+{
+  uint64_t count = input->glyph_count;
+  float scale = 16.0f / 2048.0f;
+  glyph_advances_from_design_advances_scalar(input->design_advances, scale, input->expected, count);
+  glyph_advances_from_design_advances(input->design_advances, scale, input->actual, count);
+  float max_difference = glyph_metrics_max_difference(input->expected, input->actual, count);
+  ASSERT(max_difference == 0);
+
+  uint64_t scalar_begin = os_now_ns();
+  for(uint32_t iteration_idx = 0; iteration_idx < iteration_count; ++iteration_idx)
+  {
+    glyph_advances_from_design_advances_scalar(input->design_advances, scale, input->expected, count);
+  }
+  uint64_t scalar_end = os_now_ns();
+  for(uint32_t iteration_idx = 0; iteration_idx < iteration_count; ++iteration_idx)
+  {
+    glyph_advances_from_design_advances(input->design_advances, scale, input->actual, count);
+  }
+  uint64_t kernel_end = os_now_ns();
+
+  glyph_metrics_print("scale", count, iteration_count, scalar_end - scalar_begin, kernel_end - scalar_end, max_difference);
+}
+
+static void
+benchmark_run_width(GlyphMetricsInput *input, uint32_t iteration_count)
+{
+  // NOTE(hampus): The sums add in a different order, so only relative
+  // agreement is expected
+  uint64_t count = input->glyph_count;
+  float expected = glyph_advances_sum_scalar(input->advances, count);
+  float actual = glyph_advances_sum(input->advances, count);
+  float max_difference = expected > actual ? expected - actual : actual - expected;
+  ASSERT(max_difference <= 1e-4f * expected + 1e-3f);
+
+  uint64_t scalar_begin = os_now_ns();
+  for(uint32_t iteration_idx = 0; iteration_idx < iteration_count; ++iteration_idx)
+  {
+    glyph_metrics_sink = glyph_advances_sum_scalar(input->advances, count);
+  }
+  uint64_t scalar_end = os_now_ns();
+  for(uint32_t iteration_idx = 0; iteration_idx < iteration_count; ++iteration_idx)
+  {
+    glyph_metrics_sink = glyph_advances_sum(input->advances, count);
+  }
+  uint64_t kernel_end = os_now_ns();
+
+  glyph_metrics_print("width", count, iteration_count, scalar_end - scalar_begin, kernel_end - scalar_end, max_difference);
+}
+
+static void
+benchmark_prefix_sum(GlyphMetricsInput *input, uint32_t iteration_count)
+{
+  uint64_t count = input->glyph_count;
+  float origin = 8.25f;
+  glyph_positions_from_advances_scalar(input->advances, origin, input->expected, count);
+  glyph_positions_from_advances(input->advances, origin, input->actual, count);
+  float max_difference = glyph_metrics_max_difference(input->expected, input->actual, count);
+  float run_width = input->expected[count - 1];
+  ASSERT(max_difference <= 1e-4f * run_width + 1e-3f);
+
+  uint64_t scalar_begin = os_now_ns();
+  for(uint32_t iteration_idx = 0; iteration_idx < iteration_count; ++iteration_idx)
+  {
+    glyph_positions_from_advances_scalar(input->advances, origin, input->expected, count);
+  }
+  uint64_t scalar_end = os_now_ns();
+  for(uint32_t iteration_idx = 0; iteration_idx < iteration_count; ++iteration_idx)
+  {
+    glyph_positions_from_advances(input->advances, origin, input->actual, count);
+  }
+  uint64_t kernel_end = os_now_ns();
+
+  glyph_metrics_print("positions", count, iteration_count, scalar_end - scalar_begin, kernel_end - scalar_end, max_difference);
+}
+
+static void
+benchmark_bounds(GlyphMetricsInput *input, uint32_t iteration_count)
+{
+  uint64_t count = input->glyph_count;
+  uint64_t point_count = count * 2;
+  GlyphBounds expected = glyph_bounds_empty();
+  GlyphBounds actual = glyph_bounds_empty();
+  glyph_bounds_from_points_scalar(input->points, point_count, &expected);
+  glyph_bounds_from_points(input->points, point_count, &actual);
+  ASSERT(memory_match(&expected, &actual, sizeof(GlyphBounds)));
+
+  uint64_t scalar_begin = os_now_ns();
+  for(uint32_t iteration_idx = 0; iteration_idx < iteration_count; ++iteration_idx)
+  {
+    GlyphBounds bounds = glyph_bounds_empty();
+    glyph_bounds_from_points_scalar(input->points, point_count, &bounds);
+    glyph_metrics_sink = bounds.max_x;
+  }
+  uint64_t scalar_end = os_now_ns();
+  for(uint32_t iteration_idx = 0; iteration_idx < iteration_count; ++iteration_idx)
+  {
+    GlyphBounds bounds = glyph_bounds_empty();
+    glyph_bounds_from_points(input->points, point_count, &bounds);
+    glyph_metrics_sink = bounds.max_x;
+  }
+  uint64_t kernel_end = os_now_ns();
+
+  glyph_metrics_print("bounds", count, iteration_count, scalar_end - scalar_begin, kernel_end - scalar_end, 0);
+}
+
+////////////////////////////////////////////////////////////
+// hampus: main
+
+int
+main(int argc, char **argv)
+{
+  // NOTE(hampus): Pass the number of glyphs to process per kernel and run
+  // length to trade run time for stable numbers.
+  uint64_t glyphs_per_run_length = 1 << 26;
+  if(argc > 1)
+  {
+    glyphs_per_run_length = strtoull(argv[1], 0, 10);
+  }
+
+  MemoryAccounting *memory_accounting = memory_accounting_alloc();
+  memory_set_allocator(memory_accounting_allocator(memory_accounting));
+
+  const char *kernel_name = SIMD_AVX2 ? "avx2" : SIMD_SSE2 ? "sse2" : "scalar";
+  printf("glyph metric kernels (%s)\n", kernel_name);
+  printf("%-10s %8s %14s %14s %9s %12s\n", "kernel", "glyphs", "scalar ns/gl", "kernel ns/gl", "speedup", "max diff");
+
+  uint64_t run_lengths[] = {16, 256, 4096, 65536, 1 << 20};
+  for(uint32_t length_idx = 0; length_idx < sizeof(run_lengths) / sizeof(run_lengths[0]); ++length_idx)
+  {
+    uint64_t glyph_count = run_lengths[length_idx];
+    uint64_t iteration_count = glyphs_per_run_length / glyph_count;
+    iteration_count = iteration_count != 0 ? iteration_count : 1;
+
+    GlyphMetricsInput input = glyph_metrics_input_alloc(glyph_count);
+    benchmark_design_scale(&input, (uint32_t)iteration_count);
+    benchmark_run_width(&input, (uint32_t)iteration_count);
+    benchmark_prefix_sum(&input, (uint32_t)iteration_count);
+    benchmark_bounds(&input, (uint32_t)iteration_count);
+    glyph_metrics_input_release(&input);
+  }
+
+  //----------------------------------------------------------
+  // hampus: leaks
+
+  MemoryCallSite leaks[32];
+  uint32_t leak_count = memory_accounting_call_sites(memory_accounting, true, leaks, 32);
+  for(uint32_t leak_idx = 0; leak_idx < leak_count && leak_idx < 32; ++leak_idx)
+  {
+    MemoryCallSite *site = &leaks[leak_idx];
+    printf("leak: %s(%d): %llu bytes in %llu allocations\n", site->file, site->line, (unsigned long long)site->live_bytes, (unsigned long long)site->live_count);
+  }
+  ASSERT(leak_count == 0);
+
+  memory_set_allocator(0);
+  memory_accounting_release(memory_accounting);
+
+  return 0;
+}
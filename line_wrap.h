@@ -0,0 +1,394 @@
+#ifndef LINE_WRAP_H
+#define LINE_WRAP_H
+
+#include "text_to_glyphs.h"
+
+////////////////////////////////////////////////////////////
+// hampus: line wrapping
+
+// NOTE(hampus): Breaks a shaped text into lines that fit a width, without
+// shaping anything again. The result has to be shaped with
+// MapTextToGlyphsFlag_LineBreakpoints. line_wrapper_alloc() works out, once,
+// every place a line may end and how wide the text up to there is, and
+// line_wrap() then only looks at those, so wrapping again at a new width is
+// cheap enough to do on every resize.
+//
+// Widths are measured in logical order, which is all a line's width depends
+// on, even when bidi reorders the glyphs within it. Whitespace at the end of
+// a line hangs past the width, the way every text editor does it.
+//
+// A line that wraps after a soft hyphen inside a word shows a hyphen there,
+// and is measured with the hyphen instead of the soft hyphen. The hyphen is the '-' glyph of
+// the soft hyphen's font. The renderer draws it after the line's glyphs, see
+// LineWrapLine::hyphen_glyph.
+
+enum LineWrapMode
+{
+  // NOTE(hampus): Fits as much as possible on each line, line by line
+  LineWrapMode_Greedy,
+
+  // NOTE(hampus): Picks the breaks of each paragraph that leave the least
+  // squared slack over all of its lines, except the last, like Knuth and
+  // Plass do. Costs more, and gives more even right edges.
+  LineWrapMode_Optimal,
+};
+
+struct LineWrapBreak
+{
+  // NOTE(hampus): A line may end before this character
+  uint32_t text_position;
+  bool is_mandatory;
+
+  // NOTE(hampus): The width of the text before the break, from the start of
+  // the text, with and without the whitespace right before it. A soft
+  // hyphen right before the break is left out of trimmed_x, and a line that
+  // ends here is hyphen_advance wider instead.
+  float x;
+  float trimmed_x;
+
+  // NOTE(hampus): hyphen_glyph is 0 unless a line that ends here shows a
+  // hyphen
+  uint16_t hyphen_font_id;
+  uint16_t hyphen_glyph;
+  float hyphen_advance;
+
+  // NOTE(hampus): The first glyph after the break
+  uint64_t glyph;
+};
+
+struct LineWrapLine
+{
+  uint32_t text_offset;
+  uint32_t text_length;
+
+  // NOTE(hampus): The line's glyphs in the result's glyph arrays
+  uint64_t first_glyph;
+  uint64_t glyph_count;
+
+  // NOTE(hampus): Without the whitespace at the end, and with the hyphen
+  float width;
+
+  // NOTE(hampus): When hyphen_glyph isn't 0, the line ends in a soft hyphen
+  // and shows this glyph of the result's font hyphen_font_id in its place,
+  // hyphen_x from the start of the line.
+  uint16_t hyphen_font_id;
+  uint16_t hyphen_glyph;
+  float hyphen_x;
+
+  // NOTE(hampus): The line was ended by a mandatory break or the end of the
+  // text, and not because the next word didn't fit.
+  bool ends_paragraph;
+};
+
+struct LineWrapper
+{
+  Arena *arena;
+  Arena *scratch;
+  uint32_t text_length;
+
+  // NOTE(hampus): breaks[0] is the start of the text, and the last break is
+  // the end of the text. Both count as mandatory.
+  uint32_t break_count;
+  LineWrapBreak *breaks;
+
+  // NOTE(hampus): For every break, the index of the first mandatory break
+  // after it
+  uint32_t *next_mandatory;
+};
+
+static void
+line_wrap_break_set_hyphen(LineWrapBreak *line_break, const MapTextToGlyphsResult *result, uint32_t soft_hyphen_position)
+{
+  // NOTE(hampus): The '-' of the font the soft hyphen was shaped with. Text
+  // that no font could map, and fonts without a '-', get no hyphen.
+  line_break->hyphen_font_id = 0;
+  line_break->hyphen_glyph = 0;
+  line_break->hyphen_advance = 0;
+  const TextToGlyphsSegment *segment = segment_from_text_position(result, soft_hyphen_position);
+  if(segment != 0)
+  {
+    const ShapingFontInfo *font_info = shaping_font_info_from_segment(result, segment);
+    const ShapingBackendFunctions *functions = result->font_registry->backend_functions;
+    uint32_t hyphen = '-';
+    uint16_t glyph = 0;
+    functions->get_glyph_indices(font_info->font_face, &hyphen, 1, &glyph);
+    if(glyph != 0)
+    {
+      int32_t design_advance = 0;
+      functions->get_design_glyph_advances(font_info->font_face, &glyph, 1, &design_advance);
+      line_break->hyphen_font_id = segment->font_id;
+      line_break->hyphen_glyph = glyph;
+      line_break->hyphen_advance = (float)design_advance * (segment->font_size_em / (float)font_info->metrics.design_units_per_em);
+    }
+  }
+}
+
+static LineWrapper *
+line_wrapper_alloc(const MapTextToGlyphsResult *result)
+{
+  // NOTE(hampus): Only reads the result while building, so the result can
+  // be freed before the wrapper as long as the lines aren't used to look
+  // into it. The result must not have gaps from an edit, see
+  // close_text_to_glyphs_gaps().
+  ASSERT(result->line_breakpoints != 0);
+  ASSERT(result->glyph_gap_length == 0 && result->text_gap_length == 0);
+  LineWrapper *wrapper = (LineWrapper *)memory_alloc_zero(sizeof(LineWrapper));
+  wrapper->arena = arena_alloc();
+  wrapper->scratch = arena_alloc();
+  wrapper->text_length = result->text_length;
+
+  //----------------------------------------------------------
+  // hampus: the width up to every glyph
+
+  float *glyph_x = push_array_no_zero(wrapper->scratch, float, result->glyph_count + 1);
+  glyph_positions_from_advances(result->glyph_advances, 0.0f, glyph_x, result->glyph_count);
+  glyph_x[result->glyph_count] = result->glyph_count != 0 ? glyph_x[result->glyph_count - 1] + result->glyph_advances[result->glyph_count - 1] : 0.0f;
+
+  //----------------------------------------------------------
+  // hampus: collect the breaks
+
+  // NOTE(hampus): At most one break per character, plus the start and end
+  uint32_t text_length = result->text_length;
+  const LineBreakpoint *breakpoints = result->line_breakpoints;
+  LineWrapBreak *breaks = push_array_no_zero(wrapper->arena, LineWrapBreak, text_length + 2);
+  uint32_t break_count = 0;
+
+  LineWrapBreak *start = &breaks[break_count++];
+  start->text_position = 0;
+  start->is_mandatory = true;
+  start->x = 0;
+  start->trimmed_x = 0;
+  start->glyph = 0;
+  start->hyphen_font_id = 0;
+  start->hyphen_glyph = 0;
+  start->hyphen_advance = 0;
+
+  uint32_t content_end = 0;
+  for(uint32_t position = 1; position <= text_length; ++position)
+  {
+    if(!breakpoints[position - 1].is_whitespace)
+    {
+      content_end = position;
+    }
+
+    bool is_end = position == text_length;
+    LineBreakCondition condition = is_end ? LineBreakCondition_MustBreak : line_break_condition_between(breakpoints[position - 1], breakpoints[position]);
+    if(condition != LineBreakCondition_CanBreak && condition != LineBreakCondition_MustBreak)
+    {
+      continue;
+    }
+
+    // NOTE(hampus): Never end a line inside a cluster, e.g. a ligature,
+    // unless the text says so
+    uint64_t glyph = is_end ? result->glyph_count : result->cluster_map[position];
+    if(!is_end && condition != LineBreakCondition_MustBreak && glyph == result->cluster_map[position - 1])
+    {
+      continue;
+    }
+
+    LineWrapBreak *line_break = &breaks[break_count++];
+    line_break->text_position = position;
+    line_break->is_mandatory = condition == LineBreakCondition_MustBreak;
+    line_break->x = glyph_x[glyph];
+    line_break->glyph = glyph;
+
+    // NOTE(hampus): A soft hyphen is only shown where a line wraps inside a
+    // word, not at the end of a paragraph or before whitespace
+    uint32_t trimmed_end = content_end;
+    bool is_hyphenated = (!line_break->is_mandatory &&
+                          breakpoints[position - 1].is_soft_hyphen &&
+                          !breakpoints[position].is_whitespace);
+    if(is_hyphenated)
+    {
+      trimmed_end = position - 1;
+      line_wrap_break_set_hyphen(line_break, result, position - 1);
+    }
+    else
+    {
+      line_break->hyphen_font_id = 0;
+      line_break->hyphen_glyph = 0;
+      line_break->hyphen_advance = 0;
+    }
+    uint64_t content_glyph = trimmed_end < text_length ? result->cluster_map[trimmed_end] : result->glyph_count;
+    line_break->trimmed_x = glyph_x[content_glyph];
+  }
+
+  //----------------------------------------------------------
+  // hampus: link up the mandatory breaks
+
+  uint32_t *next_mandatory = push_array_no_zero(wrapper->arena, uint32_t, break_count);
+  uint32_t next = break_count - 1;
+  for(uint32_t break_idx = break_count; break_idx > 0; --break_idx)
+  {
+    next_mandatory[break_idx - 1] = next;
+    if(breaks[break_idx - 1].is_mandatory)
+    {
+      next = break_idx - 1;
+    }
+  }
+
+  wrapper->break_count = break_count;
+  wrapper->breaks = breaks;
+  wrapper->next_mandatory = next_mandatory;
+  arena_clear(wrapper->scratch);
+  return wrapper;
+}
+
+static void
+line_wrapper_release(LineWrapper *wrapper)
+{
+  arena_release(wrapper->scratch);
+  arena_release(wrapper->arena);
+  memory_free(wrapper);
+}
+
+static float
+line_wrap_width(const LineWrapper *wrapper, uint32_t start_break, uint32_t end_break)
+{
+  const LineWrapBreak *end = &wrapper->breaks[end_break];
+  float width = end->trimmed_x - wrapper->breaks[start_break].x;
+  width = width > 0 ? width : 0;
+  return width + end->hyphen_advance;
+}
+
+static void
+line_wrap_push_line(const LineWrapper *wrapper, LineWrapLine *line, uint32_t start_break, uint32_t end_break)
+{
+  const LineWrapBreak *start = &wrapper->breaks[start_break];
+  const LineWrapBreak *end = &wrapper->breaks[end_break];
+  line->text_offset = start->text_position;
+  line->text_length = end->text_position - start->text_position;
+  line->first_glyph = start->glyph;
+  line->glyph_count = end->glyph - start->glyph;
+  line->width = line_wrap_width(wrapper, start_break, end_break);
+  line->ends_paragraph = end->is_mandatory;
+  line->hyphen_font_id = end->hyphen_font_id;
+  line->hyphen_glyph = end->hyphen_glyph;
+  line->hyphen_x = line->width - end->hyphen_advance;
+}
+
+static uint32_t
+line_wrap_greedy_end(const LineWrapper *wrapper, uint32_t start_break, float max_width)
+{
+  // NOTE(hampus): The last break up to the next mandatory one where the line
+  // still fits. trimmed_x never decreases, so it's a binary search, and then
+  // a step back over the breaks that only overflow with their hyphen. If not
+  // even the first word fits, it gets a line of its own.
+  uint32_t low = start_break + 1;
+  uint32_t high = wrapper->next_mandatory[start_break] + 1;
+  float limit = wrapper->breaks[start_break].x + max_width;
+  while(low < high)
+  {
+    uint32_t mid = low + (high - low) / 2;
+    if(wrapper->breaks[mid].trimmed_x <= limit)
+    {
+      low = mid + 1;
+    }
+    else
+    {
+      high = mid;
+    }
+  }
+  uint32_t end_break = low - 1;
+  while(end_break > start_break && wrapper->breaks[end_break].trimmed_x + wrapper->breaks[end_break].hyphen_advance > limit)
+  {
+    end_break -= 1;
+  }
+  return end_break > start_break ? end_break : start_break + 1;
+}
+
+static LineWrapLine *
+line_wrap(LineWrapper *wrapper, Arena *arena, float max_width, LineWrapMode mode, uint32_t *line_count)
+{
+  // NOTE(hampus): The lines are pushed onto `arena` in text order.
+  uint32_t count = 0;
+  uint32_t last_break = wrapper->break_count - 1;
+  uint64_t scratch_pos = arena_pos(wrapper->scratch);
+
+  //----------------------------------------------------------
+  // hampus: pick the breaks
+
+  // NOTE(hampus): line_ends[break] is the break that ends the line starting
+  // at `break`, for the breaks that start a line
+  uint32_t *line_ends = push_array_no_zero(wrapper->scratch, uint32_t, wrapper->break_count);
+  if(mode == LineWrapMode_Greedy)
+  {
+    for(uint32_t start_break = 0; start_break < last_break; start_break = line_ends[start_break])
+    {
+      line_ends[start_break] = line_wrap_greedy_end(wrapper, start_break, max_width);
+      count += 1;
+    }
+  }
+  else
+  {
+    // NOTE(hampus): Each paragraph on its own. cost[j] is the least cost of
+    // ending a line at break j, and line_starts[j] where that line starts.
+    // A line that overflows is only allowed when it's one word, and costs
+    // more than any amount of slack.
+    float *cost = push_array_no_zero(wrapper->scratch, float, wrapper->break_count);
+    uint32_t *line_starts = push_array_no_zero(wrapper->scratch, uint32_t, wrapper->break_count);
+    for(uint32_t paragraph_start = 0; paragraph_start < last_break; paragraph_start = wrapper->next_mandatory[paragraph_start])
+    {
+      uint32_t paragraph_end = wrapper->next_mandatory[paragraph_start];
+      cost[paragraph_start] = 0;
+      for(uint32_t end_break = paragraph_start + 1; end_break <= paragraph_end; ++end_break)
+      {
+        float best_cost = 3.4e38f;
+        uint32_t best_start = end_break - 1;
+        for(uint32_t start_break = end_break; start_break > paragraph_start; --start_break)
+        {
+          float width = line_wrap_width(wrapper, start_break - 1, end_break);
+          bool fits = width <= max_width;
+          if(!fits && start_break != end_break)
+          {
+            break;
+          }
+          float slack = max_width - width;
+          float line_cost = 0;
+          if(!fits)
+          {
+            line_cost = 1e30f;
+          }
+          else if(end_break != paragraph_end)
+          {
+            line_cost = slack * slack;
+          }
+          float total_cost = cost[start_break - 1] + line_cost;
+          if(total_cost < best_cost)
+          {
+            best_cost = total_cost;
+            best_start = start_break - 1;
+          }
+        }
+        cost[end_break] = best_cost;
+        line_starts[end_break] = best_start;
+      }
+
+      // hampus: walk back from the end of the paragraph
+
+      for(uint32_t end_break = paragraph_end; end_break != paragraph_start; end_break = line_starts[end_break])
+      {
+        line_ends[line_starts[end_break]] = end_break;
+        count += 1;
+      }
+    }
+  }
+
+  //----------------------------------------------------------
+  // hampus: emit the lines
+
+  LineWrapLine *lines = push_array_no_zero(arena, LineWrapLine, count);
+  uint32_t line_idx = 0;
+  for(uint32_t start_break = 0; start_break < last_break; start_break = line_ends[start_break])
+  {
+    line_wrap_push_line(wrapper, &lines[line_idx], start_break, line_ends[start_break]);
+    line_idx += 1;
+  }
+  ASSERT(line_idx == count);
+
+  arena_pop_to(wrapper->scratch, scratch_pos);
+  *line_count = count;
+  return lines;
+}
+
+#endif // LINE_WRAP_H
@@ -0,0 +1,1459 @@
+#ifndef SHAPING_DISK_CACHE_H
+#define SHAPING_DISK_CACHE_H
+
+#include "text_to_glyphs.h"
+
+#if !defined(_WIN32)
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#endif
+
+////////////////////////////////////////////////////////////
+// hampus: files
+
+// NOTE(hampus): Just what the disk cache needs. Paths are UTF-8.
+
+struct OS_FileMapping
+{
+  const uint8_t *data;
+  uint64_t size;
+#if defined(_WIN32)
+  HANDLE file;
+  HANDLE mapping;
+#endif
+};
+
+struct OS_FileProperties
+{
+  uint64_t size;
+
+  // NOTE(hampus): Only compared, never interpreted
+  uint64_t modified_time;
+};
+
+#if defined(_WIN32)
+
+static bool
+os_wide_path_from_utf8(const char *path, wchar_t *buffer, int capacity)
+{
+  return MultiByteToWideChar(CP_UTF8, 0, path, -1, buffer, capacity) != 0;
+}
+
+static bool
+os_file_map(const char *path, OS_FileMapping *mapping)
+{
+  // NOTE(hampus): Read only. Empty files can't be mapped.
+  *mapping = {};
+  wchar_t wide_path[1024];
+  if(!os_wide_path_from_utf8(path, wide_path, ARRAYSIZE(wide_path)))
+  {
+    return false;
+  }
+  HANDLE file = CreateFileW(wide_path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+  if(file == INVALID_HANDLE_VALUE)
+  {
+    return false;
+  }
+  LARGE_INTEGER size = {};
+  HANDLE file_mapping = 0;
+  void *data = 0;
+  if(GetFileSizeEx(file, &size) && size.QuadPart != 0)
+  {
+    file_mapping = CreateFileMappingW(file, 0, PAGE_READONLY, 0, 0, 0);
+  }
+  if(file_mapping != 0)
+  {
+    data = MapViewOfFile(file_mapping, FILE_MAP_READ, 0, 0, 0);
+  }
+  if(data == 0)
+  {
+    if(file_mapping != 0)
+    {
+      CloseHandle(file_mapping);
+    }
+    CloseHandle(file);
+    return false;
+  }
+  mapping->data = (const uint8_t *)data;
+  mapping->size = (uint64_t)size.QuadPart;
+  mapping->file = file;
+  mapping->mapping = file_mapping;
+  return true;
+}
+
+static void
+os_file_unmap(OS_FileMapping *mapping)
+{
+  if(mapping->data != 0)
+  {
+    UnmapViewOfFile(mapping->data);
+    CloseHandle(mapping->mapping);
+    CloseHandle(mapping->file);
+  }
+  *mapping = {};
+}
+
+static bool
+os_file_properties(const char *path, OS_FileProperties *properties)
+{
+  wchar_t wide_path[1024];
+  WIN32_FILE_ATTRIBUTE_DATA data = {};
+  if(!os_wide_path_from_utf8(path, wide_path, ARRAYSIZE(wide_path)) ||
+     !GetFileAttributesExW(wide_path, GetFileExInfoStandard, &data))
+  {
+    return false;
+  }
+  properties->size = ((uint64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+  properties->modified_time = ((uint64_t)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+  return true;
+}
+
+static bool
+os_file_replace(const char *path, const void *data, uint64_t size)
+{
+  // NOTE(hampus): Writes next to the file and moves it over, so a crash
+  // never leaves half a file behind. The file can't be mapped meanwhile.
+  wchar_t wide_path[1024];
+  wchar_t temp_path[1024 + 4];
+  if(!os_wide_path_from_utf8(path, wide_path, ARRAYSIZE(wide_path)))
+  {
+    return false;
+  }
+  wcscpy(temp_path, wide_path);
+  wcscat(temp_path, L".tmp");
+
+  HANDLE file = CreateFileW(temp_path, GENERIC_WRITE, 0, 0, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, 0);
+  if(file == INVALID_HANDLE_VALUE)
+  {
+    return false;
+  }
+  bool result = true;
+  for(uint64_t written = 0; written < size && result;)
+  {
+    DWORD chunk_size = (DWORD)((size - written) < (1u << 30) ? (size - written) : (1u << 30));
+    DWORD chunk_written = 0;
+    result = WriteFile(file, (const uint8_t *)data + written, chunk_size, &chunk_written, 0) && chunk_written == chunk_size;
+    written += chunk_written;
+  }
+  CloseHandle(file);
+  result = result && MoveFileExW(temp_path, wide_path, MOVEFILE_REPLACE_EXISTING);
+  if(!result)
+  {
+    DeleteFileW(temp_path);
+  }
+  return result;
+}
+
+#else
+
+static bool
+os_file_map(const char *path, OS_FileMapping *mapping)
+{
+  // NOTE(hampus): Read only. Empty files can't be mapped.
+  *mapping = {};
+  int file = open(path, O_RDONLY);
+  if(file < 0)
+  {
+    return false;
+  }
+  struct stat file_stat = {};
+  void *data = MAP_FAILED;
+  if(fstat(file, &file_stat) == 0 && file_stat.st_size != 0)
+  {
+    data = mmap(0, (size_t)file_stat.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+  }
+  close(file);
+  if(data == MAP_FAILED)
+  {
+    return false;
+  }
+  mapping->data = (const uint8_t *)data;
+  mapping->size = (uint64_t)file_stat.st_size;
+  return true;
+}
+
+static void
+os_file_unmap(OS_FileMapping *mapping)
+{
+  if(mapping->data != 0)
+  {
+    munmap((void *)mapping->data, (size_t)mapping->size);
+  }
+  *mapping = {};
+}
+
+static bool
+os_file_properties(const char *path, OS_FileProperties *properties)
+{
+  struct stat file_stat = {};
+  if(stat(path, &file_stat) != 0)
+  {
+    return false;
+  }
+  properties->size = (uint64_t)file_stat.st_size;
+  properties->modified_time = (uint64_t)file_stat.st_mtim.tv_sec * 1000000000ull + (uint64_t)file_stat.st_mtim.tv_nsec;
+  return true;
+}
+
+static bool
+os_file_replace(const char *path, const void *data, uint64_t size)
+{
+  // NOTE(hampus): Writes next to the file and renames it over, so a crash
+  // never leaves half a file behind, and mappings of the old file stay valid.
+  uint64_t path_length = strlen(path);
+  char *temp_path = (char *)memory_alloc(path_length + 5);
+  memory_copy(temp_path, path, path_length);
+  memory_copy(temp_path + path_length, ".tmp", 5);
+
+  bool result = false;
+  int file = open(temp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if(file >= 0)
+  {
+    result = true;
+    for(uint64_t written = 0; written < size && result;)
+    {
+      ssize_t chunk_written = write(file, (const uint8_t *)data + written, (size_t)(size - written));
+      result = chunk_written > 0;
+      written += result ? (uint64_t)chunk_written : 0;
+    }
+    result = close(file) == 0 && result;
+    result = result && rename(temp_path, path) == 0;
+    if(!result)
+    {
+      unlink(temp_path);
+    }
+  }
+  memory_free(temp_path);
+  return result;
+}
+
+#endif
+
+////////////////////////////////////////////////////////////
+// hampus: font files
+
+// NOTE(hampus): How the disk cache names the font faces of a result so that
+// they can be found again after a restart, and tells when a font file has
+// changed since. Every backend that wants a disk cache implements these, see
+// dwrite_shaping_disk_cache.h and freetype_shaping_disk_cache.h.
+
+struct ShapingFontFile
+{
+  // NOTE(hampus): UTF-8
+  char *path;
+  uint32_t face_index;
+
+  // NOTE(hampus): Up to the backend, e.g. DWRITE_FONT_SIMULATIONS
+  uint32_t simulations;
+};
+
+struct ShapingFontFileVersion
+{
+  uint64_t size;
+  uint64_t modified_time;
+};
+
+struct ShapingFontFileFunctions
+{
+  // NOTE(hampus): Fills in the file the face was loaded from, with the path
+  // pushed onto the arena. Returns false for faces that don't come from a
+  // file, and results that use them are never cached.
+  bool (*font_file_from_face)(void *user_data, Arena *arena, ShapingFontFace *font_face, ShapingFontFile *file);
+
+  // NOTE(hampus): Returns false if the file is gone.
+  // shaping_font_file_version_from_disk() does this for files on disk.
+  bool (*get_font_file_version)(void *user_data, const char *path, ShapingFontFileVersion *version);
+
+  // NOTE(hampus): Returns a new reference to the face, or 0 if it couldn't
+  // be loaded
+  ShapingFontFace *(*font_face_from_file)(void *user_data, const ShapingFontFile *file);
+};
+
+static bool
+shaping_font_file_version_from_disk(void *user_data, const char *path, ShapingFontFileVersion *version)
+{
+  OS_FileProperties properties = {};
+  if(!os_file_properties(path, &properties))
+  {
+    return false;
+  }
+  version->size = properties.size;
+  version->modified_time = properties.modified_time;
+  return true;
+}
+
+////////////////////////////////////////////////////////////
+// hampus: file format
+
+// NOTE(hampus): The file is written and read as it is laid out in memory, so
+// a cache is only good on the kind of machine that wrote it. The header
+// records the version and the size of every structure, and a file that
+// doesn't match, is cut short or points outside of itself is ignored as if
+// it were empty. Every offset is from the start of the file and every array
+// is 16 byte aligned, so the glyph arrays can be used where they are mapped.
+//
+// header | fonts | slots | entries | the strings and arrays of each font and entry
+//
+// Entries are found through the slots, an open addressed hash table of
+// entry index + 1, 0 for an empty slot.
+//
+// The version also goes up when a backend starts shaping the same text
+// differently, so that results cached by the old code aren't used.
+
+#define SHAPING_DISK_CACHE_MAGIC 0x43445348u // "HSDC"
+#define SHAPING_DISK_CACHE_VERSION 2
+
+struct ShapingDiskCacheHeader
+{
+  uint32_t magic;
+  uint32_t version;
+  uint32_t header_size;
+  uint32_t font_size;
+  uint32_t entry_size;
+  uint32_t segment_size;
+  uint32_t font_count;
+  uint32_t entry_count;
+  uint32_t slot_count;
+  uint32_t padding;
+  uint64_t file_size;
+  uint64_t fonts_offset;
+  uint64_t slots_offset;
+  uint64_t entries_offset;
+};
+
+struct ShapingDiskCacheFont
+{
+  uint64_t path_offset;
+  uint32_t path_length;
+  uint32_t face_index;
+  uint32_t simulations;
+  uint32_t padding;
+  ShapingFontFileVersion version;
+};
+
+struct ShapingDiskCacheEntry
+{
+  // hampus: key
+
+  uint64_t hash;
+  float font_size;
+
+  // NOTE(hampus): The MapTextToGlyphsFlags the result was shaped with.
+  // Lookups with fewer flags are served too.
+  uint32_t flags;
+
+  uint32_t text_length;
+  uint32_t locale_length;
+  uint32_t base_family_length;
+  uint32_t segment_count;
+  uint64_t text_offset;
+  uint64_t locale_offset;
+  uint64_t base_family_offset;
+
+  // hampus: value
+
+  uint64_t glyph_count;
+  uint64_t segments_offset;
+  uint64_t glyph_indices_offset;
+  uint64_t glyph_advances_offset;
+  uint64_t glyph_offsets_offset;
+  uint64_t cluster_map_offset;
+
+  // NOTE(hampus): 0 without the flag
+  uint64_t glyph_positions_offset;
+  uint64_t line_breakpoints_offset;
+};
+
+struct ShapingDiskCacheSegment
+{
+  uint32_t font_idx;
+  uint32_t bidi_level;
+  float font_size_em;
+  float run_width;
+  uint32_t text_offset;
+  uint32_t text_length;
+  uint64_t first_glyph;
+  uint64_t glyph_count;
+};
+
+////////////////////////////////////////////////////////////
+// hampus: shaping disk cache
+
+// NOTE(hampus): Keeps shaped text from one run of the program to the next,
+// e.g. the UI strings that have to be shaped before the first frame. The
+// file is mapped when the cache is opened, and a hit hands out a result
+// whose glyph arrays point straight into the mapping, so only the segments
+// are copied. Such results are read only and must be freed before the
+// cache is saved or closed.
+//
+// Entries are keyed by the text, locale, base family and font size. Which
+// fonts a text ends up in isn't known until it has been shaped, so every
+// entry instead records the font files its segments use, and when the cache
+// is opened, the files that have changed or gone are found. Entries that use
+// them miss, and are dropped on save.
+//
+// Opening only checks the header and the font and slot tables, so that it
+// doesn't touch the rest of the file. Each entry is checked the first time a
+// lookup finds its hash, and the outcome is kept, so a broken entry misses
+// and a good one is only checked once.
+//
+// Results that miss are added with shaping_disk_cache_add() and are served
+// from memory until shaping_disk_cache_save() writes them out together with
+// the entries that are still good. Like the other caches, a disk cache may
+// be shared between calls but not between threads.
+
+enum ShapingDiskCacheEntryState
+{
+  ShapingDiskCacheEntryState_Unchecked,
+  ShapingDiskCacheEntryState_Valid,
+  ShapingDiskCacheEntryState_Invalid,
+
+  // NOTE(hampus): Valid, but uses a font file that has changed
+  ShapingDiskCacheEntryState_Stale,
+};
+
+struct ShapingDiskCacheFontSlot
+{
+  bool is_stale;
+  bool is_loaded;
+  uint16_t font_id;
+};
+
+struct ShapingDiskCachePendingFont
+{
+  ShapingFontFile file;
+  ShapingFontFileVersion version;
+};
+
+struct ShapingDiskCachePendingEntry
+{
+  ShapingDiskCachePendingEntry *next;
+  ShapingDiskCachePendingEntry *hash_next;
+  uint64_t hash;
+  float font_size;
+  uint32_t flags;
+  const utf16_char *locale;
+  const utf16_char *base_family;
+  const utf16_char *text;
+  uint32_t locale_length;
+  uint32_t base_family_length;
+  uint32_t text_length;
+
+  // NOTE(hampus): A copy of the result on the cache's arena, whose segments
+  // refer to the cache's font registry. segment_fonts indexes pending_fonts.
+  MapTextToGlyphsResult result;
+  uint32_t *segment_fonts;
+};
+
+#define SHAPING_DISK_CACHE_PENDING_SLOT_COUNT 1024
+
+struct ShapingDiskCacheStats
+{
+  uint64_t hit_count;
+  uint64_t miss_count;
+
+  // NOTE(hampus): Entries in the file that lookups found but couldn't use,
+  // because a font file changed or the entry doesn't check out. They are
+  // dropped on save.
+  uint64_t stale_entry_count;
+  uint64_t invalid_entry_count;
+};
+
+struct ShapingDiskCache
+{
+  char *path;
+  const ShapingBackendFunctions *backend_functions;
+  ShapingFontRegistry *font_registry;
+  const ShapingFontFileFunctions *font_file_functions;
+  void *font_file_user_data;
+
+  // hampus: the mapped file
+
+  // NOTE(hampus): header is 0 when there was no usable file
+  OS_FileMapping mapping;
+  const ShapingDiskCacheHeader *header;
+  ShapingDiskCacheFontSlot *font_slots;
+
+  // NOTE(hampus): One ShapingDiskCacheEntryState per entry in the file
+  uint8_t *entry_states;
+
+  // hampus: entries added since the file was mapped
+
+  Arena *arena;
+  ShapingDiskCachePendingEntry *first_pending;
+  ShapingDiskCachePendingEntry *last_pending;
+  ShapingDiskCachePendingEntry **pending_slots;
+  uint32_t pending_count;
+  uint32_t pending_font_count;
+  uint32_t pending_font_capacity;
+  ShapingDiskCachePendingFont *pending_fonts;
+
+  ShapingDiskCacheStats stats;
+};
+
+static uint64_t
+shaping_disk_cache_hash(const utf16_char *locale, uint32_t locale_length, const utf16_char *base_family, uint32_t base_family_length, float font_size, const utf16_char *text, uint32_t text_length)
+{
+  uint64_t hash = hash_bytes(0, text, text_length * sizeof(utf16_char));
+  hash = hash_bytes(hash, locale, locale_length * sizeof(utf16_char));
+  hash = hash_bytes(hash, base_family, base_family_length * sizeof(utf16_char));
+  hash = hash_bytes(hash, &font_size, sizeof(font_size));
+  return hash;
+}
+
+static bool
+shaping_disk_cache_range_is_valid(const ShapingDiskCacheHeader *header, uint64_t offset, uint64_t count, uint64_t element_size)
+{
+  return (offset % 16) == 0 && offset <= header->file_size && count <= (header->file_size - offset) / element_size;
+}
+
+static const ShapingDiskCacheFont *
+shaping_disk_cache_fonts(const ShapingDiskCache *cache)
+{
+  return (const ShapingDiskCacheFont *)(cache->mapping.data + cache->header->fonts_offset);
+}
+
+static const ShapingDiskCacheEntry *
+shaping_disk_cache_entries(const ShapingDiskCache *cache)
+{
+  return (const ShapingDiskCacheEntry *)(cache->mapping.data + cache->header->entries_offset);
+}
+
+static const ShapingDiskCacheSegment *
+shaping_disk_cache_entry_segments(const ShapingDiskCache *cache, const ShapingDiskCacheEntry *entry)
+{
+  return (const ShapingDiskCacheSegment *)(cache->mapping.data + entry->segments_offset);
+}
+
+static bool
+shaping_disk_cache_entry_is_valid(const ShapingDiskCacheHeader *header, const uint8_t *data, const ShapingDiskCacheEntry *entry)
+{
+  bool result = (shaping_disk_cache_range_is_valid(header, entry->text_offset, entry->text_length, sizeof(utf16_char)) &&
+                 shaping_disk_cache_range_is_valid(header, entry->locale_offset, entry->locale_length, sizeof(utf16_char)) &&
+                 shaping_disk_cache_range_is_valid(header, entry->base_family_offset, entry->base_family_length, sizeof(utf16_char)) &&
+                 shaping_disk_cache_range_is_valid(header, entry->segments_offset, entry->segment_count, sizeof(ShapingDiskCacheSegment)) &&
+                 shaping_disk_cache_range_is_valid(header, entry->glyph_indices_offset, entry->glyph_count, sizeof(uint16_t)) &&
+                 shaping_disk_cache_range_is_valid(header, entry->glyph_advances_offset, entry->glyph_count, sizeof(float)) &&
+                 shaping_disk_cache_range_is_valid(header, entry->glyph_offsets_offset, entry->glyph_count, sizeof(GlyphOffset)) &&
+                 shaping_disk_cache_range_is_valid(header, entry->cluster_map_offset, entry->text_length, sizeof(uint32_t)));
+  if(result && (entry->flags & MapTextToGlyphsFlag_GlyphPositions))
+  {
+    result = shaping_disk_cache_range_is_valid(header, entry->glyph_positions_offset, entry->glyph_count, sizeof(float));
+  }
+  if(result && (entry->flags & MapTextToGlyphsFlag_LineBreakpoints))
+  {
+    result = shaping_disk_cache_range_is_valid(header, entry->line_breakpoints_offset, entry->text_length, sizeof(LineBreakpoint));
+  }
+  if(result)
+  {
+    const ShapingDiskCacheSegment *segments = (const ShapingDiskCacheSegment *)(data + entry->segments_offset);
+    for(uint32_t segment_idx = 0; segment_idx < entry->segment_count && result; ++segment_idx)
+    {
+      const ShapingDiskCacheSegment *segment = &segments[segment_idx];
+      result = (segment->font_idx < header->font_count &&
+                segment->first_glyph <= entry->glyph_count &&
+                segment->glyph_count <= entry->glyph_count - segment->first_glyph &&
+                segment->text_offset <= entry->text_length &&
+                segment->text_length <= entry->text_length - segment->text_offset);
+    }
+  }
+  if(result)
+  {
+    // NOTE(hampus): Text no font was found for points at the glyph after it,
+    // which is glyph_count at the end of the text. Text in a segment has to
+    // point at one of the segment's glyphs.
+    const uint32_t *cluster_map = (const uint32_t *)(data + entry->cluster_map_offset);
+    for(uint64_t idx = 0; idx < entry->text_length && result; ++idx)
+    {
+      result = cluster_map[idx] <= entry->glyph_count;
+    }
+    const ShapingDiskCacheSegment *segments = (const ShapingDiskCacheSegment *)(data + entry->segments_offset);
+    for(uint32_t segment_idx = 0; segment_idx < entry->segment_count && result; ++segment_idx)
+    {
+      const ShapingDiskCacheSegment *segment = &segments[segment_idx];
+      for(uint64_t idx = segment->text_offset; idx < segment->text_offset + segment->text_length && result; ++idx)
+      {
+        result = (segment->first_glyph <= cluster_map[idx] &&
+                  cluster_map[idx] < segment->first_glyph + segment->glyph_count);
+      }
+    }
+  }
+  return result;
+}
+
+static bool
+shaping_disk_cache_entry_is_stale(const ShapingDiskCache *cache, const ShapingDiskCacheEntry *entry)
+{
+  bool result = false;
+  const ShapingDiskCacheSegment *segments = shaping_disk_cache_entry_segments(cache, entry);
+  for(uint32_t segment_idx = 0; segment_idx < entry->segment_count && !result; ++segment_idx)
+  {
+    result = cache->font_slots[segments[segment_idx].font_idx].is_stale;
+  }
+  return result;
+}
+
+static ShapingDiskCacheEntryState
+shaping_disk_cache_entry_state(ShapingDiskCache *cache, uint32_t entry_idx)
+{
+  // NOTE(hampus): Checks the entry the first time it's asked for
+  ShapingDiskCacheEntryState state = (ShapingDiskCacheEntryState)cache->entry_states[entry_idx];
+  if(state == ShapingDiskCacheEntryState_Unchecked)
+  {
+    const ShapingDiskCacheEntry *entry = &shaping_disk_cache_entries(cache)[entry_idx];
+    if(!shaping_disk_cache_entry_is_valid(cache->header, cache->mapping.data, entry))
+    {
+      state = ShapingDiskCacheEntryState_Invalid;
+      cache->stats.invalid_entry_count += 1;
+    }
+    else
+    {
+      state = ShapingDiskCacheEntryState_Valid;
+    }
+    cache->entry_states[entry_idx] = (uint8_t)state;
+  }
+  if(state == ShapingDiskCacheEntryState_Valid && shaping_disk_cache_entry_is_stale(cache, &shaping_disk_cache_entries(cache)[entry_idx]))
+  {
+    state = ShapingDiskCacheEntryState_Stale;
+    cache->entry_states[entry_idx] = (uint8_t)state;
+    cache->stats.stale_entry_count += 1;
+  }
+  return state;
+}
+
+static bool
+shaping_disk_cache_has_stale_fonts(const ShapingDiskCache *cache)
+{
+  bool result = false;
+  for(uint32_t font_idx = 0; cache->header != 0 && font_idx < cache->header->font_count && !result; ++font_idx)
+  {
+    result = cache->font_slots[font_idx].is_stale;
+  }
+  return result;
+}
+
+static void
+shaping_disk_cache_map(ShapingDiskCache *cache)
+{
+  // NOTE(hampus): Leaves header at 0 unless the header and the tables check
+  // out. The entries are checked when they're looked up.
+  cache->header = 0;
+  cache->font_slots = 0;
+  cache->entry_states = 0;
+  if(!os_file_map(cache->path, &cache->mapping))
+  {
+    return;
+  }
+
+  //----------------------------------------------------------
+  // hampus: check the header and the tables
+
+  const uint8_t *data = cache->mapping.data;
+  const ShapingDiskCacheHeader *header = (const ShapingDiskCacheHeader *)data;
+  if(cache->mapping.size < sizeof(ShapingDiskCacheHeader))
+  {
+    os_file_unmap(&cache->mapping);
+    return;
+  }
+  bool is_valid = (header->magic == SHAPING_DISK_CACHE_MAGIC &&
+                   header->version == SHAPING_DISK_CACHE_VERSION &&
+                   header->header_size == sizeof(ShapingDiskCacheHeader) &&
+                   header->font_size == sizeof(ShapingDiskCacheFont) &&
+                   header->entry_size == sizeof(ShapingDiskCacheEntry) &&
+                   header->segment_size == sizeof(ShapingDiskCacheSegment) &&
+                   header->file_size == cache->mapping.size &&
+                   header->slot_count != 0 && (header->slot_count & (header->slot_count - 1)) == 0 &&
+                   header->entry_count < header->slot_count);
+  is_valid = is_valid && (shaping_disk_cache_range_is_valid(header, header->fonts_offset, header->font_count, sizeof(ShapingDiskCacheFont)) &&
+                          shaping_disk_cache_range_is_valid(header, header->slots_offset, header->slot_count, sizeof(uint32_t)) &&
+                          shaping_disk_cache_range_is_valid(header, header->entries_offset, header->entry_count, sizeof(ShapingDiskCacheEntry)));
+  if(!is_valid)
+  {
+    os_file_unmap(&cache->mapping);
+    return;
+  }
+
+  const ShapingDiskCacheFont *fonts = (const ShapingDiskCacheFont *)(data + header->fonts_offset);
+  for(uint32_t font_idx = 0; is_valid && font_idx < header->font_count; ++font_idx)
+  {
+    const ShapingDiskCacheFont *font = &fonts[font_idx];
+    is_valid = (shaping_disk_cache_range_is_valid(header, font->path_offset, (uint64_t)font->path_length + 1, 1) &&
+                data[font->path_offset + font->path_length] == 0);
+  }
+  const uint32_t *slots = (const uint32_t *)(data + header->slots_offset);
+  for(uint32_t slot_idx = 0; is_valid && slot_idx < header->slot_count; ++slot_idx)
+  {
+    is_valid = slots[slot_idx] <= header->entry_count;
+  }
+
+  if(!is_valid)
+  {
+    os_file_unmap(&cache->mapping);
+    return;
+  }
+  cache->header = header;
+
+  //----------------------------------------------------------
+  // hampus: find the fonts that have changed
+
+  cache->font_slots = push_array(cache->arena, ShapingDiskCacheFontSlot, header->font_count);
+  for(uint32_t font_idx = 0; font_idx < header->font_count; ++font_idx)
+  {
+    const ShapingDiskCacheFont *font = &fonts[font_idx];
+    ShapingFontFileVersion version = {};
+    bool exists = cache->font_file_functions->get_font_file_version(cache->font_file_user_data, (const char *)(data + font->path_offset), &version);
+    cache->font_slots[font_idx].is_stale = !exists || !memory_match(&version, &font->version, sizeof(version));
+  }
+  cache->entry_states = push_array(cache->arena, uint8_t, header->entry_count);
+}
+
+static void
+shaping_disk_cache_unmap(ShapingDiskCache *cache)
+{
+  // NOTE(hampus): The faces that were loaded stay in the registry
+  os_file_unmap(&cache->mapping);
+  cache->header = 0;
+  cache->font_slots = 0;
+  cache->entry_states = 0;
+}
+
+static void
+shaping_disk_cache_clear_pending(ShapingDiskCache *cache)
+{
+  arena_clear(cache->arena);
+  cache->first_pending = cache->last_pending = 0;
+  cache->pending_count = 0;
+  cache->pending_font_count = 0;
+  cache->pending_font_capacity = 0;
+  cache->pending_fonts = 0;
+  cache->pending_slots = push_array(cache->arena, ShapingDiskCachePendingEntry *, SHAPING_DISK_CACHE_PENDING_SLOT_COUNT);
+}
+
+static ShapingDiskCache *
+shaping_disk_cache_open(const char *path, const ShapingBackend *backend, const ShapingFontFileFunctions *font_file_functions, void *font_file_user_data)
+{
+  // NOTE(hampus): A file that doesn't exist yet or can't be used gives an
+  // empty cache, which is written to `path` on save. The cache's results
+  // share the backend's font registry, and only results from that backend
+  // can be added.
+  ShapingDiskCache *cache = (ShapingDiskCache *)memory_alloc_zero(sizeof(ShapingDiskCache));
+  uint64_t path_size = strlen(path) + 1;
+  cache->path = (char *)memory_alloc(path_size);
+  memory_copy(cache->path, path, path_size);
+  cache->backend_functions = backend->functions;
+  cache->font_registry = backend->font_registry;
+  shaping_font_registry_add_ref(cache->font_registry);
+  cache->font_file_functions = font_file_functions;
+  cache->font_file_user_data = font_file_user_data;
+  cache->arena = arena_alloc();
+  shaping_disk_cache_clear_pending(cache);
+  shaping_disk_cache_map(cache);
+  return cache;
+}
+
+static void
+shaping_disk_cache_close(ShapingDiskCache *cache)
+{
+  // NOTE(hampus): Doesn't save
+  shaping_disk_cache_unmap(cache);
+  shaping_disk_cache_clear_pending(cache);
+  arena_release(cache->arena);
+  shaping_font_registry_release(cache->font_registry);
+  memory_free(cache->path);
+  memory_free(cache);
+}
+
+//----------------------------------------------------------
+// hampus: lookup
+
+static MapTextToGlyphsResult
+shaping_disk_cache_make_result(ShapingDiskCache *cache, uint64_t segment_count, uint32_t flags)
+{
+  // NOTE(hampus): Only the segments are owned by the result. The caller
+  // points the rest into the mapping or a pending entry.
+  MapTextToGlyphsResult result = {};
+  result.arena = arena_alloc(ARENA_HEADER_SIZE + segment_count * sizeof(TextToGlyphsSegment) + 16);
+  result.backend_functions = cache->backend_functions;
+  result.font_registry = cache->font_registry;
+  shaping_font_registry_add_ref(result.font_registry);
+  result.segment_count = segment_count;
+  result.segment_capacity = segment_count;
+  result.segments = push_array_no_zero(result.arena, TextToGlyphsSegment, segment_count);
+  return result;
+}
+
+static bool
+shaping_disk_cache_lookup_mapped(ShapingDiskCache *cache, uint64_t hash, const utf16_char *locale, uint32_t locale_length, const utf16_char *base_family, uint32_t base_family_length, float font_size, const utf16_char *text, uint32_t text_length, uint32_t flags, MapTextToGlyphsResult *result)
+{
+  const ShapingDiskCacheHeader *header = cache->header;
+  if(header == 0 || header->entry_count == 0)
+  {
+    return false;
+  }
+
+  //----------------------------------------------------------
+  // hampus: find the entry
+
+  const uint8_t *data = cache->mapping.data;
+  const uint32_t *slots = (const uint32_t *)(data + header->slots_offset);
+  const ShapingDiskCacheEntry *entries = shaping_disk_cache_entries(cache);
+  // NOTE(hampus): Only entries that check out are compared, since their
+  // offsets can't be trusted before that
+  const ShapingDiskCacheEntry *entry = 0;
+  ShapingDiskCacheEntryState entry_state = ShapingDiskCacheEntryState_Unchecked;
+  for(uint32_t slot_idx = (uint32_t)hash & (header->slot_count - 1); slots[slot_idx] != 0; slot_idx = (slot_idx + 1) & (header->slot_count - 1))
+  {
+    uint32_t entry_idx = slots[slot_idx] - 1;
+    const ShapingDiskCacheEntry *candidate = &entries[entry_idx];
+    if(candidate->hash != hash)
+    {
+      continue;
+    }
+    ShapingDiskCacheEntryState state = shaping_disk_cache_entry_state(cache, entry_idx);
+    if(state != ShapingDiskCacheEntryState_Invalid &&
+       candidate->font_size == font_size &&
+       (candidate->flags & flags) == flags &&
+       candidate->text_length == text_length &&
+       candidate->locale_length == locale_length &&
+       candidate->base_family_length == base_family_length &&
+       memory_match(data + candidate->text_offset, text, text_length * sizeof(utf16_char)) &&
+       memory_match(data + candidate->locale_offset, locale, locale_length * sizeof(utf16_char)) &&
+       memory_match(data + candidate->base_family_offset, base_family, base_family_length * sizeof(utf16_char)))
+    {
+      entry = candidate;
+      entry_state = state;
+      break;
+    }
+  }
+  if(entry == 0 || entry_state == ShapingDiskCacheEntryState_Stale)
+  {
+    return false;
+  }
+
+  //----------------------------------------------------------
+  // hampus: load the fonts the first time they're used
+
+  const ShapingDiskCacheFont *fonts = shaping_disk_cache_fonts(cache);
+  const ShapingDiskCacheSegment *segments = shaping_disk_cache_entry_segments(cache, entry);
+  for(uint32_t segment_idx = 0; segment_idx < entry->segment_count; ++segment_idx)
+  {
+    uint32_t font_idx = segments[segment_idx].font_idx;
+    ShapingDiskCacheFontSlot *font_slot = &cache->font_slots[font_idx];
+    if(!font_slot->is_loaded)
+    {
+      ShapingFontFile file = {};
+      file.path = (char *)(data + fonts[font_idx].path_offset);
+      file.face_index = fonts[font_idx].face_index;
+      file.simulations = fonts[font_idx].simulations;
+      ShapingFontFace *font_face = cache->font_file_functions->font_face_from_file(cache->font_file_user_data, &file);
+      font_slot->is_loaded = true;
+      font_slot->is_stale = font_face == 0;
+      if(font_face != 0)
+      {
+        font_slot->font_id = shaping_font_registry_intern(cache->font_registry, font_face);
+        cache->backend_functions->release_font_face(font_face);
+      }
+    }
+    if(font_slot->is_stale)
+    {
+      return false;
+    }
+  }
+
+  //----------------------------------------------------------
+  // hampus: hand out the mapped arrays
+
+  *result = shaping_disk_cache_make_result(cache, entry->segment_count, flags);
+  for(uint32_t segment_idx = 0; segment_idx < entry->segment_count; ++segment_idx)
+  {
+    const ShapingDiskCacheSegment *src = &segments[segment_idx];
+    TextToGlyphsSegment *segment = &result->segments[segment_idx];
+    segment->font_id = cache->font_slots[src->font_idx].font_id;
+    segment->bidi_level = (uint8_t)src->bidi_level;
+    segment->font_size_em = src->font_size_em;
+    segment->text_offset = src->text_offset;
+    segment->text_length = src->text_length;
+    segment->first_glyph = src->first_glyph;
+    segment->glyph_count = src->glyph_count;
+    segment->run_width = src->run_width;
+  }
+  result->glyph_count = entry->glyph_count;
+  result->glyph_capacity = entry->glyph_count;
+  result->glyph_indices = (uint16_t *)(data + entry->glyph_indices_offset);
+  result->glyph_advances = (float *)(data + entry->glyph_advances_offset);
+  result->glyph_offsets = (GlyphOffset *)(data + entry->glyph_offsets_offset);
+  result->text_length = text_length;
+  result->cluster_map = (uint32_t *)(data + entry->cluster_map_offset);
+  if(flags & MapTextToGlyphsFlag_GlyphPositions)
+  {
+    result->glyph_positions = (float *)(data + entry->glyph_positions_offset);
+  }
+  if(flags & MapTextToGlyphsFlag_LineBreakpoints)
+  {
+    result->line_breakpoints = (LineBreakpoint *)(data + entry->line_breakpoints_offset);
+  }
+  return true;
+}
+
+static ShapingDiskCachePendingEntry *
+shaping_disk_cache_find_pending(ShapingDiskCache *cache, uint64_t hash, const utf16_char *locale, uint32_t locale_length, const utf16_char *base_family, uint32_t base_family_length, float font_size, const utf16_char *text, uint32_t text_length, uint32_t flags)
+{
+  ShapingDiskCachePendingEntry *result = 0;
+  for(ShapingDiskCachePendingEntry *pending = cache->pending_slots[hash & (SHAPING_DISK_CACHE_PENDING_SLOT_COUNT - 1)]; pending != 0; pending = pending->hash_next)
+  {
+    if(pending->hash == hash &&
+       pending->font_size == font_size &&
+       (pending->flags & flags) == flags &&
+       pending->text_length == text_length &&
+       pending->locale_length == locale_length &&
+       pending->base_family_length == base_family_length &&
+       memory_match(pending->text, text, text_length * sizeof(utf16_char)) &&
+       memory_match(pending->locale, locale, locale_length * sizeof(utf16_char)) &&
+       memory_match(pending->base_family, base_family, base_family_length * sizeof(utf16_char)))
+    {
+      result = pending;
+      break;
+    }
+  }
+  return result;
+}
+
+static bool
+shaping_disk_cache_lookup(ShapingDiskCache *cache, const utf16_char *locale, const utf16_char *base_family, const float font_size, const utf16_char *text, const uint32_t text_length, uint32_t flags, MapTextToGlyphsResult *result)
+{
+  // NOTE(hampus): On a hit, fills in a result that must be freed with
+  // free_map_text_to_glyphs_result() as usual, before the cache is saved
+  // or closed.
+  uint32_t locale_length = (uint32_t)utf16_length(locale);
+  uint32_t base_family_length = (uint32_t)utf16_length(base_family);
+  uint64_t hash = shaping_disk_cache_hash(locale, locale_length, base_family, base_family_length, font_size, text, text_length);
+
+  bool is_hit = shaping_disk_cache_lookup_mapped(cache, hash, locale, locale_length, base_family, base_family_length, font_size, text, text_length, flags, result);
+  if(!is_hit)
+  {
+    ShapingDiskCachePendingEntry *pending = shaping_disk_cache_find_pending(cache, hash, locale, locale_length, base_family, base_family_length, font_size, text, text_length, flags);
+    if(pending != 0)
+    {
+      const MapTextToGlyphsResult *src = &pending->result;
+      *result = shaping_disk_cache_make_result(cache, src->segment_count, flags);
+      memory_copy_typed(result->segments, src->segments, src->segment_count);
+      result->glyph_count = src->glyph_count;
+      result->glyph_capacity = src->glyph_count;
+      result->glyph_indices = src->glyph_indices;
+      result->glyph_advances = src->glyph_advances;
+      result->glyph_offsets = src->glyph_offsets;
+      result->text_length = src->text_length;
+      result->cluster_map = src->cluster_map;
+      result->glyph_positions = (flags & MapTextToGlyphsFlag_GlyphPositions) ? src->glyph_positions : 0;
+      result->line_breakpoints = (flags & MapTextToGlyphsFlag_LineBreakpoints) ? src->line_breakpoints : 0;
+      is_hit = true;
+    }
+  }
+
+  if(is_hit)
+  {
+    cache->stats.hit_count += 1;
+  }
+  else
+  {
+    cache->stats.miss_count += 1;
+  }
+  return is_hit;
+}
+
+//----------------------------------------------------------
+// hampus: adding
+
+static uint32_t
+shaping_disk_cache_pending_font_from_face(ShapingDiskCache *cache, ShapingFontFace *font_face)
+{
+  // NOTE(hampus): Returns the index of the face's file in pending_fonts,
+  // or UINT32_MAX if it can't be cached
+  uint64_t arena_pos_before = arena_pos(cache->arena);
+  ShapingFontFile file = {};
+  if(!cache->font_file_functions->font_file_from_face(cache->font_file_user_data, cache->arena, font_face, &file))
+  {
+    arena_pop_to(cache->arena, arena_pos_before);
+    return UINT32_MAX;
+  }
+
+  for(uint32_t font_idx = 0; font_idx < cache->pending_font_count; ++font_idx)
+  {
+    ShapingFontFile *other = &cache->pending_fonts[font_idx].file;
+    if(other->face_index == file.face_index && other->simulations == file.simulations && strcmp(other->path, file.path) == 0)
+    {
+      arena_pop_to(cache->arena, arena_pos_before);
+      return font_idx;
+    }
+  }
+
+  ShapingFontFileVersion version = {};
+  if(!cache->font_file_functions->get_font_file_version(cache->font_file_user_data, file.path, &version))
+  {
+    arena_pop_to(cache->arena, arena_pos_before);
+    return UINT32_MAX;
+  }
+
+  if(cache->pending_font_count == cache->pending_font_capacity)
+  {
+    uint32_t capacity = cache->pending_font_capacity == 0 ? 16 : cache->pending_font_capacity * 2;
+    ShapingDiskCachePendingFont *fonts = push_array_no_zero(cache->arena, ShapingDiskCachePendingFont, capacity);
+    if(cache->pending_font_count != 0)
+    {
+      memory_copy_typed(fonts, cache->pending_fonts, cache->pending_font_count);
+    }
+    cache->pending_fonts = fonts;
+    cache->pending_font_capacity = capacity;
+  }
+  ShapingDiskCachePendingFont *font = &cache->pending_fonts[cache->pending_font_count];
+  font->file = file;
+  font->version = version;
+  cache->pending_font_count += 1;
+  return cache->pending_font_count - 1;
+}
+
+static utf16_char *
+shaping_disk_cache_push_text(Arena *arena, const utf16_char *text, uint32_t length)
+{
+  utf16_char *result = push_array_no_zero(arena, utf16_char, length + 1);
+  memory_copy_typed(result, text, length);
+  result[length] = 0;
+  return result;
+}
+
+static void
+shaping_disk_cache_add(ShapingDiskCache *cache, const utf16_char *locale, const utf16_char *base_family, const float font_size, const utf16_char *text, const uint32_t text_length, uint32_t flags, const MapTextToGlyphsResult *result)
+{
+  // NOTE(hampus): `result` must be what map_text_to_glyphs() gave for the
+  // same arguments. It is copied, and the caller keeps it. Results with a
+  // font that doesn't come from a file aren't added. An edited result has to
+  // have its gaps closed first, see close_text_to_glyphs_gaps().
+  ASSERT(result->text_length == text_length);
+  ASSERT(result->glyph_gap_length == 0 && result->text_gap_length == 0);
+  ASSERT(result->font_registry == cache->font_registry);
+  ASSERT(!(flags & MapTextToGlyphsFlag_GlyphPositions) || result->glyph_positions != 0);
+  ASSERT(!(flags & MapTextToGlyphsFlag_LineBreakpoints) || result->line_breakpoints != 0);
+
+  uint32_t locale_length = (uint32_t)utf16_length(locale);
+  uint32_t base_family_length = (uint32_t)utf16_length(base_family);
+  uint64_t hash = shaping_disk_cache_hash(locale, locale_length, base_family, base_family_length, font_size, text, text_length);
+  if(shaping_disk_cache_find_pending(cache, hash, locale, locale_length, base_family, base_family_length, font_size, text, text_length, flags) != 0)
+  {
+    return;
+  }
+
+  //----------------------------------------------------------
+  // hampus: name the fonts
+
+  uint64_t arena_pos_before = arena_pos(cache->arena);
+  ShapingDiskCachePendingFont *pending_fonts_before = cache->pending_fonts;
+  uint32_t pending_font_count_before = cache->pending_font_count;
+  uint32_t pending_font_capacity_before = cache->pending_font_capacity;
+  uint32_t *segment_fonts = push_array_no_zero(cache->arena, uint32_t, result->segment_count);
+  for(uint64_t segment_idx = 0; segment_idx < result->segment_count; ++segment_idx)
+  {
+    segment_fonts[segment_idx] = shaping_disk_cache_pending_font_from_face(cache, shaping_font_face_from_segment(result, &result->segments[segment_idx]));
+    if(segment_fonts[segment_idx] == UINT32_MAX)
+    {
+      // NOTE(hampus): Drop the fonts this entry added too. The list from
+      // before is still there if it was grown.
+      arena_pop_to(cache->arena, arena_pos_before);
+      cache->pending_fonts = pending_fonts_before;
+      cache->pending_font_count = pending_font_count_before;
+      cache->pending_font_capacity = pending_font_capacity_before;
+      return;
+    }
+  }
+
+  //----------------------------------------------------------
+  // hampus: copy the result
+
+  ShapingDiskCachePendingEntry *pending = push_array(cache->arena, ShapingDiskCachePendingEntry, 1);
+  pending->hash = hash;
+  pending->font_size = font_size;
+  pending->flags = flags;
+  pending->locale = shaping_disk_cache_push_text(cache->arena, locale, locale_length);
+  pending->base_family = shaping_disk_cache_push_text(cache->arena, base_family, base_family_length);
+  pending->text = shaping_disk_cache_push_text(cache->arena, text, text_length);
+  pending->locale_length = locale_length;
+  pending->base_family_length = base_family_length;
+  pending->text_length = text_length;
+  pending->segment_fonts = segment_fonts;
+
+  MapTextToGlyphsResult *copy = &pending->result;
+  copy->backend_functions = cache->backend_functions;
+  copy->font_registry = cache->font_registry;
+  copy->segment_count = result->segment_count;
+  copy->segment_capacity = result->segment_count;
+  copy->segments = push_array_no_zero(cache->arena, TextToGlyphsSegment, result->segment_count);
+  memory_copy_typed(copy->segments, result->segments, result->segment_count);
+  copy->glyph_count = result->glyph_count;
+  copy->glyph_capacity = result->glyph_count;
+  copy->glyph_indices = push_array_no_zero(cache->arena, uint16_t, result->glyph_count);
+  copy->glyph_advances = push_array_no_zero(cache->arena, float, result->glyph_count);
+  copy->glyph_offsets = push_array_no_zero(cache->arena, GlyphOffset, result->glyph_count);
+  memory_copy_typed(copy->glyph_indices, result->glyph_indices, result->glyph_count);
+  memory_copy_typed(copy->glyph_advances, result->glyph_advances, result->glyph_count);
+  memory_copy_typed(copy->glyph_offsets, result->glyph_offsets, result->glyph_count);
+  copy->text_length = text_length;
+  copy->cluster_map = push_array_no_zero(cache->arena, uint32_t, text_length);
+  memory_copy_typed(copy->cluster_map, result->cluster_map, text_length);
+  if(flags & MapTextToGlyphsFlag_GlyphPositions)
+  {
+    copy->glyph_positions = push_array_no_zero(cache->arena, float, result->glyph_count);
+    memory_copy_typed(copy->glyph_positions, result->glyph_positions, result->glyph_count);
+  }
+  if(flags & MapTextToGlyphsFlag_LineBreakpoints)
+  {
+    copy->line_breakpoints = push_array_no_zero(cache->arena, LineBreakpoint, text_length);
+    memory_copy_typed(copy->line_breakpoints, result->line_breakpoints, text_length);
+  }
+
+  ShapingDiskCachePendingEntry **slot = &cache->pending_slots[hash & (SHAPING_DISK_CACHE_PENDING_SLOT_COUNT - 1)];
+  pending->hash_next = *slot;
+  *slot = pending;
+  if(cache->last_pending != 0)
+  {
+    cache->last_pending->next = pending;
+  }
+  else
+  {
+    cache->first_pending = pending;
+  }
+  cache->last_pending = pending;
+  cache->pending_count += 1;
+}
+
+static MapTextToGlyphsResult
+map_text_to_glyphs_with_disk_cache(ShapingDiskCache *cache, const ShapingBackend *backend, const utf16_char *locale, const utf16_char *base_family, const float font_size, const utf16_char *text, const uint32_t text_length, ShapingCaches *caches = 0, uint32_t flags = 0, ShapingContext *context = 0)
+{
+  MapTextToGlyphsResult result = {};
+  if(!shaping_disk_cache_lookup(cache, locale, base_family, font_size, text, text_length, flags, &result))
+  {
+    result = map_text_to_glyphs(backend, locale, base_family, font_size, text, text_length, caches, flags, context);
+    shaping_disk_cache_add(cache, locale, base_family, font_size, text, text_length, flags, &result);
+  }
+  return result;
+}
+
+//----------------------------------------------------------
+// hampus: saving
+
+struct ShapingDiskCacheWriter
+{
+  // NOTE(hampus): data is 0 while measuring
+  uint8_t *data;
+  uint64_t size;
+};
+
+static uint64_t
+shaping_disk_cache_write(ShapingDiskCacheWriter *writer, const void *data, uint64_t size)
+{
+  uint64_t offset = align_pow2(writer->size, 16);
+  if(writer->data != 0)
+  {
+    memset(writer->data + writer->size, 0, offset - writer->size);
+    if(data != 0)
+    {
+      memory_copy(writer->data + offset, data, size);
+    }
+    else
+    {
+      memset(writer->data + offset, 0, size);
+    }
+  }
+  writer->size = offset + size;
+  return offset;
+}
+
+static uint32_t
+shaping_disk_cache_saved_font_idx(ShapingDiskCacheFont *fonts, const char **font_paths, uint32_t *font_count, const char *path, uint32_t face_index, uint32_t simulations, const ShapingFontFileVersion *version)
+{
+  for(uint32_t font_idx = 0; font_idx < *font_count; ++font_idx)
+  {
+    if(fonts[font_idx].face_index == face_index && fonts[font_idx].simulations == simulations && strcmp(font_paths[font_idx], path) == 0)
+    {
+      return font_idx;
+    }
+  }
+  uint32_t font_idx = *font_count;
+  ShapingDiskCacheFont *font = &fonts[font_idx];
+  *font = {};
+  font->path_length = (uint32_t)strlen(path);
+  font->face_index = face_index;
+  font->simulations = simulations;
+  font->version = *version;
+  font_paths[font_idx] = path;
+  *font_count += 1;
+  return font_idx;
+}
+
+static bool
+shaping_disk_cache_save(ShapingDiskCache *cache)
+{
+  // NOTE(hampus): Writes the entries that are still good and the ones added
+  // since, and maps the new file. Every result handed out by the cache must
+  // have been freed. Returns false if the file couldn't be written, in which
+  // case the cache is left as it was.
+  const ShapingDiskCacheHeader *old_header = cache->header;
+  uint32_t old_entry_count = old_header != 0 ? old_header->entry_count : 0;
+  uint32_t old_font_count = old_header != 0 ? old_header->font_count : 0;
+  if(cache->pending_count == 0 && !shaping_disk_cache_has_stale_fonts(cache) && cache->stats.invalid_entry_count == 0 && old_header != 0)
+  {
+    return true;
+  }
+
+  Arena *scratch = arena_alloc();
+
+  //----------------------------------------------------------
+  // hampus: pick the entries and their fonts
+
+  // NOTE(hampus): Old entries keep their order and come first. A pending
+  // entry only has the same key as an old one if the old one couldn't serve
+  // it, and then both are kept.
+  uint32_t max_entry_count = old_entry_count + cache->pending_count;
+  uint32_t max_font_count = old_font_count + cache->pending_font_count;
+  ShapingDiskCacheFont *fonts = push_array(scratch, ShapingDiskCacheFont, max_font_count);
+  const char **font_paths = push_array(scratch, const char *, max_font_count);
+  uint32_t font_count = 0;
+
+  const ShapingDiskCacheEntry **old_entries = push_array_no_zero(scratch, const ShapingDiskCacheEntry *, old_entry_count);
+  uint32_t *old_font_map = push_array_no_zero(scratch, uint32_t, old_font_count);
+  uint32_t kept_old_count = 0;
+  if(old_header != 0)
+  {
+    const ShapingDiskCacheFont *old_fonts = shaping_disk_cache_fonts(cache);
+    for(uint32_t font_idx = 0; font_idx < old_font_count; ++font_idx)
+    {
+      old_font_map[font_idx] = UINT32_MAX;
+    }
+    const ShapingDiskCacheEntry *entries = shaping_disk_cache_entries(cache);
+    for(uint32_t entry_idx = 0; entry_idx < old_entry_count; ++entry_idx)
+    {
+      const ShapingDiskCacheEntry *entry = &entries[entry_idx];
+      if(shaping_disk_cache_entry_state(cache, entry_idx) != ShapingDiskCacheEntryState_Valid)
+      {
+        continue;
+      }
+      old_entries[kept_old_count++] = entry;
+      const ShapingDiskCacheSegment *segments = shaping_disk_cache_entry_segments(cache, entry);
+      for(uint32_t segment_idx = 0; segment_idx < entry->segment_count; ++segment_idx)
+      {
+        uint32_t old_font_idx = segments[segment_idx].font_idx;
+        if(old_font_map[old_font_idx] == UINT32_MAX)
+        {
+          const ShapingDiskCacheFont *old_font = &old_fonts[old_font_idx];
+          old_font_map[old_font_idx] = shaping_disk_cache_saved_font_idx(fonts, font_paths, &font_count, (const char *)(cache->mapping.data + old_font->path_offset), old_font->face_index, old_font->simulations, &old_font->version);
+        }
+      }
+    }
+  }
+
+  ShapingDiskCachePendingEntry **new_entries = push_array_no_zero(scratch, ShapingDiskCachePendingEntry *, cache->pending_count);
+  uint32_t *pending_font_map = push_array_no_zero(scratch, uint32_t, cache->pending_font_count);
+  uint32_t kept_new_count = 0;
+  for(uint32_t font_idx = 0; font_idx < cache->pending_font_count; ++font_idx)
+  {
+    ShapingDiskCachePendingFont *font = &cache->pending_fonts[font_idx];
+    pending_font_map[font_idx] = shaping_disk_cache_saved_font_idx(fonts, font_paths, &font_count, font->file.path, font->file.face_index, font->file.simulations, &font->version);
+  }
+  for(ShapingDiskCachePendingEntry *pending = cache->first_pending; pending != 0; pending = pending->next)
+  {
+    new_entries[kept_new_count++] = pending;
+  }
+
+  //----------------------------------------------------------
+  // hampus: lay out the file, once to measure and once to write
+
+  uint32_t entry_count = kept_old_count + kept_new_count;
+  uint32_t slot_count = 16;
+  while(slot_count < entry_count * 2)
+  {
+    slot_count *= 2;
+  }
+  ASSERT(entry_count <= max_entry_count);
+
+  ShapingDiskCacheWriter writer = {};
+  for(uint32_t pass_idx = 0; pass_idx < 2; ++pass_idx)
+  {
+    if(pass_idx == 1)
+    {
+      writer.data = push_array_no_zero(scratch, uint8_t, writer.size);
+      writer.size = 0;
+    }
+
+    ShapingDiskCacheHeader header = {};
+    uint64_t header_offset = shaping_disk_cache_write(&writer, 0, sizeof(ShapingDiskCacheHeader));
+    header.fonts_offset = shaping_disk_cache_write(&writer, 0, font_count * sizeof(ShapingDiskCacheFont));
+    header.slots_offset = shaping_disk_cache_write(&writer, 0, slot_count * sizeof(uint32_t));
+    header.entries_offset = shaping_disk_cache_write(&writer, 0, entry_count * sizeof(ShapingDiskCacheEntry));
+    ShapingDiskCacheFont *written_fonts = (ShapingDiskCacheFont *)(writer.data + header.fonts_offset);
+    uint32_t *written_slots = (uint32_t *)(writer.data + header.slots_offset);
+    ShapingDiskCacheEntry *written_entries = (ShapingDiskCacheEntry *)(writer.data + header.entries_offset);
+
+    // hampus: fonts
+
+    for(uint32_t font_idx = 0; font_idx < font_count; ++font_idx)
+    {
+      uint64_t path_offset = shaping_disk_cache_write(&writer, font_paths[font_idx], fonts[font_idx].path_length + 1);
+      if(writer.data != 0)
+      {
+        written_fonts[font_idx] = fonts[font_idx];
+        written_fonts[font_idx].path_offset = path_offset;
+      }
+    }
+
+    // hampus: entries
+
+    for(uint32_t entry_idx = 0; entry_idx < entry_count; ++entry_idx)
+    {
+      ShapingDiskCacheEntry entry = {};
+      const uint8_t *text = 0;
+      const uint8_t *locale = 0;
+      const uint8_t *base_family = 0;
+      const uint8_t *glyph_indices = 0;
+      const uint8_t *glyph_advances = 0;
+      const uint8_t *glyph_offsets = 0;
+      const uint8_t *cluster_map = 0;
+      const uint8_t *glyph_positions = 0;
+      const uint8_t *line_breakpoints = 0;
+      if(entry_idx < kept_old_count)
+      {
+        const ShapingDiskCacheEntry *old_entry = old_entries[entry_idx];
+        const uint8_t *data = cache->mapping.data;
+        entry = *old_entry;
+        text = data + old_entry->text_offset;
+        locale = data + old_entry->locale_offset;
+        base_family = data + old_entry->base_family_offset;
+        glyph_indices = data + old_entry->glyph_indices_offset;
+        glyph_advances = data + old_entry->glyph_advances_offset;
+        glyph_offsets = data + old_entry->glyph_offsets_offset;
+        cluster_map = data + old_entry->cluster_map_offset;
+        glyph_positions = data + old_entry->glyph_positions_offset;
+        line_breakpoints = data + old_entry->line_breakpoints_offset;
+      }
+      else
+      {
+        ShapingDiskCachePendingEntry *pending = new_entries[entry_idx - kept_old_count];
+        const MapTextToGlyphsResult *result = &pending->result;
+        entry.hash = pending->hash;
+        entry.font_size = pending->font_size;
+        entry.flags = pending->flags;
+        entry.text_length = pending->text_length;
+        entry.locale_length = pending->locale_length;
+        entry.base_family_length = pending->base_family_length;
+        entry.segment_count = (uint32_t)result->segment_count;
+        entry.glyph_count = result->glyph_count;
+        text = (const uint8_t *)pending->text;
+        locale = (const uint8_t *)pending->locale;
+        base_family = (const uint8_t *)pending->base_family;
+        glyph_indices = (const uint8_t *)result->glyph_indices;
+        glyph_advances = (const uint8_t *)result->glyph_advances;
+        glyph_offsets = (const uint8_t *)result->glyph_offsets;
+        cluster_map = (const uint8_t *)result->cluster_map;
+        glyph_positions = (const uint8_t *)result->glyph_positions;
+        line_breakpoints = (const uint8_t *)result->line_breakpoints;
+      }
+
+      entry.text_offset = shaping_disk_cache_write(&writer, text, entry.text_length * sizeof(utf16_char));
+      entry.locale_offset = shaping_disk_cache_write(&writer, locale, entry.locale_length * sizeof(utf16_char));
+      entry.base_family_offset = shaping_disk_cache_write(&writer, base_family, entry.base_family_length * sizeof(utf16_char));
+      entry.segments_offset = shaping_disk_cache_write(&writer, 0, entry.segment_count * sizeof(ShapingDiskCacheSegment));
+      entry.glyph_indices_offset = shaping_disk_cache_write(&writer, glyph_indices, entry.glyph_count * sizeof(uint16_t));
+      entry.glyph_advances_offset = shaping_disk_cache_write(&writer, glyph_advances, entry.glyph_count * sizeof(float));
+      entry.glyph_offsets_offset = shaping_disk_cache_write(&writer, glyph_offsets, entry.glyph_count * sizeof(GlyphOffset));
+      entry.cluster_map_offset = shaping_disk_cache_write(&writer, cluster_map, entry.text_length * sizeof(uint32_t));
+      entry.glyph_positions_offset = 0;
+      entry.line_breakpoints_offset = 0;
+      if(entry.flags & MapTextToGlyphsFlag_GlyphPositions)
+      {
+        entry.glyph_positions_offset = shaping_disk_cache_write(&writer, glyph_positions, entry.glyph_count * sizeof(float));
+      }
+      if(entry.flags & MapTextToGlyphsFlag_LineBreakpoints)
+      {
+        entry.line_breakpoints_offset = shaping_disk_cache_write(&writer, line_breakpoints, entry.text_length * sizeof(LineBreakpoint));
+      }
+
+      if(writer.data == 0)
+      {
+        continue;
+      }
+
+      // hampus: segments
+
+      ShapingDiskCacheSegment *segments = (ShapingDiskCacheSegment *)(writer.data + entry.segments_offset);
+      if(entry_idx < kept_old_count)
+      {
+        const ShapingDiskCacheSegment *old_segments = shaping_disk_cache_entry_segments(cache, old_entries[entry_idx]);
+        for(uint32_t segment_idx = 0; segment_idx < entry.segment_count; ++segment_idx)
+        {
+          segments[segment_idx] = old_segments[segment_idx];
+          segments[segment_idx].font_idx = old_font_map[old_segments[segment_idx].font_idx];
+        }
+      }
+      else
+      {
+        ShapingDiskCachePendingEntry *pending = new_entries[entry_idx - kept_old_count];
+        for(uint32_t segment_idx = 0; segment_idx < entry.segment_count; ++segment_idx)
+        {
+          const TextToGlyphsSegment *src = &pending->result.segments[segment_idx];
+          ShapingDiskCacheSegment *segment = &segments[segment_idx];
+          *segment = {};
+          segment->font_idx = pending_font_map[pending->segment_fonts[segment_idx]];
+          segment->bidi_level = src->bidi_level;
+          segment->font_size_em = src->font_size_em;
+          segment->run_width = src->run_width;
+          segment->text_offset = src->text_offset;
+          segment->text_length = src->text_length;
+          segment->first_glyph = src->first_glyph;
+          segment->glyph_count = src->glyph_count;
+        }
+      }
+
+      // hampus: slot
+
+      written_entries[entry_idx] = entry;
+      uint32_t slot_idx = (uint32_t)entry.hash & (slot_count - 1);
+      while(written_slots[slot_idx] != 0)
+      {
+        slot_idx = (slot_idx + 1) & (slot_count - 1);
+      }
+      written_slots[slot_idx] = entry_idx + 1;
+    }
+
+    if(writer.data != 0)
+    {
+      header.magic = SHAPING_DISK_CACHE_MAGIC;
+      header.version = SHAPING_DISK_CACHE_VERSION;
+      header.header_size = sizeof(ShapingDiskCacheHeader);
+      header.font_size = sizeof(ShapingDiskCacheFont);
+      header.entry_size = sizeof(ShapingDiskCacheEntry);
+      header.segment_size = sizeof(ShapingDiskCacheSegment);
+      header.font_count = font_count;
+      header.entry_count = entry_count;
+      header.slot_count = slot_count;
+      header.file_size = writer.size;
+      memory_copy(writer.data + header_offset, &header, sizeof(header));
+    }
+  }
+
+  //----------------------------------------------------------
+  // hampus: swap the files
+
+  // NOTE(hampus): The old file has to be unmapped first, since Windows won't
+  // replace a mapped file
+  shaping_disk_cache_unmap(cache);
+  bool result = os_file_replace(cache->path, writer.data, writer.size);
+  arena_release(scratch);
+  if(result)
+  {
+    shaping_disk_cache_clear_pending(cache);
+  }
+  cache->stats.stale_entry_count = 0;
+  cache->stats.invalid_entry_count = 0;
+  shaping_disk_cache_map(cache);
+  return result;
+}
+
+#endif // SHAPING_DISK_CACHE_H
@@ -0,0 +1,647 @@
+#ifndef SOFTWARE_RASTERIZER_H
+#define SOFTWARE_RASTERIZER_H
+
+#include <stdio.h>
+
+#include "text_to_glyphs.h"
+
+////////////////////////////////////////////////////////////
+// hampus: software rasterizer
+
+// NOTE(hampus): Draws shaped glyphs into a bitmap on the CPU, for when there
+// is no GPU and no Direct2D, e.g. thumbnails on a server or comparing
+// against golden images.
+//
+// Glyphs are rasterized straight from their outlines with exact area
+// coverage: every line of the outline adds its signed area and cover to an
+// accumulation buffer, and a running sum along each row turns that into
+// coverage. The running sum is the hot loop, and has AVX2, SSE2 and NEON
+// versions next to the scalar one.
+//
+// The rasterizer doesn't know where outlines come from. It calls a
+// GlyphOutlineFunction, e.g. freetype_glyph_outline in
+// freetype_software_rasterizer.h or stub_glyph_outline.
+
+struct GlyphOutlineLine
+{
+  float x0;
+  float y0;
+  float x1;
+  float y1;
+};
+
+// NOTE(hampus): The outline of one glyph at em_size, as closed contours
+// flattened into lines, in pixels from the glyph origin on the baseline with
+// y going down. Either winding direction works, overlapping contours are
+// filled by their summed winding. The lines may be pushed onto `arena`.
+// Returns false if the glyph has no outline.
+typedef bool GlyphOutlineFunction(void *user_data, Arena *arena, ShapingFontFace *font_face, float em_size, uint16_t glyph_index, GlyphOutlineLine **lines, uint32_t *line_count);
+
+enum SoftwareBitmapFormat
+{
+  // NOTE(hampus): One byte of coverage per pixel
+  SoftwareBitmapFormat_A8,
+
+  // NOTE(hampus): Premultiplied, in the byte order of DXGI_FORMAT_B8G8R8A8
+  SoftwareBitmapFormat_BGRA8,
+};
+
+struct SoftwareBitmap
+{
+  SoftwareBitmapFormat format;
+  uint32_t width;
+  uint32_t height;
+  uint32_t pitch;
+  uint8_t *pixels;
+};
+
+struct SoftwareColor
+{
+  float r;
+  float g;
+  float b;
+  float a;
+};
+
+struct SoftwareRasterizerStats
+{
+  uint64_t glyph_count;
+  uint64_t empty_glyph_count;
+  uint64_t line_count;
+  uint64_t pixel_count;
+};
+
+struct SoftwareRasterizer
+{
+  Arena *scratch;
+
+  GlyphOutlineFunction *outline;
+  void *outline_user_data;
+
+  // NOTE(hampus): Sized for the largest glyph so far
+  uint64_t accumulation_capacity;
+  float *accumulation;
+  uint64_t coverage_capacity;
+  uint8_t *coverage;
+
+  SoftwareRasterizerStats stats;
+};
+
+static SoftwareBitmap
+software_bitmap_alloc(SoftwareBitmapFormat format, uint32_t width, uint32_t height)
+{
+  SoftwareBitmap bitmap = {};
+  bitmap.format = format;
+  bitmap.width = width;
+  bitmap.height = height;
+  bitmap.pitch = width * (format == SoftwareBitmapFormat_A8 ? 1 : 4);
+  bitmap.pixels = (uint8_t *)memory_alloc_zero((uint64_t)bitmap.pitch * height);
+  return bitmap;
+}
+
+static void
+software_bitmap_release(SoftwareBitmap *bitmap)
+{
+  memory_free(bitmap->pixels);
+  *bitmap = {};
+}
+
+static SoftwareRasterizer *
+software_rasterizer_alloc(GlyphOutlineFunction *outline, void *outline_user_data)
+{
+  SoftwareRasterizer *rasterizer = (SoftwareRasterizer *)memory_alloc_zero(sizeof(SoftwareRasterizer));
+  rasterizer->scratch = arena_alloc();
+  rasterizer->outline = outline;
+  rasterizer->outline_user_data = outline_user_data;
+  return rasterizer;
+}
+
+static void
+software_rasterizer_release(SoftwareRasterizer *rasterizer)
+{
+  memory_free(rasterizer->accumulation);
+  memory_free(rasterizer->coverage);
+  arena_release(rasterizer->scratch);
+  memory_free(rasterizer);
+}
+
+//----------------------------------------------------------
+// hampus: coverage accumulation
+
+static void
+software_accumulate_coverage_scalar(const float *accumulation, uint8_t *coverage, uint32_t count, float *carry)
+{
+  float sum = *carry;
+  for(uint32_t idx = 0; idx < count; ++idx)
+  {
+    sum += accumulation[idx];
+    float value = sum < 0 ? -sum : sum;
+    value = value < 1.0f ? value : 1.0f;
+    coverage[idx] = (uint8_t)(value * 255.0f + 0.5f);
+  }
+  *carry = sum;
+}
+
+static void
+software_accumulate_coverage(const float *accumulation, uint8_t *coverage, uint32_t count)
+{
+  // NOTE(hampus): Running sum of one row of the accumulation buffer, turned
+  // into 8-bit coverage. The vector paths do the sum as a prefix sum within
+  // each register and carry the last element over to the next one.
+  uint32_t idx = 0;
+  float carry = 0;
+
+#if SIMD_AVX2
+  {
+    __m256 offset = _mm256_setzero_ps();
+    __m256 sign_mask = _mm256_set1_ps(-0.0f);
+    __m256 one = _mm256_set1_ps(1.0f);
+    __m256 scale = _mm256_set1_ps(255.0f);
+    __m256 half = _mm256_set1_ps(0.5f);
+    for(; idx + 8 <= count; idx += 8)
+    {
+      __m256 x = _mm256_loadu_ps(accumulation + idx);
+      x = _mm256_add_ps(x, _mm256_castsi256_ps(_mm256_slli_si256(_mm256_castps_si256(x), 4)));
+      x = _mm256_add_ps(x, _mm256_castsi256_ps(_mm256_slli_si256(_mm256_castps_si256(x), 8)));
+
+      // NOTE(hampus): The shifts stay within each 128-bit lane, so add the
+      // total of the low lane to the high one.
+      __m256 lane_totals = _mm256_permute_ps(x, _MM_SHUFFLE(3, 3, 3, 3));
+      x = _mm256_add_ps(x, _mm256_permute2f128_ps(lane_totals, lane_totals, 0x08));
+      x = _mm256_add_ps(x, offset);
+      offset = _mm256_permute_ps(x, _MM_SHUFFLE(3, 3, 3, 3));
+      offset = _mm256_permute2f128_ps(offset, offset, 0x11);
+
+      __m256 value = _mm256_min_ps(_mm256_andnot_ps(sign_mask, x), one);
+      __m256i value_i32 = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(value, scale), half));
+      __m256i value_i16 = _mm256_packs_epi32(value_i32, value_i32);
+      __m256i value_u8 = _mm256_packus_epi16(value_i16, value_i16);
+      uint32_t low = (uint32_t)_mm_cvtsi128_si32(_mm256_castsi256_si128(value_u8));
+      uint32_t high = (uint32_t)_mm_cvtsi128_si32(_mm256_extracti128_si256(value_u8, 1));
+      memory_copy(coverage + idx, &low, 4);
+      memory_copy(coverage + idx + 4, &high, 4);
+    }
+    carry = _mm256_cvtss_f32(offset);
+  }
+#elif SIMD_SSE2
+  {
+    __m128 offset = _mm_setzero_ps();
+    __m128 sign_mask = _mm_set1_ps(-0.0f);
+    __m128 one = _mm_set1_ps(1.0f);
+    __m128 scale = _mm_set1_ps(255.0f);
+    __m128 half = _mm_set1_ps(0.5f);
+    for(; idx + 4 <= count; idx += 4)
+    {
+      __m128 x = _mm_loadu_ps(accumulation + idx);
+      x = _mm_add_ps(x, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(x), 4)));
+      x = _mm_add_ps(x, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(x), 8)));
+      x = _mm_add_ps(x, offset);
+      offset = _mm_shuffle_ps(x, x, _MM_SHUFFLE(3, 3, 3, 3));
+
+      __m128 value = _mm_min_ps(_mm_andnot_ps(sign_mask, x), one);
+      __m128i value_i32 = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(value, scale), half));
+      __m128i value_i16 = _mm_packs_epi32(value_i32, value_i32);
+      uint32_t packed = (uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(value_i16, value_i16));
+      memory_copy(coverage + idx, &packed, 4);
+    }
+    carry = _mm_cvtss_f32(offset);
+  }
+#elif SIMD_NEON
+  {
+    float32x4_t offset = vdupq_n_f32(0);
+    float32x4_t zero = vdupq_n_f32(0);
+    float32x4_t one = vdupq_n_f32(1.0f);
+    for(; idx + 4 <= count; idx += 4)
+    {
+      float32x4_t x = vld1q_f32(accumulation + idx);
+      x = vaddq_f32(x, vextq_f32(zero, x, 3));
+      x = vaddq_f32(x, vextq_f32(zero, x, 2));
+      x = vaddq_f32(x, offset);
+      offset = vdupq_n_f32(vgetq_lane_f32(x, 3));
+
+      float32x4_t value = vminq_f32(vabsq_f32(x), one);
+      uint32x4_t value_u32 = vcvtq_u32_f32(vaddq_f32(vmulq_n_f32(value, 255.0f), vdupq_n_f32(0.5f)));
+      uint16x4_t value_u16 = vmovn_u32(value_u32);
+      uint8x8_t value_u8 = vmovn_u16(vcombine_u16(value_u16, value_u16));
+      uint32_t packed = vget_lane_u32(vreinterpret_u32_u8(value_u8), 0);
+      memory_copy(coverage + idx, &packed, 4);
+    }
+    carry = vgetq_lane_f32(offset, 0);
+  }
+#endif
+
+  software_accumulate_coverage_scalar(accumulation + idx, coverage + idx, count - idx, &carry);
+}
+
+//----------------------------------------------------------
+// hampus: lines
+
+static void
+software_rasterizer_draw_line(float *accumulation, uint32_t stride, uint32_t height, float x0, float y0, float x1, float y1)
+{
+  // NOTE(hampus): Adds the line's signed area and cover to every pixel it
+  // crosses. The line has to lie within [0, stride - 2] x [0, height].
+  if(y0 == y1)
+  {
+    return;
+  }
+  float direction = 1.0f;
+  if(y0 > y1)
+  {
+    direction = -1.0f;
+    float swap = x0;
+    x0 = x1;
+    x1 = swap;
+    swap = y0;
+    y0 = y1;
+    y1 = swap;
+  }
+
+  float dxdy = (x1 - x0) / (y1 - y0);
+  float x = x0;
+  uint32_t row_begin = (uint32_t)y0;
+  uint32_t row_end = (uint32_t)y1 + ((float)(uint32_t)y1 < y1 ? 1 : 0);
+  row_end = row_end < height ? row_end : height;
+  for(uint32_t row = row_begin; row < row_end; ++row)
+  {
+    float *line = accumulation + (uint64_t)row * stride;
+    float row_top = (float)row > y0 ? (float)row : y0;
+    float row_bottom = (float)(row + 1) < y1 ? (float)(row + 1) : y1;
+    float dy = row_bottom - row_top;
+    float x_next = x + dxdy * dy;
+    float d = dy * direction;
+    float left = x < x_next ? x : x_next;
+    float right = x < x_next ? x_next : x;
+
+    float left_floor = (float)(int32_t)left;
+    int32_t left_idx = (int32_t)left_floor;
+    float right_ceil = (float)(int32_t)right;
+    right_ceil += right_ceil < right ? 1.0f : 0.0f;
+    int32_t right_idx = (int32_t)right_ceil;
+
+    if(right_idx <= left_idx + 1)
+    {
+      // NOTE(hampus): Within one pixel, split at the line's middle x
+      float mid = 0.5f * (x + x_next) - left_floor;
+      line[left_idx] += d - d * mid;
+      line[left_idx + 1] += d * mid;
+    }
+    else
+    {
+      float inverse_width = 1.0f / (right - left);
+      float left_fraction = left - left_floor;
+      float first_area = 0.5f * inverse_width * (1.0f - left_fraction) * (1.0f - left_fraction);
+      float right_fraction = right - right_ceil + 1.0f;
+      float last_area = 0.5f * inverse_width * right_fraction * right_fraction;
+
+      line[left_idx] += d * first_area;
+      if(right_idx == left_idx + 2)
+      {
+        line[left_idx + 1] += d * (1.0f - first_area - last_area);
+      }
+      else
+      {
+        float second_area = inverse_width * (1.5f - left_fraction);
+        line[left_idx + 1] += d * (second_area - first_area);
+        for(int32_t idx = left_idx + 2; idx < right_idx - 1; ++idx)
+        {
+          line[idx] += d * inverse_width;
+        }
+        float before_last_area = second_area + (float)(right_idx - left_idx - 3) * inverse_width;
+        line[right_idx - 1] += d * (1.0f - before_last_area - last_area);
+      }
+      line[right_idx] += d * last_area;
+    }
+    x = x_next;
+  }
+}
+
+//----------------------------------------------------------
+// hampus: compositing
+
+static void
+software_bitmap_blend_row(SoftwareBitmap *bitmap, uint32_t x, uint32_t y, const uint8_t *coverage, uint32_t count, SoftwareColor color)
+{
+  // NOTE(hampus): Source over, with the coverage as alpha
+  uint8_t *dst = bitmap->pixels + (uint64_t)y * bitmap->pitch;
+  if(bitmap->format == SoftwareBitmapFormat_A8)
+  {
+    dst += x;
+    uint32_t color_a = (uint32_t)(color.a * 255.0f + 0.5f);
+    for(uint32_t idx = 0; idx < count; ++idx)
+    {
+      uint32_t alpha = (coverage[idx] * color_a + 127) / 255;
+      dst[idx] = (uint8_t)(alpha + (dst[idx] * (255 - alpha) + 127) / 255);
+    }
+  }
+  else
+  {
+    dst += x * 4;
+    uint32_t color_b = (uint32_t)(color.b * 255.0f + 0.5f);
+    uint32_t color_g = (uint32_t)(color.g * 255.0f + 0.5f);
+    uint32_t color_r = (uint32_t)(color.r * 255.0f + 0.5f);
+    uint32_t color_a = (uint32_t)(color.a * 255.0f + 0.5f);
+    for(uint32_t idx = 0; idx < count; ++idx, dst += 4)
+    {
+      uint32_t alpha = (coverage[idx] * color_a + 127) / 255;
+      if(alpha == 0)
+      {
+        continue;
+      }
+      uint32_t inverse_alpha = 255 - alpha;
+      dst[0] = (uint8_t)((color_b * alpha + dst[0] * inverse_alpha + 127) / 255);
+      dst[1] = (uint8_t)((color_g * alpha + dst[1] * inverse_alpha + 127) / 255);
+      dst[2] = (uint8_t)((color_r * alpha + dst[2] * inverse_alpha + 127) / 255);
+      dst[3] = (uint8_t)((255 * alpha + dst[3] * inverse_alpha + 127) / 255);
+    }
+  }
+}
+
+//----------------------------------------------------------
+// hampus: glyphs
+
+static void
+software_rasterize_glyph(SoftwareRasterizer *rasterizer, SoftwareBitmap *bitmap, ShapingFontFace *font_face, float em_size, uint16_t glyph_index, float origin_x, float origin_y, SoftwareColor color)
+{
+  uint64_t scratch_pos = arena_pos(rasterizer->scratch);
+  rasterizer->stats.glyph_count += 1;
+
+  GlyphOutlineLine *lines = 0;
+  uint32_t line_count = 0;
+  if(!rasterizer->outline(rasterizer->outline_user_data, rasterizer->scratch, font_face, em_size, glyph_index, &lines, &line_count) || line_count == 0)
+  {
+    rasterizer->stats.empty_glyph_count += 1;
+    arena_pop_to(rasterizer->scratch, scratch_pos);
+    return;
+  }
+  rasterizer->stats.line_count += line_count;
+
+  // hampus: bounds in bitmap pixels
+
+  // NOTE(hampus): Every line is two (x, y) points
+  GlyphBounds bounds = glyph_bounds_empty();
+  glyph_bounds_from_points(&lines[0].x0, (uint64_t)line_count * 2, &bounds);
+  float min_x = origin_x + bounds.min_x;
+  float min_y = origin_y + bounds.min_y;
+  float max_x = origin_x + bounds.max_x;
+  float max_y = origin_y + bounds.max_y;
+  int32_t left = (int32_t)min_x - (min_x < 0 ? 1 : 0);
+  int32_t top = (int32_t)min_y - (min_y < 0 ? 1 : 0);
+  int32_t right = (int32_t)max_x + 1;
+  int32_t bottom = (int32_t)max_y + 1;
+  if(right <= 0 || bottom <= 0 || left >= (int32_t)bitmap->width || top >= (int32_t)bitmap->height)
+  {
+    arena_pop_to(rasterizer->scratch, scratch_pos);
+    return;
+  }
+  uint32_t width = (uint32_t)(right - left);
+  uint32_t height = (uint32_t)(bottom - top);
+
+  // hampus: accumulate
+
+  // NOTE(hampus): Two extra columns, for what lines on the right edge spill
+  uint32_t stride = width + 2;
+  uint64_t accumulation_size = (uint64_t)stride * height;
+  if(accumulation_size > rasterizer->accumulation_capacity)
+  {
+    memory_free(rasterizer->accumulation);
+    rasterizer->accumulation_capacity = accumulation_size * 2;
+    rasterizer->accumulation = (float *)memory_alloc(sizeof(float) * rasterizer->accumulation_capacity);
+  }
+  if(stride > rasterizer->coverage_capacity)
+  {
+    memory_free(rasterizer->coverage);
+    rasterizer->coverage_capacity = stride * 2;
+    rasterizer->coverage = (uint8_t *)memory_alloc(rasterizer->coverage_capacity);
+  }
+  float *accumulation = rasterizer->accumulation;
+  memset(accumulation, 0, sizeof(float) * accumulation_size);
+
+  float offset_x = origin_x - (float)left;
+  float offset_y = origin_y - (float)top;
+  for(uint32_t line_idx = 0; line_idx < line_count; ++line_idx)
+  {
+    GlyphOutlineLine *line = &lines[line_idx];
+    software_rasterizer_draw_line(accumulation, stride, height,
+                                  line->x0 + offset_x, line->y0 + offset_y,
+                                  line->x1 + offset_x, line->y1 + offset_y);
+  }
+
+  // hampus: resolve and blend the visible rows
+
+  int32_t visible_left = left > 0 ? left : 0;
+  int32_t visible_top = top > 0 ? top : 0;
+  int32_t visible_right = right < (int32_t)bitmap->width ? right : (int32_t)bitmap->width;
+  int32_t visible_bottom = bottom < (int32_t)bitmap->height ? bottom : (int32_t)bitmap->height;
+  for(int32_t y = visible_top; y < visible_bottom; ++y)
+  {
+    software_accumulate_coverage(accumulation + (uint64_t)(y - top) * stride, rasterizer->coverage, width);
+    software_bitmap_blend_row(bitmap, (uint32_t)visible_left, (uint32_t)y, rasterizer->coverage + (visible_left - left), (uint32_t)(visible_right - visible_left), color);
+  }
+  rasterizer->stats.pixel_count += (uint64_t)width * height;
+
+  arena_pop_to(rasterizer->scratch, scratch_pos);
+}
+
+static void
+software_rasterize_glyphs(SoftwareRasterizer *rasterizer, SoftwareBitmap *bitmap, ShapingFontFace *font_face, float em_size, bool is_right_to_left, const uint16_t *glyph_indices, const float *glyph_advances, const GlyphOffset *glyph_offsets, uint64_t glyph_count, float baseline_x, float baseline_y, SoftwareColor color)
+{
+  // NOTE(hampus): The baseline origin is the same one DrawGlyphRun would
+  // get, so for right to left runs it is the right end of the run.
+  uint64_t scratch_pos = arena_pos(rasterizer->scratch);
+  float *pen_positions = push_array_no_zero(rasterizer->scratch, float, glyph_count);
+  glyph_positions_from_advances(glyph_advances, 0.0f, pen_positions, glyph_count);
+  for(uint64_t glyph_idx = 0; glyph_idx < glyph_count; ++glyph_idx)
+  {
+    float glyph_x = 0;
+    if(is_right_to_left)
+    {
+      glyph_x = baseline_x - pen_positions[glyph_idx] - glyph_advances[glyph_idx] - glyph_offsets[glyph_idx].advance_offset;
+    }
+    else
+    {
+      glyph_x = baseline_x + pen_positions[glyph_idx] + glyph_offsets[glyph_idx].advance_offset;
+    }
+    float glyph_y = baseline_y - glyph_offsets[glyph_idx].ascender_offset;
+    software_rasterize_glyph(rasterizer, bitmap, font_face, em_size, glyph_indices[glyph_idx], glyph_x, glyph_y, color);
+  }
+  arena_pop_to(rasterizer->scratch, scratch_pos);
+}
+
+static void
+software_rasterize_segment(SoftwareRasterizer *rasterizer, SoftwareBitmap *bitmap, const MapTextToGlyphsResult *result, const TextToGlyphsSegment *segment, float baseline_x, float baseline_y, SoftwareColor color)
+{
+  software_rasterize_glyphs(rasterizer,
+                            bitmap,
+                            shaping_font_face_from_segment(result, segment),
+                            segment->font_size_em,
+                            (segment->bidi_level & 1) != 0,
+                            result->glyph_indices + segment->first_glyph,
+                            result->glyph_advances + segment->first_glyph,
+                            result->glyph_offsets + segment->first_glyph,
+                            segment->glyph_count,
+                            baseline_x,
+                            baseline_y,
+                            color);
+}
+
+////////////////////////////////////////////////////////////
+// hampus: png writer
+
+// NOTE(hampus): Just enough PNG to look at a bitmap: no compression, the
+// pixels go into stored deflate blocks. BGRA8 bitmaps are written as
+// straight RGBA.
+
+static uint32_t
+png_crc32(uint32_t crc, const uint8_t *data, uint64_t size)
+{
+  static uint32_t table[256];
+  static bool table_is_initialized = false;
+  if(!table_is_initialized)
+  {
+    for(uint32_t idx = 0; idx < 256; ++idx)
+    {
+      uint32_t value = idx;
+      for(uint32_t bit = 0; bit < 8; ++bit)
+      {
+        value = (value & 1) ? 0xEDB88320 ^ (value >> 1) : value >> 1;
+      }
+      table[idx] = value;
+    }
+    table_is_initialized = true;
+  }
+  crc = ~crc;
+  for(uint64_t idx = 0; idx < size; ++idx)
+  {
+    crc = table[(crc ^ data[idx]) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+static uint8_t *
+png_write_u32_be(uint8_t *ptr, uint32_t value)
+{
+  ptr[0] = (uint8_t)(value >> 24);
+  ptr[1] = (uint8_t)(value >> 16);
+  ptr[2] = (uint8_t)(value >> 8);
+  ptr[3] = (uint8_t)value;
+  return ptr + 4;
+}
+
+static uint8_t *
+png_write_chunk(uint8_t *ptr, const char *type, const uint8_t *data, uint32_t size)
+{
+  ptr = png_write_u32_be(ptr, size);
+  uint8_t *type_and_data = ptr;
+  memory_copy(ptr, type, 4);
+  ptr += 4;
+  if(size != 0)
+  {
+    memory_copy(ptr, data, size);
+    ptr += size;
+  }
+  return png_write_u32_be(ptr, png_crc32(0, type_and_data, size + 4));
+}
+
+static bool
+software_bitmap_write_png(const SoftwareBitmap *bitmap, const char *path)
+{
+  uint32_t channel_count = bitmap->format == SoftwareBitmapFormat_A8 ? 1 : 4;
+  uint64_t row_size = 1 + (uint64_t)bitmap->width * channel_count;
+  uint64_t raw_size = row_size * bitmap->height;
+  uint64_t block_count = raw_size / 0xFFFF + 1;
+  uint64_t zlib_size = 2 + raw_size + block_count * 5 + 4;
+  ASSERT(zlib_size <= UINT32_MAX);
+
+  // hampus: filtered rows
+
+  uint8_t *raw = (uint8_t *)memory_alloc(raw_size);
+  for(uint32_t y = 0; y < bitmap->height; ++y)
+  {
+    uint8_t *dst = raw + y * row_size;
+    const uint8_t *src = bitmap->pixels + (uint64_t)y * bitmap->pitch;
+    *dst++ = 0;
+    if(bitmap->format == SoftwareBitmapFormat_A8)
+    {
+      memory_copy(dst, src, bitmap->width);
+    }
+    else
+    {
+      for(uint32_t x = 0; x < bitmap->width; ++x, src += 4, dst += 4)
+      {
+        uint32_t alpha = src[3];
+        dst[0] = alpha != 0 ? (uint8_t)((src[2] * 255 + alpha / 2) / alpha) : 0;
+        dst[1] = alpha != 0 ? (uint8_t)((src[1] * 255 + alpha / 2) / alpha) : 0;
+        dst[2] = alpha != 0 ? (uint8_t)((src[0] * 255 + alpha / 2) / alpha) : 0;
+        dst[3] = (uint8_t)alpha;
+      }
+    }
+  }
+
+  // hampus: zlib stream of stored blocks
+
+  uint8_t *zlib = (uint8_t *)memory_alloc(zlib_size);
+  uint8_t *ptr = zlib;
+  *ptr++ = 0x78;
+  *ptr++ = 0x01;
+  uint32_t adler_a = 1;
+  uint32_t adler_b = 0;
+  for(uint64_t offset = 0; offset < raw_size || offset == 0;)
+  {
+    uint32_t block_size = raw_size - offset < 0xFFFF ? (uint32_t)(raw_size - offset) : 0xFFFF;
+    bool is_last = offset + block_size == raw_size;
+    *ptr++ = is_last ? 1 : 0;
+    *ptr++ = (uint8_t)block_size;
+    *ptr++ = (uint8_t)(block_size >> 8);
+    *ptr++ = (uint8_t)~block_size;
+    *ptr++ = (uint8_t)(~block_size >> 8);
+    memory_copy(ptr, raw + offset, block_size);
+    ptr += block_size;
+    for(uint32_t idx = 0; idx < block_size; ++idx)
+    {
+      adler_a = (adler_a + raw[offset + idx]) % 65521;
+      adler_b = (adler_b + adler_a) % 65521;
+    }
+    offset += block_size;
+    if(is_last)
+    {
+      break;
+    }
+  }
+  ptr = png_write_u32_be(ptr, (adler_b << 16) | adler_a);
+  uint32_t zlib_used = (uint32_t)(ptr - zlib);
+
+  // hampus: file
+
+  uint64_t png_size = 8 + (12 + 13) + (12 + zlib_used) + 12;
+  uint8_t *png = (uint8_t *)memory_alloc(png_size);
+  ptr = png;
+  const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+  memory_copy(ptr, signature, 8);
+  ptr += 8;
+
+  uint8_t header[13] = {};
+  png_write_u32_be(header + 0, bitmap->width);
+  png_write_u32_be(header + 4, bitmap->height);
+  header[8] = 8;
+  header[9] = bitmap->format == SoftwareBitmapFormat_A8 ? 0 : 6;
+  ptr = png_write_chunk(ptr, "IHDR", header, sizeof(header));
+  ptr = png_write_chunk(ptr, "IDAT", zlib, zlib_used);
+  ptr = png_write_chunk(ptr, "IEND", 0, 0);
+  ASSERT((uint64_t)(ptr - png) == png_size);
+
+  bool result = false;
+  FILE *file = fopen(path, "wb");
+  if(file != 0)
+  {
+    result = fwrite(png, 1, png_size, file) == png_size;
+    fclose(file);
+  }
+
+  memory_free(png);
+  memory_free(zlib);
+  memory_free(raw);
+  return result;
+}
+
+#endif // SOFTWARE_RASTERIZER_H
@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "stub_text_to_glyphs.h"
+
+// NOTE(hampus): Set to 1 to also rasterize real glyphs, from the fonts that
+// fontconfig finds, through the FreeType backend. build.sh does on Linux.
+#if !defined(SOFTWARE_RASTERIZER_BENCHMARK_FREETYPE)
+#  define SOFTWARE_RASTERIZER_BENCHMARK_FREETYPE 0
+#endif
+
+#if SOFTWARE_RASTERIZER_BENCHMARK_FREETYPE
+#  include "freetype_software_rasterizer.h"
+#endif
+
+////////////////////////////////////////////////////////////
+// hampus: coverage kernel
+
+static void
+benchmark_coverage_kernel(uint32_t row_width, uint32_t iteration_count)
+{
+  // NOTE(hampus): A row with a few spans of coverage, like a line of text
+  // cut through its x-height. Checks that the vector path matches the
+  // scalar one, and times both.
+  float *accumulation = (float *)memory_alloc(sizeof(float) * row_width);
+  uint8_t *coverage = (uint8_t *)memory_alloc(row_width);
+  uint8_t *expected = (uint8_t *)memory_alloc(row_width);
+  for(uint32_t idx = 0; idx < row_width; ++idx)
+  {
+    uint32_t phase = idx % 24;
+    accumulation[idx] = phase == 3 ? 0.75f : phase == 4 ? 0.25f : phase == 13 ? -0.6f : phase == 14 ? -0.4f : 0.0f;
+  }
+
+  float carry = 0;
+  software_accumulate_coverage_scalar(accumulation, expected, row_width, &carry);
+  software_accumulate_coverage(accumulation, coverage, row_width);
+  uint32_t max_difference = 0;
+  for(uint32_t idx = 0; idx < row_width; ++idx)
+  {
+    uint32_t difference = coverage[idx] > expected[idx] ? coverage[idx] - expected[idx] : expected[idx] - coverage[idx];
+    max_difference = difference > max_difference ? difference : max_difference;
+  }
+  ASSERT(max_difference <= 1);
+
+  uint64_t scalar_begin = os_now_ns();
+  for(uint32_t iteration_idx = 0; iteration_idx < iteration_count; ++iteration_idx)
+  {
+    carry = 0;
+    software_accumulate_coverage_scalar(accumulation, coverage, row_width, &carry);
+  }
+  uint64_t scalar_end = os_now_ns();
+  for(uint32_t iteration_idx = 0; iteration_idx < iteration_count; ++iteration_idx)
+  {
+    software_accumulate_coverage(accumulation, coverage, row_width);
+  }
+  uint64_t vector_end = os_now_ns();
+
+  double pixel_count = (double)row_width * iteration_count;
+  printf("%8u %14.3f %14.3f %10u\n",
+         row_width,
+         (double)(scalar_end - scalar_begin) / pixel_count,
+         (double)(vector_end - scalar_end) / pixel_count,
+         max_difference);
+
+  memory_free(expected);
+  memory_free(coverage);
+  memory_free(accumulation);
+}
+
+////////////////////////////////////////////////////////////
+// hampus: glyph throughput
+
+static void
+benchmark_rasterize_text(const ShapingBackend *backend, GlyphOutlineFunction *outline, SoftwareBitmapFormat format, float font_size, uint64_t min_glyph_count, const char *png_path)
+{
+  const utf16_char *locale = utf16_literal("en-us");
+  const utf16_char *base_family = utf16_literal("Fira Code");
+  const utf16_char *lines[] =
+  {
+    utf16_literal("The quick brown fox jumps over the lazy dog. 0123456789"),
+    utf16_literal("fn main() { let x = vec![1, 2, 3]; println!(\"{:?}\", x); }"),
+    utf16_literal("Sphinx of black quartz, judge my vow! (*&^%$#@) [{<>}]"),
+  };
+  const uint32_t line_count = sizeof(lines) / sizeof(lines[0]);
+
+  MapTextToGlyphsResult results[line_count] = {};
+  float line_height = font_size * 1.25f;
+  uint32_t bitmap_width = 16;
+  for(uint32_t line_idx = 0; line_idx < line_count; ++line_idx)
+  {
+    uint32_t length = 0;
+    while(lines[line_idx][length] != 0)
+    {
+      length += 1;
+    }
+    results[line_idx] = map_text_to_glyphs(backend, locale, base_family, font_size, lines[line_idx], length);
+    uint32_t line_width = (uint32_t)(font_size * length) + 16;
+    bitmap_width = line_width > bitmap_width ? line_width : bitmap_width;
+  }
+  uint32_t bitmap_height = (uint32_t)(line_height * line_count + font_size) + 8;
+
+  SoftwareRasterizer *rasterizer = software_rasterizer_alloc(outline, 0);
+  SoftwareBitmap bitmap = software_bitmap_alloc(format, bitmap_width, bitmap_height);
+  SoftwareColor color = {0.1f, 0.2f, 0.9f, 1.0f};
+
+  uint64_t begin = os_now_ns();
+  uint32_t pass_count = 0;
+  while(rasterizer->stats.glyph_count < min_glyph_count)
+  {
+    memset(bitmap.pixels, 0, (uint64_t)bitmap.pitch * bitmap.height);
+    for(uint32_t line_idx = 0; line_idx < line_count; ++line_idx)
+    {
+      MapTextToGlyphsResult *result = &results[line_idx];
+      float baseline_y = 4.0f + font_size + line_height * line_idx;
+      float pen_x = 8.25f;
+      for(uint64_t segment_idx = 0; segment_idx < result->segment_count; ++segment_idx)
+      {
+        TextToGlyphsSegment *segment = &result->segments[segment_idx];
+        float segment_width = segment->run_width;
+        float baseline_x = (segment->bidi_level & 1) != 0 ? pen_x + segment_width : pen_x;
+        software_rasterize_segment(rasterizer, &bitmap, result, segment, baseline_x, baseline_y, color);
+        pen_x += segment_width;
+      }
+    }
+    pass_count += 1;
+  }
+  uint64_t end = os_now_ns();
+
+  SoftwareRasterizerStats *stats = &rasterizer->stats;
+  double seconds = (double)(end - begin) / 1e9;
+  printf("%8.0f %8s %12.2f %12.1f %12.1f %8u\n",
+         font_size,
+         format == SoftwareBitmapFormat_A8 ? "a8" : "bgra8",
+         (double)stats->glyph_count / seconds / 1e6,
+         (double)stats->pixel_count / seconds / 1e6,
+         (double)(end - begin) / (double)stats->glyph_count,
+         pass_count);
+
+  if(png_path != 0 && software_bitmap_write_png(&bitmap, png_path))
+  {
+    printf("wrote %s\n", png_path);
+  }
+
+  software_bitmap_release(&bitmap);
+  software_rasterizer_release(rasterizer);
+  for(uint32_t line_idx = 0; line_idx < line_count; ++line_idx)
+  {
+    free_map_text_to_glyphs_result(&results[line_idx]);
+  }
+}
+
+////////////////////////////////////////////////////////////
+// hampus: main
+
+int
+main(int argc, char **argv)
+{
+  // NOTE(hampus): Pass a number of glyphs to rasterize per size to trade run
+  // time for stable numbers.
+  uint64_t min_glyph_count = 1 << 20;
+  if(argc > 1)
+  {
+    min_glyph_count = strtoull(argv[1], 0, 10);
+  }
+
+  MemoryAccounting *memory_accounting = memory_accounting_alloc();
+  memory_set_allocator(memory_accounting_allocator(memory_accounting));
+
+  StubShapingBackend stub_backend = {};
+  stub_shaping_backend_init(&stub_backend);
+  ShapingBackend backend = stub_shaping_backend(&stub_backend);
+
+  //----------------------------------------------------------
+  // hampus: coverage kernel
+
+  const char *kernel_name = SIMD_AVX2 ? "avx2" : SIMD_SSE2 ? "sse2" : SIMD_NEON ? "neon" : "scalar";
+  printf("coverage kernel (%s)\n", kernel_name);
+  printf("%8s %14s %14s %10s\n", "width", "scalar ns/px", "kernel ns/px", "max diff");
+  benchmark_coverage_kernel(13, 1 << 20);
+  benchmark_coverage_kernel(64, 1 << 18);
+  benchmark_coverage_kernel(1024, 1 << 14);
+
+  //----------------------------------------------------------
+  // hampus: glyph throughput
+
+  printf("\nglyph throughput\n");
+  printf("%8s %8s %12s %12s %12s %8s\n", "px", "format", "Mglyphs/s", "Mpixels/s", "ns/glyph", "passes");
+  float font_sizes[] = {12.0f, 16.0f, 48.0f};
+  for(uint32_t size_idx = 0; size_idx < sizeof(font_sizes) / sizeof(font_sizes[0]); ++size_idx)
+  {
+    benchmark_rasterize_text(&backend, stub_glyph_outline, SoftwareBitmapFormat_A8, font_sizes[size_idx], min_glyph_count, 0);
+    benchmark_rasterize_text(&backend, stub_glyph_outline, SoftwareBitmapFormat_BGRA8, font_sizes[size_idx], min_glyph_count, size_idx == 2 ? "software_rasterizer.png" : 0);
+  }
+
+#if SOFTWARE_RASTERIZER_BENCHMARK_FREETYPE
+  // NOTE(hampus): Real outlines have curves and many more lines per glyph
+  // than the stub's octagons, and go through FreeType for every glyph.
+  printf("\nglyph throughput (freetype)\n");
+  printf("%8s %8s %12s %12s %12s %8s\n", "px", "format", "Mglyphs/s", "Mpixels/s", "ns/glyph", "passes");
+  FreeTypeShapingBackend *freetype_backend = freetype_shaping_backend_alloc();
+  ShapingBackend real_backend = freetype_shaping_backend(freetype_backend);
+  for(uint32_t size_idx = 0; size_idx < sizeof(font_sizes) / sizeof(font_sizes[0]); ++size_idx)
+  {
+    benchmark_rasterize_text(&real_backend, freetype_glyph_outline, SoftwareBitmapFormat_A8, font_sizes[size_idx], min_glyph_count, 0);
+    benchmark_rasterize_text(&real_backend, freetype_glyph_outline, SoftwareBitmapFormat_BGRA8, font_sizes[size_idx], min_glyph_count, size_idx == 2 ? "software_rasterizer_freetype.png" : 0);
+  }
+  freetype_shaping_backend_release(freetype_backend);
+#endif
+
+  //----------------------------------------------------------
+  // hampus: leaks
+
+  stub_shaping_backend_release(&stub_backend);
+  for(uint32_t kind = 0; kind < StubFontKind_COUNT; ++kind)
+  {
+    ASSERT(stub_backend.font_faces[kind].reference_count == 0);
+  }
+
+  MemoryCallSite leaks[32];
+  uint32_t leak_count = memory_accounting_call_sites(memory_accounting, true, leaks, 32);
+  for(uint32_t leak_idx = 0; leak_idx < leak_count && leak_idx < 32; ++leak_idx)
+  {
+    MemoryCallSite *site = &leaks[leak_idx];
+    printf("leak: %s(%d): %llu bytes in %llu allocations\n", site->file, site->line, (unsigned long long)site->live_bytes, (unsigned long long)site->live_count);
+  }
+  ASSERT(leak_count == 0);
+
+  memory_set_allocator(0);
+  memory_accounting_release(memory_accounting);
+
+  return 0;
+}
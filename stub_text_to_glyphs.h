@@ -0,0 +1,654 @@
+#ifndef STUB_TEXT_TO_GLYPHS_H
+#define STUB_TEXT_TO_GLYPHS_H
+
+#include "text_to_glyphs.h"
+#include "glyph_atlas.h"
+#include "color_glyph_cache.h"
+#include "software_rasterizer.h"
+#include "shaping_disk_cache.h"
+
+////////////////////////////////////////////////////////////
+// hampus: stub shaping backend
+
+// NOTE(hampus): A fake backend that behaves like DirectWrite on a system
+// with a Latin font (with code ligatures), a Hebrew/Arabic font, a CJK font
+// and an emoji font. Everything it answers is a pure function of the input
+// and it does very little work, so timing the pipeline with it measures the
+// pipeline itself. It runs anywhere, which lets the shaping logic be
+// benchmarked without Windows.
+//
+// - Fallback picks the first font that covers a codepoint, and keeps
+//   cluster extenders with the font before them. Common codepoints stay in
+//   the run before them when its font has them; the CJK font has ASCII.
+// - Text is simple unless it is right to left, an emoji, a combining mark,
+//   or one of the characters that start a code ligature.
+// - Scripts are assigned by block. Neutral characters take the script
+//   before them, and Hebrew and Arabic get bidi level 1.
+// - Shaping gives one glyph per codepoint, except that the code ligatures
+//   (->, =>, !=, ==, <=, >=) become one glyph and a zero width joiner folds
+//   the next codepoint into the glyph before it.
+
+enum StubFontKind
+{
+  StubFontKind_Latin,
+  StubFontKind_RightToLeft,
+  StubFontKind_CJK,
+  StubFontKind_Emoji,
+  StubFontKind_COUNT,
+};
+
+enum StubScript
+{
+  StubScript_Common,
+  StubScript_Latin,
+  StubScript_Hebrew,
+  StubScript_Arabic,
+  StubScript_Han,
+  StubScript_Emoji,
+};
+
+struct StubFontFace
+{
+  StubFontKind kind;
+  volatile int32_t reference_count;
+};
+
+struct StubShapingBackend
+{
+  StubFontFace font_faces[StubFontKind_COUNT];
+
+  // NOTE(hampus): Calls into the backend, to see how much work the caches save
+  volatile int32_t map_characters_count;
+  volatile int32_t analyze_count;
+  volatile int32_t shape_run_count;
+
+  // NOTE(hampus): What the disk cache sees as the version of each font's
+  // file. Change one to pretend the font was updated.
+  ShapingFontFileVersion font_file_versions[StubFontKind_COUNT];
+
+  ShapingFontRegistry *font_registry;
+};
+
+#define STUB_DESIGN_UNITS_PER_EM 1000
+#define STUB_GLYPH_COUNT 4094
+
+static StubFontFace *
+stub_font_face_from_shaping_font_face(ShapingFontFace *font_face)
+{
+  return (StubFontFace *)font_face;
+}
+
+static bool
+stub_font_covers_codepoint(StubFontKind kind, uint32_t codepoint)
+{
+  bool result = false;
+  switch(kind)
+  {
+    case StubFontKind_Latin:
+    {
+      result = (codepoint < 0x0250 ||
+                (0x0300 <= codepoint && codepoint <= 0x036F) ||
+                (0x2000 <= codepoint && codepoint <= 0x206F));
+    }
+    break;
+    case StubFontKind_RightToLeft:
+    {
+      result = (0x0590 <= codepoint && codepoint <= 0x06FF);
+    }
+    break;
+    case StubFontKind_CJK:
+    {
+      result = ((0x3000 <= codepoint && codepoint <= 0x9FFF) ||
+                (0xAC00 <= codepoint && codepoint <= 0xD7AF) ||
+                (0xFF00 <= codepoint && codepoint <= 0xFFEF));
+    }
+    break;
+    case StubFontKind_Emoji:
+    {
+      result = ((0x1F000 <= codepoint && codepoint <= 0x1FAFF) ||
+                (0x2600 <= codepoint && codepoint <= 0x27BF) ||
+                (0xFE00 <= codepoint && codepoint <= 0xFE0F));
+    }
+    break;
+    default:
+    break;
+  }
+  return result;
+}
+
+static bool
+stub_font_has_glyph(StubFontKind kind, uint32_t codepoint)
+{
+  // NOTE(hampus): Like real CJK fonts, the CJK font also carries ASCII, so
+  // spaces and punctuation can stay in a CJK run.
+  return stub_font_covers_codepoint(kind, codepoint) || (kind == StubFontKind_CJK && codepoint < 0x0080);
+}
+
+static StubFontFace *
+stub_font_face_from_codepoint(StubShapingBackend *backend, uint32_t codepoint)
+{
+  StubFontFace *result = 0;
+  for(uint32_t kind = 0; kind < StubFontKind_COUNT; ++kind)
+  {
+    if(stub_font_covers_codepoint((StubFontKind)kind, codepoint))
+    {
+      result = &backend->font_faces[kind];
+      break;
+    }
+  }
+  return result;
+}
+
+static uint16_t
+stub_glyph_from_codepoint(uint32_t codepoint)
+{
+  return (uint16_t)(1 + codepoint % (STUB_GLYPH_COUNT - 1));
+}
+
+static int32_t
+stub_design_advance_from_glyph(uint16_t glyph)
+{
+  return 400 + (glyph % 7) * 50;
+}
+
+static bool
+stub_is_ligature_start(uint32_t codepoint)
+{
+  return codepoint == '-' || codepoint == '=' || codepoint == '!' || codepoint == '<' || codepoint == '>';
+}
+
+static bool
+stub_is_ligature(uint32_t first, uint32_t second)
+{
+  return ((first == '-' && second == '>') ||
+          (first == '=' && second == '>') ||
+          (first == '!' && second == '=') ||
+          (first == '=' && second == '=') ||
+          (first == '<' && second == '=') ||
+          (first == '>' && second == '='));
+}
+
+static StubScript
+stub_script_from_codepoint(uint32_t codepoint)
+{
+  StubScript result = StubScript_Common;
+  if(('A' <= codepoint && codepoint <= 'Z') || ('a' <= codepoint && codepoint <= 'z') || (0x00C0 <= codepoint && codepoint < 0x0250))
+  {
+    result = StubScript_Latin;
+  }
+  else if(0x0590 <= codepoint && codepoint <= 0x05FF)
+  {
+    result = StubScript_Hebrew;
+  }
+  else if(0x0600 <= codepoint && codepoint <= 0x06FF)
+  {
+    result = StubScript_Arabic;
+  }
+  else if(stub_font_covers_codepoint(StubFontKind_CJK, codepoint))
+  {
+    result = StubScript_Han;
+  }
+  else if(0x1F000 <= codepoint && codepoint <= 0x1FAFF)
+  {
+    result = StubScript_Emoji;
+  }
+  return result;
+}
+
+//----------------------------------------------------------
+// hampus: backend functions
+
+static void
+stub_add_ref_font_face(ShapingFontFace *font_face)
+{
+  atomic_s32_increment(&stub_font_face_from_shaping_font_face(font_face)->reference_count);
+}
+
+static void
+stub_release_font_face(ShapingFontFace *font_face)
+{
+  int32_t reference_count = atomic_s32_decrement(&stub_font_face_from_shaping_font_face(font_face)->reference_count);
+  ASSERT(reference_count >= 0);
+}
+
+static uint16_t
+stub_get_design_units_per_em(ShapingFontFace *font_face)
+{
+  return STUB_DESIGN_UNITS_PER_EM;
+}
+
+static void
+stub_get_design_font_metrics(ShapingFontFace *font_face, ShapingFontMetrics *metrics)
+{
+  metrics->design_units_per_em = STUB_DESIGN_UNITS_PER_EM;
+  metrics->ascent = 800;
+  metrics->descent = 200;
+  metrics->line_gap = stub_font_face_from_shaping_font_face(font_face)->kind == StubFontKind_CJK ? 100 : 0;
+}
+
+static void
+stub_get_font_properties(ShapingFontFace *font_face, ShapingFontProperties *properties)
+{
+  // NOTE(hampus): Advances differ from glyph to glyph, so none of the stub
+  // fonts is monospaced
+  StubFontKind kind = stub_font_face_from_shaping_font_face(font_face)->kind;
+  properties->glyph_count = STUB_GLYPH_COUNT;
+  properties->flags = kind == StubFontKind_Emoji ? ShapingFontFlag_Color : 0;
+}
+
+static void
+stub_get_glyph_indices(ShapingFontFace *font_face, const uint32_t *codepoints, uint32_t count, uint16_t *glyph_indices)
+{
+  StubFontFace *stub_font_face = stub_font_face_from_shaping_font_face(font_face);
+  for(uint32_t idx = 0; idx < count; ++idx)
+  {
+    glyph_indices[idx] = stub_font_has_glyph(stub_font_face->kind, codepoints[idx]) ? stub_glyph_from_codepoint(codepoints[idx]) : 0;
+  }
+}
+
+static void
+stub_get_design_glyph_advances(ShapingFontFace *font_face, const uint16_t *glyph_indices, uint32_t count, int32_t *design_advances)
+{
+  for(uint32_t idx = 0; idx < count; ++idx)
+  {
+    design_advances[idx] = stub_design_advance_from_glyph(glyph_indices[idx]);
+  }
+}
+
+static ShapingFontFace *
+stub_map_characters(void *state, const utf16_char *locale, const utf16_char *base_family, const utf16_char *text, uint32_t text_length, uint32_t *mapped_length, float *scale)
+{
+  StubShapingBackend *backend = (StubShapingBackend *)state;
+  atomic_s32_increment(&backend->map_characters_count);
+
+  // NOTE(hampus): Like DirectWrite, common codepoints stay in the run they
+  // are in as long as its font has them, so what a space gets depends on
+  // what comes before it.
+  uint32_t codepoint = 0;
+  uint32_t length = decode_utf16(text, text_length, &codepoint);
+  StubFontFace *font_face = stub_font_face_from_codepoint(backend, codepoint);
+  while(length < text_length)
+  {
+    uint32_t codepoint_length = decode_utf16(text + length, text_length - length, &codepoint);
+    bool stays_in_run = (is_cluster_extender(codepoint) ||
+                         (font_face != 0 && is_common_or_inherited_codepoint(codepoint) && stub_font_has_glyph(font_face->kind, codepoint)) ||
+                         stub_font_face_from_codepoint(backend, codepoint) == font_face);
+    if(!stays_in_run)
+    {
+      break;
+    }
+    length += codepoint_length;
+  }
+
+  if(font_face != 0)
+  {
+    stub_add_ref_font_face((ShapingFontFace *)font_face);
+  }
+  *mapped_length = length;
+  *scale = 1.0f;
+  return (ShapingFontFace *)font_face;
+}
+
+static bool
+stub_is_simple_codepoint(StubFontFace *font_face, uint32_t codepoint)
+{
+  return ((font_face->kind == StubFontKind_Latin || font_face->kind == StubFontKind_CJK) &&
+          !stub_is_ligature_start(codepoint) &&
+          !is_cluster_extender(codepoint) &&
+          !(0xD800 <= codepoint && codepoint <= 0xDFFF));
+}
+
+static bool
+stub_get_text_complexity(void *state, ShapingFontFace *font_face, const utf16_char *text, uint32_t text_length, uint32_t *mapped_length, uint16_t *glyph_indices)
+{
+  // NOTE(hampus): Like GetTextComplexity, the length of the leading run of
+  // text that is either all simple or all complex.
+  StubFontFace *stub_font_face = stub_font_face_from_shaping_font_face(font_face);
+  bool is_simple = stub_is_simple_codepoint(stub_font_face, (uint32_t)text[0]);
+  uint32_t length = 0;
+  while(length < text_length && stub_is_simple_codepoint(stub_font_face, (uint32_t)text[length]) == is_simple)
+  {
+    if(is_simple)
+    {
+      glyph_indices[length] = stub_glyph_from_codepoint((uint32_t)text[length]);
+    }
+    length += 1;
+  }
+  *mapped_length = length;
+  return is_simple;
+}
+
+static ShapingScriptRun *
+stub_analyze_script_and_bidi(void *state, Arena *arena, const utf16_char *locale, const utf16_char *text, uint32_t text_length, uint32_t *run_count)
+{
+  StubShapingBackend *backend = (StubShapingBackend *)state;
+  atomic_s32_increment(&backend->analyze_count);
+
+  ShapingScriptRun *runs = push_array_no_zero(arena, ShapingScriptRun, text_length);
+  uint32_t count = 0;
+  for(uint32_t idx = 0; idx < text_length;)
+  {
+    uint32_t codepoint = 0;
+    uint32_t codepoint_length = decode_utf16(text + idx, text_length - idx, &codepoint);
+    StubScript script = stub_script_from_codepoint(codepoint);
+
+    ShapingScriptRun *run = count != 0 ? &runs[count - 1] : 0;
+    if(run != 0 && (script == StubScript_Common || run->analysis.script == (uint32_t)script))
+    {
+      run->text_length += codepoint_length;
+    }
+    else if(run != 0 && run->analysis.script == StubScript_Common)
+    {
+      run->analysis.script = script;
+      run->text_length += codepoint_length;
+    }
+    else
+    {
+      run = &runs[count];
+      count += 1;
+      run->text_position = idx;
+      run->text_length = codepoint_length;
+      run->analysis.script = script;
+      run->analysis.shapes = 0;
+    }
+    idx += codepoint_length;
+  }
+
+  for(uint32_t run_idx = 0; run_idx < count; ++run_idx)
+  {
+    ShapingScriptRun *run = &runs[run_idx];
+    run->bidi_level = (run->analysis.script == StubScript_Hebrew || run->analysis.script == StubScript_Arabic) ? 1 : 0;
+  }
+
+  *run_count = count;
+  return runs;
+}
+
+static bool
+stub_shape_run(void *state, Arena *scratch, ShapingFontFace *font_face, const float font_size, const ShapingScriptAnalysis *analysis, bool is_right_to_left, const utf16_char *locale, const utf16_char *text, const uint32_t text_length, uint32_t max_glyph_count, uint16_t *cluster_map, uint16_t *glyph_indices, float *glyph_advances, GlyphOffset *glyph_offsets, uint32_t *glyph_count)
+{
+  StubShapingBackend *backend = (StubShapingBackend *)state;
+  atomic_s32_increment(&backend->shape_run_count);
+
+  float scale = font_size / (float)STUB_DESIGN_UNITS_PER_EM;
+  uint32_t count = 0;
+  for(uint32_t idx = 0; idx < text_length;)
+  {
+    uint32_t codepoint = 0;
+    uint32_t codepoint_length = decode_utf16(text + idx, text_length - idx, &codepoint);
+    uint32_t cluster_length = codepoint_length;
+
+    uint32_t next_codepoint = 0;
+    if(idx + cluster_length < text_length)
+    {
+      uint32_t next_length = decode_utf16(text + idx + cluster_length, text_length - idx - cluster_length, &next_codepoint);
+      if(stub_is_ligature(codepoint, next_codepoint))
+      {
+        cluster_length += next_length;
+      }
+    }
+
+    // hampus: zero width joiners glue the next codepoint on
+
+    while(idx + cluster_length < text_length && text[idx + cluster_length] == 0x200D)
+    {
+      cluster_length += 1;
+      if(idx + cluster_length < text_length)
+      {
+        cluster_length += decode_utf16(text + idx + cluster_length, text_length - idx - cluster_length, &next_codepoint);
+      }
+    }
+
+    if(count == max_glyph_count)
+    {
+      *glyph_count = count + 1;
+      return false;
+    }
+
+    uint16_t glyph = stub_glyph_from_codepoint(codepoint + (cluster_length > codepoint_length ? 0x1000 : 0));
+    glyph_indices[count] = glyph;
+    glyph_advances[count] = (float)stub_design_advance_from_glyph(glyph) * scale;
+    glyph_offsets[count] = {};
+    for(uint32_t cluster_idx = 0; cluster_idx < cluster_length; ++cluster_idx)
+    {
+      cluster_map[idx + cluster_idx] = (uint16_t)count;
+    }
+    count += 1;
+    idx += cluster_length;
+  }
+  *glyph_count = count;
+  return true;
+}
+
+static const ShapingBackendFunctions stub_shaping_backend_functions =
+{
+  stub_add_ref_font_face,
+  stub_release_font_face,
+  stub_get_design_units_per_em,
+  stub_get_design_font_metrics,
+  stub_get_font_properties,
+  stub_get_glyph_indices,
+  stub_get_design_glyph_advances,
+  stub_map_characters,
+  stub_get_text_complexity,
+  stub_analyze_script_and_bidi,
+  default_analyze_line_breakpoints,
+  stub_shape_run,
+};
+
+static void
+stub_shaping_backend_init(StubShapingBackend *backend)
+{
+  *backend = {};
+  for(uint32_t kind = 0; kind < StubFontKind_COUNT; ++kind)
+  {
+    backend->font_faces[kind].kind = (StubFontKind)kind;
+  }
+  backend->font_registry = shaping_font_registry_alloc(&stub_shaping_backend_functions);
+}
+
+static void
+stub_shaping_backend_release(StubShapingBackend *backend)
+{
+  shaping_font_registry_release(backend->font_registry);
+  backend->font_registry = 0;
+}
+
+static ShapingBackend
+stub_shaping_backend(StubShapingBackend *backend)
+{
+  ShapingBackend result = {};
+  result.functions = &stub_shaping_backend_functions;
+  result.state = backend;
+  result.font_registry = backend->font_registry;
+  return result;
+}
+
+////////////////////////////////////////////////////////////
+// hampus: stub font files
+
+// NOTE(hampus): The ShapingFontFileFunctions for the disk cache. Each font
+// lives in a made up file named after it, whose version is kept in
+// StubShapingBackend::font_file_versions. user_data is the backend.
+
+static const char *stub_font_file_paths[StubFontKind_COUNT] =
+{
+  "stub/latin.ttf",
+  "stub/right_to_left.ttf",
+  "stub/cjk.ttf",
+  "stub/emoji.ttf",
+};
+
+static bool
+stub_font_file_from_face(void *user_data, Arena *arena, ShapingFontFace *font_face, ShapingFontFile *file)
+{
+  const char *path = stub_font_file_paths[stub_font_face_from_shaping_font_face(font_face)->kind];
+  uint64_t path_size = strlen(path) + 1;
+  file->path = push_array_no_zero(arena, char, path_size);
+  memory_copy(file->path, path, path_size);
+  file->face_index = 0;
+  file->simulations = 0;
+  return true;
+}
+
+static bool
+stub_get_font_file_version(void *user_data, const char *path, ShapingFontFileVersion *version)
+{
+  StubShapingBackend *backend = (StubShapingBackend *)user_data;
+  bool result = false;
+  for(uint32_t kind = 0; kind < StubFontKind_COUNT && !result; ++kind)
+  {
+    if(strcmp(path, stub_font_file_paths[kind]) == 0)
+    {
+      *version = backend->font_file_versions[kind];
+      result = true;
+    }
+  }
+  return result;
+}
+
+static ShapingFontFace *
+stub_font_face_from_file(void *user_data, const ShapingFontFile *file)
+{
+  StubShapingBackend *backend = (StubShapingBackend *)user_data;
+  ShapingFontFace *result = 0;
+  for(uint32_t kind = 0; kind < StubFontKind_COUNT && result == 0; ++kind)
+  {
+    if(file->face_index == 0 && strcmp(file->path, stub_font_file_paths[kind]) == 0)
+    {
+      result = (ShapingFontFace *)&backend->font_faces[kind];
+      stub_add_ref_font_face(result);
+    }
+  }
+  return result;
+}
+
+static const ShapingFontFileFunctions stub_font_file_functions =
+{
+  stub_font_file_from_face,
+  stub_get_font_file_version,
+  stub_font_face_from_file,
+};
+
+////////////////////////////////////////////////////////////
+// hampus: stub rasterizer
+
+// NOTE(hampus): A GlyphRasterizeFunction that draws every glyph as a box
+// whose size depends on the glyph and the em size, filled with a pattern
+// that depends on the subpixel offset. Space-like glyphs come out empty.
+
+static bool
+stub_rasterize_glyph(void *user_data, Arena *scratch, ShapingFontFace *font_face, float em_size, uint16_t glyph_index, float subpixel_x, GlyphBitmap *bitmap)
+{
+  *bitmap = {};
+  if(glyph_index == stub_glyph_from_codepoint(' '))
+  {
+    return true;
+  }
+
+  float advance = (float)stub_design_advance_from_glyph(glyph_index) * (em_size / (float)STUB_DESIGN_UNITS_PER_EM);
+  uint32_t width = (uint32_t)(advance * 0.8f) + 2;
+  uint32_t height = (uint32_t)(em_size * (0.5f + (float)(glyph_index % 5) * 0.1f)) + 1;
+  uint8_t *coverage = push_array_no_zero(scratch, uint8_t, width * height);
+  uint8_t fill = (uint8_t)(64 + (uint32_t)(subpixel_x * 128.0f));
+  for(uint32_t idx = 0; idx < width * height; ++idx)
+  {
+    coverage[idx] = (uint8_t)(fill + (idx % width) * 3);
+  }
+
+  bitmap->width = width;
+  bitmap->height = height;
+  bitmap->left = 0;
+  bitmap->top = -(int32_t)height;
+  bitmap->pitch = width;
+  bitmap->coverage = coverage;
+  return true;
+}
+
+////////////////////////////////////////////////////////////
+// hampus: stub outlines
+
+// NOTE(hampus): A GlyphOutlineFunction that gives every glyph the outline of
+// an octagonal ring, sized like the boxes of the stub rasterizer, so there
+// are slanted edges and a hole. Space-like glyphs have no outline.
+
+static bool
+stub_glyph_outline(void *user_data, Arena *arena, ShapingFontFace *font_face, float em_size, uint16_t glyph_index, GlyphOutlineLine **lines, uint32_t *line_count)
+{
+  if(glyph_index == stub_glyph_from_codepoint(' '))
+  {
+    return false;
+  }
+
+  float advance = (float)stub_design_advance_from_glyph(glyph_index) * (em_size / (float)STUB_DESIGN_UNITS_PER_EM);
+  float width = advance * 0.8f;
+  float height = em_size * (0.5f + (float)(glyph_index % 5) * 0.1f);
+  float left = advance * 0.1f;
+
+  GlyphOutlineLine *result = push_array_no_zero(arena, GlyphOutlineLine, 16);
+  for(uint32_t contour_idx = 0; contour_idx < 2; ++contour_idx)
+  {
+    // NOTE(hampus): The inner contour is inset by a fifth of the width and
+    // goes the other way round
+    float inset = contour_idx == 0 ? 0.0f : width * 0.2f;
+    float x0 = left + inset;
+    float x1 = left + width - inset;
+    float y0 = -height + inset;
+    float y1 = -inset;
+    float cut = (x1 - x0) * 0.3f;
+    float points[8][2] =
+    {
+      {x0 + cut, y0}, {x1 - cut, y0}, {x1, y0 + cut}, {x1, y1 - cut},
+      {x1 - cut, y1}, {x0 + cut, y1}, {x0, y1 - cut}, {x0, y0 + cut},
+    };
+    for(uint32_t point_idx = 0; point_idx < 8; ++point_idx)
+    {
+      uint32_t from = contour_idx == 0 ? point_idx : 7 - point_idx;
+      uint32_t to = contour_idx == 0 ? (point_idx + 1) % 8 : (14 - point_idx) % 8;
+      GlyphOutlineLine *line = &result[contour_idx * 8 + point_idx];
+      line->x0 = points[from][0];
+      line->y0 = points[from][1];
+      line->x1 = points[to][0];
+      line->y1 = points[to][1];
+    }
+  }
+  *lines = result;
+  *line_count = 16;
+  return true;
+}
+
+////////////////////////////////////////////////////////////
+// hampus: stub color glyphs
+
+// NOTE(hampus): Only the emoji font has color glyphs. Each one is split into
+// a colored layer and one in the text color, the way COLR fonts usually come
+// out, except every eighth glyph, which has no color, to have runs that mix
+// both.
+
+static bool
+stub_is_color_font(void *user_data, ShapingFontFace *font_face)
+{
+  return stub_font_face_from_shaping_font_face(font_face)->kind == StubFontKind_Emoji;
+}
+
+static bool
+stub_decompose_color_glyph(void *user_data, Arena *arena, ShapingFontFace *font_face, uint16_t glyph_index, ColorGlyphLayer **layers, uint32_t *layer_count)
+{
+  if(stub_font_face_from_shaping_font_face(font_face)->kind != StubFontKind_Emoji || glyph_index % 8 == 0)
+  {
+    return false;
+  }
+
+  ColorGlyphLayer *result = push_array(arena, ColorGlyphLayer, 2);
+  result[0].glyph_index = glyph_index;
+  result[0].kind = DrawListRunKind_Outline;
+  result[0].color = {1.0f, 0.8f, 0.0f, 1.0f};
+  result[1].glyph_index = (uint16_t)(glyph_index + 1);
+  result[1].kind = DrawListRunKind_Outline;
+  result[1].uses_foreground_color = true;
+  *layers = result;
+  *layer_count = 2;
+  return true;
+}
+
+#endif // STUB_TEXT_TO_GLYPHS_H
@@ -0,0 +1,5516 @@
+#ifndef TEXT_TO_GLYPHS_H
+#define TEXT_TO_GLYPHS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#  include <windows.h>
+#else
+#  include <pthread.h>
+#  include <sched.h>
+#  include <time.h>
+#  include <unistd.h>
+#endif
+
+// NOTE(hampus): The instruction sets the compiler was allowed to use, e.g.
+// with -mavx2 or /arch:AVX2. Kernels pick their widest path at compile time.
+// Define TEXT_TO_GLYPHS_NO_SIMD to build only the scalar paths.
+#if !defined(TEXT_TO_GLYPHS_NO_SIMD)
+#  if defined(__AVX2__)
+#    define SIMD_AVX2 1
+#  endif
+#  if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#    define SIMD_SSE2 1
+#  endif
+#  if defined(__ARM_NEON) || defined(_M_ARM64)
+#    define SIMD_NEON 1
+#  endif
+#endif
+
+#if !defined(SIMD_AVX2)
+#  define SIMD_AVX2 0
+#endif
+#if !defined(SIMD_SSE2)
+#  define SIMD_SSE2 0
+#endif
+#if !defined(SIMD_NEON)
+#  define SIMD_NEON 0
+#endif
+
+#if SIMD_AVX2 || SIMD_SSE2
+#  include <immintrin.h>
+#endif
+#if SIMD_NEON
+#  include <arm_neon.h>
+#endif
+
+#define ASSERT(expr)        \
+  if(!(expr))               \
+  {                         \
+    *(volatile int *)0 = 0; \
+  }
+
+#define memory_copy(dst, src, size) memcpy((uint8_t *)(dst), (uint8_t *)(src), (size))
+#define memory_copy_typed(dst, src, count) memcpy((uint8_t *)(dst), (uint8_t *)(src), sizeof(*(dst)) * (count))
+#define memory_move_typed(dst, src, count) memmove((uint8_t *)(dst), (uint8_t *)(src), sizeof(*(dst)) * (count))
+#define memory_match(a, b, size) (memcmp((a), (b), (size)) == 0)
+
+#define KB(n) ((uint64_t)(n) << 10)
+#define MB(n) ((uint64_t)(n) << 20)
+
+#define align_pow2(x, b) (((x) + (b) - 1) & (~((b) - 1)))
+
+////////////////////////////////////////////////////////////
+// hampus: memory
+
+// NOTE(hampus): Every allocation in the shaping code goes through
+// memory_alloc(), memory_alloc_zero() and memory_free(), which forward to the
+// current allocator together with the file and line they were called from.
+// The allocator can be swapped with memory_set_allocator(), but only while
+// nothing allocated by the previous one is still alive, since frees go to
+// whichever allocator is current.
+
+struct MemoryAllocator
+{
+  void *(*alloc)(void *state, uint64_t size, const char *file, int line);
+
+  // NOTE(hampus): ptr is never 0
+  void (*free)(void *state, void *ptr);
+
+  void *state;
+};
+
+static void *
+memory_malloc_alloc(void *state, uint64_t size, const char *file, int line)
+{
+  return malloc(size);
+}
+
+static void
+memory_malloc_free(void *state, void *ptr)
+{
+  free(ptr);
+}
+
+static MemoryAllocator memory_malloc_allocator = {memory_malloc_alloc, memory_malloc_free, 0};
+static MemoryAllocator *memory_allocator = &memory_malloc_allocator;
+
+static void
+memory_set_allocator(MemoryAllocator *allocator)
+{
+  memory_allocator = allocator != 0 ? allocator : &memory_malloc_allocator;
+}
+
+static void *
+memory_alloc_from_site(uint64_t size, const char *file, int line)
+{
+  void *result = memory_allocator->alloc(memory_allocator->state, size, file, line);
+  ASSERT(result != 0);
+  return result;
+}
+
+static void *
+memory_alloc_zero_from_site(uint64_t size, const char *file, int line)
+{
+  void *result = memory_alloc_from_site(size, file, line);
+  memset(result, 0, size);
+  return result;
+}
+
+static void
+memory_free(void *ptr)
+{
+  if(ptr != 0)
+  {
+    memory_allocator->free(memory_allocator->state, ptr);
+  }
+}
+
+#define memory_alloc(size) memory_alloc_from_site((size), __FILE__, __LINE__)
+#define memory_alloc_zero(size) memory_alloc_zero_from_site((size), __FILE__, __LINE__)
+
+////////////////////////////////////////////////////////////
+// hampus: utf-16 strings
+
+// NOTE(hampus): One UTF-16 code unit. This is wchar_t on Windows so text can
+// be handed to DirectWrite as is, and char16_t everywhere else since wchar_t
+// is 32 bits there.
+
+#if defined(_WIN32)
+typedef wchar_t utf16_char;
+#  define utf16_literal(string) L##string
+#else
+typedef char16_t utf16_char;
+#  define utf16_literal(string) u##string
+#endif
+
+static uint64_t
+utf16_length(const utf16_char *string)
+{
+  uint64_t length = 0;
+  while(string[length] != 0)
+  {
+    length += 1;
+  }
+  return length;
+}
+
+static bool
+utf16_match(const utf16_char *a, const utf16_char *b)
+{
+  for(; *a != 0 && *a == *b; ++a, ++b)
+  {
+  }
+  return *a == *b;
+}
+
+static utf16_char *
+utf16_copy(const utf16_char *string)
+{
+  uint64_t size = (utf16_length(string) + 1) * sizeof(utf16_char);
+  utf16_char *result = (utf16_char *)memory_alloc(size);
+  memory_copy(result, string, size);
+  return result;
+}
+
+static uint32_t
+decode_utf16(const utf16_char *text, uint32_t text_length, uint32_t *codepoint)
+{
+  // NOTE(hampus): Returns the number of UTF-16 code units the codepoint
+  // takes up. Unpaired surrogates are returned as is.
+  uint32_t result = 1;
+  *codepoint = (uint32_t)text[0];
+  if(0xD800 <= text[0] && text[0] <= 0xDBFF && text_length > 1 && 0xDC00 <= text[1] && text[1] <= 0xDFFF)
+  {
+    *codepoint = 0x10000 + ((((uint32_t)text[0] - 0xD800) << 10) | ((uint32_t)text[1] - 0xDC00));
+    result = 2;
+  }
+  return result;
+}
+
+static uint32_t
+encode_utf16(utf16_char *text, uint32_t codepoint)
+{
+  // NOTE(hampus): Returns the number of UTF-16 code units written
+  uint32_t result = 1;
+  if(codepoint >= 0x10000)
+  {
+    codepoint -= 0x10000;
+    text[0] = (utf16_char)(0xD800 + (codepoint >> 10));
+    text[1] = (utf16_char)(0xDC00 + (codepoint & 0x3FF));
+    result = 2;
+  }
+  else
+  {
+    text[0] = (utf16_char)codepoint;
+  }
+  return result;
+}
+
+////////////////////////////////////////////////////////////
+// hampus: utf-8 text
+
+// NOTE(hampus): Text that arrives as UTF-8 is turned into the UTF-16 the
+// backends take. UTF-16 never needs more code units than the UTF-8 has
+// bytes, so text_size code units is always room enough. Malformed UTF-8
+// becomes one U+FFFD for every byte that doesn't start a well formed
+// sequence.
+//
+// If utf8_offsets isn't 0, it gets the byte offset of the codepoint each
+// UTF-16 code unit came from, and one more entry past the last one that
+// holds text_size, so it needs room for text_size + 1 entries.
+
+static uint32_t
+decode_utf8(const uint8_t *text, uint32_t text_size, uint32_t *codepoint)
+{
+  // NOTE(hampus): Returns the number of bytes the codepoint takes up.
+  // Overlong forms, surrogates and anything past U+10FFFF aren't well formed.
+  uint32_t lead = text[0];
+  uint32_t result = 0;
+  uint32_t min_codepoint = 0;
+  uint32_t value = 0;
+  if(lead < 0x80)
+  {
+    *codepoint = lead;
+    return 1;
+  }
+  else if(0xC2 <= lead && lead <= 0xDF)
+  {
+    result = 2;
+    min_codepoint = 0x80;
+    value = lead & 0x1F;
+  }
+  else if(0xE0 <= lead && lead <= 0xEF)
+  {
+    result = 3;
+    min_codepoint = 0x800;
+    value = lead & 0x0F;
+  }
+  else if(0xF0 <= lead && lead <= 0xF4)
+  {
+    result = 4;
+    min_codepoint = 0x10000;
+    value = lead & 0x07;
+  }
+
+  bool is_valid = result != 0 && result <= text_size;
+  for(uint32_t idx = 1; is_valid && idx < result; ++idx)
+  {
+    is_valid = (text[idx] & 0xC0) == 0x80;
+    value = (value << 6) | (text[idx] & 0x3F);
+  }
+  is_valid = is_valid && min_codepoint <= value && value <= 0x10FFFF && !(0xD800 <= value && value <= 0xDFFF);
+  if(!is_valid)
+  {
+    value = 0xFFFD;
+    result = 1;
+  }
+  *codepoint = value;
+  return result;
+}
+
+static uint32_t
+utf16_from_utf8_range(const uint8_t *text, uint32_t text_size, uint32_t text_idx, uint32_t stop_idx, utf16_char *utf16_text, uint32_t *utf16_length, uint32_t *utf8_offsets)
+{
+  // NOTE(hampus): Decodes one codepoint at a time until stop_idx, or past it
+  // when a codepoint straddles it. Returns where it stopped.
+  uint32_t length = *utf16_length;
+  while(text_idx < stop_idx)
+  {
+    uint32_t codepoint = 0;
+    uint32_t size = decode_utf8(text + text_idx, text_size - text_idx, &codepoint);
+    uint32_t unit_count = encode_utf16(utf16_text + length, codepoint);
+    if(utf8_offsets != 0)
+    {
+      utf8_offsets[length] = text_idx;
+      utf8_offsets[length + unit_count - 1] = text_idx;
+    }
+    text_idx += size;
+    length += unit_count;
+  }
+  *utf16_length = length;
+  return text_idx;
+}
+
+static uint32_t
+utf16_from_utf8_scalar(const char *text, uint32_t text_size, utf16_char *utf16_text, uint32_t *utf8_offsets)
+{
+  uint32_t utf16_length = 0;
+  utf16_from_utf8_range((const uint8_t *)text, text_size, 0, text_size, utf16_text, &utf16_length, utf8_offsets);
+  if(utf8_offsets != 0)
+  {
+    utf8_offsets[utf16_length] = text_size;
+  }
+  return utf16_length;
+}
+
+#if SIMD_AVX2 || SIMD_SSE2
+static void
+utf8_offsets_from_ascii(uint32_t *utf8_offsets, uint32_t text_idx, uint32_t count)
+{
+  // NOTE(hampus): count is a multiple of 16
+  __m128i offsets = _mm_add_epi32(_mm_set1_epi32((int)text_idx), _mm_setr_epi32(0, 1, 2, 3));
+  __m128i four = _mm_set1_epi32(4);
+  for(uint32_t idx = 0; idx < count; idx += 4)
+  {
+    _mm_storeu_si128((__m128i *)(utf8_offsets + idx), offsets);
+    offsets = _mm_add_epi32(offsets, four);
+  }
+}
+#endif
+
+static uint32_t
+utf16_from_utf8(const char *text, uint32_t text_size, utf16_char *utf16_text, uint32_t *utf8_offsets)
+{
+  // NOTE(hampus): Most text is mostly ASCII, so runs of it are widened a
+  // whole block at a time. Everything else is decoded one codepoint at a
+  // time, with the well formed 2, 3 and 4 byte sequences decoded inline and
+  // the malformed ones left to decode_utf8(). Non-ASCII isn't decoded a
+  // block at a time, since SSE2 has no byte shuffle to pack the code units
+  // together, and packing them one lane at a time came out slower than this
+  // loop. The blocks are only tried again after 16 ASCII bytes in a row, so
+  // the spaces and digits between non-ASCII words don't make mostly
+  // non-ASCII text check blocks that won't turn out to be ASCII.
+  const uint8_t *bytes = (const uint8_t *)text;
+  uint32_t text_idx = 0;
+  uint32_t utf16_length = 0;
+  while(text_idx < text_size)
+  {
+#if SIMD_AVX2 || SIMD_SSE2
+#  if SIMD_AVX2
+    for(; text_idx + 32 <= text_size; text_idx += 32, utf16_length += 32)
+    {
+      __m256i block = _mm256_loadu_si256((const __m256i *)(bytes + text_idx));
+      if(_mm256_movemask_epi8(block) != 0)
+      {
+        break;
+      }
+      _mm256_storeu_si256((__m256i *)(utf16_text + utf16_length), _mm256_cvtepu8_epi16(_mm256_castsi256_si128(block)));
+      _mm256_storeu_si256((__m256i *)(utf16_text + utf16_length + 16), _mm256_cvtepu8_epi16(_mm256_extracti128_si256(block, 1)));
+      if(utf8_offsets != 0)
+      {
+        utf8_offsets_from_ascii(utf8_offsets + utf16_length, text_idx, 32);
+      }
+    }
+#  endif
+    __m128i zero = _mm_setzero_si128();
+    for(; text_idx + 16 <= text_size; text_idx += 16, utf16_length += 16)
+    {
+      __m128i block = _mm_loadu_si128((const __m128i *)(bytes + text_idx));
+      if(_mm_movemask_epi8(block) != 0)
+      {
+        break;
+      }
+      _mm_storeu_si128((__m128i *)(utf16_text + utf16_length), _mm_unpacklo_epi8(block, zero));
+      _mm_storeu_si128((__m128i *)(utf16_text + utf16_length + 8), _mm_unpackhi_epi8(block, zero));
+      if(utf8_offsets != 0)
+      {
+        utf8_offsets_from_ascii(utf8_offsets + utf16_length, text_idx, 16);
+      }
+    }
+#endif
+
+    uint32_t ascii_run_length = 0;
+    while(text_idx < text_size && ascii_run_length < 16)
+    {
+      uint32_t lead = bytes[text_idx];
+      uint32_t codepoint = lead;
+      uint32_t size = 1;
+      if(lead < 0x80)
+      {
+        ascii_run_length += 1;
+      }
+      else
+      {
+        ascii_run_length = 0;
+        uint32_t remaining = text_size - text_idx;
+        if(0xC2 <= lead && lead <= 0xDF && remaining >= 2 && (bytes[text_idx + 1] & 0xC0) == 0x80)
+        {
+          codepoint = ((lead & 0x1F) << 6) | (bytes[text_idx + 1] & 0x3F);
+          size = 2;
+        }
+        else if(0xE0 <= lead && lead <= 0xEF && remaining >= 3 && (bytes[text_idx + 1] & 0xC0) == 0x80 && (bytes[text_idx + 2] & 0xC0) == 0x80 &&
+                (codepoint = ((lead & 0x0F) << 12) | ((bytes[text_idx + 1] & 0x3F) << 6) | (bytes[text_idx + 2] & 0x3F)) >= 0x800 &&
+                !(0xD800 <= codepoint && codepoint <= 0xDFFF))
+        {
+          size = 3;
+        }
+        else if(0xF0 <= lead && lead <= 0xF4 && remaining >= 4 && (bytes[text_idx + 1] & 0xC0) == 0x80 && (bytes[text_idx + 2] & 0xC0) == 0x80 &&
+                (bytes[text_idx + 3] & 0xC0) == 0x80 &&
+                (codepoint = ((lead & 0x07) << 18) | ((bytes[text_idx + 1] & 0x3F) << 12) | ((bytes[text_idx + 2] & 0x3F) << 6) | (bytes[text_idx + 3] & 0x3F)) >= 0x10000 &&
+                codepoint <= 0x10FFFF)
+        {
+          size = 4;
+        }
+        else
+        {
+          size = decode_utf8(bytes + text_idx, remaining, &codepoint);
+        }
+      }
+
+      if(codepoint < 0x10000)
+      {
+        utf16_text[utf16_length] = (utf16_char)codepoint;
+        if(utf8_offsets != 0)
+        {
+          utf8_offsets[utf16_length] = text_idx;
+        }
+        utf16_length += 1;
+      }
+      else
+      {
+        encode_utf16(utf16_text + utf16_length, codepoint);
+        if(utf8_offsets != 0)
+        {
+          utf8_offsets[utf16_length] = text_idx;
+          utf8_offsets[utf16_length + 1] = text_idx;
+        }
+        utf16_length += 2;
+      }
+      text_idx += size;
+    }
+  }
+  if(utf8_offsets != 0)
+  {
+    utf8_offsets[utf16_length] = text_size;
+  }
+  return utf16_length;
+}
+
+////////////////////////////////////////////////////////////
+// hampus: arena
+
+// NOTE(hampus): A chained arena. The first block is the handle that is passed
+// around, and its `current` member points to the block that is currently being
+// pushed onto. When a block runs out, a new one at least twice as big is
+// chained on, so even a very long text ends up in a handful of blocks.
+// Blocks that are popped off are kept on the handle's free list and reused
+// by later pushes, so an arena that is cleared and refilled with about the
+// same amount of data stops allocating. Everything is freed at once with
+// arena_release().
+
+#define ARENA_DEFAULT_BLOCK_SIZE KB(16)
+
+struct Arena
+{
+  Arena *current;
+  Arena *prev;
+  Arena *free_last;
+  uint64_t base_pos;
+  uint64_t pos;
+  uint64_t size;
+};
+
+#define ARENA_HEADER_SIZE align_pow2(sizeof(Arena), 16)
+
+static Arena *
+arena_alloc(uint64_t size = ARENA_DEFAULT_BLOCK_SIZE)
+{
+  size = align_pow2(size, KB(4));
+  Arena *arena = (Arena *)memory_alloc(size);
+  ASSERT(arena != 0);
+  arena->current = arena;
+  arena->prev = 0;
+  arena->free_last = 0;
+  arena->base_pos = 0;
+  arena->pos = ARENA_HEADER_SIZE;
+  arena->size = size;
+  return arena;
+}
+
+static void
+arena_release(Arena *arena)
+{
+  Arena *prev = 0;
+  for(Arena *block = arena->free_last; block != 0; block = prev)
+  {
+    prev = block->prev;
+    memory_free(block);
+  }
+  for(Arena *block = arena->current; block != 0; block = prev)
+  {
+    prev = block->prev;
+    memory_free(block);
+  }
+}
+
+static void *
+arena_push_no_zero(Arena *arena, uint64_t size, uint64_t align = 16)
+{
+  Arena *current = arena->current;
+  uint64_t pos = align_pow2(current->pos, align);
+  if(pos + size > current->size)
+  {
+    uint64_t min_block_size = ARENA_HEADER_SIZE + size + align;
+
+    // hampus: try to reuse a block that was popped off earlier
+
+    Arena *block = 0;
+    for(Arena **free_block = &arena->free_last; *free_block != 0; free_block = &(*free_block)->prev)
+    {
+      if((*free_block)->size >= min_block_size)
+      {
+        block = *free_block;
+        *free_block = block->prev;
+        block->pos = ARENA_HEADER_SIZE;
+        break;
+      }
+    }
+
+    if(block == 0)
+    {
+      uint64_t block_size = current->size * 2;
+      if(block_size < min_block_size)
+      {
+        block_size = min_block_size;
+      }
+      block = arena_alloc(block_size);
+    }
+    block->base_pos = current->base_pos + current->size;
+    block->prev = current;
+    arena->current = current = block;
+    pos = align_pow2(current->pos, align);
+  }
+  void *result = (uint8_t *)current + pos;
+  current->pos = pos + size;
+  return result;
+}
+
+static void *
+arena_push(Arena *arena, uint64_t size, uint64_t align = 16)
+{
+  void *result = arena_push_no_zero(arena, size, align);
+  memset(result, 0, size);
+  return result;
+}
+
+static uint64_t
+arena_pos(Arena *arena)
+{
+  Arena *current = arena->current;
+  return current->base_pos + current->pos;
+}
+
+static void
+arena_pop_to(Arena *arena, uint64_t pos)
+{
+  if(pos < ARENA_HEADER_SIZE)
+  {
+    pos = ARENA_HEADER_SIZE;
+  }
+  Arena *current = arena->current;
+  while(current->base_pos >= pos && current->prev != 0)
+  {
+    Arena *prev = current->prev;
+    current->prev = arena->free_last;
+    arena->free_last = current;
+    current = prev;
+  }
+  arena->current = current;
+  current->pos = pos - current->base_pos;
+}
+
+static void
+arena_clear(Arena *arena)
+{
+  arena_pop_to(arena, 0);
+}
+
+#define push_array(arena, type, count) (type *)arena_push((arena), sizeof(type) * (count), alignof(type) < 16 ? 16 : alignof(type))
+#define push_array_no_zero(arena, type, count) (type *)arena_push_no_zero((arena), sizeof(type) * (count), alignof(type) < 16 ? 16 : alignof(type))
+
+////////////////////////////////////////////////////////////
+// hampus: tracing
+
+// NOTE(hampus): Timers around each phase of shaping. They are compiled in
+// when TEXT_TO_GLYPHS_TRACE is defined to 1 before including this file.
+// Otherwise trace_begin() and trace_end() expand to nothing, and the query
+// functions return nothing. Each thread records into its own ring buffer,
+// which keeps the newest TRACE_RING_CAPACITY events, so recording an event
+// takes no locks. Each ring also keeps counters per phase that are never
+// overwritten.
+//
+//   trace_begin(map);
+//   ...
+//   trace_end(map, TracePhase_MapCharacters, char_count, glyph_count);
+
+#if !defined(TEXT_TO_GLYPHS_TRACE)
+#  define TEXT_TO_GLYPHS_TRACE 0
+#endif
+
+enum TracePhase
+{
+  TracePhase_MapTextToGlyphs,
+  TracePhase_MapCharacters,
+  TracePhase_GetTextComplexity,
+  TracePhase_AnalyzeScriptAndBidi,
+  TracePhase_ShapeRun,
+  TracePhase_Utf16FromUtf8,
+
+  // NOTE(hampus): Parts of the phases above that a backend times on its own
+  TracePhase_GetGlyphs,
+  TracePhase_GetGlyphPlacements,
+  TracePhase_CopyAnalysis,
+
+  TracePhase_COUNT,
+};
+
+static const char *trace_phase_names[TracePhase_COUNT] =
+{
+  "map_text_to_glyphs",
+  "map_characters",
+  "get_text_complexity",
+  "analyze_script_and_bidi",
+  "shape_run",
+  "utf16_from_utf8",
+  "get_glyphs",
+  "get_glyph_placements",
+  "copy_analysis",
+};
+
+struct TracePhaseCounters
+{
+  uint64_t call_count;
+  uint64_t char_count;
+  uint64_t glyph_count;
+  uint64_t total_ns;
+};
+
+#if TEXT_TO_GLYPHS_TRACE
+
+// NOTE(hampus): These are in the threads section further down
+static uint64_t
+os_now_ns(void);
+
+static uint64_t
+atomic_u64_compare_exchange(volatile uint64_t *value, uint64_t exchange, uint64_t comparand);
+
+static void
+atomic_u64_store(volatile uint64_t *value, uint64_t new_value);
+
+static int32_t
+atomic_s32_increment(volatile int32_t *value);
+
+#  define TRACE_RING_CAPACITY 4096
+
+struct TraceEvent
+{
+  uint64_t begin_ns;
+  uint64_t end_ns;
+  uint32_t char_count;
+  uint32_t glyph_count;
+  TracePhase phase;
+};
+
+struct TraceRing
+{
+  TraceRing *next;
+  uint32_t thread_idx;
+
+  // NOTE(hampus): Every event ever recorded, the newest
+  // TRACE_RING_CAPACITY of which are still in `events`
+  uint64_t event_count;
+  TraceEvent events[TRACE_RING_CAPACITY];
+
+  TracePhaseCounters counters[TracePhase_COUNT];
+};
+
+// NOTE(hampus): All the rings, pushed on with a compare exchange. A thread
+// allocates a new ring when the generation has moved on since it allocated its
+// current one, which is how trace_release() invalidates them.
+static volatile uint64_t trace_first_ring;
+static volatile int32_t trace_ring_count;
+static volatile uint64_t trace_generation = 1;
+
+static thread_local TraceRing *trace_thread_ring;
+static thread_local uint64_t trace_thread_generation;
+
+#  define trace_begin(name) uint64_t name##_trace_begin_ns = os_now_ns()
+#  define trace_end(name, phase, char_count, glyph_count) trace_record((phase), name##_trace_begin_ns, os_now_ns(), (char_count), (glyph_count))
+
+static TraceRing *
+trace_ring_from_thread(void)
+{
+  if(trace_thread_generation != trace_generation)
+  {
+    TraceRing *ring = (TraceRing *)memory_alloc_zero(sizeof(TraceRing));
+    ring->thread_idx = (uint32_t)atomic_s32_increment(&trace_ring_count);
+    for(;;)
+    {
+      uint64_t first = trace_first_ring;
+      ring->next = (TraceRing *)first;
+      if(atomic_u64_compare_exchange(&trace_first_ring, (uint64_t)ring, first) == first)
+      {
+        break;
+      }
+    }
+    trace_thread_ring = ring;
+    trace_thread_generation = trace_generation;
+  }
+  return trace_thread_ring;
+}
+
+static void
+trace_record(TracePhase phase, uint64_t begin_ns, uint64_t end_ns, uint64_t char_count, uint64_t glyph_count)
+{
+  TraceRing *ring = trace_ring_from_thread();
+  TraceEvent *event = &ring->events[ring->event_count % TRACE_RING_CAPACITY];
+  event->begin_ns = begin_ns;
+  event->end_ns = end_ns;
+  event->char_count = (uint32_t)char_count;
+  event->glyph_count = (uint32_t)glyph_count;
+  event->phase = phase;
+  ring->event_count += 1;
+
+  TracePhaseCounters *counters = &ring->counters[phase];
+  counters->call_count += 1;
+  counters->char_count += char_count;
+  counters->glyph_count += glyph_count;
+  counters->total_ns += end_ns - begin_ns;
+}
+
+#else
+
+#  define trace_begin(name)
+#  define trace_end(name, phase, char_count, glyph_count)
+
+#endif
+
+// NOTE(hampus): The functions below read every thread's ring, so they must
+// only be called while no other thread is shaping.
+
+static TracePhaseCounters
+trace_phase_counters(TracePhase phase)
+{
+  // NOTE(hampus): The counters of one phase summed over all threads
+  TracePhaseCounters result = {};
+#if TEXT_TO_GLYPHS_TRACE
+  for(TraceRing *ring = (TraceRing *)trace_first_ring; ring != 0; ring = ring->next)
+  {
+    result.call_count += ring->counters[phase].call_count;
+    result.char_count += ring->counters[phase].char_count;
+    result.glyph_count += ring->counters[phase].glyph_count;
+    result.total_ns += ring->counters[phase].total_ns;
+  }
+#endif
+  return result;
+}
+
+static void
+trace_release(void)
+{
+  // NOTE(hampus): Frees every ring. Threads that trace again afterwards
+  // start over with new ones.
+#if TEXT_TO_GLYPHS_TRACE
+  TraceRing *next = 0;
+  for(TraceRing *ring = (TraceRing *)trace_first_ring; ring != 0; ring = next)
+  {
+    next = ring->next;
+    memory_free(ring);
+  }
+  atomic_u64_store(&trace_first_ring, 0);
+  atomic_u64_store(&trace_generation, trace_generation + 1);
+  trace_ring_count = 0;
+#endif
+}
+
+static char *
+trace_json_append_string(char *ptr, const char *string)
+{
+  for(; *string != 0; ++string, ++ptr)
+  {
+    *ptr = *string;
+  }
+  return ptr;
+}
+
+static char *
+trace_json_append_u64(char *ptr, uint64_t value)
+{
+  char digits[20];
+  uint32_t digit_count = 0;
+  do
+  {
+    digits[digit_count] = (char)('0' + value % 10);
+    digit_count += 1;
+    value /= 10;
+  } while(value != 0);
+  for(; digit_count != 0; --digit_count, ++ptr)
+  {
+    *ptr = digits[digit_count - 1];
+  }
+  return ptr;
+}
+
+static char *
+trace_json_append_us_from_ns(char *ptr, uint64_t ns)
+{
+  // NOTE(hampus): Chrome wants microseconds, keep the nanoseconds as decimals
+  ptr = trace_json_append_u64(ptr, ns / 1000);
+  *ptr++ = '.';
+  uint64_t fraction = ns % 1000;
+  *ptr++ = (char)('0' + fraction / 100);
+  *ptr++ = (char)('0' + (fraction / 10) % 10);
+  *ptr++ = (char)('0' + fraction % 10);
+  return ptr;
+}
+
+static char *
+trace_export_chrome_json(Arena *arena, uint64_t *size)
+{
+  // NOTE(hampus): Writes the events still in the rings as Chrome trace_event
+  // JSON, which chrome://tracing and Perfetto can open. Each thread's ring
+  // becomes its own track, and timestamps start at the oldest event. The
+  // string is pushed onto the arena and is zero terminated.
+  uint64_t event_count = 0;
+#if TEXT_TO_GLYPHS_TRACE
+  uint64_t first_ns = UINT64_MAX;
+  for(TraceRing *ring = (TraceRing *)trace_first_ring; ring != 0; ring = ring->next)
+  {
+    uint64_t ring_event_count = ring->event_count < TRACE_RING_CAPACITY ? ring->event_count : TRACE_RING_CAPACITY;
+    for(uint64_t idx = ring->event_count - ring_event_count; idx < ring->event_count; ++idx)
+    {
+      uint64_t begin_ns = ring->events[idx % TRACE_RING_CAPACITY].begin_ns;
+      first_ns = begin_ns < first_ns ? begin_ns : first_ns;
+    }
+    event_count += ring_event_count;
+  }
+#endif
+
+  // NOTE(hampus): No event takes up more than 256 bytes
+  char *result = push_array_no_zero(arena, char, 64 + event_count * 256);
+  char *ptr = trace_json_append_string(result, "{\"traceEvents\":[");
+#if TEXT_TO_GLYPHS_TRACE
+  bool first_event = true;
+  for(TraceRing *ring = (TraceRing *)trace_first_ring; ring != 0; ring = ring->next)
+  {
+    uint64_t ring_event_count = ring->event_count < TRACE_RING_CAPACITY ? ring->event_count : TRACE_RING_CAPACITY;
+    for(uint64_t idx = ring->event_count - ring_event_count; idx < ring->event_count; ++idx)
+    {
+      TraceEvent *event = &ring->events[idx % TRACE_RING_CAPACITY];
+      ptr = trace_json_append_string(ptr, first_event ? "\n" : ",\n");
+      ptr = trace_json_append_string(ptr, "{\"name\":\"");
+      ptr = trace_json_append_string(ptr, trace_phase_names[event->phase]);
+      ptr = trace_json_append_string(ptr, "\",\"cat\":\"shaping\",\"ph\":\"X\",\"pid\":1,\"tid\":");
+      ptr = trace_json_append_u64(ptr, ring->thread_idx);
+      ptr = trace_json_append_string(ptr, ",\"ts\":");
+      ptr = trace_json_append_us_from_ns(ptr, event->begin_ns - first_ns);
+      ptr = trace_json_append_string(ptr, ",\"dur\":");
+      ptr = trace_json_append_us_from_ns(ptr, event->end_ns - event->begin_ns);
+      ptr = trace_json_append_string(ptr, ",\"args\":{\"chars\":");
+      ptr = trace_json_append_u64(ptr, event->char_count);
+      ptr = trace_json_append_string(ptr, ",\"glyphs\":");
+      ptr = trace_json_append_u64(ptr, event->glyph_count);
+      ptr = trace_json_append_string(ptr, "}}");
+      first_event = false;
+    }
+  }
+#endif
+  ptr = trace_json_append_string(ptr, "\n]}\n");
+  *ptr = 0;
+  *size = (uint64_t)(ptr - result);
+  return result;
+}
+
+////////////////////////////////////////////////////////////
+// hampus: glyph metric kernels
+
+// NOTE(hampus): The loops over glyph arrays that both the shaping and the
+// rendering code keep running. Each one has an AVX2 and an SSE2 path next to
+// the scalar one, which is kept around to compare against. The vector sums
+// add in a different order, so they can differ from the scalar ones in the
+// last bits.
+
+struct GlyphBounds
+{
+  float min_x;
+  float min_y;
+  float max_x;
+  float max_y;
+};
+
+static void
+glyph_advances_from_design_advances_scalar(const int32_t *design_advances, float scale, float *advances, uint64_t count)
+{
+  for(uint64_t idx = 0; idx < count; ++idx)
+  {
+    advances[idx] = (float)design_advances[idx] * scale;
+  }
+}
+
+static void
+glyph_advances_from_design_advances(const int32_t *design_advances, float scale, float *advances, uint64_t count)
+{
+  uint64_t idx = 0;
+#if SIMD_AVX2
+  __m256 scale8 = _mm256_set1_ps(scale);
+  for(; idx + 8 <= count; idx += 8)
+  {
+    __m256i design = _mm256_loadu_si256((const __m256i *)(design_advances + idx));
+    _mm256_storeu_ps(advances + idx, _mm256_mul_ps(_mm256_cvtepi32_ps(design), scale8));
+  }
+#elif SIMD_SSE2
+  __m128 scale4 = _mm_set1_ps(scale);
+  for(; idx + 4 <= count; idx += 4)
+  {
+    __m128i design = _mm_loadu_si128((const __m128i *)(design_advances + idx));
+    _mm_storeu_ps(advances + idx, _mm_mul_ps(_mm_cvtepi32_ps(design), scale4));
+  }
+#endif
+  glyph_advances_from_design_advances_scalar(design_advances + idx, scale, advances + idx, count - idx);
+}
+
+static float
+glyph_advances_sum_scalar(const float *advances, uint64_t count)
+{
+  float sum = 0;
+  for(uint64_t idx = 0; idx < count; ++idx)
+  {
+    sum += advances[idx];
+  }
+  return sum;
+}
+
+static float
+glyph_advances_sum(const float *advances, uint64_t count)
+{
+  // NOTE(hampus): The width of a run
+  uint64_t idx = 0;
+  float sum = 0;
+#if SIMD_AVX2
+  __m256 sum8_0 = _mm256_setzero_ps();
+  __m256 sum8_1 = _mm256_setzero_ps();
+  for(; idx + 16 <= count; idx += 16)
+  {
+    sum8_0 = _mm256_add_ps(sum8_0, _mm256_loadu_ps(advances + idx));
+    sum8_1 = _mm256_add_ps(sum8_1, _mm256_loadu_ps(advances + idx + 8));
+  }
+  __m256 sum8 = _mm256_add_ps(sum8_0, sum8_1);
+  __m128 sum4 = _mm_add_ps(_mm256_castps256_ps128(sum8), _mm256_extractf128_ps(sum8, 1));
+  sum4 = _mm_add_ps(sum4, _mm_movehl_ps(sum4, sum4));
+  sum4 = _mm_add_ss(sum4, _mm_shuffle_ps(sum4, sum4, _MM_SHUFFLE(1, 1, 1, 1)));
+  sum = _mm_cvtss_f32(sum4);
+#elif SIMD_SSE2
+  __m128 sum4_0 = _mm_setzero_ps();
+  __m128 sum4_1 = _mm_setzero_ps();
+  for(; idx + 8 <= count; idx += 8)
+  {
+    sum4_0 = _mm_add_ps(sum4_0, _mm_loadu_ps(advances + idx));
+    sum4_1 = _mm_add_ps(sum4_1, _mm_loadu_ps(advances + idx + 4));
+  }
+  __m128 sum4 = _mm_add_ps(sum4_0, sum4_1);
+  sum4 = _mm_add_ps(sum4, _mm_movehl_ps(sum4, sum4));
+  sum4 = _mm_add_ss(sum4, _mm_shuffle_ps(sum4, sum4, _MM_SHUFFLE(1, 1, 1, 1)));
+  sum = _mm_cvtss_f32(sum4);
+#endif
+  return sum + glyph_advances_sum_scalar(advances + idx, count - idx);
+}
+
+static void
+glyph_positions_from_advances_scalar(const float *advances, float origin, float *positions, uint64_t count)
+{
+  float pen = origin;
+  for(uint64_t idx = 0; idx < count; ++idx)
+  {
+    positions[idx] = pen;
+    pen += advances[idx];
+  }
+}
+
+static void
+glyph_positions_from_advances(const float *advances, float origin, float *positions, uint64_t count)
+{
+  // NOTE(hampus): Where each glyph starts, i.e. origin plus the advances of
+  // the glyphs before it. Done as a prefix sum within each register,
+  // carrying the total over to the next one.
+  uint64_t idx = 0;
+  float pen = origin;
+#if SIMD_AVX2
+  __m256 offset8 = _mm256_set1_ps(origin);
+  for(; idx + 8 <= count; idx += 8)
+  {
+    __m256 advance = _mm256_loadu_ps(advances + idx);
+    __m256 x = _mm256_add_ps(advance, _mm256_castsi256_ps(_mm256_slli_si256(_mm256_castps_si256(advance), 4)));
+    x = _mm256_add_ps(x, _mm256_castsi256_ps(_mm256_slli_si256(_mm256_castps_si256(x), 8)));
+    __m256 lane_totals = _mm256_permute_ps(x, _MM_SHUFFLE(3, 3, 3, 3));
+    x = _mm256_add_ps(x, _mm256_permute2f128_ps(lane_totals, lane_totals, 0x08));
+    x = _mm256_add_ps(x, offset8);
+    _mm256_storeu_ps(positions + idx, _mm256_sub_ps(x, advance));
+    offset8 = _mm256_permute_ps(x, _MM_SHUFFLE(3, 3, 3, 3));
+    offset8 = _mm256_permute2f128_ps(offset8, offset8, 0x11);
+  }
+  pen = _mm256_cvtss_f32(offset8);
+#elif SIMD_SSE2
+  __m128 offset4 = _mm_set1_ps(origin);
+  for(; idx + 4 <= count; idx += 4)
+  {
+    __m128 advance = _mm_loadu_ps(advances + idx);
+    __m128 x = _mm_add_ps(advance, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(advance), 4)));
+    x = _mm_add_ps(x, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(x), 8)));
+    x = _mm_add_ps(x, offset4);
+    _mm_storeu_ps(positions + idx, _mm_sub_ps(x, advance));
+    offset4 = _mm_shuffle_ps(x, x, _MM_SHUFFLE(3, 3, 3, 3));
+  }
+  pen = _mm_cvtss_f32(offset4);
+#endif
+  glyph_positions_from_advances_scalar(advances + idx, pen, positions + idx, count - idx);
+}
+
+static GlyphBounds
+glyph_bounds_empty(void)
+{
+  GlyphBounds bounds = {3.4e38f, 3.4e38f, -3.4e38f, -3.4e38f};
+  return bounds;
+}
+
+static void
+glyph_bounds_from_points_scalar(const float *points, uint64_t point_count, GlyphBounds *bounds)
+{
+  for(uint64_t idx = 0; idx < point_count; ++idx)
+  {
+    float x = points[idx * 2 + 0];
+    float y = points[idx * 2 + 1];
+    bounds->min_x = x < bounds->min_x ? x : bounds->min_x;
+    bounds->min_y = y < bounds->min_y ? y : bounds->min_y;
+    bounds->max_x = x > bounds->max_x ? x : bounds->max_x;
+    bounds->max_y = y > bounds->max_y ? y : bounds->max_y;
+  }
+}
+
+static void
+glyph_bounds_from_points(const float *points, uint64_t point_count, GlyphBounds *bounds)
+{
+  // NOTE(hampus): Grows `bounds` to hold every (x, y) pair of `points`.
+  // Start from glyph_bounds_empty() to get the bounds of just the points.
+  uint64_t idx = 0;
+#if SIMD_AVX2 || SIMD_SSE2
+  // NOTE(hampus): The registers hold x, y, x, y, so lanes 0 and 2 track x,
+  // and lanes 1 and 3 track y.
+  __m128 min4 = _mm_setr_ps(bounds->min_x, bounds->min_y, bounds->min_x, bounds->min_y);
+  __m128 max4 = _mm_setr_ps(bounds->max_x, bounds->max_y, bounds->max_x, bounds->max_y);
+#  if SIMD_AVX2
+  __m256 min8 = _mm256_set_m128(min4, min4);
+  __m256 max8 = _mm256_set_m128(max4, max4);
+  for(; idx + 4 <= point_count; idx += 4)
+  {
+    __m256 xy = _mm256_loadu_ps(points + idx * 2);
+    min8 = _mm256_min_ps(min8, xy);
+    max8 = _mm256_max_ps(max8, xy);
+  }
+  min4 = _mm_min_ps(_mm256_castps256_ps128(min8), _mm256_extractf128_ps(min8, 1));
+  max4 = _mm_max_ps(_mm256_castps256_ps128(max8), _mm256_extractf128_ps(max8, 1));
+#  endif
+  for(; idx + 2 <= point_count; idx += 2)
+  {
+    __m128 xy = _mm_loadu_ps(points + idx * 2);
+    min4 = _mm_min_ps(min4, xy);
+    max4 = _mm_max_ps(max4, xy);
+  }
+  min4 = _mm_min_ps(min4, _mm_movehl_ps(min4, min4));
+  max4 = _mm_max_ps(max4, _mm_movehl_ps(max4, max4));
+  float min_xy[4];
+  float max_xy[4];
+  _mm_storeu_ps(min_xy, min4);
+  _mm_storeu_ps(max_xy, max4);
+  bounds->min_x = min_xy[0];
+  bounds->min_y = min_xy[1];
+  bounds->max_x = max_xy[0];
+  bounds->max_y = max_xy[1];
+#endif
+  glyph_bounds_from_points_scalar(points + idx * 2, point_count - idx, bounds);
+}
+
+////////////////////////////////////////////////////////////
+// hampus: text to glyphs types
+
+// NOTE(hampus): A font face that belongs to a shaping backend. The core
+// never looks inside it, it only hands it back to the backend and keeps it
+// alive through the backend's add_ref/release functions.
+struct ShapingFontFace;
+
+// NOTE(hampus): Same layout as DWRITE_GLYPH_OFFSET. advance_offset is along
+// the reading direction of the run and ascender_offset points up.
+struct GlyphOffset
+{
+  float advance_offset;
+  float ascender_offset;
+};
+
+// NOTE(hampus): Vertical font metrics in design units. The descent is
+// positive below the baseline, and a line takes up ascent + descent + line_gap.
+struct ShapingFontMetrics
+{
+  uint16_t design_units_per_em;
+  uint16_t ascent;
+  uint16_t descent;
+  int16_t line_gap;
+};
+
+enum ShapingFontFlags
+{
+  ShapingFontFlag_Monospace = (1 << 0),
+
+  // NOTE(hampus): Has glyphs with color layers or images of their own
+  ShapingFontFlag_Color = (1 << 1),
+};
+
+struct ShapingFontProperties
+{
+  uint32_t glyph_count;
+
+  // NOTE(hampus): ShapingFontFlags
+  uint32_t flags;
+};
+
+// NOTE(hampus): What the backend needs to know about a run to shape it. The
+// meaning of the values is up to the backend, the core only compares them.
+struct ShapingScriptAnalysis
+{
+  uint32_t script;
+  uint32_t shapes;
+};
+
+struct ShapingScriptRun
+{
+  uint32_t text_position;
+  uint32_t text_length;
+  ShapingScriptAnalysis analysis;
+  uint32_t bidi_level;
+};
+
+// NOTE(hampus): Same values as DWRITE_BREAK_CONDITION
+enum LineBreakCondition
+{
+  LineBreakCondition_Neutral,
+  LineBreakCondition_CanBreak,
+  LineBreakCondition_MayNotBreak,
+  LineBreakCondition_MustBreak,
+};
+
+// NOTE(hampus): Same layout as DWRITE_LINE_BREAKPOINT. One per UTF-16 code
+// unit, saying whether a line may end before and after it.
+struct LineBreakpoint
+{
+  uint8_t break_condition_before : 2;
+  uint8_t break_condition_after : 2;
+  uint8_t is_whitespace : 1;
+  uint8_t is_soft_hyphen : 1;
+  uint8_t padding : 2;
+};
+
+struct ShapingBackendFunctions;
+struct ShapingFontRegistry;
+
+struct TextToGlyphsSegment
+{
+  // per segment data
+
+  // NOTE(hampus): Indexes the result's font registry, see
+  // shaping_font_face_from_segment()
+  uint16_t font_id;
+  uint8_t bidi_level;
+  float font_size_em;
+
+  // NOTE(hampus): The UTF-16 code units of the source text this segment was
+  // shaped from. Text that no font could map is not part of any segment.
+  uint32_t text_offset;
+  uint32_t text_length;
+
+  // NOTE(hampus): The glyphs of this segment are
+  // [first_glyph, first_glyph + glyph_count) in the result's glyph arrays.
+  // After an edit there may be a gap in the arrays before first_glyph, see
+  // MapTextToGlyphsResult::glyph_gap_begin, but never inside a segment.
+  uint64_t first_glyph;
+  uint64_t glyph_count;
+
+  // NOTE(hampus): The sum of the segment's glyph advances
+  float run_width;
+};
+
+// NOTE(hampus): Extra output of map_text_to_glyphs() that not every caller
+// wants to pay for.
+enum MapTextToGlyphsFlags
+{
+  MapTextToGlyphsFlag_GlyphPositions = (1 << 0),
+  MapTextToGlyphsFlag_LineBreakpoints = (1 << 1),
+
+  // NOTE(hampus): Only for the UTF-8 entry points, see map_utf8_text_to_glyphs()
+  MapTextToGlyphsFlag_Utf8Offsets = (1 << 2),
+};
+
+struct MapTextToGlyphsResult
+{
+  // NOTE(hampus): Owns the segment array and the glyph arrays below. The result
+  // also holds one reference to the font registry its segments refer to. Free
+  // it all with free_map_text_to_glyphs_result().
+  Arena *arena;
+
+  // NOTE(hampus): The functions of the backend the font faces belong to.
+  const ShapingBackendFunctions *backend_functions;
+  ShapingFontRegistry *font_registry;
+
+  // NOTE(hampus): One of these segments for every time the fallback font doesn't match the
+  // previous one. For example, if a font contained all the characters, there would just be
+  // one segment in the array.
+
+  uint64_t segment_count;
+  uint64_t segment_capacity;
+  TextToGlyphsSegment *segments;
+
+  // NOTE(hampus): Per glyph data for all segments, stored as one structure
+  // of arrays. The shaper writes straight into these, so a segment can be
+  // handed to a glyph run without any copying.
+
+  uint64_t glyph_count;
+  uint64_t glyph_capacity;
+  uint16_t *glyph_indices;
+  float *glyph_advances;
+  GlyphOffset *glyph_offsets;
+
+  // NOTE(hampus): With MapTextToGlyphsFlag_GlyphPositions, the pen position
+  // of every glyph, i.e. the sum of the advances before it in its segment.
+  // Like the advances, it runs along the reading direction, so in a
+  // right-to-left segment it's the distance from the segment's right edge.
+  // Has room for glyph_capacity glyphs like the arrays above. 0 without the
+  // flag.
+  float *glyph_positions;
+
+  // NOTE(hampus): Editing the result with remap_text_to_glyphs_after_edit()
+  // leaves a gap of glyph_gap_length unused glyphs in the arrays above, right
+  // after the last edit, so that the next edit close by only has to move the
+  // glyphs between the two. The glyph_gap_begin'th glyph and the ones after
+  // it come glyph_gap_length later in the arrays. Segments and the cluster
+  // map index the arrays, so they already skip the gap, and glyph_count
+  // doesn't count it. glyph_gap_length is 0 right after shaping, and
+  // close_text_to_glyphs_gaps() gets it back there.
+  uint64_t glyph_gap_begin;
+  uint64_t glyph_gap_length;
+
+  // NOTE(hampus): With MapTextToGlyphsFlag_LineBreakpoints, the line
+  // breakpoints of every UTF-16 code unit of the source text. 0 without the
+  // flag.
+  LineBreakpoint *line_breakpoints;
+
+  // NOTE(hampus): For every UTF-16 code unit of the source text, the index of
+  // the first glyph of the cluster it belongs to. This is the same as the
+  // cluster map the shaper gives back, except that it indexes the result's
+  // glyph arrays directly. Text that no font could map points at the glyph
+  // that comes after it.
+
+  uint32_t text_length;
+  uint32_t *cluster_map;
+
+  // NOTE(hampus): How many code units the cluster map and the line
+  // breakpoints have room for. 0 when the result doesn't own its arrays,
+  // like a disk cache hit, which an edit then makes copies of first.
+  uint32_t text_capacity;
+
+  // NOTE(hampus): The same kind of gap as the one in the glyph arrays, in
+  // the cluster map and the line breakpoints. Text offsets are not affected,
+  // see text_array_index().
+  uint32_t text_gap_begin;
+  uint32_t text_gap_length;
+
+  // NOTE(hampus): With MapTextToGlyphsFlag_Utf8Offsets, when the text was
+  // UTF-8, the byte offset of every UTF-16 code unit above, plus one past
+  // the end that holds the size of the text in bytes. Text offsets, the
+  // cluster map and the line breakpoints are all in UTF-16 code units, and
+  // this turns them into byte offsets. 0 without the flag.
+  uint32_t *utf8_offsets;
+};
+
+////////////////////////////////////////////////////////////
+// hampus: line breakpoints
+
+// NOTE(hampus): A small subset of the Unicode line breaking rules, for
+// backends that don't come with a line breaker. Lines may end after spaces,
+// hyphens and soft hyphens, and around ideographs and kana. They must end
+// after a line or paragraph separator. No break splits a surrogate pair,
+// separates a combining mark from its base, or touches a no-break space or
+// word joiner. Everything else, like punctuation that may not start a line,
+// is left to the backends that know better.
+
+static bool
+is_ideographic_for_line_breaking(utf16_char c)
+{
+  return ((0x2E80 <= c && c <= 0x2FFF) ||
+          (0x3040 <= c && c <= 0x30FF) ||
+          (0x3400 <= c && c <= 0x4DBF) ||
+          (0x4E00 <= c && c <= 0x9FFF) ||
+          (0xF900 <= c && c <= 0xFAFF));
+}
+
+static void
+default_analyze_line_breakpoints(void *state, const utf16_char *locale, const utf16_char *text, uint32_t text_length, LineBreakpoint *breakpoints)
+{
+  for(uint32_t idx = 0; idx < text_length; ++idx)
+  {
+    utf16_char c = text[idx];
+    LineBreakpoint breakpoint = {};
+    breakpoint.break_condition_before = LineBreakCondition_Neutral;
+    breakpoint.break_condition_after = LineBreakCondition_Neutral;
+
+    if(c == ' ' || c == '\t')
+    {
+      breakpoint.is_whitespace = 1;
+      breakpoint.break_condition_after = LineBreakCondition_CanBreak;
+    }
+    else if(c == '\n' || c == 0x000B || c == 0x000C || c == 0x0085 || c == 0x2028 || c == 0x2029)
+    {
+      breakpoint.is_whitespace = 1;
+      breakpoint.break_condition_after = LineBreakCondition_MustBreak;
+    }
+    else if(c == '\r')
+    {
+      breakpoint.is_whitespace = 1;
+      bool is_crlf = idx + 1 < text_length && text[idx + 1] == '\n';
+      breakpoint.break_condition_after = is_crlf ? LineBreakCondition_MayNotBreak : LineBreakCondition_MustBreak;
+    }
+    else if(c == '-' || c == 0x2010 || c == 0x2013)
+    {
+      breakpoint.break_condition_after = LineBreakCondition_CanBreak;
+    }
+    else if(c == 0x00AD)
+    {
+      breakpoint.is_soft_hyphen = 1;
+      breakpoint.break_condition_after = LineBreakCondition_CanBreak;
+    }
+    else if(c == 0x00A0 || c == 0x202F || c == 0x2060 || c == 0xFEFF)
+    {
+      breakpoint.break_condition_before = LineBreakCondition_MayNotBreak;
+      breakpoint.break_condition_after = LineBreakCondition_MayNotBreak;
+    }
+    else if((0xDC00 <= c && c <= 0xDFFF) || (0x0300 <= c && c <= 0x036F) || c == 0x200D)
+    {
+      breakpoint.break_condition_before = LineBreakCondition_MayNotBreak;
+    }
+    else if(is_ideographic_for_line_breaking(c))
+    {
+      breakpoint.break_condition_before = LineBreakCondition_CanBreak;
+      breakpoint.break_condition_after = LineBreakCondition_CanBreak;
+    }
+
+    if(idx == 0)
+    {
+      breakpoint.break_condition_before = LineBreakCondition_MayNotBreak;
+    }
+    breakpoints[idx] = breakpoint;
+  }
+}
+
+static LineBreakCondition
+line_break_condition_between(LineBreakpoint before, LineBreakpoint after)
+{
+  // NOTE(hampus): Whether a line may end between two characters, given the
+  // first one's breakpoint and the second one's. A must break wins over
+  // everything, then a may-not break over a can break.
+  uint32_t first = before.break_condition_after;
+  uint32_t second = after.break_condition_before;
+  LineBreakCondition condition = LineBreakCondition_MayNotBreak;
+  if(first == LineBreakCondition_MustBreak || second == LineBreakCondition_MustBreak)
+  {
+    condition = LineBreakCondition_MustBreak;
+  }
+  else if(first == LineBreakCondition_MayNotBreak || second == LineBreakCondition_MayNotBreak)
+  {
+    condition = LineBreakCondition_MayNotBreak;
+  }
+  else if(first == LineBreakCondition_CanBreak || second == LineBreakCondition_CanBreak)
+  {
+    condition = LineBreakCondition_CanBreak;
+  }
+  return condition;
+}
+
+////////////////////////////////////////////////////////////
+// hampus: shaping backend
+
+// NOTE(hampus): Everything platform specific that the shaping pipeline needs.
+// A backend is a static table of functions plus a pointer to its state, see
+// dwrite_text_to_glyphs.h, freetype_text_to_glyphs.h and
+// stub_text_to_glyphs.h. The font face functions don't get the state since
+// results and caches hold on to font faces long after the call that created
+// them. All functions may be called from several threads at once when
+// shaping in batches.
+
+struct ShapingBackendFunctions
+{
+  // hampus: font faces
+
+  void (*add_ref_font_face)(ShapingFontFace *font_face);
+  void (*release_font_face)(ShapingFontFace *font_face);
+  uint16_t (*get_design_units_per_em)(ShapingFontFace *font_face);
+  void (*get_design_font_metrics)(ShapingFontFace *font_face, ShapingFontMetrics *metrics);
+  void (*get_font_properties)(ShapingFontFace *font_face, ShapingFontProperties *properties);
+
+  // NOTE(hampus): Glyph index 0 for codepoints the font doesn't have
+  void (*get_glyph_indices)(ShapingFontFace *font_face, const uint32_t *codepoints, uint32_t count, uint16_t *glyph_indices);
+  void (*get_design_glyph_advances)(ShapingFontFace *font_face, const uint16_t *glyph_indices, uint32_t count, int32_t *design_advances);
+
+  // hampus: text analysis
+
+  // NOTE(hampus): Finds the font for the start of the text, and how much of
+  // the text it covers. Returns a new reference, or 0 if no font has the
+  // characters, in which case mapped_length is the amount of text to skip.
+  ShapingFontFace *(*map_characters)(void *state, const utf16_char *locale, const utf16_char *base_family, const utf16_char *text, uint32_t text_length, uint32_t *mapped_length, float *scale);
+
+  // NOTE(hampus): Returns whether the first mapped_length characters can be
+  // shaped one glyph per character without any shaping, and writes those
+  // glyphs to glyph_indices. glyph_indices has room for text_length glyphs.
+  bool (*get_text_complexity)(void *state, ShapingFontFace *font_face, const utf16_char *text, uint32_t text_length, uint32_t *mapped_length, uint16_t *glyph_indices);
+
+  // NOTE(hampus): Splits the text into runs of one script and bidi level,
+  // pushed onto the arena in text order.
+  ShapingScriptRun *(*analyze_script_and_bidi)(void *state, Arena *arena, const utf16_char *locale, const utf16_char *text, uint32_t text_length, uint32_t *run_count);
+
+  // NOTE(hampus): Writes one breakpoint per character of the text. Backends
+  // without a line breaker of their own use default_analyze_line_breakpoints.
+  void (*analyze_line_breakpoints)(void *state, const utf16_char *locale, const utf16_char *text, uint32_t text_length, LineBreakpoint *breakpoints);
+
+  // hampus: shaping
+
+  // NOTE(hampus): Shapes one run into at most max_glyph_count glyphs, in
+  // logical order. cluster_map gets the index of the first glyph of each
+  // character's cluster. Returns false if max_glyph_count was too small.
+  bool (*shape_run)(void *state, Arena *scratch, ShapingFontFace *font_face, const float font_size, const ShapingScriptAnalysis *analysis, bool is_right_to_left, const utf16_char *locale, const utf16_char *text, const uint32_t text_length, uint32_t max_glyph_count, uint16_t *cluster_map, uint16_t *glyph_indices, float *glyph_advances, GlyphOffset *glyph_offsets, uint32_t *glyph_count);
+};
+
+struct ShapingBackend
+{
+  const ShapingBackendFunctions *functions;
+  void *state;
+
+  // NOTE(hampus): Where the results shaped with this backend keep their
+  // font faces. Usually owned by the backend's state.
+  ShapingFontRegistry *font_registry;
+};
+
+////////////////////////////////////////////////////////////
+// hampus: font registry
+
+// NOTE(hampus): Interns the font faces of a backend and gives each one a
+// 16-bit ID, which is what segments refer to them by. The registry holds the
+// reference to each face that results used to hold one each of, and keeps the
+// metrics and properties of every face, so those are only ever asked of the
+// backend once.
+//
+// The registry is reference counted. The backend holds one reference and
+// every result another, so results can still outlive the backend, and the
+// faces are released when the last of them is gone. Interning takes a lock
+// and looking a face up by ID doesn't, so one registry is shared by every
+// thread that shapes with the backend. Faces stay until the registry goes,
+// and there can be at most 65536 of them.
+
+struct ShapingFontInfo
+{
+  ShapingFontFace *font_face;
+  ShapingFontMetrics metrics;
+  ShapingFontProperties properties;
+};
+
+// NOTE(hampus): The registry itself holds a mutex, so it is further down
+// after the threads section.
+
+static ShapingFontRegistry *
+shaping_font_registry_alloc(const ShapingBackendFunctions *backend_functions);
+
+static void
+shaping_font_registry_add_ref(ShapingFontRegistry *registry);
+
+static void
+shaping_font_registry_release(ShapingFontRegistry *registry);
+
+static uint16_t
+shaping_font_registry_intern(ShapingFontRegistry *registry, ShapingFontFace *font_face);
+
+static const ShapingFontInfo *
+shaping_font_info_from_id(const ShapingFontRegistry *registry, uint16_t font_id);
+
+static const ShapingFontInfo *
+shaping_font_info_from_segment(const MapTextToGlyphsResult *result, const TextToGlyphsSegment *segment)
+{
+  return shaping_font_info_from_id(result->font_registry, segment->font_id);
+}
+
+static ShapingFontFace *
+shaping_font_face_from_segment(const MapTextToGlyphsResult *result, const TextToGlyphsSegment *segment)
+{
+  return shaping_font_info_from_id(result->font_registry, segment->font_id)->font_face;
+}
+
+////////////////////////////////////////////////////////////
+// hampus: result helpers
+
+static void
+reserve_glyphs(MapTextToGlyphsResult *result, uint64_t count)
+{
+  // NOTE(hampus): Makes room for `count` more glyphs after the ones already in
+  // the result. The old arrays are left behind on the arena when growing, which
+  // is at most as much memory as the final arrays since we grow by doubling.
+  ASSERT(result->glyph_gap_length == 0);
+  uint64_t needed = result->glyph_count + count;
+  if(needed > result->glyph_capacity)
+  {
+    uint64_t capacity = result->glyph_capacity * 2;
+    if(capacity < needed)
+    {
+      capacity = needed;
+    }
+    uint16_t *indices = push_array_no_zero(result->arena, uint16_t, capacity);
+    float *advances = push_array_no_zero(result->arena, float, capacity);
+    GlyphOffset *offsets = push_array_no_zero(result->arena, GlyphOffset, capacity);
+    memory_copy_typed(indices, result->glyph_indices, result->glyph_count);
+    memory_copy_typed(advances, result->glyph_advances, result->glyph_count);
+    memory_copy_typed(offsets, result->glyph_offsets, result->glyph_count);
+    result->glyph_indices = indices;
+    result->glyph_advances = advances;
+    result->glyph_offsets = offsets;
+    if(result->glyph_positions != 0)
+    {
+      float *positions = push_array_no_zero(result->arena, float, capacity);
+      memory_copy_typed(positions, result->glyph_positions, result->glyph_count);
+      result->glyph_positions = positions;
+    }
+    result->glyph_capacity = capacity;
+  }
+}
+
+static TextToGlyphsSegment *
+push_segment(MapTextToGlyphsResult *result)
+{
+  if(result->segment_count == result->segment_capacity)
+  {
+    uint64_t capacity = result->segment_capacity == 0 ? 8 : result->segment_capacity * 2;
+    TextToGlyphsSegment *segments = push_array_no_zero(result->arena, TextToGlyphsSegment, capacity);
+    memory_copy_typed(segments, result->segments, result->segment_count);
+    result->segments = segments;
+    result->segment_capacity = capacity;
+  }
+  TextToGlyphsSegment *segment = &result->segments[result->segment_count];
+  result->segment_count += 1;
+  *segment = {};
+  segment->first_glyph = result->glyph_count;
+  return segment;
+}
+
+static uint64_t
+glyph_array_index(const MapTextToGlyphsResult *result, uint64_t glyph)
+{
+  // NOTE(hampus): Where the glyph with `glyph` glyphs before it is in the
+  // glyph arrays, skipping the gap an edit may have left in them.
+  return glyph < result->glyph_gap_begin ? glyph : glyph + result->glyph_gap_length;
+}
+
+static uint64_t
+glyph_from_array_index(const MapTextToGlyphsResult *result, uint64_t array_index)
+{
+  return array_index < result->glyph_gap_begin ? array_index : array_index - result->glyph_gap_length;
+}
+
+static uint32_t
+text_array_index(const MapTextToGlyphsResult *result, uint32_t text_position)
+{
+  // NOTE(hampus): Where the cluster map and the line breakpoints of the
+  // code unit at `text_position` are, skipping the gap an edit may have left.
+  return text_position < result->text_gap_begin ? text_position : text_position + result->text_gap_length;
+}
+
+static void
+compute_segment_range_metrics(MapTextToGlyphsResult *result, uint64_t first_segment, uint64_t opl_segment)
+{
+  for(uint64_t segment_idx = first_segment; segment_idx < opl_segment; ++segment_idx)
+  {
+    TextToGlyphsSegment *segment = &result->segments[segment_idx];
+    const float *advances = result->glyph_advances + segment->first_glyph;
+    segment->run_width = glyph_advances_sum(advances, segment->glyph_count);
+    if(result->glyph_positions != 0)
+    {
+      glyph_positions_from_advances(advances, 0.0f, result->glyph_positions + segment->first_glyph, segment->glyph_count);
+    }
+  }
+}
+
+static void
+compute_segment_metrics(MapTextToGlyphsResult *result, uint32_t flags)
+{
+  // NOTE(hampus): Run once the glyph arrays are final, so the positions
+  // don't have to be carried along while the shaper fills them in.
+  if(flags & MapTextToGlyphsFlag_GlyphPositions)
+  {
+    result->glyph_positions = push_array_no_zero(result->arena, float, result->glyph_capacity);
+  }
+  compute_segment_range_metrics(result, 0, result->segment_count);
+}
+
+static float
+glyph_x_in_segment(const MapTextToGlyphsResult *result, const TextToGlyphsSegment *segment, uint64_t glyph)
+{
+  // NOTE(hampus): The left edge of the glyph's advance, measured from the
+  // left edge of the segment, whatever the reading direction. `glyph`
+  // indexes the result's glyph arrays. Without glyph positions this has to
+  // sum up the advances before the glyph.
+  ASSERT(segment->first_glyph <= glyph && glyph < segment->first_glyph + segment->glyph_count);
+  float position = 0;
+  if(result->glyph_positions != 0)
+  {
+    position = result->glyph_positions[glyph];
+  }
+  else
+  {
+    position = glyph_advances_sum(result->glyph_advances + segment->first_glyph, glyph - segment->first_glyph);
+  }
+  if(segment->bidi_level & 1)
+  {
+    position = segment->run_width - position - result->glyph_advances[glyph];
+  }
+  return position;
+}
+
+static uint64_t
+glyph_from_segment_x(const MapTextToGlyphsResult *result, const TextToGlyphsSegment *segment, float x)
+{
+  // NOTE(hampus): The glyph whose advance covers `x`, measured from the left
+  // edge of the segment, clamped to the first and last glyph. Needs glyph
+  // positions, which are sorted within a segment, so this is a binary
+  // search for the last glyph that starts at or before x.
+  ASSERT(result->glyph_positions != 0 && segment->glyph_count != 0);
+  float position = (segment->bidi_level & 1) ? segment->run_width - x : x;
+  const float *positions = result->glyph_positions + segment->first_glyph;
+  uint64_t low = 1;
+  uint64_t high = segment->glyph_count;
+  while(low < high)
+  {
+    uint64_t mid = low + (high - low) / 2;
+    if(positions[mid] <= position)
+    {
+      low = mid + 1;
+    }
+    else
+    {
+      high = mid;
+    }
+  }
+  return segment->first_glyph + low - 1;
+}
+
+static void
+free_map_text_to_glyphs_result(MapTextToGlyphsResult *result)
+{
+  if(result->arena == 0)
+  {
+    return;
+  }
+  shaping_font_registry_release(result->font_registry);
+  arena_release(result->arena);
+  *result = {};
+}
+
+////////////////////////////////////////////////////////////
+// hampus: complex run shaping
+
+static uint64_t
+shape_complex_run(MapTextToGlyphsResult *result, Arena *scratch, const ShapingBackend *backend, ShapingFontFace *font_face, const utf16_char *locale, const float font_size, const ShapingScriptAnalysis *analysis, bool is_right_to_left, const utf16_char *text, const uint32_t text_length, uint32_t *result_cluster_map)
+{
+  // NOTE(hampus): Shapes one run that has a single script and bidi level,
+  // and appends the glyphs to the result. result_cluster_map is the part of
+  // the result's cluster map that belongs to this run. Returns the number of
+  // glyphs that were appended.
+
+  uint64_t scratch_pos = arena_pos(scratch);
+
+  uint32_t max_glyph_count = (3 * text_length) / 2 + 16;
+  uint16_t *cluster_map = push_array_no_zero(scratch, uint16_t, text_length);
+
+  uint32_t actual_glyph_count = 0;
+
+  for(int retry = 0;;)
+  {
+    reserve_glyphs(result, max_glyph_count);
+    trace_begin(shape);
+    bool fits = backend->functions->shape_run(backend->state,
+                                              scratch,
+                                              font_face,
+                                              font_size,
+                                              analysis,
+                                              is_right_to_left,
+                                              locale,
+                                              text,
+                                              text_length,
+                                              max_glyph_count,
+                                              cluster_map,
+                                              result->glyph_indices + result->glyph_count,
+                                              result->glyph_advances + result->glyph_count,
+                                              result->glyph_offsets + result->glyph_count,
+                                              &actual_glyph_count);
+    trace_end(shape, TracePhase_ShapeRun, text_length, fits ? actual_glyph_count : 0);
+
+    if(!fits && ++retry < 8)
+    {
+      // TODO(hampus): Test this codepath.
+      max_glyph_count *= 2;
+      continue;
+    }
+
+    ASSERT(fits);
+    break;
+  }
+
+  for(uint32_t idx = 0; idx < text_length; ++idx)
+  {
+    result_cluster_map[idx] = (uint32_t)result->glyph_count + cluster_map[idx];
+  }
+
+  result->glyph_count += actual_glyph_count;
+
+  arena_pop_to(scratch, scratch_pos);
+  return actual_glyph_count;
+}
+
+////////////////////////////////////////////////////////////
+// hampus: shaped word cache
+
+// NOTE(hampus): Most UI text is the same handful of words over and over
+// again. Complex runs are split at spaces and every word is looked up here
+// before it is sent to the shaper. Entries are keyed on everything that can
+// change how a word is shaped: font face, em size, locale, script, bidi
+// level and the text itself, spaces after the word included. The cache
+// keeps a reference to the font face of each entry so a face can't be freed
+// and have its address reused while an entry still points to it.
+
+#define SHAPED_WORD_CACHE_MAX_WORD_LENGTH 64
+
+struct ShapedWord
+{
+  ShapedWord *hash_next;
+  ShapedWord *lru_next;
+  ShapedWord *lru_prev;
+
+  // hampus: key
+  uint64_t hash;
+  ShapingFontFace *font_face;
+  float font_size_em;
+  uint32_t bidi_level;
+  ShapingScriptAnalysis analysis;
+  const utf16_char *locale;
+  const utf16_char *text;
+  uint32_t text_length;
+
+  // hampus: value
+  uint32_t glyph_count;
+  uint16_t *glyph_indices;
+  float *glyph_advances;
+  GlyphOffset *glyph_offsets;
+
+  // NOTE(hampus): Relative to the first glyph of the word, one per character
+  uint16_t *cluster_map;
+
+  // NOTE(hampus): Size of the whole allocation, which also holds the key
+  // strings and glyph arrays right after this struct.
+  uint64_t size;
+};
+
+struct ShapedWordCache
+{
+  // NOTE(hampus): The backend the cached font faces belong to. A cache can
+  // only be used with one backend.
+  const ShapingBackendFunctions *backend_functions;
+
+  uint64_t memory_budget;
+  uint64_t memory_used;
+
+  uint64_t slot_count;
+  ShapedWord **slots;
+
+  // NOTE(hampus): lru_first is the most recently used entry, lru_last is
+  // the next one to be evicted.
+  ShapedWord *lru_first;
+  ShapedWord *lru_last;
+
+  uint64_t entry_count;
+  uint64_t hit_count;
+  uint64_t miss_count;
+  uint64_t eviction_count;
+};
+
+static uint64_t
+hash_bytes(uint64_t seed, const void *data, uint64_t size)
+{
+  // NOTE(hampus): FNV-1a
+  uint64_t hash = seed ^ 14695981039346656037ull;
+  const uint8_t *bytes = (const uint8_t *)data;
+  for(uint64_t idx = 0; idx < size; ++idx)
+  {
+    hash ^= bytes[idx];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+static ShapedWordCache *
+shaped_word_cache_alloc(uint64_t memory_budget)
+{
+  ShapedWordCache *cache = (ShapedWordCache *)memory_alloc_zero(sizeof(ShapedWordCache));
+  cache->memory_budget = memory_budget;
+  cache->slot_count = 1024;
+  cache->slots = (ShapedWord **)memory_alloc_zero(cache->slot_count * sizeof(ShapedWord *));
+  return cache;
+}
+
+static void
+shaped_word_cache_remove(ShapedWordCache *cache, ShapedWord *word)
+{
+  ShapedWord **slot = &cache->slots[word->hash & (cache->slot_count - 1)];
+  while(*slot != word)
+  {
+    slot = &(*slot)->hash_next;
+  }
+  *slot = word->hash_next;
+
+  if(word->lru_prev != 0)
+  {
+    word->lru_prev->lru_next = word->lru_next;
+  }
+  else
+  {
+    cache->lru_first = word->lru_next;
+  }
+  if(word->lru_next != 0)
+  {
+    word->lru_next->lru_prev = word->lru_prev;
+  }
+  else
+  {
+    cache->lru_last = word->lru_prev;
+  }
+
+  cache->memory_used -= word->size;
+  cache->entry_count -= 1;
+  cache->backend_functions->release_font_face(word->font_face);
+  memory_free(word);
+}
+
+static void
+shaped_word_cache_release(ShapedWordCache *cache)
+{
+  while(cache->lru_last != 0)
+  {
+    shaped_word_cache_remove(cache, cache->lru_last);
+  }
+  memory_free(cache->slots);
+  memory_free(cache);
+}
+
+static void
+shaped_word_cache_push_front(ShapedWordCache *cache, ShapedWord *word)
+{
+  word->lru_prev = 0;
+  word->lru_next = cache->lru_first;
+  if(cache->lru_first != 0)
+  {
+    cache->lru_first->lru_prev = word;
+  }
+  else
+  {
+    cache->lru_last = word;
+  }
+  cache->lru_first = word;
+}
+
+static uint64_t
+shaped_word_hash_step(uint64_t hash, uint64_t value)
+{
+  return (hash ^ value) * 0x9E3779B97F4A7C15ull;
+}
+
+static uint64_t
+shaped_word_locale_hash(const utf16_char *locale)
+{
+  uint64_t hash = 0;
+  for(const utf16_char *c = locale; *c != 0; ++c)
+  {
+    hash = shaped_word_hash_step(hash, *c);
+  }
+  return hash;
+}
+
+static uint64_t
+shaped_word_run_hash(uint64_t locale_hash, ShapingFontFace *font_face, const float font_size, uint32_t bidi_level, const ShapingScriptAnalysis *analysis)
+{
+  // NOTE(hampus): Everything but the text is the same for every word of a
+  // run, so it is only hashed once per run and used as the seed for the words.
+  uint32_t font_size_bits = 0;
+  memcpy(&font_size_bits, &font_size, sizeof(font_size_bits));
+  uint64_t hash = shaped_word_hash_step(locale_hash, (uint64_t)font_face);
+  hash = shaped_word_hash_step(hash, ((uint64_t)font_size_bits << 32) | bidi_level);
+  hash = shaped_word_hash_step(hash, ((uint64_t)analysis->script << 32) | analysis->shapes);
+  return hash;
+}
+
+static uint64_t
+shaped_word_hash(uint64_t run_hash, const utf16_char *text, uint32_t text_length)
+{
+  // NOTE(hampus): One step per code unit instead of per byte, words are
+  // hashed for every lookup so this has to be cheaper than shaping them.
+  uint64_t hash = run_hash;
+  for(uint32_t idx = 0; idx < text_length; ++idx)
+  {
+    hash = shaped_word_hash_step(hash, text[idx]);
+  }
+  return hash ^ (hash >> 29);
+}
+
+static ShapedWord *
+shaped_word_cache_lookup(ShapedWordCache *cache, uint64_t hash, ShapingFontFace *font_face, const float font_size, uint32_t bidi_level, const ShapingScriptAnalysis *analysis, const utf16_char *locale, const utf16_char *text, uint32_t text_length)
+{
+  ShapedWord *result = 0;
+  for(ShapedWord *word = cache->slots[hash & (cache->slot_count - 1)]; word != 0; word = word->hash_next)
+  {
+    if(word->hash == hash &&
+       word->font_face == font_face &&
+       word->font_size_em == font_size &&
+       word->bidi_level == bidi_level &&
+       word->analysis.script == analysis->script &&
+       word->analysis.shapes == analysis->shapes &&
+       word->text_length == text_length &&
+       memcmp(word->text, text, text_length * sizeof(utf16_char)) == 0 &&
+       utf16_match(word->locale, locale))
+    {
+      result = word;
+      break;
+    }
+  }
+
+  if(result != 0)
+  {
+    cache->hit_count += 1;
+    if(cache->lru_first != result)
+    {
+      // NOTE(hampus): Unlink and move to the front of the LRU list
+      result->lru_prev->lru_next = result->lru_next;
+      if(result->lru_next != 0)
+      {
+        result->lru_next->lru_prev = result->lru_prev;
+      }
+      else
+      {
+        cache->lru_last = result->lru_prev;
+      }
+      shaped_word_cache_push_front(cache, result);
+    }
+  }
+  else
+  {
+    cache->miss_count += 1;
+  }
+  return result;
+}
+
+static void
+shaped_word_cache_grow(ShapedWordCache *cache)
+{
+  uint64_t slot_count = cache->slot_count * 2;
+  ShapedWord **slots = (ShapedWord **)memory_alloc_zero(slot_count * sizeof(ShapedWord *));
+  for(uint64_t slot_idx = 0; slot_idx < cache->slot_count; ++slot_idx)
+  {
+    ShapedWord *next = 0;
+    for(ShapedWord *word = cache->slots[slot_idx]; word != 0; word = next)
+    {
+      next = word->hash_next;
+      ShapedWord **slot = &slots[word->hash & (slot_count - 1)];
+      word->hash_next = *slot;
+      *slot = word;
+    }
+  }
+  memory_free(cache->slots);
+  cache->slots = slots;
+  cache->slot_count = slot_count;
+}
+
+static void
+shaped_word_cache_insert(ShapedWordCache *cache, const ShapingBackend *backend, uint64_t hash, ShapingFontFace *font_face, const float font_size, uint32_t bidi_level, const ShapingScriptAnalysis *analysis, const utf16_char *locale, const utf16_char *text, uint32_t text_length, const MapTextToGlyphsResult *result, uint64_t first_glyph, uint32_t glyph_count, const uint32_t *result_cluster_map)
+{
+  uint64_t locale_length = utf16_length(locale);
+
+  // NOTE(hampus): The entry, its key strings and its glyph arrays are one allocation.
+  uint64_t offsets_offset = align_pow2(sizeof(ShapedWord), alignof(GlyphOffset));
+  uint64_t advances_offset = offsets_offset + glyph_count * sizeof(GlyphOffset);
+  uint64_t indices_offset = advances_offset + glyph_count * sizeof(float);
+  uint64_t cluster_map_offset = indices_offset + glyph_count * sizeof(uint16_t);
+  uint64_t text_offset = align_pow2(cluster_map_offset + text_length * sizeof(uint16_t), alignof(utf16_char));
+  uint64_t locale_offset = text_offset + text_length * sizeof(utf16_char);
+  uint64_t size = locale_offset + (locale_length + 1) * sizeof(utf16_char);
+
+  if(size > cache->memory_budget || glyph_count > 0xffff)
+  {
+    return;
+  }
+
+  ASSERT(cache->backend_functions == 0 || cache->backend_functions == backend->functions);
+  cache->backend_functions = backend->functions;
+
+  while(cache->memory_used + size > cache->memory_budget)
+  {
+    shaped_word_cache_remove(cache, cache->lru_last);
+    cache->eviction_count += 1;
+  }
+
+  if(cache->entry_count >= cache->slot_count)
+  {
+    shaped_word_cache_grow(cache);
+  }
+
+  uint8_t *memory = (uint8_t *)memory_alloc(size);
+  ShapedWord *word = (ShapedWord *)memory;
+  *word = {};
+  word->hash = hash;
+  word->font_face = font_face;
+  backend->functions->add_ref_font_face(font_face);
+  word->font_size_em = font_size;
+  word->bidi_level = bidi_level;
+  word->analysis = *analysis;
+  word->text_length = text_length;
+  word->glyph_count = glyph_count;
+  word->glyph_offsets = (GlyphOffset *)(memory + offsets_offset);
+  word->glyph_advances = (float *)(memory + advances_offset);
+  word->glyph_indices = (uint16_t *)(memory + indices_offset);
+  word->cluster_map = (uint16_t *)(memory + cluster_map_offset);
+  word->size = size;
+
+  utf16_char *word_text = (utf16_char *)(memory + text_offset);
+  utf16_char *word_locale = (utf16_char *)(memory + locale_offset);
+  memory_copy_typed(word_text, text, text_length);
+  memory_copy_typed(word_locale, locale, locale_length + 1);
+  word->text = word_text;
+  word->locale = word_locale;
+
+  memory_copy_typed(word->glyph_indices, result->glyph_indices + first_glyph, glyph_count);
+  memory_copy_typed(word->glyph_advances, result->glyph_advances + first_glyph, glyph_count);
+  memory_copy_typed(word->glyph_offsets, result->glyph_offsets + first_glyph, glyph_count);
+  for(uint32_t idx = 0; idx < text_length; ++idx)
+  {
+    word->cluster_map[idx] = (uint16_t)(result_cluster_map[idx] - first_glyph);
+  }
+
+  ShapedWord **slot = &cache->slots[hash & (cache->slot_count - 1)];
+  word->hash_next = *slot;
+  *slot = word;
+  shaped_word_cache_push_front(cache, word);
+
+  cache->memory_used += size;
+  cache->entry_count += 1;
+}
+
+static bool
+is_word_separator(utf16_char c)
+{
+  return c == ' ' || c == '\t';
+}
+
+static uint64_t
+shape_complex_run_with_word_cache(ShapedWordCache *cache, MapTextToGlyphsResult *result, Arena *scratch, const ShapingBackend *backend, ShapingFontFace *font_face, const utf16_char *locale, uint64_t locale_hash, const float font_size, const ShapingScriptAnalysis *analysis, uint32_t bidi_level, const utf16_char *text, const uint32_t text_length, uint32_t *result_cluster_map)
+{
+  // NOTE(hampus): Splits the run into words and shapes them one at a time,
+  // so that every word can be looked up on its own.
+  // This gives up kerning and contextual forms across spaces, which
+  // is the same trade-off browsers make for their word caches.
+
+  bool is_right_to_left = (bidi_level & 1) != 0;
+  uint64_t run_hash = shaped_word_run_hash(locale_hash, font_face, font_size, bidi_level, analysis);
+  uint64_t glyph_count = 0;
+  for(uint32_t word_start = 0; word_start < text_length;)
+  {
+    // NOTE(hampus): A word is cached together with the separators after it,
+    // so the spaces around it are part of the key and a line only needs
+    // one lookup per word.
+    uint32_t word_end = word_start;
+    while(word_end < text_length && !is_word_separator(text[word_end]))
+    {
+      word_end += 1;
+    }
+    while(word_end < text_length && is_word_separator(text[word_end]))
+    {
+      word_end += 1;
+    }
+
+    const utf16_char *word_text = text + word_start;
+    uint32_t word_length = word_end - word_start;
+    if(word_length > SHAPED_WORD_CACHE_MAX_WORD_LENGTH)
+    {
+      // NOTE(hampus): Scripts that don't use spaces end up here. Caching
+      // whole sentences would just push the actual words out of the cache.
+      glyph_count += shape_complex_run(result, scratch, backend, font_face, locale, font_size, analysis, is_right_to_left, word_text, word_length, result_cluster_map + word_start);
+    }
+    else
+    {
+      uint64_t hash = shaped_word_hash(run_hash, word_text, word_length);
+      ShapedWord *word = shaped_word_cache_lookup(cache, hash, font_face, font_size, bidi_level, analysis, locale, word_text, word_length);
+      if(word != 0)
+      {
+        reserve_glyphs(result, word->glyph_count);
+        memory_copy_typed(result->glyph_indices + result->glyph_count, word->glyph_indices, word->glyph_count);
+        memory_copy_typed(result->glyph_advances + result->glyph_count, word->glyph_advances, word->glyph_count);
+        memory_copy_typed(result->glyph_offsets + result->glyph_count, word->glyph_offsets, word->glyph_count);
+        for(uint32_t idx = 0; idx < word_length; ++idx)
+        {
+          result_cluster_map[word_start + idx] = (uint32_t)result->glyph_count + word->cluster_map[idx];
+        }
+        result->glyph_count += word->glyph_count;
+        glyph_count += word->glyph_count;
+      }
+      else
+      {
+        uint64_t first_glyph = result->glyph_count;
+        uint64_t word_glyph_count = shape_complex_run(result, scratch, backend, font_face, locale, font_size, analysis, is_right_to_left, word_text, word_length, result_cluster_map + word_start);
+        shaped_word_cache_insert(cache, backend, hash, font_face, font_size, bidi_level, analysis, locale, word_text, word_length, result, first_glyph, (uint32_t)word_glyph_count, result_cluster_map + word_start);
+        glyph_count += word_glyph_count;
+      }
+    }
+
+    word_start = word_end;
+  }
+  return glyph_count;
+}
+
+////////////////////////////////////////////////////////////
+// hampus: font fallback cache
+
+// NOTE(hampus): Font fallback is by far the most expensive step for text
+// that needs it, and it keeps giving the same answers for the same
+// characters. This remembers which font face (and scale) each codepoint
+// was mapped to, per base family and locale. Only codepoints that have never
+// been seen go to the backend. It assumes the same fonts are available for
+// every call that is given the same cache.
+//
+// Common and inherited codepoints (spaces, digits, punctuation) don't have
+// a font of their own, fallback keeps them in the font of the run they are
+// in. For those the cache only remembers whether a run in some font kept
+// them, keyed on that font.
+
+struct FontFallbackCacheEntry
+{
+  // NOTE(hampus): codepoint + 1, so that 0 can mean an empty slot
+  uint32_t key;
+  float scale;
+  ShapingFontFace *font_face;
+
+  // NOTE(hampus): The font of the run before the codepoint, for common and
+  // inherited codepoints. font_face is then either the same font, or 0 if
+  // the run ended before the codepoint.
+  ShapingFontFace *run_font_face;
+
+  // NOTE(hampus): The cluster extender right after the codepoint, 0 if there
+  // is none. Fallback can pick another font for a codepoint with an
+  // extender (e.g. an emoji presentation selector) than for the codepoint
+  // alone, so those are cached apart.
+  uint32_t extender;
+};
+
+// NOTE(hampus): The same answers as the entries, for one 256 codepoint page
+// of the BMP, laid out so that a run of cached codepoints can be checked
+// without hashing. Fonts are numbered per family, see
+// FontFallbackCacheFamily::fonts.
+#define FONT_FALLBACK_CACHE_PAGE_FONT_COUNT 8
+
+struct FontFallbackCachePage
+{
+  // NOTE(hampus): Font number + 1 of codepoints that aren't common, 0 if the
+  // codepoint isn't cached or its font has no number
+  uint8_t fonts[256];
+
+  // NOTE(hampus): For common codepoints, one bit per font number whose runs
+  // keep the codepoint
+  uint8_t kept_in_runs[256];
+
+  // NOTE(hampus): For common codepoints, one bit per font number that a
+  // mapping starting with the codepoint went on in, when the codepoint after
+  // it was one of that font's. These have no entries, the pages are the only
+  // place they are kept.
+  uint8_t starts_runs[256];
+};
+
+struct FontFallbackCacheFamily
+{
+  FontFallbackCacheFamily *next;
+  utf16_char *base_family;
+  utf16_char *locale;
+
+  uint64_t entry_count;
+  uint64_t slot_count;
+  FontFallbackCacheEntry *slots;
+
+  // NOTE(hampus): The first few fonts entries of this family were mapped to.
+  // The entries hold the references.
+  uint32_t font_count;
+  ShapingFontFace *fonts[FONT_FALLBACK_CACHE_PAGE_FONT_COUNT];
+  FontFallbackCachePage *pages[256];
+};
+
+struct FontFallbackCache
+{
+  const ShapingBackendFunctions *backend_functions;
+  FontFallbackCacheFamily *first_family;
+  uint64_t hit_count;
+  uint64_t miss_count;
+};
+
+static FontFallbackCache *
+font_fallback_cache_alloc(void)
+{
+  FontFallbackCache *cache = (FontFallbackCache *)memory_alloc_zero(sizeof(FontFallbackCache));
+  return cache;
+}
+
+static void
+font_fallback_cache_release(FontFallbackCache *cache)
+{
+  FontFallbackCacheFamily *next = 0;
+  for(FontFallbackCacheFamily *family = cache->first_family; family != 0; family = next)
+  {
+    next = family->next;
+    for(uint64_t slot_idx = 0; slot_idx < family->slot_count; ++slot_idx)
+    {
+      FontFallbackCacheEntry *entry = &family->slots[slot_idx];
+      if(entry->key != 0 && entry->font_face != 0)
+      {
+        cache->backend_functions->release_font_face(entry->font_face);
+      }
+      if(entry->key != 0 && entry->run_font_face != 0 && entry->run_font_face != entry->font_face)
+      {
+        cache->backend_functions->release_font_face(entry->run_font_face);
+      }
+    }
+    for(uint32_t page_idx = 0; page_idx < 256; ++page_idx)
+    {
+      memory_free(family->pages[page_idx]);
+    }
+    memory_free(family->slots);
+    memory_free(family->base_family);
+    memory_free(family->locale);
+    memory_free(family);
+  }
+  memory_free(cache);
+}
+
+static FontFallbackCacheFamily *
+font_fallback_cache_family_from_key(FontFallbackCache *cache, const ShapingBackend *backend, const utf16_char *base_family, const utf16_char *locale)
+{
+  ASSERT(cache->backend_functions == 0 || cache->backend_functions == backend->functions);
+  cache->backend_functions = backend->functions;
+
+  // NOTE(hampus): There is usually only a handful of families in use,
+  // so a list is fine here.
+  FontFallbackCacheFamily *result = 0;
+  for(FontFallbackCacheFamily *family = cache->first_family; family != 0; family = family->next)
+  {
+    if(utf16_match(family->base_family, base_family) && utf16_match(family->locale, locale))
+    {
+      result = family;
+      break;
+    }
+  }
+  if(result == 0)
+  {
+    result = (FontFallbackCacheFamily *)memory_alloc_zero(sizeof(FontFallbackCacheFamily));
+    result->base_family = utf16_copy(base_family);
+    result->locale = utf16_copy(locale);
+    result->slot_count = 256;
+    result->slots = (FontFallbackCacheEntry *)memory_alloc_zero(result->slot_count * sizeof(FontFallbackCacheEntry));
+    result->next = cache->first_family;
+    cache->first_family = result;
+  }
+  return result;
+}
+
+static uint64_t
+font_fallback_cache_slot_from_codepoint(uint32_t codepoint, ShapingFontFace *run_font_face, uint32_t extender, uint64_t slot_count)
+{
+  uint64_t hash = ((uint64_t)codepoint ^ ((uint64_t)(uintptr_t)run_font_face >> 4) ^ ((uint64_t)extender << 21)) * 0x9E3779B97F4A7C15ull;
+  return (hash >> 32) & (slot_count - 1);
+}
+
+static FontFallbackCacheEntry *
+font_fallback_cache_lookup(FontFallbackCacheFamily *family, uint32_t codepoint, ShapingFontFace *run_font_face, uint32_t extender)
+{
+  FontFallbackCacheEntry *result = 0;
+  uint64_t slot_idx = font_fallback_cache_slot_from_codepoint(codepoint, run_font_face, extender, family->slot_count);
+  for(;;)
+  {
+    FontFallbackCacheEntry *entry = &family->slots[slot_idx];
+    if(entry->key == 0)
+    {
+      break;
+    }
+    if(entry->key == codepoint + 1 && entry->run_font_face == run_font_face && entry->extender == extender)
+    {
+      result = entry;
+      break;
+    }
+    slot_idx = (slot_idx + 1) & (family->slot_count - 1);
+  }
+  return result;
+}
+
+static uint32_t
+font_fallback_cache_font_number(FontFallbackCacheFamily *family, ShapingFontFace *font_face)
+{
+  // NOTE(hampus): FONT_FALLBACK_CACHE_PAGE_FONT_COUNT if the family has run
+  // out of numbers
+  uint32_t result = 0;
+  while(result < family->font_count && family->fonts[result] != font_face)
+  {
+    result += 1;
+  }
+  if(result == family->font_count && result < FONT_FALLBACK_CACHE_PAGE_FONT_COUNT)
+  {
+    family->fonts[result] = font_face;
+    family->font_count += 1;
+  }
+  return result;
+}
+
+static void
+font_fallback_cache_insert(FontFallbackCache *cache, FontFallbackCacheFamily *family, uint32_t codepoint, ShapingFontFace *run_font_face, uint32_t extender, ShapingFontFace *font_face, float scale)
+{
+  ASSERT(run_font_face == 0 || font_face == 0 || run_font_face == font_face);
+
+  // NOTE(hampus): Most of what a miss maps is already cached, which the
+  // pages can tell without hashing
+  uint32_t font_number = font_face != 0 ? font_fallback_cache_font_number(family, font_face) : FONT_FALLBACK_CACHE_PAGE_FONT_COUNT;
+  bool is_paged = (codepoint < 0x10000 && !(0xD800 <= codepoint && codepoint <= 0xDFFF) && font_number < FONT_FALLBACK_CACHE_PAGE_FONT_COUNT && extender == 0);
+  FontFallbackCachePage *page = is_paged ? family->pages[codepoint >> 8] : 0;
+  if(page != 0 && run_font_face == 0 && page->fonts[codepoint & 0xff] == font_number + 1)
+  {
+    return;
+  }
+  if(page != 0 && run_font_face != 0 && (page->kept_in_runs[codepoint & 0xff] & (1 << font_number)))
+  {
+    return;
+  }
+  if(font_fallback_cache_lookup(family, codepoint, run_font_face, extender) != 0)
+  {
+    return;
+  }
+
+  // NOTE(hampus): Keep the load factor under 1/2 so probe sequences stay short
+  if((family->entry_count + 1) * 2 > family->slot_count)
+  {
+    uint64_t old_slot_count = family->slot_count;
+    FontFallbackCacheEntry *old_slots = family->slots;
+    family->slot_count *= 2;
+    family->slots = (FontFallbackCacheEntry *)memory_alloc_zero(family->slot_count * sizeof(FontFallbackCacheEntry));
+    for(uint64_t old_slot_idx = 0; old_slot_idx < old_slot_count; ++old_slot_idx)
+    {
+      FontFallbackCacheEntry *old_entry = &old_slots[old_slot_idx];
+      if(old_entry->key != 0)
+      {
+        uint64_t slot_idx = font_fallback_cache_slot_from_codepoint(old_entry->key - 1, old_entry->run_font_face, old_entry->extender, family->slot_count);
+        while(family->slots[slot_idx].key != 0)
+        {
+          slot_idx = (slot_idx + 1) & (family->slot_count - 1);
+        }
+        family->slots[slot_idx] = *old_entry;
+      }
+    }
+    memory_free(old_slots);
+  }
+
+  uint64_t slot_idx = font_fallback_cache_slot_from_codepoint(codepoint, run_font_face, extender, family->slot_count);
+  while(family->slots[slot_idx].key != 0)
+  {
+    slot_idx = (slot_idx + 1) & (family->slot_count - 1);
+  }
+  FontFallbackCacheEntry *entry = &family->slots[slot_idx];
+  entry->key = codepoint + 1;
+  entry->scale = scale;
+  entry->font_face = font_face;
+  entry->run_font_face = run_font_face;
+  entry->extender = extender;
+  if(font_face != 0)
+  {
+    cache->backend_functions->add_ref_font_face(font_face);
+  }
+  if(run_font_face != 0 && run_font_face != font_face)
+  {
+    // NOTE(hampus): So that the key can't be a freed font's address
+    cache->backend_functions->add_ref_font_face(run_font_face);
+  }
+  family->entry_count += 1;
+
+  if(is_paged)
+  {
+    if(page == 0)
+    {
+      page = (FontFallbackCachePage *)memory_alloc_zero(sizeof(FontFallbackCachePage));
+      family->pages[codepoint >> 8] = page;
+    }
+    if(run_font_face == 0)
+    {
+      page->fonts[codepoint & 0xff] = (uint8_t)(font_number + 1);
+    }
+    else
+    {
+      page->kept_in_runs[codepoint & 0xff] |= (uint8_t)(1 << font_number);
+    }
+  }
+}
+
+static bool
+is_cluster_extender(uint32_t codepoint)
+{
+  // NOTE(hampus): Codepoints that font fallback keeps together with the
+  // codepoint before them. Text next to these is only taken from the cache
+  // as a whole cluster, so that e.g. emoji sequences and combining marks
+  // aren't split across fonts.
+  return ((0x0300 <= codepoint && codepoint <= 0x036F) ||   // combining diacritical marks
+          (0x1AB0 <= codepoint && codepoint <= 0x1AFF) ||   // combining diacritical marks extended
+          (0x1DC0 <= codepoint && codepoint <= 0x1DFF) ||   // combining diacritical marks supplement
+          (0x20D0 <= codepoint && codepoint <= 0x20FF) ||   // combining diacritical marks for symbols
+          (0xFE20 <= codepoint && codepoint <= 0xFE2F) ||   // combining half marks
+          codepoint == 0x200C || codepoint == 0x200D ||     // zero width (non-)joiner
+          (0xFE00 <= codepoint && codepoint <= 0xFE0F) ||   // variation selectors
+          (0x1F3FB <= codepoint && codepoint <= 0x1F3FF) || // emoji skin tone modifiers
+          (0xE0020 <= codepoint && codepoint <= 0xE007F) || // tags
+          (0xE0100 <= codepoint && codepoint <= 0xE01EF));  // variation selectors supplement
+}
+
+static uint32_t
+cluster_extenders_length(const utf16_char *text, uint32_t text_length)
+{
+  // NOTE(hampus): The length of the cluster extenders at the start of the text
+  uint32_t length = 0;
+  while(length < text_length)
+  {
+    uint32_t codepoint = 0;
+    uint32_t codepoint_length = decode_utf16(text + length, text_length - length, &codepoint);
+    if(!is_cluster_extender(codepoint))
+    {
+      break;
+    }
+    length += codepoint_length;
+  }
+  return length;
+}
+
+static bool
+is_common_or_inherited_codepoint(uint32_t codepoint)
+{
+  // NOTE(hampus): The Common and Inherited script codepoints that text in
+  // any script uses. Fallback gives these the font of the run around them
+  // rather than one of their own. Emoji are Common too, but they go to a
+  // color font whatever is around them, so they aren't in here.
+  return (codepoint <= 0x0040 ||
+          (0x005B <= codepoint && codepoint <= 0x0060) ||
+          (0x007B <= codepoint && codepoint <= 0x00BF && codepoint != 0x00AA && codepoint != 0x00BA) ||
+          codepoint == 0x00D7 || codepoint == 0x00F7 ||
+          (0x02B9 <= codepoint && codepoint <= 0x02DF) ||   // modifier letters
+          (0x0300 <= codepoint && codepoint <= 0x036F) ||   // combining diacritical marks
+          (0x2000 <= codepoint && codepoint <= 0x206F) ||   // general punctuation
+          (0x2070 <= codepoint && codepoint <= 0x20FF) ||   // super and subscripts, currency, combining marks for symbols
+          (0x2E00 <= codepoint && codepoint <= 0x2E7F) ||   // supplemental punctuation
+          (0x3000 <= codepoint && codepoint <= 0x3004) ||   // CJK space and punctuation
+          (0x3008 <= codepoint && codepoint <= 0x3020) ||   // CJK brackets
+          (0x3099 <= codepoint && codepoint <= 0x309C) ||   // kana voicing marks
+          codepoint == 0x30FB || codepoint == 0x30FC ||     // katakana middle dot, prolonged sound mark
+          (0xFE00 <= codepoint && codepoint <= 0xFE0F) ||   // variation selectors
+          (0xFE10 <= codepoint && codepoint <= 0xFE6F) ||   // vertical forms, half marks, small forms
+          (0xFF01 <= codepoint && codepoint <= 0xFF20) ||   // fullwidth digits and punctuation
+          (0xFF3B <= codepoint && codepoint <= 0xFF40) ||
+          (0xFF5B <= codepoint && codepoint <= 0xFF65) ||
+          (0xE0100 <= codepoint && codepoint <= 0xE01EF));  // variation selectors supplement
+}
+
+static void
+font_fallback_cache_insert_run_start(FontFallbackCacheFamily *family, uint32_t codepoint, ShapingFontFace *font_face)
+{
+  uint32_t font_number = font_fallback_cache_font_number(family, font_face);
+  if(codepoint < 0x10000 && !(0xD800 <= codepoint && codepoint <= 0xDFFF) && font_number < FONT_FALLBACK_CACHE_PAGE_FONT_COUNT)
+  {
+    FontFallbackCachePage **page = &family->pages[codepoint >> 8];
+    if(*page == 0)
+    {
+      *page = (FontFallbackCachePage *)memory_alloc_zero(sizeof(FontFallbackCachePage));
+    }
+    (*page)->starts_runs[codepoint & 0xff] |= (uint8_t)(1 << font_number);
+  }
+}
+
+static bool
+font_fallback_cache_starts_run(FontFallbackCacheFamily *family, uint32_t codepoint, ShapingFontFace *font_face)
+{
+  bool result = false;
+  uint32_t font_number = font_fallback_cache_font_number(family, font_face);
+  if(codepoint < 0x10000 && font_number < FONT_FALLBACK_CACHE_PAGE_FONT_COUNT)
+  {
+    FontFallbackCachePage *page = family->pages[codepoint >> 8];
+    result = page != 0 && (page->starts_runs[codepoint & 0xff] & (1 << font_number)) != 0;
+  }
+  return result;
+}
+
+static uint32_t
+font_fallback_cache_run_length(FontFallbackCacheFamily *family, ShapingFontFace *font_face, const utf16_char *text, uint32_t text_length, uint32_t *strong_length)
+{
+  // NOTE(hampus): How much of the text right after a cached codepoint that
+  // isn't common stays in the same run of `font_face`, from the pages alone.
+  // Codepoints that aren't in a page and codepoints before a cluster
+  // extender end it, so the caller looks those up one at a time.
+  // strong_length is set to the length up to and including the last
+  // codepoint that isn't common, 0 if they all are.
+  uint32_t length = 0;
+  *strong_length = 0;
+  uint32_t font_number = font_fallback_cache_font_number(family, font_face);
+  if(font_number >= FONT_FALLBACK_CACHE_PAGE_FONT_COUNT)
+  {
+    return length;
+  }
+  uint8_t font_value = (uint8_t)(font_number + 1);
+  uint8_t run_bit = (uint8_t)(1 << font_number);
+
+  // NOTE(hampus): Surrogates and cluster extenders are never in a page
+  uint32_t previous_strong_length = 0;
+  for(; length < text_length; ++length)
+  {
+    utf16_char c = text[length];
+    FontFallbackCachePage *page = family->pages[c >> 8];
+    if(page == 0)
+    {
+      break;
+    }
+    if(page->fonts[c & 0xff] == font_value)
+    {
+      previous_strong_length = *strong_length;
+      *strong_length = length + 1;
+    }
+    else if(!(page->kept_in_runs[c & 0xff] & run_bit))
+    {
+      break;
+    }
+  }
+
+  // NOTE(hampus): The codepoint before a cluster extender goes with it
+  if(length > 0 && length < text_length)
+  {
+    uint32_t codepoint = 0;
+    decode_utf16(text + length, text_length - length, &codepoint);
+    if(is_cluster_extender(codepoint))
+    {
+      if(*strong_length == length)
+      {
+        *strong_length = previous_strong_length;
+      }
+      length -= 1;
+    }
+  }
+  return length;
+}
+
+////////////////////////////////////////////////////////////
+// hampus: glyph table cache
+
+// NOTE(hampus): A dense codepoint to glyph index table per font face,
+// together with each glyph's design advance, for the simple text path.
+// The table is filled in 256 codepoint pages the first time a page is
+// touched. A codepoint is only marked simple if the backend reported it
+// as simple while filling its page, so text made up of such codepoints can be
+// shaped with table lookups and no backend calls at all. This relies on simple
+// text being simple character by character, which is how GetTextComplexity
+// treats it. Only the BMP is covered, everything else takes the normal path.
+
+#define GLYPH_TABLE_PAGE_SIZE 256
+#define GLYPH_TABLE_PAGE_COUNT (0x10000 / GLYPH_TABLE_PAGE_SIZE)
+
+struct GlyphTablePage
+{
+  bool is_simple[GLYPH_TABLE_PAGE_SIZE];
+  uint16_t glyph_indices[GLYPH_TABLE_PAGE_SIZE];
+
+  // NOTE(hampus): Scaled by font size / design units per em when used, the
+  // same expression the rest of the pipeline uses, so an advance from the
+  // table is the same float as one from shaping.
+  int32_t design_advances[GLYPH_TABLE_PAGE_SIZE];
+};
+
+struct FontGlyphTable
+{
+  FontGlyphTable *hash_next;
+  ShapingFontFace *font_face;
+  uint16_t design_units_per_em;
+  GlyphTablePage *pages[GLYPH_TABLE_PAGE_COUNT];
+};
+
+struct GlyphTableCache
+{
+  const ShapingBackendFunctions *backend_functions;
+
+  uint64_t slot_count;
+  FontGlyphTable **slots;
+  uint64_t page_count;
+
+  // NOTE(hampus): Number of UTF-16 code units that were shaped straight
+  // from a table, and that had to go to the backend's complexity check.
+  uint64_t table_char_count;
+  uint64_t fallback_char_count;
+};
+
+static GlyphTableCache *
+glyph_table_cache_alloc(void)
+{
+  GlyphTableCache *cache = (GlyphTableCache *)memory_alloc_zero(sizeof(GlyphTableCache));
+  cache->slot_count = 64;
+  cache->slots = (FontGlyphTable **)memory_alloc_zero(cache->slot_count * sizeof(FontGlyphTable *));
+  return cache;
+}
+
+static void
+glyph_table_cache_release(GlyphTableCache *cache)
+{
+  for(uint64_t slot_idx = 0; slot_idx < cache->slot_count; ++slot_idx)
+  {
+    FontGlyphTable *next = 0;
+    for(FontGlyphTable *table = cache->slots[slot_idx]; table != 0; table = next)
+    {
+      next = table->hash_next;
+      for(uint64_t page_idx = 0; page_idx < GLYPH_TABLE_PAGE_COUNT; ++page_idx)
+      {
+        memory_free(table->pages[page_idx]);
+      }
+      cache->backend_functions->release_font_face(table->font_face);
+      memory_free(table);
+    }
+  }
+  memory_free(cache->slots);
+  memory_free(cache);
+}
+
+static FontGlyphTable *
+font_glyph_table_from_font_face(GlyphTableCache *cache, const ShapingBackend *backend, ShapingFontFace *font_face)
+{
+  ASSERT(cache->backend_functions == 0 || cache->backend_functions == backend->functions);
+  cache->backend_functions = backend->functions;
+
+  uint64_t slot_idx = (((uint64_t)font_face) >> 4) & (cache->slot_count - 1);
+  FontGlyphTable *result = 0;
+  for(FontGlyphTable *table = cache->slots[slot_idx]; table != 0; table = table->hash_next)
+  {
+    if(table->font_face == font_face)
+    {
+      result = table;
+      break;
+    }
+  }
+  if(result == 0)
+  {
+    result = (FontGlyphTable *)memory_alloc_zero(sizeof(FontGlyphTable));
+    result->font_face = font_face;
+    backend->functions->add_ref_font_face(font_face);
+    result->design_units_per_em = backend->functions->get_design_units_per_em(font_face);
+    result->hash_next = cache->slots[slot_idx];
+    cache->slots[slot_idx] = result;
+  }
+  return result;
+}
+
+static GlyphTablePage *
+font_glyph_table_page_from_codepoint(GlyphTableCache *cache, FontGlyphTable *table, const ShapingBackend *backend, uint32_t codepoint)
+{
+  uint32_t page_idx = codepoint / GLYPH_TABLE_PAGE_SIZE;
+  GlyphTablePage *page = table->pages[page_idx];
+  if(page == 0)
+  {
+    page = (GlyphTablePage *)memory_alloc_zero(sizeof(GlyphTablePage));
+    table->pages[page_idx] = page;
+    cache->page_count += 1;
+
+    uint32_t first_codepoint = page_idx * GLYPH_TABLE_PAGE_SIZE;
+    bool is_surrogate_page = (0xD800 <= first_codepoint && first_codepoint <= 0xDFFF);
+    if(!is_surrogate_page)
+    {
+      uint32_t codepoints[GLYPH_TABLE_PAGE_SIZE];
+      utf16_char page_text[GLYPH_TABLE_PAGE_SIZE];
+      for(uint32_t idx = 0; idx < GLYPH_TABLE_PAGE_SIZE; ++idx)
+      {
+        codepoints[idx] = first_codepoint + idx;
+        page_text[idx] = (utf16_char)(first_codepoint + idx);
+      }
+
+      backend->functions->get_glyph_indices(table->font_face, codepoints, GLYPH_TABLE_PAGE_SIZE, page->glyph_indices);
+
+      backend->functions->get_design_glyph_advances(table->font_face, page->glyph_indices, GLYPH_TABLE_PAGE_SIZE, page->design_advances);
+
+      // NOTE(hampus): The complexity check only tells us how long the simple
+      // prefix is, so skip past each complex codepoint and ask again.
+      uint16_t complexity_glyph_indices[GLYPH_TABLE_PAGE_SIZE];
+      for(uint32_t idx = 0; idx < GLYPH_TABLE_PAGE_SIZE;)
+      {
+        uint32_t mapped_length = 0;
+        trace_begin(complexity);
+        bool is_simple = backend->functions->get_text_complexity(backend->state,
+                                                                 table->font_face,
+                                                                 page_text + idx,
+                                                                 GLYPH_TABLE_PAGE_SIZE - idx,
+                                                                 &mapped_length,
+                                                                 complexity_glyph_indices);
+        trace_end(complexity, TracePhase_GetTextComplexity, mapped_length, 0);
+        if(is_simple && mapped_length != 0)
+        {
+          for(uint32_t simple_idx = idx; simple_idx < idx + mapped_length; ++simple_idx)
+          {
+            // NOTE(hampus): Missing glyphs are left to the normal path
+            page->is_simple[simple_idx] = page->glyph_indices[simple_idx] != 0;
+          }
+          idx += mapped_length;
+        }
+        else
+        {
+          idx += 1;
+        }
+      }
+    }
+  }
+  return page;
+}
+
+static uint32_t
+font_glyph_table_map_simple_text(GlyphTableCache *cache, FontGlyphTable *table, const ShapingBackend *backend, const utf16_char *text, const uint32_t text_length, const float font_size, uint16_t *glyph_indices, float *glyph_advances)
+{
+  // NOTE(hampus): Returns the length of the prefix of the text that could
+  // be shaped from the table, writing one glyph per character.
+  float scale = font_size / (float)table->design_units_per_em;
+  uint32_t length = 0;
+  for(; length < text_length; ++length)
+  {
+    uint32_t codepoint = (uint32_t)text[length];
+    if(0xD800 <= codepoint && codepoint <= 0xDFFF)
+    {
+      break;
+    }
+    GlyphTablePage *page = font_glyph_table_page_from_codepoint(cache, table, backend, codepoint);
+    uint32_t idx = codepoint % GLYPH_TABLE_PAGE_SIZE;
+    if(!page->is_simple[idx])
+    {
+      break;
+    }
+    glyph_indices[length] = page->glyph_indices[idx];
+    glyph_advances[length] = (float)page->design_advances[idx] * scale;
+  }
+
+  // NOTE(hampus): The character right before a complex one may belong to
+  // the same cluster, e.g. a base character followed by a combining mark,
+  // so it has to be shaped together with it.
+  if(length < text_length && length > 0)
+  {
+    length -= 1;
+  }
+
+  cache->table_char_count += length;
+  return length;
+}
+
+////////////////////////////////////////////////////////////
+// hampus: paragraph analysis
+
+// NOTE(hampus): Script and bidi analysis needs a whole paragraph to resolve
+// the bidi levels right, e.g. of the spaces between two right-to-left words,
+// and is much cheaper done once than for every complex piece of text the
+// complexity check finds. The paragraph around the first complex text is
+// analyzed into a table of runs, which the rest of the paragraph is shaped
+// from, and the next paragraph is analyzed once the text gets there.
+// Paragraphs without complex text are never analyzed.
+
+static bool
+is_paragraph_separator(utf16_char c)
+{
+  return c == '\n' || c == '\r' || c == 0x2029 || c == 0x0085;
+}
+
+struct ParagraphAnalysis
+{
+  // NOTE(hampus): [text_begin, text_end) of the text is the paragraph that
+  // was analyzed last, including its separator. The runs cover it and have
+  // text positions relative to the whole text.
+  uint32_t text_begin;
+  uint32_t text_end;
+  uint32_t run_count;
+  ShapingScriptRun *runs;
+
+  // NOTE(hampus): The run the last lookup landed in. Lookups mostly move
+  // forward, so they start from here.
+  uint32_t run_cursor;
+
+  // NOTE(hampus): The runs live on the scratch arena from here
+  uint64_t scratch_pos;
+};
+
+static ParagraphAnalysis
+paragraph_analysis_make(Arena *scratch)
+{
+  ParagraphAnalysis analysis = {};
+  analysis.scratch_pos = arena_pos(scratch);
+  return analysis;
+}
+
+static bool
+paragraph_analysis_covers(const ParagraphAnalysis *analysis, uint32_t position)
+{
+  return analysis->run_count != 0 && analysis->text_begin <= position && position < analysis->text_end;
+}
+
+static bool
+paragraph_analysis_seek(ParagraphAnalysis *analysis, Arena *scratch, const ShapingBackend *backend, const utf16_char *locale, const utf16_char *text, uint32_t text_length, uint32_t position)
+{
+  // NOTE(hampus): Makes sure the paragraph around `position` is analyzed.
+  // Analyzing pops the scratch arena back to where the analysis was made,
+  // so nothing pushed after that may be in use. Returns whether it did.
+  if(paragraph_analysis_covers(analysis, position))
+  {
+    return false;
+  }
+
+  uint32_t begin = position;
+  if(begin > 0 && text[begin] == '\n' && text[begin - 1] == '\r')
+  {
+    begin -= 1;
+  }
+  while(begin > 0 && !is_paragraph_separator(text[begin - 1]))
+  {
+    begin -= 1;
+  }
+
+  uint32_t end = position;
+  while(end < text_length && !is_paragraph_separator(text[end]))
+  {
+    end += 1;
+  }
+  if(end < text_length)
+  {
+    end += (text[end] == '\r' && end + 1 < text_length && text[end + 1] == '\n') ? 2 : 1;
+  }
+
+  arena_pop_to(scratch, analysis->scratch_pos);
+  trace_begin(analyze);
+  uint32_t run_count = 0;
+  ShapingScriptRun *runs = backend->functions->analyze_script_and_bidi(backend->state, scratch, locale, text + begin, end - begin, &run_count);
+  trace_end(analyze, TracePhase_AnalyzeScriptAndBidi, end - begin, 0);
+  ASSERT(run_count != 0);
+  for(uint32_t run_idx = 0; run_idx < run_count; ++run_idx)
+  {
+    runs[run_idx].text_position += begin;
+  }
+
+  analysis->text_begin = begin;
+  analysis->text_end = end;
+  analysis->run_count = run_count;
+  analysis->runs = runs;
+  analysis->run_cursor = 0;
+  return true;
+}
+
+static ShapingScriptRun *
+paragraph_analysis_run_at(ParagraphAnalysis *analysis, uint32_t position)
+{
+  ASSERT(paragraph_analysis_covers(analysis, position));
+  if(analysis->runs[analysis->run_cursor].text_position > position)
+  {
+    analysis->run_cursor = 0;
+  }
+  while(analysis->runs[analysis->run_cursor].text_position + analysis->runs[analysis->run_cursor].text_length <= position)
+  {
+    analysis->run_cursor += 1;
+  }
+  return &analysis->runs[analysis->run_cursor];
+}
+
+static uint32_t
+paragraph_analysis_left_to_right_length(ParagraphAnalysis *analysis, uint32_t position, uint32_t max_length)
+{
+  // NOTE(hampus): How much of the text from `position` is at bidi level 0,
+  // which is all of it outside of the analyzed paragraph.
+  uint32_t length = 0;
+  while(length < max_length && paragraph_analysis_covers(analysis, position + length))
+  {
+    ShapingScriptRun *run = paragraph_analysis_run_at(analysis, position + length);
+    if(run->bidi_level != 0)
+    {
+      return length;
+    }
+    length = run->text_position + run->text_length - position;
+  }
+  return max_length;
+}
+
+////////////////////////////////////////////////////////////
+// hampus: map text to glyphs
+
+// NOTE(hampus): All caches are optional, and a cache may be shared between calls
+// but not between threads.
+
+struct ShapingCaches
+{
+  ShapedWordCache *word_cache;
+  FontFallbackCache *fallback_cache;
+  GlyphTableCache *glyph_table_cache;
+};
+
+// NOTE(hampus): The memory a thread shapes with, apart from the results. Every
+// call pops what it pushed back off before returning, and the arenas keep
+// the blocks they have grown to, so once a context has shaped text about as
+// long as what it is given now, a call allocates nothing but its result.
+// Keep one per thread and pass it to every call. The entry points that take
+// an optional context allocate their scratch memory per call without one.
+
+struct ShapingContext
+{
+  Arena *scratch;
+
+  // NOTE(hampus): For results that are only needed while shaping, like the
+  // window of a re-shape or a stream
+  Arena *window_arena;
+};
+
+static ShapingContext *
+shaping_context_alloc(void)
+{
+  ShapingContext *context = (ShapingContext *)memory_alloc_zero(sizeof(ShapingContext));
+  context->scratch = arena_alloc();
+  context->window_arena = arena_alloc();
+  return context;
+}
+
+static void
+shaping_context_release(ShapingContext *context)
+{
+  arena_release(context->window_arena);
+  arena_release(context->scratch);
+  memory_free(context);
+}
+
+static MapTextToGlyphsResult
+map_text_to_glyphs_with_lookahead(Arena *arena, Arena *scratch, const ShapingBackend *backend, const utf16_char *locale, const utf16_char *base_family, const float font_size, const utf16_char *text, const uint32_t text_length, const uint32_t lookahead_length, ShapingCaches *caches, uint32_t flags)
+{
+  // NOTE(hampus): The result is pushed onto `arena`, which it takes ownership
+  // of. Everything that doesn't end up in the result is pushed onto the
+  // scratch arena, which is popped back to where it was before returning.
+  // This lets callers that shape a lot of text keep one scratch arena
+  // around instead of allocating a new one per call.
+  //
+  // The `lookahead_length` code units after the text aren't shaped, only
+  // font fallback, bidi analysis and line breaking see them, so that the end
+  // of the text comes out the same as with the text that follows it.
+
+  trace_begin(map_text);
+
+  const ShapingBackendFunctions *functions = backend->functions;
+
+  MapTextToGlyphsResult result = {};
+  result.arena = arena;
+  result.backend_functions = functions;
+  result.font_registry = backend->font_registry;
+  shaping_font_registry_add_ref(result.font_registry);
+
+  uint64_t scratch_start_pos = arena_pos(scratch);
+
+  struct MappedText
+  {
+    MappedText *next;
+    MappedText *prev;
+
+    ShapingFontFace *font_face;
+    uint16_t font_id;
+    float scale;
+    uint32_t text_offset;
+    uint32_t text_length;
+  };
+
+  MappedText *first_mapping = 0;
+  MappedText *last_mapping = 0;
+
+  FontFallbackCacheFamily *fallback_family = 0;
+  if(caches != 0 && caches->fallback_cache != 0)
+  {
+    fallback_family = font_fallback_cache_family_from_key(caches->fallback_cache, backend, base_family, locale);
+  }
+
+  uint64_t locale_hash = 0;
+  if(caches != 0 && caches->word_cache != 0)
+  {
+    locale_hash = shaped_word_locale_hash(locale);
+  }
+
+  // NOTE(hampus): Whether the last mapping ends with a cache hit. A common
+  // codepoint can only be looked up after one, since otherwise the backend
+  // has already decided not to keep it in the run before it. A chain of hits
+  // always starts with one that isn't common, and last_strong_offset is
+  // where the latest of those is.
+  bool last_was_cache_hit = false;
+  uint32_t last_strong_offset = 0;
+
+  // NOTE(hampus): Whether common codepoints at the end of the text stay in
+  // the run before them can depend on what comes after them, so the
+  // lookahead is mapped too and cut off again afterwards.
+  uint32_t mapped_text_opl = text_length + lookahead_length;
+
+  for(uint32_t fallback_offset = 0; fallback_offset < mapped_text_opl;)
+  {
+    //----------------------------------------------------------
+    // hampus: get mapped font and length
+
+    ShapingFontFace *mapped_font_face = 0;
+    uint32_t mapped_text_length = 0;
+    float mapped_scale = 0;
+
+    // NOTE(hampus): A cache hit hands out the cache's own pointer without a
+    // new reference, the backend always gives us a new reference.
+    bool owns_reference = false;
+
+    uint32_t codepoint = 0;
+    uint32_t codepoint_length = 0;
+    uint32_t next_codepoint = 0;
+    uint32_t next_codepoint_length = 0;
+    bool is_common = false;
+    ShapingFontFace *run_font_face = 0;
+    bool ends_run = false;
+    if(fallback_family != 0)
+    {
+      codepoint_length = decode_utf16(text + fallback_offset, mapped_text_opl - fallback_offset, &codepoint);
+      if(fallback_offset + codepoint_length < mapped_text_opl)
+      {
+        next_codepoint_length = decode_utf16(text + fallback_offset + codepoint_length, mapped_text_opl - fallback_offset - codepoint_length, &next_codepoint);
+      }
+      is_common = is_common_or_inherited_codepoint(codepoint);
+      if(is_common && last_was_cache_hit)
+      {
+        run_font_face = last_mapping->font_face;
+      }
+      bool can_look_up = !is_common || run_font_face != 0;
+      if(can_look_up && !is_cluster_extender(codepoint) && !is_cluster_extender(next_codepoint))
+      {
+        FontFallbackCacheEntry *entry = font_fallback_cache_lookup(fallback_family, codepoint, run_font_face, 0);
+        if(entry != 0 && run_font_face != 0 && entry->font_face == 0)
+        {
+          ends_run = true;
+        }
+        else if(entry != 0)
+        {
+          mapped_font_face = entry->font_face;
+          mapped_scale = entry->scale;
+          mapped_text_length = codepoint_length;
+        }
+      }
+      else if(!is_common && !is_cluster_extender(codepoint) && is_cluster_extender(next_codepoint))
+      {
+        // NOTE(hampus): A codepoint is looked up together with the first
+        // extender after it, and the whole cluster goes with it
+        FontFallbackCacheEntry *entry = font_fallback_cache_lookup(fallback_family, codepoint, 0, next_codepoint);
+        if(entry != 0)
+        {
+          uint32_t extenders_offset = fallback_offset + codepoint_length;
+          mapped_font_face = entry->font_face;
+          mapped_scale = entry->scale;
+          mapped_text_length = codepoint_length + cluster_extenders_length(text + extenders_offset, mapped_text_opl - extenders_offset);
+        }
+      }
+
+      // NOTE(hampus): A common codepoint the backend would start a new
+      // mapping with goes with the codepoint after it, if that one is cached
+      // and a mapping like this went on in its font before.
+      uint32_t run_offset = 0;
+      if(mapped_text_length == 0 && is_common && (run_font_face == 0 || ends_run) && !is_cluster_extender(codepoint) &&
+         next_codepoint_length != 0 && !is_common_or_inherited_codepoint(next_codepoint) && !is_cluster_extender(next_codepoint))
+      {
+        uint32_t next_offset = fallback_offset + codepoint_length;
+        uint32_t after_next_codepoint = 0;
+        if(next_offset + next_codepoint_length < mapped_text_opl)
+        {
+          decode_utf16(text + next_offset + next_codepoint_length, mapped_text_opl - next_offset - next_codepoint_length, &after_next_codepoint);
+        }
+        FontFallbackCacheEntry *entry = 0;
+        if(!is_cluster_extender(after_next_codepoint))
+        {
+          entry = font_fallback_cache_lookup(fallback_family, next_codepoint, 0, 0);
+        }
+        if(entry != 0 && entry->font_face != 0 && font_fallback_cache_starts_run(fallback_family, codepoint, entry->font_face))
+        {
+          mapped_font_face = entry->font_face;
+          mapped_scale = entry->scale;
+          mapped_text_length = codepoint_length + next_codepoint_length;
+          last_strong_offset = next_offset;
+          run_offset = next_offset + next_codepoint_length;
+        }
+      }
+      else if(mapped_text_length != 0 && !is_common && mapped_font_face != 0)
+      {
+        run_offset = fallback_offset + mapped_text_length;
+      }
+
+      if(mapped_text_length != 0)
+      {
+        caches->fallback_cache->hit_count += mapped_text_length;
+      }
+      else
+      {
+        caches->fallback_cache->miss_count += 1;
+      }
+
+      // NOTE(hampus): After a hit for a codepoint that isn't common, the rest
+      // of the run is taken from the pages in one go, instead of going
+      // around this loop once per codepoint.
+      if(run_offset != 0)
+      {
+        uint32_t strong_length = 0;
+        uint32_t run_length = font_fallback_cache_run_length(fallback_family, mapped_font_face, text + run_offset, mapped_text_opl - run_offset, &strong_length);
+        if(strong_length != 0)
+        {
+          last_strong_offset = run_offset + strong_length - 1;
+        }
+        mapped_text_length += run_length;
+        caches->fallback_cache->hit_count += run_length;
+      }
+    }
+
+    bool is_cache_hit = mapped_text_length != 0;
+    if(!is_cache_hit)
+    {
+      // NOTE(hampus): A common codepoint right after a cache hit is given to
+      // the backend together with the text from the last codepoint that
+      // isn't common, so that it gets mapped in the same run as it would be
+      // without the cache.
+      uint32_t context_length = 0;
+      if(run_font_face != 0 && !ends_run)
+      {
+        context_length = fallback_offset - last_strong_offset;
+      }
+
+      // NOTE(hampus): This get the appropiate font required for rendering the text
+      trace_begin(map_characters);
+      mapped_font_face = functions->map_characters(backend->state,
+                                                   locale,
+                                                   base_family,
+                                                   text + fallback_offset - context_length,
+                                                   mapped_text_opl - fallback_offset + context_length,
+                                                   &mapped_text_length,
+                                                   &mapped_scale);
+      trace_end(map_characters, TracePhase_MapCharacters, mapped_text_length, 0);
+      ASSERT(mapped_text_length != 0);
+      if(context_length != 0)
+      {
+        if(mapped_font_face == run_font_face && mapped_text_length > context_length)
+        {
+          mapped_text_length -= context_length;
+        }
+        else
+        {
+          // NOTE(hampus): The backend ends the run before this codepoint,
+          // which is also where it would start its next mapping without the cache.
+          if(mapped_font_face == run_font_face)
+          {
+            font_fallback_cache_insert(caches->fallback_cache, fallback_family, codepoint, run_font_face, 0, 0, 0);
+          }
+          if(mapped_font_face != 0)
+          {
+            functions->release_font_face(mapped_font_face);
+          }
+          context_length = 0;
+          trace_begin(map_characters_again);
+          mapped_font_face = functions->map_characters(backend->state,
+                                                       locale,
+                                                       base_family,
+                                                       text + fallback_offset,
+                                                       mapped_text_opl - fallback_offset,
+                                                       &mapped_text_length,
+                                                       &mapped_scale);
+          trace_end(map_characters_again, TracePhase_MapCharacters, mapped_text_length, 0);
+          ASSERT(mapped_text_length != 0);
+        }
+      }
+      owns_reference = true;
+      if(mapped_font_face == 0)
+      {
+        // NOTE(hampus): This means that no font was available for this character.
+        // mapped_text_length is the number of characters to skip.
+        // Should be replaced by a missing glyph, typically glyph index 0 in fonts.
+      }
+
+      if(fallback_family != 0)
+      {
+        // NOTE(hampus): Common codepoints are only remembered where the
+        // backend saw the run they are in, i.e. after a codepoint that isn't
+        // common.
+        const utf16_char *mapped_ptr = text + fallback_offset;
+        const utf16_char *mapped_opl = mapped_ptr + mapped_text_length;
+        bool has_run = context_length != 0;
+        while(mapped_ptr < mapped_opl)
+        {
+          uint32_t mapped_codepoint = 0;
+          mapped_ptr += decode_utf16(mapped_ptr, (uint32_t)(mapped_opl - mapped_ptr), &mapped_codepoint);
+          if(!is_cluster_extender(mapped_codepoint))
+          {
+            if(!is_common_or_inherited_codepoint(mapped_codepoint))
+            {
+              font_fallback_cache_insert(caches->fallback_cache, fallback_family, mapped_codepoint, 0, 0, mapped_font_face, mapped_scale);
+
+              // NOTE(hampus): Only clusters the backend mapped as a whole
+              uint32_t extender = 0;
+              uint32_t extenders_offset = (uint32_t)(mapped_ptr - text);
+              if(extenders_offset < mapped_text_opl)
+              {
+                decode_utf16(mapped_ptr, mapped_text_opl - extenders_offset, &extender);
+              }
+              if(is_cluster_extender(extender) && mapped_ptr + cluster_extenders_length(mapped_ptr, mapped_text_opl - extenders_offset) <= mapped_opl)
+              {
+                font_fallback_cache_insert(caches->fallback_cache, fallback_family, mapped_codepoint, 0, extender, mapped_font_face, mapped_scale);
+              }
+            }
+            else if(has_run && mapped_font_face != 0)
+            {
+              font_fallback_cache_insert(caches->fallback_cache, fallback_family, mapped_codepoint, mapped_font_face, 0, mapped_font_face, mapped_scale);
+            }
+          }
+          has_run = has_run || !is_common_or_inherited_codepoint(mapped_codepoint);
+        }
+
+        bool is_start_kept = (context_length == 0 && mapped_font_face != 0 && is_common && !is_cluster_extender(codepoint) &&
+                              next_codepoint_length != 0 && mapped_text_length >= codepoint_length + next_codepoint_length &&
+                              !is_common_or_inherited_codepoint(next_codepoint) && !is_cluster_extender(next_codepoint));
+        if(is_start_kept)
+        {
+          font_fallback_cache_insert_run_start(fallback_family, codepoint, mapped_font_face);
+        }
+      }
+    }
+    last_was_cache_hit = is_cache_hit;
+    if(is_cache_hit && !is_common && last_strong_offset < fallback_offset)
+    {
+      last_strong_offset = fallback_offset;
+    }
+
+    if(last_mapping != 0 && last_mapping->font_face == mapped_font_face)
+    {
+      // NOTE(hampus): The mapping we merge into already holds a reference.
+      last_mapping->text_length += mapped_text_length;
+      if(owns_reference && mapped_font_face != 0)
+      {
+        functions->release_font_face(mapped_font_face);
+      }
+    }
+    else
+    {
+      if(!owns_reference && mapped_font_face != 0)
+      {
+        functions->add_ref_font_face(mapped_font_face);
+      }
+      MappedText *mapping = push_array(scratch, MappedText, 1);
+      mapping->text_offset = fallback_offset;
+      mapping->text_length = mapped_text_length;
+      mapping->scale = mapped_scale;
+      mapping->font_face = mapped_font_face;
+      if(mapped_font_face != 0)
+      {
+        mapping->font_id = shaping_font_registry_intern(backend->font_registry, mapped_font_face);
+      }
+      if(first_mapping == 0)
+      {
+        first_mapping = last_mapping = mapping;
+      }
+      else
+      {
+        mapping->prev = last_mapping;
+        last_mapping->next = mapping;
+        last_mapping = mapping;
+      }
+    }
+
+    fallback_offset += mapped_text_length;
+  }
+
+  while(last_mapping != 0 && last_mapping->text_offset >= text_length)
+  {
+    if(last_mapping->font_face != 0)
+    {
+      functions->release_font_face(last_mapping->font_face);
+    }
+    last_mapping = last_mapping->prev;
+    if(last_mapping != 0)
+    {
+      last_mapping->next = 0;
+    }
+    else
+    {
+      first_mapping = 0;
+    }
+  }
+  if(last_mapping != 0 && last_mapping->text_offset + last_mapping->text_length > text_length)
+  {
+    last_mapping->text_length = text_length - last_mapping->text_offset;
+  }
+
+  // NOTE(hampus): Enough for any text that ends up with at most 1.5 glyphs per
+  // character, which covers the simple path and the shaper's own upper bound.
+  reserve_glyphs(&result, (3 * (uint64_t)text_length) / 2 + 16);
+
+  result.text_length = text_length;
+  result.text_capacity = text_length;
+  result.cluster_map = push_array_no_zero(result.arena, uint32_t, text_length);
+
+  ParagraphAnalysis paragraph = paragraph_analysis_make(scratch);
+
+  for(MappedText *mapping = first_mapping; mapping != 0; mapping = mapping->next)
+  {
+    if(mapping->font_face == 0)
+    {
+      for(uint32_t idx = 0; idx < mapping->text_length; ++idx)
+      {
+        result.cluster_map[mapping->text_offset + idx] = (uint32_t)result.glyph_count;
+      }
+      continue;
+    }
+
+    // NOTE(hampus): Only the segment that is currently being appended to is
+    // kept around. push_segment() may move the segment array, but that
+    // only happens when we are done with the previous segment anyway.
+    TextToGlyphsSegment *segment = 0;
+
+    FontGlyphTable *glyph_table = 0;
+    if(caches != 0 && caches->glyph_table_cache != 0)
+    {
+      glyph_table = font_glyph_table_from_font_face(caches->glyph_table_cache, backend, mapping->font_face);
+    }
+    const ShapingFontInfo *font_info = shaping_font_info_from_id(backend->font_registry, mapping->font_id);
+
+    // NOTE(hampus): Everything pushed onto scratch below is only needed while
+    // shaping this mapping, except the paragraph analysis.
+    uint64_t scratch_pos = arena_pos(scratch);
+
+    //----------------------------------------------------------
+    // hampus: shape both simple and complex text straight into the result
+
+    const utf16_char *fallback_ptr = text + mapping->text_offset;
+    const utf16_char *fallback_opl = fallback_ptr + mapping->text_length;
+    while(fallback_ptr < fallback_opl)
+    {
+      uint32_t fallback_remaining = (uint32_t)(fallback_opl - fallback_ptr);
+
+      // NOTE(hampus): The complexity check writes at most one glyph per character,
+      // and only the simple prefix is kept, so the end of the result's
+      // glyph array can be used directly as its output.
+      reserve_glyphs(&result, fallback_remaining);
+      bool is_simple = false;
+      uint32_t complex_mapped_length = 0;
+      bool have_advances = false;
+
+      if(glyph_table != 0)
+      {
+        complex_mapped_length = font_glyph_table_map_simple_text(caches->glyph_table_cache,
+                                                                 glyph_table,
+                                                                 backend,
+                                                                 fallback_ptr,
+                                                                 fallback_remaining,
+                                                                 font_size,
+                                                                 result.glyph_indices + result.glyph_count,
+                                                                 result.glyph_advances + result.glyph_count);
+        is_simple = complex_mapped_length != 0;
+        have_advances = is_simple;
+      }
+
+      if(!is_simple)
+      {
+        trace_begin(complexity);
+        is_simple = functions->get_text_complexity(backend->state,
+                                                   mapping->font_face,
+                                                   fallback_ptr,
+                                                   fallback_remaining,
+                                                   &complex_mapped_length,
+                                                   result.glyph_indices + result.glyph_count);
+        trace_end(complexity, TracePhase_GetTextComplexity, complex_mapped_length, is_simple ? complex_mapped_length : 0);
+        ASSERT(complex_mapped_length != 0);
+        if(glyph_table != 0)
+        {
+          caches->glyph_table_cache->fallback_char_count += complex_mapped_length;
+        }
+      }
+
+      if(is_simple)
+      {
+        // NOTE(hampus): Simple text that the paragraph's bidi analysis put
+        // at a right-to-left level, e.g. the spaces between right-to-left
+        // words, has to be shaped as part of that run.
+        uint32_t text_position = (uint32_t)(fallback_ptr - text);
+        uint32_t left_to_right_length = paragraph_analysis_left_to_right_length(&paragraph, text_position, complex_mapped_length);
+        if(left_to_right_length == 0)
+        {
+          is_simple = false;
+          ShapingScriptRun *run = paragraph_analysis_run_at(&paragraph, text_position);
+          uint32_t run_length = run->text_position + run->text_length - text_position;
+          complex_mapped_length = run_length < complex_mapped_length ? run_length : complex_mapped_length;
+        }
+        else
+        {
+          complex_mapped_length = left_to_right_length;
+        }
+      }
+
+      if(is_simple)
+      {
+        // NOTE(hampus): This text was simple. This means we can just use
+        // the indices directly without having to do any more shaping work.
+
+        if(segment != 0)
+        {
+          if(segment->bidi_level != 0)
+          {
+            segment = 0;
+          }
+        }
+
+        if(segment == 0)
+        {
+          segment = push_segment(&result);
+          segment->font_id = mapping->font_id;
+          segment->font_size_em = font_size;
+          segment->text_offset = (uint32_t)(fallback_ptr - text);
+        }
+
+        uint64_t glyph_count = complex_mapped_length;
+        uint16_t *glyph_indices = result.glyph_indices + result.glyph_count;
+        float *glyph_advances = result.glyph_advances + result.glyph_count;
+        GlyphOffset *glyph_offsets = result.glyph_offsets + result.glyph_count;
+
+        // hampus: fill in advances
+
+        if(!have_advances)
+        {
+          uint16_t design_units_per_em = font_info->metrics.design_units_per_em;
+          int32_t *design_advances = push_array_no_zero(scratch, int32_t, glyph_count);
+          functions->get_design_glyph_advances(mapping->font_face, glyph_indices, (uint32_t)glyph_count, design_advances);
+          glyph_advances_from_design_advances(design_advances, font_size / (float)design_units_per_em, glyph_advances, glyph_count);
+        }
+
+        // hampus: simple text has no offsets
+
+        memset(glyph_offsets, 0, sizeof(GlyphOffset) * glyph_count);
+
+        // hampus: one glyph per character
+
+        uint32_t *cluster_map = result.cluster_map + (fallback_ptr - text);
+        for(uint32_t idx = 0; idx < complex_mapped_length; ++idx)
+        {
+          cluster_map[idx] = (uint32_t)result.glyph_count + idx;
+        }
+
+        result.glyph_count += glyph_count;
+        segment->glyph_count += glyph_count;
+        segment->text_length += complex_mapped_length;
+      }
+      else
+      {
+
+        // NOTE(hampus): This text was not simple. We have to do extra work. :(
+        // It's shaped one piece of a paragraph run at a time, and may go on
+        // into the next paragraph. A right-to-left run is shaped to its end
+        // even where the text turns simple, so that it's shaped in one go.
+
+        uint32_t run_begin = (uint32_t)(fallback_ptr - text);
+        uint32_t run_offset = run_begin;
+        uint32_t run_opl = run_begin + complex_mapped_length;
+        uint32_t mapping_opl = (uint32_t)(fallback_opl - text);
+        while(run_offset < run_opl)
+        {
+          if(paragraph_analysis_seek(&paragraph, scratch, backend, locale, text, text_length + lookahead_length, run_offset))
+          {
+            scratch_pos = arena_pos(scratch);
+          }
+          ShapingScriptRun run = *paragraph_analysis_run_at(&paragraph, run_offset);
+          uint32_t run_end = run.text_position + run.text_length;
+          uint32_t piece_opl = run.bidi_level != 0 ? mapping_opl : run_opl;
+          run.text_position = run_offset;
+          run.text_length = (run_end < piece_opl ? run_end : piece_opl) - run_offset;
+          run_offset += run.text_length;
+
+          if(segment != 0)
+          {
+            if(segment->bidi_level != run.bidi_level)
+            {
+              segment = 0;
+            }
+          }
+
+          if(segment == 0)
+          {
+            segment = push_segment(&result);
+            segment->font_id = mapping->font_id;
+            segment->font_size_em = font_size;
+            segment->bidi_level = run.bidi_level;
+            segment->text_offset = run.text_position;
+          }
+
+          const utf16_char *run_text = text + run.text_position;
+          uint32_t *run_cluster_map = result.cluster_map + (run_text - text);
+          uint64_t glyph_count = 0;
+          if(caches != 0 && caches->word_cache != 0)
+          {
+            glyph_count = shape_complex_run_with_word_cache(caches->word_cache, &result, scratch, backend, mapping->font_face, locale, locale_hash, font_size, &run.analysis, run.bidi_level, run_text, run.text_length, run_cluster_map);
+          }
+          else
+          {
+            bool is_right_to_left = (run.bidi_level & 1) != 0;
+            glyph_count = shape_complex_run(&result, scratch, backend, mapping->font_face, locale, font_size, &run.analysis, is_right_to_left, run_text, run.text_length, run_cluster_map);
+          }
+          segment->glyph_count += glyph_count;
+          segment->text_length += run.text_length;
+        }
+        complex_mapped_length = run_offset - run_begin;
+      }
+
+      fallback_ptr += complex_mapped_length;
+    }
+
+    arena_pop_to(scratch, scratch_pos);
+  }
+
+  //----------------------------------------------------------
+  // hampus: release the references font fallback gave us
+
+  // NOTE(hampus): The registry has taken its own reference by now.
+  for(MappedText *mapping = first_mapping; mapping != 0; mapping = mapping->next)
+  {
+    if(mapping->font_face != 0)
+    {
+      functions->release_font_face(mapping->font_face);
+    }
+  }
+
+  compute_segment_metrics(&result, flags);
+  if(flags & MapTextToGlyphsFlag_LineBreakpoints)
+  {
+    result.line_breakpoints = push_array_no_zero(result.arena, LineBreakpoint, text_length + lookahead_length);
+    functions->analyze_line_breakpoints(backend->state, locale, text, text_length + lookahead_length, result.line_breakpoints);
+  }
+
+  arena_pop_to(scratch, scratch_start_pos);
+  trace_end(map_text, TracePhase_MapTextToGlyphs, text_length, result.glyph_count);
+  return result;
+}
+
+static MapTextToGlyphsResult
+map_text_to_glyphs_with_scratch(Arena *arena, Arena *scratch, const ShapingBackend *backend, const utf16_char *locale, const utf16_char *base_family, const float font_size, const utf16_char *text, const uint32_t text_length, ShapingCaches *caches, uint32_t flags)
+{
+  return map_text_to_glyphs_with_lookahead(arena, scratch, backend, locale, base_family, font_size, text, text_length, 0, caches, flags);
+}
+
+static MapTextToGlyphsResult
+map_text_to_glyphs(const ShapingBackend *backend, const utf16_char *locale, const utf16_char *base_family, const float font_size, const utf16_char *text, const uint32_t text_length, ShapingCaches *caches = 0, uint32_t flags = 0, ShapingContext *context = 0)
+{
+  Arena *scratch = context != 0 ? context->scratch : arena_alloc();
+  MapTextToGlyphsResult result = map_text_to_glyphs_with_scratch(arena_alloc(), scratch, backend, locale, base_family, font_size, text, text_length, caches, flags);
+  if(context == 0)
+  {
+    arena_release(scratch);
+  }
+  return result;
+}
+
+static MapTextToGlyphsResult
+map_utf8_text_to_glyphs(const ShapingBackend *backend, const utf16_char *locale, const utf16_char *base_family, const float font_size, const char *text, const uint32_t text_size, ShapingCaches *caches = 0, uint32_t flags = 0, ShapingContext *context = 0)
+{
+  // NOTE(hampus): map_text_to_glyphs() for `text_size` bytes of UTF-8. The
+  // UTF-16 text only lives on the scratch arena while it's shaped, so pass
+  // a context to keep from allocating it every call. Everything in the
+  // result that indexes the text is still in UTF-16 code units, which
+  // MapTextToGlyphsFlag_Utf8Offsets gives the byte offsets of.
+  Arena *scratch = context != 0 ? context->scratch : arena_alloc();
+  uint64_t scratch_pos = arena_pos(scratch);
+  Arena *arena = arena_alloc();
+
+  trace_begin(utf16_from_utf8);
+  utf16_char *utf16_text = push_array_no_zero(scratch, utf16_char, text_size);
+  uint32_t *utf8_offsets = 0;
+  if(flags & MapTextToGlyphsFlag_Utf8Offsets)
+  {
+    utf8_offsets = push_array_no_zero(arena, uint32_t, text_size + 1);
+  }
+  uint32_t text_length = utf16_from_utf8(text, text_size, utf16_text, utf8_offsets);
+  if(utf8_offsets != 0)
+  {
+    // NOTE(hampus): Give back the room the offsets didn't need
+    arena_pop_to(arena, arena_pos(arena) - (text_size - text_length) * sizeof(uint32_t));
+  }
+  trace_end(utf16_from_utf8, TracePhase_Utf16FromUtf8, text_size, 0);
+
+  MapTextToGlyphsResult result = map_text_to_glyphs_with_scratch(arena, scratch, backend, locale, base_family, font_size, utf16_text, text_length, caches, flags);
+  result.utf8_offsets = utf8_offsets;
+
+  arena_pop_to(scratch, scratch_pos);
+  if(context == 0)
+  {
+    arena_release(scratch);
+  }
+  return result;
+}
+
+////////////////////////////////////////////////////////////
+// hampus: incremental re-shaping
+
+// NOTE(hampus): After an edit only the text around the edit has to be shaped
+// again. The edited range is widened to the closest safe boundary on each
+// side, that window is shaped, and its glyphs are spliced into the result in
+// place of the old ones. Only the glyphs of the segments that touch the
+// window are moved, into a gap left in the arrays after them, see
+// MapTextToGlyphsResult::glyph_gap_begin. The segments after the window still
+// get their text offsets shifted, and only the ones that touch the window get
+// their metrics summed up again.
+//
+// A boundary is safe when it starts a new cluster, is followed by a strong
+// left-to-right or right-to-left letter at its natural bidi level, and is
+// somewhere words end. That's after a space or tab, where the result's line
+// breakpoints allow a line break, or between two clusters of a script that
+// is written without spaces and shaped one cluster at a time, so that edits
+// in CJK or Thai text don't widen the window to the whole paragraph. The
+// bidi levels and fonts on either side then don't depend on the other side,
+// except that the end of the window has to see that letter, so it's shaped
+// with it as lookahead. Right-to-left text no longer widens the window to
+// the left-to-right text around it. Explicit embedding controls that are
+// still open at a boundary aren't detected.
+
+struct TextEdit
+{
+  // NOTE(hampus): [offset, offset + removed_length) of the original text is
+  // replaced by inserted_text.
+  uint32_t offset;
+  uint32_t removed_length;
+  const utf16_char *inserted_text;
+  uint32_t inserted_length;
+};
+
+static const TextToGlyphsSegment *
+segment_from_text_position(const MapTextToGlyphsResult *result, uint32_t text_position)
+{
+  // NOTE(hampus): Segments are sorted by text offset, so binary search for
+  // the last one that starts at or before the position.
+  const TextToGlyphsSegment *segment = 0;
+  uint64_t low = 0;
+  uint64_t high = result->segment_count;
+  while(low < high)
+  {
+    uint64_t mid = low + (high - low) / 2;
+    if(result->segments[mid].text_offset <= text_position)
+    {
+      low = mid + 1;
+    }
+    else
+    {
+      high = mid;
+    }
+  }
+  if(low > 0)
+  {
+    const TextToGlyphsSegment *candidate = &result->segments[low - 1];
+    if(text_position < candidate->text_offset + candidate->text_length)
+    {
+      segment = candidate;
+    }
+  }
+  return segment;
+}
+
+static uint64_t
+glyph_from_text_position(const MapTextToGlyphsResult *result, uint32_t text_position)
+{
+  // NOTE(hampus): An index into the glyph arrays, like the cluster map
+  uint64_t glyph = result->glyph_count + result->glyph_gap_length;
+  if(text_position < result->text_length)
+  {
+    glyph = result->cluster_map[text_array_index(result, text_position)];
+  }
+  return glyph;
+}
+
+static bool
+is_strong_bidi_character(utf16_char c, uint8_t *bidi_level)
+{
+  // NOTE(hampus): A conservative subset of the strong bidi classes, the
+  // letters of common scripts that are always L, or always R or AL. Anything
+  // else is taken to be weak or neutral, which only makes windows larger.
+  bool is_left_to_right = (('A' <= c && c <= 'Z') || ('a' <= c && c <= 'z') ||
+                           (0x00C0 <= c && c <= 0x024F && c != 0x00D7 && c != 0x00F7) ||
+                           (0x0388 <= c && c <= 0x03F5) ||
+                           (0x0400 <= c && c <= 0x0481) ||
+                           (0x0E01 <= c && c <= 0x0E2E) ||
+                           (0x0E40 <= c && c <= 0x0E44) ||
+                           (0x3041 <= c && c <= 0x3096) ||
+                           (0x30A1 <= c && c <= 0x30FA) ||
+                           (0x3400 <= c && c <= 0x4DBF) ||
+                           (0x4E00 <= c && c <= 0x9FFF) ||
+                           (0xAC00 <= c && c <= 0xD7A3));
+  bool is_right_to_left = ((0x05D0 <= c && c <= 0x05EA) ||
+                           (0x0620 <= c && c <= 0x064A) ||
+                           (0x066E <= c && c <= 0x066F) ||
+                           (0x0671 <= c && c <= 0x06D3));
+  *bidi_level = is_right_to_left ? 1 : 0;
+  return is_left_to_right || is_right_to_left;
+}
+
+static bool
+is_unspaced_cluster_boundary(utf16_char before, utf16_char after)
+{
+  // NOTE(hampus): Between ideographs or kana, or between two Thai clusters.
+  // A Thai cluster starts with a consonant or a leading vowel, and a
+  // leading vowel always goes with the consonant after it.
+  bool is_thai_before = (0x0E01 <= before && before <= 0x0E5B) && !(0x0E40 <= before && before <= 0x0E44);
+  bool is_thai_after = (0x0E01 <= after && after <= 0x0E2E) || (0x0E40 <= after && after <= 0x0E44);
+  return ((is_ideographic_for_line_breaking(before) && is_ideographic_for_line_breaking(after)) ||
+          (is_thai_before && is_thai_after));
+}
+
+static bool
+is_word_boundary_for_reshaping(const MapTextToGlyphsResult *result, const utf16_char *text, uint32_t text_position)
+{
+  bool is_boundary = (is_word_separator(text[text_position - 1]) ||
+                      is_unspaced_cluster_boundary(text[text_position - 1], text[text_position]));
+  if(!is_boundary && result->line_breakpoints != 0)
+  {
+    LineBreakpoint before = result->line_breakpoints[text_array_index(result, text_position - 1)];
+    LineBreakpoint after = result->line_breakpoints[text_array_index(result, text_position)];
+    is_boundary = line_break_condition_between(before, after) != LineBreakCondition_MayNotBreak;
+  }
+  return is_boundary;
+}
+
+static bool
+is_safe_reshape_boundary(const MapTextToGlyphsResult *result, const utf16_char *text, uint32_t text_position)
+{
+  if(text_position == 0 || text_position >= result->text_length)
+  {
+    return true;
+  }
+  uint8_t bidi_level = 0;
+  if(!is_word_boundary_for_reshaping(result, text, text_position) ||
+     glyph_from_text_position(result, text_position) == glyph_from_text_position(result, text_position - 1) ||
+     !is_strong_bidi_character(text[text_position], &bidi_level))
+  {
+    return false;
+  }
+  // NOTE(hampus): A letter that isn't at its natural level is inside an
+  // embedding, which the text on both sides of it is part of.
+  const TextToGlyphsSegment *segment = segment_from_text_position(result, text_position);
+  return segment != 0 && segment->bidi_level == bidi_level;
+}
+
+static void
+own_result_arrays(MapTextToGlyphsResult *result)
+{
+  // NOTE(hampus): Gives a result that borrows its glyph and text arrays, like
+  // a disk cache hit, copies of its own that can be edited in place.
+  if(result->text_capacity != 0)
+  {
+    return;
+  }
+  uint16_t *indices = push_array_no_zero(result->arena, uint16_t, result->glyph_count);
+  float *advances = push_array_no_zero(result->arena, float, result->glyph_count);
+  GlyphOffset *offsets = push_array_no_zero(result->arena, GlyphOffset, result->glyph_count);
+  memory_copy_typed(indices, result->glyph_indices, result->glyph_count);
+  memory_copy_typed(advances, result->glyph_advances, result->glyph_count);
+  memory_copy_typed(offsets, result->glyph_offsets, result->glyph_count);
+  result->glyph_indices = indices;
+  result->glyph_advances = advances;
+  result->glyph_offsets = offsets;
+  if(result->glyph_positions != 0)
+  {
+    float *positions = push_array_no_zero(result->arena, float, result->glyph_count);
+    memory_copy_typed(positions, result->glyph_positions, result->glyph_count);
+    result->glyph_positions = positions;
+  }
+  result->glyph_capacity = result->glyph_count;
+
+  uint32_t *cluster_map = push_array_no_zero(result->arena, uint32_t, result->text_length);
+  memory_copy_typed(cluster_map, result->cluster_map, result->text_length);
+  result->cluster_map = cluster_map;
+  if(result->line_breakpoints != 0)
+  {
+    LineBreakpoint *line_breakpoints = push_array_no_zero(result->arena, LineBreakpoint, result->text_length);
+    memory_copy_typed(line_breakpoints, result->line_breakpoints, result->text_length);
+    result->line_breakpoints = line_breakpoints;
+  }
+  result->text_capacity = result->text_length;
+}
+
+static void
+move_glyph_array_indices(MapTextToGlyphsResult *result, uint64_t begin_index, uint64_t end_index, int64_t shift)
+{
+  // NOTE(hampus): Moves the segments and the cluster map entries that point
+  // into [begin_index, end_index) of the glyph arrays by `shift`. Both are
+  // sorted by glyph, so the first one is found with a binary search and the
+  // rest are the ones right after it.
+  uint64_t low = 0;
+  uint64_t high = result->segment_count;
+  while(low < high)
+  {
+    uint64_t mid = low + (high - low) / 2;
+    if(result->segments[mid].first_glyph < begin_index)
+    {
+      low = mid + 1;
+    }
+    else
+    {
+      high = mid;
+    }
+  }
+  for(uint64_t segment_idx = low; segment_idx < result->segment_count && result->segments[segment_idx].first_glyph < end_index; ++segment_idx)
+  {
+    result->segments[segment_idx].first_glyph = (uint64_t)(result->segments[segment_idx].first_glyph + shift);
+  }
+
+  uint32_t text_low = 0;
+  uint32_t text_high = result->text_length;
+  while(text_low < text_high)
+  {
+    uint32_t mid = text_low + (text_high - text_low) / 2;
+    if(result->cluster_map[text_array_index(result, mid)] < begin_index)
+    {
+      text_low = mid + 1;
+    }
+    else
+    {
+      text_high = mid;
+    }
+  }
+  for(uint32_t text_position = text_low; text_position < result->text_length; ++text_position)
+  {
+    uint32_t *glyph = &result->cluster_map[text_array_index(result, text_position)];
+    if(*glyph >= end_index)
+    {
+      break;
+    }
+    *glyph = (uint32_t)(*glyph + shift);
+  }
+}
+
+static void
+move_glyph_arrays(MapTextToGlyphsResult *result, uint64_t dst_index, uint64_t src_index, uint64_t count)
+{
+  memory_move_typed(result->glyph_indices + dst_index, result->glyph_indices + src_index, count);
+  memory_move_typed(result->glyph_advances + dst_index, result->glyph_advances + src_index, count);
+  memory_move_typed(result->glyph_offsets + dst_index, result->glyph_offsets + src_index, count);
+  if(result->glyph_positions != 0)
+  {
+    memory_move_typed(result->glyph_positions + dst_index, result->glyph_positions + src_index, count);
+  }
+}
+
+static void
+move_glyph_gap(MapTextToGlyphsResult *result, uint64_t gap_begin)
+{
+  // NOTE(hampus): Moves the glyphs between the old and the new place of the
+  // gap over to the other side of it. Linear in the number of those glyphs.
+  uint64_t gap_length = result->glyph_gap_length;
+  uint64_t old_gap_begin = result->glyph_gap_begin;
+  if(gap_length != 0 && gap_begin < old_gap_begin)
+  {
+    move_glyph_arrays(result, gap_begin + gap_length, gap_begin, old_gap_begin - gap_begin);
+    move_glyph_array_indices(result, gap_begin, old_gap_begin, (int64_t)gap_length);
+  }
+  else if(gap_length != 0 && gap_begin > old_gap_begin)
+  {
+    move_glyph_arrays(result, old_gap_begin, old_gap_begin + gap_length, gap_begin - old_gap_begin);
+    move_glyph_array_indices(result, old_gap_begin + gap_length, gap_begin + gap_length, -(int64_t)gap_length);
+  }
+  result->glyph_gap_begin = gap_begin;
+}
+
+static void
+grow_glyph_gap(MapTextToGlyphsResult *result, uint64_t gap_length)
+{
+  // NOTE(hampus): Makes the gap at least `gap_length` glyphs long by moving
+  // the glyphs after it, growing the arrays by doubling if they are full.
+  // The whole unused part of the arrays becomes the gap.
+  uint64_t gap_begin = result->glyph_gap_begin;
+  uint64_t suffix_index = gap_begin + result->glyph_gap_length;
+  uint64_t suffix_count = result->glyph_count - gap_begin;
+  uint64_t needed = result->glyph_count + gap_length;
+  uint64_t capacity = result->glyph_capacity;
+  if(needed > capacity)
+  {
+    capacity = capacity * 2;
+    if(capacity < needed)
+    {
+      capacity = needed;
+    }
+    uint64_t new_suffix_index = capacity - suffix_count;
+    uint16_t *indices = push_array_no_zero(result->arena, uint16_t, capacity);
+    float *advances = push_array_no_zero(result->arena, float, capacity);
+    GlyphOffset *offsets = push_array_no_zero(result->arena, GlyphOffset, capacity);
+    memory_copy_typed(indices, result->glyph_indices, gap_begin);
+    memory_copy_typed(advances, result->glyph_advances, gap_begin);
+    memory_copy_typed(offsets, result->glyph_offsets, gap_begin);
+    memory_copy_typed(indices + new_suffix_index, result->glyph_indices + suffix_index, suffix_count);
+    memory_copy_typed(advances + new_suffix_index, result->glyph_advances + suffix_index, suffix_count);
+    memory_copy_typed(offsets + new_suffix_index, result->glyph_offsets + suffix_index, suffix_count);
+    result->glyph_indices = indices;
+    result->glyph_advances = advances;
+    result->glyph_offsets = offsets;
+    if(result->glyph_positions != 0)
+    {
+      float *positions = push_array_no_zero(result->arena, float, capacity);
+      memory_copy_typed(positions, result->glyph_positions, gap_begin);
+      memory_copy_typed(positions + new_suffix_index, result->glyph_positions + suffix_index, suffix_count);
+      result->glyph_positions = positions;
+    }
+    result->glyph_capacity = capacity;
+  }
+  else
+  {
+    move_glyph_arrays(result, capacity - suffix_count, suffix_index, suffix_count);
+  }
+
+  // NOTE(hampus): Text at the end that no font could map points one past the
+  // last glyph, which moves along with the glyphs after the gap.
+  uint64_t new_suffix_index = capacity - suffix_count;
+  move_glyph_array_indices(result, suffix_index, suffix_index + suffix_count + 1, (int64_t)new_suffix_index - (int64_t)suffix_index);
+  result->glyph_gap_length = capacity - result->glyph_count;
+}
+
+static void
+move_text_gap(MapTextToGlyphsResult *result, uint32_t gap_begin)
+{
+  uint32_t gap_length = result->text_gap_length;
+  uint32_t old_gap_begin = result->text_gap_begin;
+  if(gap_length != 0 && gap_begin != old_gap_begin)
+  {
+    uint32_t dst = gap_begin < old_gap_begin ? gap_begin + gap_length : old_gap_begin;
+    uint32_t src = gap_begin < old_gap_begin ? gap_begin : old_gap_begin + gap_length;
+    uint32_t count = gap_begin < old_gap_begin ? old_gap_begin - gap_begin : gap_begin - old_gap_begin;
+    memory_move_typed(result->cluster_map + dst, result->cluster_map + src, count);
+    if(result->line_breakpoints != 0)
+    {
+      memory_move_typed(result->line_breakpoints + dst, result->line_breakpoints + src, count);
+    }
+  }
+  result->text_gap_begin = gap_begin;
+}
+
+static void
+grow_text_gap(MapTextToGlyphsResult *result, uint32_t gap_length)
+{
+  uint32_t gap_begin = result->text_gap_begin;
+  uint32_t suffix_index = gap_begin + result->text_gap_length;
+  uint32_t suffix_length = result->text_length - gap_begin;
+  uint32_t needed = result->text_length + gap_length;
+  uint32_t capacity = result->text_capacity;
+  if(needed > capacity)
+  {
+    capacity = capacity * 2;
+    if(capacity < needed)
+    {
+      capacity = needed;
+    }
+    uint32_t *cluster_map = push_array_no_zero(result->arena, uint32_t, capacity);
+    memory_copy_typed(cluster_map, result->cluster_map, gap_begin);
+    memory_copy_typed(cluster_map + capacity - suffix_length, result->cluster_map + suffix_index, suffix_length);
+    result->cluster_map = cluster_map;
+    if(result->line_breakpoints != 0)
+    {
+      LineBreakpoint *line_breakpoints = push_array_no_zero(result->arena, LineBreakpoint, capacity);
+      memory_copy_typed(line_breakpoints, result->line_breakpoints, gap_begin);
+      memory_copy_typed(line_breakpoints + capacity - suffix_length, result->line_breakpoints + suffix_index, suffix_length);
+      result->line_breakpoints = line_breakpoints;
+    }
+    result->text_capacity = capacity;
+  }
+  else
+  {
+    memory_move_typed(result->cluster_map + capacity - suffix_length, result->cluster_map + suffix_index, suffix_length);
+    if(result->line_breakpoints != 0)
+    {
+      memory_move_typed(result->line_breakpoints + capacity - suffix_length, result->line_breakpoints + suffix_index, suffix_length);
+    }
+  }
+  result->text_gap_length = capacity - result->text_length;
+}
+
+static void
+close_text_to_glyphs_gaps(MapTextToGlyphsResult *result)
+{
+  // NOTE(hampus): Moves the gaps edits leave in the arrays to the end and
+  // drops them, so the glyph arrays are [0, glyph_count) and the text arrays
+  // [0, text_length) again, for code that walks them from start to end, like
+  // line_wrapper_alloc() and the disk cache. Linear in the number of glyphs
+  // and code units after the gaps.
+  move_glyph_gap(result, result->glyph_count);
+  uint64_t opl_index = result->glyph_count + result->glyph_gap_length;
+  move_glyph_array_indices(result, opl_index, opl_index + 1, -(int64_t)result->glyph_gap_length);
+  result->glyph_gap_begin = 0;
+  result->glyph_gap_length = 0;
+
+  move_text_gap(result, result->text_length);
+  result->text_gap_begin = 0;
+  result->text_gap_length = 0;
+}
+
+static void
+push_segment_piece(TextToGlyphsSegment *pieces, uint64_t *piece_count, const TextToGlyphsSegment *src, uint32_t text_offset, uint32_t text_length, uint64_t first_glyph, uint64_t glyph_count)
+{
+  // NOTE(hampus): Merges the piece into the previous one when the two are
+  // really one run that was split by the re-shaping window.
+  if(text_length == 0 && glyph_count == 0)
+  {
+    return;
+  }
+  TextToGlyphsSegment *last = *piece_count != 0 ? &pieces[*piece_count - 1] : 0;
+  if(last != 0 &&
+     last->font_id == src->font_id &&
+     last->font_size_em == src->font_size_em &&
+     last->bidi_level == src->bidi_level &&
+     last->first_glyph + last->glyph_count == first_glyph &&
+     last->text_offset + last->text_length == text_offset)
+  {
+    last->glyph_count += glyph_count;
+    last->text_length += text_length;
+  }
+  else
+  {
+    TextToGlyphsSegment *piece = &pieces[*piece_count];
+    *piece_count += 1;
+    *piece = *src;
+    piece->text_offset = text_offset;
+    piece->text_length = text_length;
+    piece->first_glyph = first_glyph;
+    piece->glyph_count = glyph_count;
+  }
+}
+
+static void
+push_segment_pieces_in_text_range(TextToGlyphsSegment *pieces, uint64_t *piece_count, const MapTextToGlyphsResult *src, uint64_t first_segment, uint64_t opl_segment, uint32_t text_begin, uint32_t text_end, int64_t text_shift, int64_t glyph_shift)
+{
+  // NOTE(hampus): The parts of src's segments that fall inside
+  // [text_begin, text_end), moved by text_shift and glyph_shift. Glyphs are
+  // counted without src's glyph gap, see glyph_from_array_index().
+  for(uint64_t segment_idx = first_segment; segment_idx < opl_segment; ++segment_idx)
+  {
+    const TextToGlyphsSegment *segment = &src->segments[segment_idx];
+    uint32_t begin = segment->text_offset;
+    uint32_t end = segment->text_offset + segment->text_length;
+    if(begin < text_begin)
+    {
+      begin = text_begin;
+    }
+    if(end > text_end)
+    {
+      end = text_end;
+    }
+    if(begin >= end)
+    {
+      continue;
+    }
+    uint64_t segment_first_glyph = glyph_from_array_index(src, segment->first_glyph);
+    uint64_t first_glyph = begin == segment->text_offset ? segment_first_glyph : glyph_from_array_index(src, glyph_from_text_position(src, begin));
+    uint64_t opl_glyph = end == segment->text_offset + segment->text_length ? segment_first_glyph + segment->glyph_count : glyph_from_array_index(src, glyph_from_text_position(src, end));
+    push_segment_piece(pieces, piece_count, segment, (uint32_t)(begin + text_shift), end - begin, first_glyph + glyph_shift, opl_glyph - first_glyph);
+  }
+}
+
+static void
+remap_text_to_glyphs_after_edit(MapTextToGlyphsResult *result, const ShapingBackend *backend, const utf16_char *locale, const utf16_char *base_family, const float font_size, const utf16_char *text, const uint32_t text_length, const TextEdit *edit, ShapingCaches *caches = 0, uint32_t flags = 0, ShapingContext *context = 0)
+{
+  // NOTE(hampus): `result` must be the result of shaping `text` with the
+  // same backend, font settings and flags, and is turned into the result
+  // for the edited text. UTF-8 offsets don't survive the edit.
+
+  ASSERT(result->text_length == text_length);
+  ASSERT(result->font_registry == backend->font_registry);
+  ASSERT(edit->offset + edit->removed_length <= text_length);
+  ASSERT(((flags & MapTextToGlyphsFlag_GlyphPositions) != 0) == (result->glyph_positions != 0));
+  ASSERT(((flags & MapTextToGlyphsFlag_LineBreakpoints) != 0) == (result->line_breakpoints != 0));
+
+  //----------------------------------------------------------
+  // hampus: find the window in the original text
+
+  uint32_t window_begin = edit->offset;
+  if(window_begin > 0)
+  {
+    // NOTE(hampus): Always take at least the character before the edit,
+    // since the inserted text may join up with it.
+    window_begin -= 1;
+  }
+  while(!is_safe_reshape_boundary(result, text, window_begin))
+  {
+    window_begin -= 1;
+  }
+
+  uint32_t window_end = edit->offset + edit->removed_length;
+  if(window_end < text_length)
+  {
+    window_end += 1;
+  }
+  while(!is_safe_reshape_boundary(result, text, window_end))
+  {
+    window_end += 1;
+  }
+
+  //----------------------------------------------------------
+  // hampus: build the edited text of the window and shape it
+
+  Arena *scratch = context != 0 ? context->scratch : arena_alloc();
+  Arena *window_arena = context != 0 ? context->window_arena : arena_alloc();
+  uint64_t scratch_pos = arena_pos(scratch);
+  uint64_t window_arena_pos = arena_pos(window_arena);
+
+  // NOTE(hampus): The letter after the window goes along as lookahead,
+  // including the low half of a surrogate pair.
+  uint32_t lookahead_length = 0;
+  if(window_end < text_length)
+  {
+    lookahead_length = (window_end + 1 < text_length && 0xD800 <= text[window_end] && text[window_end] <= 0xDBFF) ? 2 : 1;
+  }
+
+  uint32_t prefix_length = edit->offset - window_begin;
+  uint32_t suffix_length = window_end - (edit->offset + edit->removed_length);
+  uint32_t window_length = prefix_length + edit->inserted_length + suffix_length;
+  utf16_char *window_text = push_array_no_zero(scratch, utf16_char, window_length + lookahead_length);
+  memory_copy_typed(window_text, text + window_begin, prefix_length);
+  memory_copy_typed(window_text + prefix_length, edit->inserted_text, edit->inserted_length);
+  memory_copy_typed(window_text + prefix_length + edit->inserted_length, text + edit->offset + edit->removed_length, suffix_length + lookahead_length);
+
+  MapTextToGlyphsResult window = map_text_to_glyphs_with_lookahead(window_arena, scratch, backend, locale, base_family, font_size, window_text, window_length, lookahead_length, caches, flags & MapTextToGlyphsFlag_LineBreakpoints);
+
+  //----------------------------------------------------------
+  // hampus: cut the segments that touch the window up
+
+  // NOTE(hampus): Glyphs here are counted without the gap, see
+  // glyph_from_array_index().
+  int64_t text_shift = (int64_t)window_length - (int64_t)(window_end - window_begin);
+  uint64_t window_first_glyph = glyph_from_array_index(result, glyph_from_text_position(result, window_begin));
+  uint64_t window_opl_glyph = glyph_from_array_index(result, glyph_from_text_position(result, window_end));
+  int64_t glyph_shift = (int64_t)window.glyph_count - (int64_t)(window_opl_glyph - window_first_glyph);
+
+  // NOTE(hampus): [first_segment, opl_segment) are the segments that touch
+  // the window, including the ones that end or start right at its edges,
+  // since those may join up with the window's segments.
+  uint64_t low = 0;
+  uint64_t high = result->segment_count;
+  while(low < high)
+  {
+    uint64_t mid = low + (high - low) / 2;
+    if(result->segments[mid].text_offset + result->segments[mid].text_length < window_begin)
+    {
+      low = mid + 1;
+    }
+    else
+    {
+      high = mid;
+    }
+  }
+  uint64_t first_segment = low;
+  high = result->segment_count;
+  while(low < high)
+  {
+    uint64_t mid = low + (high - low) / 2;
+    if(result->segments[mid].text_offset <= window_end)
+    {
+      low = mid + 1;
+    }
+    else
+    {
+      high = mid;
+    }
+  }
+  uint64_t opl_segment = low;
+
+  // NOTE(hampus): The glyphs of the segments that touch the window are the
+  // only ones that get moved, so they end where the gap is put.
+  uint64_t touched_opl_glyph = window_opl_glyph;
+  if(opl_segment > first_segment)
+  {
+    const TextToGlyphsSegment *last_segment = &result->segments[opl_segment - 1];
+    uint64_t last_opl_glyph = glyph_from_array_index(result, last_segment->first_glyph) + last_segment->glyph_count;
+    if(last_opl_glyph > touched_opl_glyph)
+    {
+      touched_opl_glyph = last_opl_glyph;
+    }
+  }
+
+  uint64_t piece_count = 0;
+  TextToGlyphsSegment *pieces = push_array_no_zero(scratch, TextToGlyphsSegment, (opl_segment - first_segment) + 1 + window.segment_count);
+  push_segment_pieces_in_text_range(pieces, &piece_count, result, first_segment, opl_segment, 0, window_begin, 0, 0);
+  push_segment_pieces_in_text_range(pieces, &piece_count, &window, 0, window.segment_count, 0, window_length, window_begin, (int64_t)window_first_glyph);
+  push_segment_pieces_in_text_range(pieces, &piece_count, result, first_segment, opl_segment, window_end, text_length, text_shift, glyph_shift);
+
+  //----------------------------------------------------------
+  // hampus: splice the window's glyphs in
+
+  // NOTE(hampus): With the gap right after the touched segments, the glyphs
+  // before it are where their logical index says, and the ones after it
+  // don't move at all, so only the touched segments' cluster map entries
+  // and first glyphs need fixing up.
+  own_result_arrays(result);
+  move_glyph_gap(result, touched_opl_glyph);
+  if(glyph_shift > 0 && (uint64_t)glyph_shift > result->glyph_gap_length)
+  {
+    grow_glyph_gap(result, (uint64_t)glyph_shift);
+  }
+  move_glyph_array_indices(result, window_opl_glyph, touched_opl_glyph, glyph_shift);
+
+  uint64_t tail_glyph_count = touched_opl_glyph - window_opl_glyph;
+  uint64_t tail_first_glyph = window_first_glyph + window.glyph_count;
+  move_glyph_arrays(result, tail_first_glyph, window_opl_glyph, tail_glyph_count);
+  memory_copy_typed(result->glyph_indices + window_first_glyph, window.glyph_indices, window.glyph_count);
+  memory_copy_typed(result->glyph_advances + window_first_glyph, window.glyph_advances, window.glyph_count);
+  memory_copy_typed(result->glyph_offsets + window_first_glyph, window.glyph_offsets, window.glyph_count);
+  uint64_t old_first_index = glyph_array_index(result, window_first_glyph);
+  result->glyph_gap_begin = tail_first_glyph + tail_glyph_count;
+  result->glyph_gap_length = (uint64_t)((int64_t)result->glyph_gap_length - glyph_shift);
+  result->glyph_count = (uint64_t)((int64_t)result->glyph_count + glyph_shift);
+
+  //----------------------------------------------------------
+  // hampus: splice the window's text arrays in
+
+  // NOTE(hampus): The window was analyzed on its own, so its first character
+  // looks like the start of a text. That character and the space before it
+  // haven't changed, so it keeps the condition it had before the edit.
+  uint8_t break_condition_before = 0;
+  if(result->line_breakpoints != 0 && window_begin > 0)
+  {
+    break_condition_before = result->line_breakpoints[text_array_index(result, window_begin)].break_condition_before;
+  }
+
+  move_text_gap(result, window_end);
+  if(text_shift > 0 && (uint32_t)text_shift > result->text_gap_length)
+  {
+    grow_text_gap(result, (uint32_t)text_shift);
+  }
+  for(uint32_t idx = 0; idx < window_length; ++idx)
+  {
+    result->cluster_map[window_begin + idx] = (uint32_t)glyph_array_index(result, window.cluster_map[idx] + window_first_glyph);
+  }
+
+  // NOTE(hampus): Text right before the window that no font could map points
+  // at the window's first glyph, which is after the gap now if the window and
+  // the rest of its segment have no glyphs left.
+  uint64_t new_first_index = glyph_array_index(result, window_first_glyph);
+  for(uint32_t text_position = window_begin; text_position > 0 && result->cluster_map[text_position - 1] == old_first_index && new_first_index != old_first_index; --text_position)
+  {
+    result->cluster_map[text_position - 1] = (uint32_t)new_first_index;
+  }
+
+  if(result->line_breakpoints != 0)
+  {
+    memory_copy_typed(result->line_breakpoints + window_begin, window.line_breakpoints, window_length);
+    if(window_begin > 0)
+    {
+      result->line_breakpoints[window_begin].break_condition_before = break_condition_before;
+    }
+  }
+  result->text_gap_begin = window_begin + window_length;
+  result->text_gap_length = (uint32_t)((int64_t)result->text_gap_length - text_shift);
+  result->text_length = (uint32_t)(text_length + text_shift);
+  result->utf8_offsets = 0;
+
+  //----------------------------------------------------------
+  // hampus: splice the window's segments in
+
+  uint64_t segment_count = result->segment_count - (opl_segment - first_segment) + piece_count;
+  if(segment_count > result->segment_capacity)
+  {
+    uint64_t capacity = result->segment_capacity * 2;
+    if(capacity < segment_count)
+    {
+      capacity = segment_count;
+    }
+    TextToGlyphsSegment *segments = push_array_no_zero(result->arena, TextToGlyphsSegment, capacity);
+    memory_copy_typed(segments, result->segments, first_segment);
+    memory_copy_typed(segments + first_segment + piece_count, result->segments + opl_segment, result->segment_count - opl_segment);
+    result->segments = segments;
+    result->segment_capacity = capacity;
+  }
+  else
+  {
+    memory_move_typed(result->segments + first_segment + piece_count, result->segments + opl_segment, result->segment_count - opl_segment);
+  }
+  // NOTE(hampus): The glyphs after the gap didn't move, but the text after
+  // the window did.
+  for(uint64_t segment_idx = first_segment + piece_count; segment_idx < segment_count; ++segment_idx)
+  {
+    result->segments[segment_idx].text_offset = (uint32_t)(result->segments[segment_idx].text_offset + text_shift);
+  }
+  memory_copy_typed(result->segments + first_segment, pieces, piece_count);
+  result->segment_count = segment_count;
+  compute_segment_range_metrics(result, first_segment, first_segment + piece_count);
+
+  shaping_font_registry_release(window.font_registry);
+  if(context != 0)
+  {
+    arena_pop_to(window_arena, window_arena_pos);
+    arena_pop_to(scratch, scratch_pos);
+  }
+  else
+  {
+    arena_release(window_arena);
+    arena_release(scratch);
+  }
+}
+
+////////////////////////////////////////////////////////////
+// hampus: streaming
+
+// NOTE(hampus): Shapes text of any size with a fixed amount of memory. Text is
+// pulled from `read` into a buffer of window_capacity code units. Each window
+// is cut after the last paragraph separator in the buffer, or after the last
+// space if a paragraph doesn't fit, and then shaped on its own. A cut never
+// splits a grapheme cluster, so a combining mark or the rest of an emoji ZWJ
+// sequence always stays with its base. Every segment
+// of the window is handed to `emit` as soon as the window is done. The
+// segment and the window result are only valid during the callback. The
+// window result's arena and the scratch arena are popped and reused for the
+// next window, so after the first few windows nothing new is allocated, and
+// with a context nothing at all once it has seen a window of that size.
+
+// NOTE(hampus): Reads at most `capacity` code units into `buffer` and returns
+// how many were read. 0 means the end of the text.
+typedef uint32_t TextStreamReadFunction(void *user_data, utf16_char *buffer, uint32_t capacity);
+
+// NOTE(hampus): window_text_offset is where the window starts in the whole
+// stream. The segment's text_offset is relative to the window.
+typedef void TextToGlyphsSegmentCallback(void *user_data, const MapTextToGlyphsResult *window, const TextToGlyphsSegment *segment, uint64_t window_text_offset);
+
+static bool
+is_stream_window_cluster_boundary(const utf16_char *buffer, uint32_t length, uint32_t idx)
+{
+  // NOTE(hampus): Whether a window may end before buffer[idx] without
+  // splitting a grapheme cluster: not inside a surrogate pair, not before a
+  // combining mark, variation selector, skin tone or other extender, and not
+  // right after a zero width joiner. What comes after the buffer isn't known
+  // yet, so the very end never counts.
+  bool result = false;
+  if(0 < idx && idx < length)
+  {
+    uint32_t codepoint = 0;
+    decode_utf16(buffer + idx, length - idx, &codepoint);
+    utf16_char before = buffer[idx - 1];
+    result = !(0xDC00 <= buffer[idx] && buffer[idx] <= 0xDFFF) &&
+             !is_cluster_extender(codepoint) &&
+             before != 0x200D;
+  }
+  return result;
+}
+
+static uint32_t
+stream_window_cut(const utf16_char *buffer, uint32_t length)
+{
+  // NOTE(hampus): A line can't run across a paragraph separator, so after
+  // one is always a cluster boundary too. A lone \r at the very end might
+  // be the first half of a \r\n, so it is left for the next window.
+  for(uint32_t idx = length; idx > 0; --idx)
+  {
+    utf16_char c = buffer[idx - 1];
+    if(is_paragraph_separator(c) && !(c == '\r' && idx == length))
+    {
+      return idx;
+    }
+  }
+  for(uint32_t idx = length - 1; idx > 0; --idx)
+  {
+    if(is_word_separator(buffer[idx - 1]) && is_stream_window_cluster_boundary(buffer, length, idx))
+    {
+      return idx;
+    }
+  }
+
+  // NOTE(hampus): One enormous word. Cut where a line may break, after a
+  // hyphen or around an ideograph, and failing that between any two
+  // clusters.
+  for(uint32_t idx = length - 1; idx > 0; --idx)
+  {
+    utf16_char before = buffer[idx - 1];
+    bool is_line_break = (before == '-' || before == 0x2010 || before == 0x2013 || before == 0x00AD ||
+                          is_ideographic_for_line_breaking(before) ||
+                          is_ideographic_for_line_breaking(buffer[idx]));
+    if(is_line_break && is_stream_window_cluster_boundary(buffer, length, idx))
+    {
+      return idx;
+    }
+  }
+  for(uint32_t idx = length - 1; idx > 0; --idx)
+  {
+    if(is_stream_window_cluster_boundary(buffer, length, idx))
+    {
+      return idx;
+    }
+  }
+
+  // NOTE(hampus): The whole buffer is one cluster, at least don't split a
+  // surrogate pair
+  uint32_t cut = length;
+  if(0xD800 <= buffer[cut - 1] && buffer[cut - 1] <= 0xDBFF && cut > 1)
+  {
+    cut -= 1;
+  }
+  return cut;
+}
+
+static void
+map_text_stream_to_glyphs(const ShapingBackend *backend, const utf16_char *locale, const utf16_char *base_family, const float font_size, TextStreamReadFunction *read, void *read_user_data, TextToGlyphsSegmentCallback *emit, void *emit_user_data, uint32_t window_capacity = 1 << 16, ShapingCaches *caches = 0, uint32_t flags = 0, ShapingContext *context = 0)
+{
+  Arena *window_arena = context != 0 ? context->window_arena : arena_alloc();
+  Arena *scratch = context != 0 ? context->scratch : arena_alloc();
+  uint64_t window_arena_pos = arena_pos(window_arena);
+  uint64_t scratch_pos = arena_pos(scratch);
+
+  // NOTE(hampus): The buffer lives on the scratch arena below everything a
+  // window pushes
+  utf16_char *buffer = push_array_no_zero(scratch, utf16_char, window_capacity);
+  uint32_t buffer_length = 0;
+  uint64_t stream_offset = 0;
+  bool end_of_stream = false;
+
+  for(;;)
+  {
+    // hampus: fill up the buffer
+
+    while(!end_of_stream && buffer_length < window_capacity)
+    {
+      uint32_t read_length = read(read_user_data, buffer + buffer_length, window_capacity - buffer_length);
+      if(read_length == 0)
+      {
+        end_of_stream = true;
+      }
+      buffer_length += read_length;
+    }
+
+    if(buffer_length == 0)
+    {
+      break;
+    }
+
+    // hampus: shape one window
+
+    uint32_t window_length = end_of_stream ? buffer_length : stream_window_cut(buffer, buffer_length);
+    MapTextToGlyphsResult window = map_text_to_glyphs_with_scratch(window_arena, scratch, backend, locale, base_family, font_size, buffer, window_length, caches, flags);
+    for(uint64_t segment_idx = 0; segment_idx < window.segment_count; ++segment_idx)
+    {
+      emit(emit_user_data, &window, &window.segments[segment_idx], stream_offset);
+    }
+
+    // hampus: recycle the window's memory
+
+    shaping_font_registry_release(window.font_registry);
+    arena_pop_to(window_arena, window_arena_pos);
+
+    memmove(buffer, buffer + window_length, (buffer_length - window_length) * sizeof(utf16_char));
+    buffer_length -= window_length;
+    stream_offset += window_length;
+  }
+
+  if(context != 0)
+  {
+    arena_pop_to(scratch, scratch_pos);
+    arena_pop_to(window_arena, window_arena_pos);
+  }
+  else
+  {
+    arena_release(scratch);
+    arena_release(window_arena);
+  }
+}
+
+////////////////////////////////////////////////////////////
+// hampus: threads
+
+// NOTE(hampus): Just what the batch shaper and the backends need, on top of
+// Win32 or pthreads.
+
+typedef void OS_ThreadFunction(void *parameter);
+
+#if defined(_WIN32)
+
+struct OS_Thread
+{
+  HANDLE handle;
+  OS_ThreadFunction *function;
+  void *parameter;
+};
+
+struct OS_Event
+{
+  HANDLE handle;
+};
+
+struct OS_Mutex
+{
+  SRWLOCK lock;
+};
+
+static DWORD WINAPI
+os_thread_entry_point(void *parameter)
+{
+  OS_Thread *thread = (OS_Thread *)parameter;
+  thread->function(thread->parameter);
+  return 0;
+}
+
+static OS_Thread *
+os_thread_launch(OS_ThreadFunction *function, void *parameter)
+{
+  OS_Thread *thread = (OS_Thread *)memory_alloc_zero(sizeof(OS_Thread));
+  thread->function = function;
+  thread->parameter = parameter;
+  thread->handle = CreateThread(0, 0, os_thread_entry_point, thread, 0, 0);
+  ASSERT(thread->handle != 0);
+  return thread;
+}
+
+static void
+os_thread_join(OS_Thread *thread)
+{
+  WaitForSingleObject(thread->handle, INFINITE);
+  CloseHandle(thread->handle);
+  memory_free(thread);
+}
+
+static OS_Event *
+os_event_alloc(void)
+{
+  // NOTE(hampus): Auto reset, a wait consumes the signal
+  OS_Event *event = (OS_Event *)memory_alloc_zero(sizeof(OS_Event));
+  event->handle = CreateEventW(0, FALSE, FALSE, 0);
+  return event;
+}
+
+static void
+os_event_release(OS_Event *event)
+{
+  CloseHandle(event->handle);
+  memory_free(event);
+}
+
+static void
+os_event_signal(OS_Event *event)
+{
+  SetEvent(event->handle);
+}
+
+static void
+os_event_wait(OS_Event *event)
+{
+  WaitForSingleObject(event->handle, INFINITE);
+}
+
+static void
+os_mutex_init(OS_Mutex *mutex)
+{
+  InitializeSRWLock(&mutex->lock);
+}
+
+static void
+os_mutex_destroy(OS_Mutex *mutex)
+{
+}
+
+static void
+os_mutex_lock(OS_Mutex *mutex)
+{
+  AcquireSRWLockExclusive(&mutex->lock);
+}
+
+static void
+os_mutex_unlock(OS_Mutex *mutex)
+{
+  ReleaseSRWLockExclusive(&mutex->lock);
+}
+
+static void
+os_thread_yield(void)
+{
+  SwitchToThread();
+}
+
+static uint32_t
+os_logical_processor_count(void)
+{
+  SYSTEM_INFO system_info = {};
+  GetSystemInfo(&system_info);
+  return system_info.dwNumberOfProcessors;
+}
+
+static uint64_t
+os_now_ns(void)
+{
+  LARGE_INTEGER frequency = {};
+  LARGE_INTEGER counter = {};
+  QueryPerformanceFrequency(&frequency);
+  QueryPerformanceCounter(&counter);
+  uint64_t seconds = (uint64_t)counter.QuadPart / (uint64_t)frequency.QuadPart;
+  uint64_t remainder = (uint64_t)counter.QuadPart % (uint64_t)frequency.QuadPart;
+  return seconds * 1000000000ull + (remainder * 1000000000ull) / (uint64_t)frequency.QuadPart;
+}
+
+static uint64_t
+atomic_u64_compare_exchange(volatile uint64_t *value, uint64_t exchange, uint64_t comparand)
+{
+  return (uint64_t)InterlockedCompareExchange64((volatile LONGLONG *)value, (LONGLONG)exchange, (LONGLONG)comparand);
+}
+
+static void
+atomic_u64_store(volatile uint64_t *value, uint64_t new_value)
+{
+  InterlockedExchange64((volatile LONGLONG *)value, (LONGLONG)new_value);
+}
+
+static int32_t
+atomic_s32_increment(volatile int32_t *value)
+{
+  return (int32_t)InterlockedIncrement((volatile LONG *)value);
+}
+
+static int32_t
+atomic_s32_decrement(volatile int32_t *value)
+{
+  return (int32_t)InterlockedDecrement((volatile LONG *)value);
+}
+
+// NOTE(hampus): The interlocked functions are full barriers, which is at
+// least as strong as acquire and release.
+
+static uint64_t
+atomic_u64_load_acquire(volatile uint64_t *value)
+{
+  return (uint64_t)InterlockedCompareExchange64((volatile LONGLONG *)value, 0, 0);
+}
+
+static void
+atomic_u64_store_release(volatile uint64_t *value, uint64_t new_value)
+{
+  InterlockedExchange64((volatile LONGLONG *)value, (LONGLONG)new_value);
+}
+
+static int32_t
+atomic_s32_load_acquire(volatile int32_t *value)
+{
+  return (int32_t)InterlockedCompareExchange((volatile LONG *)value, 0, 0);
+}
+
+static void
+atomic_s32_store_release(volatile int32_t *value, int32_t new_value)
+{
+  InterlockedExchange((volatile LONG *)value, (LONG)new_value);
+}
+
+#else
+
+struct OS_Thread
+{
+  pthread_t handle;
+  OS_ThreadFunction *function;
+  void *parameter;
+};
+
+struct OS_Event
+{
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  bool is_signaled;
+};
+
+struct OS_Mutex
+{
+  pthread_mutex_t mutex;
+};
+
+static void *
+os_thread_entry_point(void *parameter)
+{
+  OS_Thread *thread = (OS_Thread *)parameter;
+  thread->function(thread->parameter);
+  return 0;
+}
+
+static OS_Thread *
+os_thread_launch(OS_ThreadFunction *function, void *parameter)
+{
+  OS_Thread *thread = (OS_Thread *)memory_alloc_zero(sizeof(OS_Thread));
+  thread->function = function;
+  thread->parameter = parameter;
+  int error = pthread_create(&thread->handle, 0, os_thread_entry_point, thread);
+  ASSERT(error == 0);
+  return thread;
+}
+
+static void
+os_thread_join(OS_Thread *thread)
+{
+  pthread_join(thread->handle, 0);
+  memory_free(thread);
+}
+
+static OS_Event *
+os_event_alloc(void)
+{
+  // NOTE(hampus): Auto reset, a wait consumes the signal
+  OS_Event *event = (OS_Event *)memory_alloc_zero(sizeof(OS_Event));
+  pthread_mutex_init(&event->mutex, 0);
+  pthread_cond_init(&event->cond, 0);
+  return event;
+}
+
+static void
+os_event_release(OS_Event *event)
+{
+  pthread_cond_destroy(&event->cond);
+  pthread_mutex_destroy(&event->mutex);
+  memory_free(event);
+}
+
+static void
+os_event_signal(OS_Event *event)
+{
+  pthread_mutex_lock(&event->mutex);
+  event->is_signaled = true;
+  pthread_cond_signal(&event->cond);
+  pthread_mutex_unlock(&event->mutex);
+}
+
+static void
+os_event_wait(OS_Event *event)
+{
+  pthread_mutex_lock(&event->mutex);
+  while(!event->is_signaled)
+  {
+    pthread_cond_wait(&event->cond, &event->mutex);
+  }
+  event->is_signaled = false;
+  pthread_mutex_unlock(&event->mutex);
+}
+
+static void
+os_mutex_init(OS_Mutex *mutex)
+{
+  pthread_mutex_init(&mutex->mutex, 0);
+}
+
+static void
+os_mutex_destroy(OS_Mutex *mutex)
+{
+  pthread_mutex_destroy(&mutex->mutex);
+}
+
+static void
+os_mutex_lock(OS_Mutex *mutex)
+{
+  pthread_mutex_lock(&mutex->mutex);
+}
+
+static void
+os_mutex_unlock(OS_Mutex *mutex)
+{
+  pthread_mutex_unlock(&mutex->mutex);
+}
+
+static void
+os_thread_yield(void)
+{
+  sched_yield();
+}
+
+static uint32_t
+os_logical_processor_count(void)
+{
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+  return count > 0 ? (uint32_t)count : 1;
+}
+
+static uint64_t
+os_now_ns(void)
+{
+  struct timespec ts = {};
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t
+atomic_u64_compare_exchange(volatile uint64_t *value, uint64_t exchange, uint64_t comparand)
+{
+  __atomic_compare_exchange_n(value, &comparand, exchange, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+  return comparand;
+}
+
+static void
+atomic_u64_store(volatile uint64_t *value, uint64_t new_value)
+{
+  __atomic_store_n(value, new_value, __ATOMIC_SEQ_CST);
+}
+
+static int32_t
+atomic_s32_increment(volatile int32_t *value)
+{
+  return __atomic_add_fetch(value, 1, __ATOMIC_SEQ_CST);
+}
+
+static int32_t
+atomic_s32_decrement(volatile int32_t *value)
+{
+  return __atomic_sub_fetch(value, 1, __ATOMIC_SEQ_CST);
+}
+
+static uint64_t
+atomic_u64_load_acquire(volatile uint64_t *value)
+{
+  return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+static void
+atomic_u64_store_release(volatile uint64_t *value, uint64_t new_value)
+{
+  __atomic_store_n(value, new_value, __ATOMIC_RELEASE);
+}
+
+static int32_t
+atomic_s32_load_acquire(volatile int32_t *value)
+{
+  return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+static void
+atomic_s32_store_release(volatile int32_t *value, int32_t new_value)
+{
+  __atomic_store_n(value, new_value, __ATOMIC_RELEASE);
+}
+
+#endif
+
+////////////////////////////////////////////////////////////
+// hampus: font registry implementation
+
+#define SHAPING_FONT_REGISTRY_PAGE_SIZE 256
+#define SHAPING_FONT_REGISTRY_MAX_FONT_COUNT 65536
+#define SHAPING_FONT_REGISTRY_PAGE_COUNT (SHAPING_FONT_REGISTRY_MAX_FONT_COUNT / SHAPING_FONT_REGISTRY_PAGE_SIZE)
+
+struct ShapingFontRegistry
+{
+  volatile int32_t reference_count;
+  const ShapingBackendFunctions *backend_functions;
+
+  // NOTE(hampus): Guards everything below. A page entry is written once,
+  // before its ID is handed out, and never changes after that, so lookups
+  // by ID don't need the lock.
+  OS_Mutex mutex;
+  uint32_t font_count;
+  ShapingFontInfo *pages[SHAPING_FONT_REGISTRY_PAGE_COUNT];
+
+  // NOTE(hampus): Open addressed on the face pointer. Each slot holds
+  // ID + 1, or 0 when empty.
+  uint32_t slot_count;
+  uint32_t *slots;
+};
+
+static ShapingFontRegistry *
+shaping_font_registry_alloc(const ShapingBackendFunctions *backend_functions)
+{
+  ShapingFontRegistry *registry = (ShapingFontRegistry *)memory_alloc_zero(sizeof(ShapingFontRegistry));
+  registry->reference_count = 1;
+  registry->backend_functions = backend_functions;
+  os_mutex_init(&registry->mutex);
+  registry->slot_count = 64;
+  registry->slots = (uint32_t *)memory_alloc_zero(registry->slot_count * sizeof(uint32_t));
+  return registry;
+}
+
+static void
+shaping_font_registry_add_ref(ShapingFontRegistry *registry)
+{
+  atomic_s32_increment(&registry->reference_count);
+}
+
+static void
+shaping_font_registry_release(ShapingFontRegistry *registry)
+{
+  if(atomic_s32_decrement(&registry->reference_count) != 0)
+  {
+    return;
+  }
+  for(uint32_t font_id = 0; font_id < registry->font_count; ++font_id)
+  {
+    ShapingFontInfo *info = &registry->pages[font_id / SHAPING_FONT_REGISTRY_PAGE_SIZE][font_id % SHAPING_FONT_REGISTRY_PAGE_SIZE];
+    registry->backend_functions->release_font_face(info->font_face);
+  }
+  for(uint32_t page_idx = 0; page_idx < SHAPING_FONT_REGISTRY_PAGE_COUNT; ++page_idx)
+  {
+    memory_free(registry->pages[page_idx]);
+  }
+  memory_free(registry->slots);
+  os_mutex_destroy(&registry->mutex);
+  memory_free(registry);
+}
+
+static const ShapingFontInfo *
+shaping_font_info_from_id(const ShapingFontRegistry *registry, uint16_t font_id)
+{
+  return &registry->pages[font_id / SHAPING_FONT_REGISTRY_PAGE_SIZE][font_id % SHAPING_FONT_REGISTRY_PAGE_SIZE];
+}
+
+static uint32_t
+shaping_font_registry_slot_from_font_face(const ShapingFontFace *font_face, uint32_t slot_count)
+{
+  uint64_t key = (uint64_t)font_face >> 4;
+  return (uint32_t)((key * 0x9E3779B97F4A7C15ull) >> 32) & (slot_count - 1);
+}
+
+static uint16_t
+shaping_font_registry_intern(ShapingFontRegistry *registry, ShapingFontFace *font_face)
+{
+  // NOTE(hampus): Takes a reference of its own the first time it sees a face
+  os_mutex_lock(&registry->mutex);
+
+  uint32_t slot_idx = shaping_font_registry_slot_from_font_face(font_face, registry->slot_count);
+  for(; registry->slots[slot_idx] != 0; slot_idx = (slot_idx + 1) & (registry->slot_count - 1))
+  {
+    uint16_t font_id = (uint16_t)(registry->slots[slot_idx] - 1);
+    if(shaping_font_info_from_id(registry, font_id)->font_face == font_face)
+    {
+      os_mutex_unlock(&registry->mutex);
+      return font_id;
+    }
+  }
+
+  //----------------------------------------------------------
+  // hampus: first time, ask the backend about the face
+
+  ASSERT(registry->font_count < SHAPING_FONT_REGISTRY_MAX_FONT_COUNT);
+  uint32_t font_id = registry->font_count;
+  ShapingFontInfo **page = &registry->pages[font_id / SHAPING_FONT_REGISTRY_PAGE_SIZE];
+  if(*page == 0)
+  {
+    *page = (ShapingFontInfo *)memory_alloc_zero(SHAPING_FONT_REGISTRY_PAGE_SIZE * sizeof(ShapingFontInfo));
+  }
+  ShapingFontInfo *info = &(*page)[font_id % SHAPING_FONT_REGISTRY_PAGE_SIZE];
+  info->font_face = font_face;
+  registry->backend_functions->add_ref_font_face(font_face);
+  registry->backend_functions->get_design_font_metrics(font_face, &info->metrics);
+  registry->backend_functions->get_font_properties(font_face, &info->properties);
+  registry->slots[slot_idx] = font_id + 1;
+  registry->font_count += 1;
+
+  // NOTE(hampus): Keep the slots at most half full
+  if(registry->font_count * 2 > registry->slot_count)
+  {
+    uint32_t slot_count = registry->slot_count * 2;
+    uint32_t *slots = (uint32_t *)memory_alloc_zero(slot_count * sizeof(uint32_t));
+    for(uint32_t id = 0; id < registry->font_count; ++id)
+    {
+      uint32_t new_slot_idx = shaping_font_registry_slot_from_font_face(shaping_font_info_from_id(registry, (uint16_t)id)->font_face, slot_count);
+      while(slots[new_slot_idx] != 0)
+      {
+        new_slot_idx = (new_slot_idx + 1) & (slot_count - 1);
+      }
+      slots[new_slot_idx] = id + 1;
+    }
+    memory_free(registry->slots);
+    registry->slots = slots;
+    registry->slot_count = slot_count;
+  }
+
+  os_mutex_unlock(&registry->mutex);
+  return (uint16_t)font_id;
+}
+
+////////////////////////////////////////////////////////////
+// hampus: batch shaping
+
+// NOTE(hampus): Shapes many independent texts on a pool of worker threads.
+// Every worker owns a deque of job indices, packed as a [begin, end) range
+// into one 64-bit value so it can be updated with a single compare exchange.
+// The owner takes jobs from the front, and a worker that runs dry steals
+// the back half of another worker's range. Each worker has its own shaping
+// context and optional caches, so no shaping state is shared between threads.
+// The backend is shared, which every backend allows.
+//
+// The thread that calls map_text_to_glyphs_batch() is worker 0, so a pool
+// of worker_count workers only launches worker_count - 1 threads, a pool of
+// one worker shapes the batch right there without waking anyone, and only
+// the workers that get jobs of their own are woken at all.
+//
+// A batch is published by bumping the pool's batch generation with a
+// release store once its backend, jobs, results and job ranges are written,
+// and a worker loads it with acquire before it reads any of them. Every
+// woken worker checks in once it has run out of jobs, and the batch is only
+// done when all of them have, so no worker can still be reading a batch
+// while the next one is written over it.
+
+struct MapTextToGlyphsJob
+{
+  const utf16_char *text;
+  uint32_t text_length;
+  const utf16_char *base_family;
+  float font_size;
+  const utf16_char *locale;
+
+  // NOTE(hampus): MapTextToGlyphsFlags
+  uint32_t flags;
+};
+
+struct ShapingThreadPool;
+
+struct ShapingWorker
+{
+  ShapingThreadPool *pool;
+  uint32_t worker_idx;
+
+  // NOTE(hampus): Both 0 for worker 0, which is the calling thread
+  OS_Thread *thread;
+  OS_Event *wake_event;
+  ShapingContext *context;
+  ShapingCaches *caches;
+
+  // NOTE(hampus): begin in the low 32 bits, end in the high 32 bits
+  volatile uint64_t job_range;
+
+  // NOTE(hampus): The last batch this worker has started on
+  uint64_t batch_generation;
+
+  uint64_t completed_job_count;
+  uint64_t stolen_job_count;
+};
+
+struct ShapingThreadPool
+{
+  uint32_t worker_count;
+  ShapingWorker *workers;
+  OS_Event *done_event;
+  volatile int32_t quit;
+
+  // hampus: current batch
+  volatile uint64_t batch_generation;
+  const ShapingBackend *backend;
+  const MapTextToGlyphsJob *jobs;
+  MapTextToGlyphsResult *results;
+  volatile int32_t remaining_job_count;
+  volatile int32_t active_worker_count;
+
+  // NOTE(hampus): The workers woken for the current batch, worker 0
+  // included
+  uint32_t batch_worker_count;
+};
+
+static uint64_t
+shaping_job_range_make(uint32_t begin, uint32_t end)
+{
+  return ((uint64_t)end << 32) | (uint64_t)begin;
+}
+
+static bool
+shaping_worker_pop_job(ShapingWorker *worker, uint32_t *job_idx)
+{
+  for(;;)
+  {
+    uint64_t range = atomic_u64_load_acquire(&worker->job_range);
+    uint32_t begin = (uint32_t)(range & 0xffffffff);
+    uint32_t end = (uint32_t)(range >> 32);
+    if(begin >= end)
+    {
+      return false;
+    }
+    if(atomic_u64_compare_exchange(&worker->job_range, shaping_job_range_make(begin + 1, end), range) == range)
+    {
+      *job_idx = begin;
+      return true;
+    }
+  }
+}
+
+static bool
+shaping_worker_steal_jobs(ShapingWorker *thief, ShapingWorker *victim)
+{
+  for(;;)
+  {
+    uint64_t range = atomic_u64_load_acquire(&victim->job_range);
+    uint32_t begin = (uint32_t)(range & 0xffffffff);
+    uint32_t end = (uint32_t)(range >> 32);
+    if(begin >= end)
+    {
+      return false;
+    }
+    uint32_t steal_count = (end - begin + 1) / 2;
+    if(atomic_u64_compare_exchange(&victim->job_range, shaping_job_range_make(begin, end - steal_count), range) == range)
+    {
+      // NOTE(hampus): Our own range is empty, so nobody else can be
+      // modifying it right now.
+      atomic_u64_store(&thief->job_range, shaping_job_range_make(end - steal_count, end));
+      thief->stolen_job_count += steal_count;
+      return true;
+    }
+  }
+}
+
+static void
+shaping_worker_run_batch(ShapingWorker *worker)
+{
+  // NOTE(hampus): Jobs only ever leave the ranges, so once there is
+  // nothing left to pop or steal, every job that's left is already taken
+  // by a worker that will finish it. This worker is done with the batch
+  // then, and goes back to waiting on its wake event, instead of spinning
+  // while the others finish.
+  ShapingThreadPool *pool = worker->pool;
+  while(atomic_s32_load_acquire(&pool->remaining_job_count) > 0)
+  {
+    uint32_t job_idx = 0;
+    if(shaping_worker_pop_job(worker, &job_idx))
+    {
+      // NOTE(hampus): A result left over from an earlier batch is shaped
+      // over, in its own arena, instead of allocating a new one
+      const MapTextToGlyphsJob &job = pool->jobs[job_idx];
+      MapTextToGlyphsResult *result = &pool->results[job_idx];
+      Arena *arena = result->arena;
+      if(arena != 0)
+      {
+        shaping_font_registry_release(result->font_registry);
+        arena_clear(arena);
+      }
+      else
+      {
+        arena = arena_alloc();
+      }
+      *result = map_text_to_glyphs_with_scratch(arena,
+                                                worker->context->scratch,
+                                                pool->backend,
+                                                job.locale,
+                                                job.base_family,
+                                                job.font_size,
+                                                job.text,
+                                                job.text_length,
+                                                worker->caches,
+                                                job.flags);
+      worker->completed_job_count += 1;
+      atomic_s32_decrement(&pool->remaining_job_count);
+      continue;
+    }
+
+    // NOTE(hampus): Out of our own work, go looking for someone else's,
+    // starting with our neighbour so the thieves spread out. Only the
+    // workers woken for the batch can have any.
+    bool stole = false;
+    for(uint32_t offset = 1; offset < pool->batch_worker_count && !stole; ++offset)
+    {
+      ShapingWorker *victim = &pool->workers[(worker->worker_idx + offset) % pool->batch_worker_count];
+      stole = shaping_worker_steal_jobs(worker, victim);
+    }
+    if(!stole)
+    {
+      break;
+    }
+  }
+}
+
+static void
+shaping_worker_thread_proc(void *parameter)
+{
+  ShapingWorker *worker = (ShapingWorker *)parameter;
+  ShapingThreadPool *pool = worker->pool;
+  for(;;)
+  {
+    os_event_wait(worker->wake_event);
+    if(atomic_s32_load_acquire(&pool->quit))
+    {
+      break;
+    }
+
+    // NOTE(hampus): Pairs with the release store in map_text_to_glyphs_batch(),
+    // so the batch and our job range are visible from here on. Each batch
+    // signals each worker at most once.
+    uint64_t batch_generation = atomic_u64_load_acquire(&pool->batch_generation);
+    ASSERT(batch_generation != worker->batch_generation);
+    worker->batch_generation = batch_generation;
+
+    shaping_worker_run_batch(worker);
+
+    // NOTE(hampus): The last thing a worker does with the batch. The last
+    // one out signals done_event, unless that is worker 0, which isn't
+    // waiting then.
+    if(atomic_s32_decrement(&pool->active_worker_count) == 0)
+    {
+      os_event_signal(pool->done_event);
+    }
+  }
+}
+
+static ShapingThreadPool *
+shaping_thread_pool_alloc(uint32_t worker_count = 0, ShapingCaches *worker_caches = 0)
+{
+  // NOTE(hampus): worker_count 0 means one worker per logical processor.
+  // If worker_caches is given it must hold worker_count caches, one for
+  // each worker, since caches can't be shared between threads.
+  if(worker_count == 0)
+  {
+    worker_count = os_logical_processor_count();
+  }
+
+  ShapingThreadPool *pool = (ShapingThreadPool *)memory_alloc_zero(sizeof(ShapingThreadPool));
+  pool->worker_count = worker_count;
+  pool->workers = (ShapingWorker *)memory_alloc_zero(worker_count * sizeof(ShapingWorker));
+  pool->done_event = os_event_alloc();
+  for(uint32_t worker_idx = 0; worker_idx < worker_count; ++worker_idx)
+  {
+    ShapingWorker *worker = &pool->workers[worker_idx];
+    worker->pool = pool;
+    worker->worker_idx = worker_idx;
+    worker->context = shaping_context_alloc();
+    worker->caches = worker_caches != 0 ? &worker_caches[worker_idx] : 0;
+    if(worker_idx != 0)
+    {
+      worker->wake_event = os_event_alloc();
+      worker->thread = os_thread_launch(shaping_worker_thread_proc, worker);
+    }
+  }
+  return pool;
+}
+
+static void
+shaping_thread_pool_release(ShapingThreadPool *pool)
+{
+  atomic_s32_store_release(&pool->quit, 1);
+  for(uint32_t worker_idx = 1; worker_idx < pool->worker_count; ++worker_idx)
+  {
+    os_event_signal(pool->workers[worker_idx].wake_event);
+  }
+  for(uint32_t worker_idx = 0; worker_idx < pool->worker_count; ++worker_idx)
+  {
+    ShapingWorker *worker = &pool->workers[worker_idx];
+    if(worker_idx != 0)
+    {
+      os_thread_join(worker->thread);
+      os_event_release(worker->wake_event);
+    }
+    shaping_context_release(worker->context);
+  }
+  os_event_release(pool->done_event);
+  memory_free(pool->workers);
+  memory_free(pool);
+}
+
+static void
+map_text_to_glyphs_batch(ShapingThreadPool *pool, const ShapingBackend *backend, const MapTextToGlyphsJob *jobs, const uint32_t job_count, MapTextToGlyphsResult *results)
+{
+  // NOTE(hampus): results[i] is the result of jobs[i]. Blocks until every job
+  // has been shaped, and shapes jobs on the calling thread meanwhile. Each
+  // result has to be zero or hold a result from before, which is freed and
+  // its arena reused, so passing the same results every frame doesn't
+  // allocate a new arena per job. Each result has to be freed with
+  // free_map_text_to_glyphs_result() as usual in the end.
+  if(job_count == 0)
+  {
+    return;
+  }
+
+  uint32_t batch_worker_count = job_count < pool->worker_count ? job_count : pool->worker_count;
+  pool->backend = backend;
+  pool->jobs = jobs;
+  pool->results = results;
+  pool->remaining_job_count = (int32_t)job_count;
+  pool->active_worker_count = (int32_t)batch_worker_count;
+  pool->batch_worker_count = batch_worker_count;
+
+  // NOTE(hampus): Start every worker off with an even share, stealing
+  // takes care of the jobs not being equally expensive.
+  for(uint32_t worker_idx = 0; worker_idx < batch_worker_count; ++worker_idx)
+  {
+    uint32_t begin = (uint32_t)(((uint64_t)job_count * worker_idx) / batch_worker_count);
+    uint32_t end = (uint32_t)(((uint64_t)job_count * (worker_idx + 1)) / batch_worker_count);
+    atomic_u64_store(&pool->workers[worker_idx].job_range, shaping_job_range_make(begin, end));
+  }
+  atomic_u64_store_release(&pool->batch_generation, pool->batch_generation + 1);
+  for(uint32_t worker_idx = 1; worker_idx < batch_worker_count; ++worker_idx)
+  {
+    os_event_signal(pool->workers[worker_idx].wake_event);
+  }
+
+  shaping_worker_run_batch(&pool->workers[0]);
+  if(atomic_s32_decrement(&pool->active_worker_count) != 0)
+  {
+    os_event_wait(pool->done_event);
+  }
+  ASSERT(atomic_s32_load_acquire(&pool->active_worker_count) == 0);
+}
+
+////////////////////////////////////////////////////////////
+// hampus: memory accounting
+
+// NOTE(hampus): An allocator that sits on top of another one and keeps count
+// of what goes through it: allocations per call site, the bytes currently
+// allocated and the peak. Install it with
+//
+//   MemoryAccounting *accounting = memory_accounting_alloc();
+//   memory_set_allocator(memory_accounting_allocator(accounting));
+//
+// Every allocation gets a small header in front of it that remembers its
+// size and call site, so frees can be attributed too.
+
+#define MEMORY_ACCOUNTING_SITE_CAPACITY 256
+
+struct MemoryCallSite
+{
+  const char *file;
+  int line;
+
+  uint64_t alloc_count;
+  uint64_t total_bytes;
+
+  // NOTE(hampus): What is still allocated from here
+  uint64_t live_count;
+  uint64_t live_bytes;
+};
+
+struct MemoryAccountingStats
+{
+  uint64_t alloc_count;
+  uint64_t free_count;
+  uint64_t current_bytes;
+  uint64_t peak_bytes;
+};
+
+struct MemoryAccounting
+{
+  MemoryAllocator allocator;
+  MemoryAllocator *parent;
+
+  OS_Mutex mutex;
+  MemoryAccountingStats stats;
+
+  // NOTE(hampus): Open addressed on the line number. Site 0 collects
+  // everything once the table is full.
+  uint32_t site_count;
+  MemoryCallSite sites[MEMORY_ACCOUNTING_SITE_CAPACITY];
+};
+
+struct MemoryAccountingHeader
+{
+  uint64_t size;
+  uint64_t site_idx;
+};
+
+static_assert(sizeof(MemoryAccountingHeader) == 16, "Allocations have to stay 16 byte aligned");
+
+static uint32_t
+memory_accounting_site_idx_from_location(MemoryAccounting *accounting, const char *file, int line)
+{
+  uint32_t result = 0;
+  uint32_t slot_mask = MEMORY_ACCOUNTING_SITE_CAPACITY - 1;
+  uint32_t slot_idx = ((uint32_t)line * 2654435761u) & slot_mask;
+  for(uint32_t probe_idx = 0; probe_idx < MEMORY_ACCOUNTING_SITE_CAPACITY; ++probe_idx, slot_idx = (slot_idx + 1) & slot_mask)
+  {
+    if(slot_idx == 0)
+    {
+      continue;
+    }
+    MemoryCallSite *site = &accounting->sites[slot_idx];
+    if(site->file == 0)
+    {
+      // NOTE(hampus): Keep one slot free so that probing always ends
+      if(accounting->site_count + 2 < MEMORY_ACCOUNTING_SITE_CAPACITY)
+      {
+        site->file = file;
+        site->line = line;
+        accounting->site_count += 1;
+        result = slot_idx;
+      }
+      break;
+    }
+    if(site->line == line && (site->file == file || strcmp(site->file, file) == 0))
+    {
+      result = slot_idx;
+      break;
+    }
+  }
+  return result;
+}
+
+static void *
+memory_accounting_alloc_(void *state, uint64_t size, const char *file, int line)
+{
+  MemoryAccounting *accounting = (MemoryAccounting *)state;
+  MemoryAccountingHeader *header = (MemoryAccountingHeader *)accounting->parent->alloc(accounting->parent->state, sizeof(MemoryAccountingHeader) + size, file, line);
+  if(header == 0)
+  {
+    return 0;
+  }
+
+  os_mutex_lock(&accounting->mutex);
+  uint32_t site_idx = memory_accounting_site_idx_from_location(accounting, file, line);
+  MemoryCallSite *site = &accounting->sites[site_idx];
+  site->alloc_count += 1;
+  site->total_bytes += size;
+  site->live_count += 1;
+  site->live_bytes += size;
+
+  MemoryAccountingStats *stats = &accounting->stats;
+  stats->alloc_count += 1;
+  stats->current_bytes += size;
+  if(stats->current_bytes > stats->peak_bytes)
+  {
+    stats->peak_bytes = stats->current_bytes;
+  }
+  os_mutex_unlock(&accounting->mutex);
+
+  header->size = size;
+  header->site_idx = site_idx;
+  return header + 1;
+}
+
+static void
+memory_accounting_free_(void *state, void *ptr)
+{
+  MemoryAccounting *accounting = (MemoryAccounting *)state;
+  MemoryAccountingHeader *header = (MemoryAccountingHeader *)ptr - 1;
+
+  os_mutex_lock(&accounting->mutex);
+  MemoryCallSite *site = &accounting->sites[header->site_idx];
+  ASSERT(site->live_count != 0 && site->live_bytes >= header->size);
+  site->live_count -= 1;
+  site->live_bytes -= header->size;
+
+  MemoryAccountingStats *stats = &accounting->stats;
+  stats->free_count += 1;
+  stats->current_bytes -= header->size;
+  os_mutex_unlock(&accounting->mutex);
+
+  accounting->parent->free(accounting->parent->state, header);
+}
+
+static MemoryAccounting *
+memory_accounting_alloc(MemoryAllocator *parent = 0)
+{
+  // NOTE(hampus): Allocations go to `parent`, or malloc if there is none
+  if(parent == 0)
+  {
+    parent = &memory_malloc_allocator;
+  }
+  MemoryAccounting *accounting = (MemoryAccounting *)parent->alloc(parent->state, sizeof(MemoryAccounting), __FILE__, __LINE__);
+  ASSERT(accounting != 0);
+  memset(accounting, 0, sizeof(MemoryAccounting));
+  accounting->allocator.alloc = memory_accounting_alloc_;
+  accounting->allocator.free = memory_accounting_free_;
+  accounting->allocator.state = accounting;
+  accounting->parent = parent;
+  os_mutex_init(&accounting->mutex);
+  accounting->sites[0].file = "(other)";
+  return accounting;
+}
+
+static void
+memory_accounting_release(MemoryAccounting *accounting)
+{
+  ASSERT(memory_allocator != &accounting->allocator);
+  MemoryAllocator *parent = accounting->parent;
+  os_mutex_destroy(&accounting->mutex);
+  parent->free(parent->state, accounting);
+}
+
+static MemoryAllocator *
+memory_accounting_allocator(MemoryAccounting *accounting)
+{
+  return &accounting->allocator;
+}
+
+static MemoryAccountingStats
+memory_accounting_stats(MemoryAccounting *accounting)
+{
+  os_mutex_lock(&accounting->mutex);
+  MemoryAccountingStats result = accounting->stats;
+  os_mutex_unlock(&accounting->mutex);
+  return result;
+}
+
+static void
+memory_accounting_reset_peak(MemoryAccounting *accounting)
+{
+  // NOTE(hampus): Makes the peak start over from what is allocated right now,
+  // e.g. to get the peak of a single shaping call.
+  os_mutex_lock(&accounting->mutex);
+  accounting->stats.peak_bytes = accounting->stats.current_bytes;
+  os_mutex_unlock(&accounting->mutex);
+}
+
+static uint32_t
+memory_accounting_call_sites(MemoryAccounting *accounting, bool only_live, MemoryCallSite *sites, uint32_t max_site_count)
+{
+  // NOTE(hampus): Copies out up to max_site_count call sites and returns how
+  // many there are in total. With only_live set, only sites that still have
+  // allocations alive are reported, which makes this the leak report once
+  // everything should have been freed. Nothing is allocated here, so it is
+  // fine to call with the accounting allocator installed.
+  uint32_t result = 0;
+  os_mutex_lock(&accounting->mutex);
+  for(uint32_t site_idx = 0; site_idx < MEMORY_ACCOUNTING_SITE_CAPACITY; ++site_idx)
+  {
+    MemoryCallSite *site = &accounting->sites[site_idx];
+    if(site->alloc_count == 0 || (only_live && site->live_count == 0))
+    {
+      continue;
+    }
+    if(result < max_site_count)
+    {
+      sites[result] = *site;
+    }
+    result += 1;
+  }
+  os_mutex_unlock(&accounting->mutex);
+  return result;
+}
+
+#endif // TEXT_TO_GLYPHS_H
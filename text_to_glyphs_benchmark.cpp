@@ -0,0 +1,1862 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "stub_text_to_glyphs.h"
+#include "frame_scheduler.h"
+#include "line_wrap.h"
+
+// NOTE(hampus): Counts every allocation the shaping code makes
+static MemoryAccounting *benchmark_memory_accounting;
+
+////////////////////////////////////////////////////////////
+// hampus: corpora
+
+struct Corpus
+{
+  const char *name;
+  utf16_char *text;
+  uint32_t text_length;
+};
+
+static Corpus
+corpus_from_codepoints(Arena *arena, const char *name, const uint32_t *codepoints, uint32_t codepoint_count, uint32_t text_length)
+{
+  // NOTE(hampus): Repeats the codepoints until the text is text_length code
+  // units long, never cutting a surrogate pair in half.
+  Corpus result = {};
+  result.name = name;
+  result.text = push_array_no_zero(arena, utf16_char, text_length + 1);
+  uint32_t idx = 0;
+  for(uint32_t codepoint_idx = 0; idx < text_length; codepoint_idx = (codepoint_idx + 1) % codepoint_count)
+  {
+    uint32_t codepoint = codepoints[codepoint_idx];
+    if(codepoint >= 0x10000 && idx + 2 > text_length)
+    {
+      codepoint = ' ';
+    }
+    idx += encode_utf16(result.text + idx, codepoint);
+  }
+  result.text[idx] = 0;
+  result.text_length = idx;
+  return result;
+}
+
+static uint32_t
+codepoints_from_utf8(const char *utf8, uint32_t *codepoints)
+{
+  uint32_t count = 0;
+  const uint8_t *ptr = (const uint8_t *)utf8;
+  while(*ptr != 0)
+  {
+    uint32_t codepoint = *ptr;
+    uint32_t length = 1;
+    if(codepoint >= 0xF0)
+    {
+      codepoint &= 0x07;
+      length = 4;
+    }
+    else if(codepoint >= 0xE0)
+    {
+      codepoint &= 0x0F;
+      length = 3;
+    }
+    else if(codepoint >= 0xC0)
+    {
+      codepoint &= 0x1F;
+      length = 2;
+    }
+    for(uint32_t idx = 1; idx < length; ++idx)
+    {
+      codepoint = (codepoint << 6) | (ptr[idx] & 0x3F);
+    }
+    codepoints[count] = codepoint;
+    count += 1;
+    ptr += length;
+  }
+  return count;
+}
+
+static Corpus
+corpus_from_utf8(Arena *arena, const char *name, const char *utf8, uint32_t text_length)
+{
+  uint32_t *codepoints = push_array_no_zero(arena, uint32_t, strlen(utf8));
+  uint32_t codepoint_count = codepoints_from_utf8(utf8, codepoints);
+  return corpus_from_codepoints(arena, name, codepoints, codepoint_count, text_length);
+}
+
+static const char *corpus_ascii_utf8 =
+  "The quick brown fox jumps over the lazy dog, and then it runs back home again. ";
+
+static const char *corpus_code_utf8 =
+  "if(a != b && c->next == 0) { return x <= y ? x : y; } while(i >= 0) { f = (v) => v->w; } ";
+
+static const char *corpus_bidi_utf8 =
+  "He said \xd7\xa9\xd7\x9c\xd7\x95\xd7\x9d \xd7\xa2\xd7\x95\xd7\x9c\xd7\x9d and then "
+  "\xd9\x85\xd8\xb1\xd8\xad\xd8\xa8\xd8\xa7 \xd8\xa8\xd8\xa7\xd9\x84\xd8\xb9\xd8\xa7\xd9\x84\xd9\x85 to everyone. ";
+
+static const char *corpus_cjk_utf8 =
+  "\xe6\xbc\xa2\xe5\xad\x97\xe3\x81\xa8\xe3\x81\x8b\xe3\x81\xaa\xe3\x81\xa8\xe3\x82\xab\xe3\x83\x8a\xe3\x80\x82"
+  "\xed\x95\x9c\xea\xb5\xad\xec\x96\xb4 \xec\x9e\x85\xeb\x8b\x88\xeb\x8b\xa4\xe3\x80\x82";
+
+static const char *corpus_emoji_utf8 =
+  "Nice \xf0\x9f\x98\x80 work \xf0\x9f\x91\x8d\xf0\x9f\x8f\xbd team "
+  "\xf0\x9f\x91\xa8\xe2\x80\x8d\xf0\x9f\x91\xa9\xe2\x80\x8d\xf0\x9f\x91\xa7 \xe2\x9d\xa4\xef\xb8\x8f ok ";
+
+static const char *corpus_cjk_latin_utf8 =
+  "\xe6\xbc\xa2\xe5\xad\x97 2024, \xe3\x81\x8b\xe3\x81\xaa: word \xe6\xbc\xa2 (x) 7 \xe5\xad\x97\xe3\x80\x82 plain, 12 "
+  "words. \xe3\x82\xab\xe3\x83\x8a 3 a b \xe6\xbc\xa2\xe5\xad\x97! ";
+
+// NOTE(hampus): Japanese without a single space, like a paragraph of CJK
+// text is written
+static const char *corpus_unspaced_utf8 =
+  "\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e\xe3\x81\xae\xe6\x96\x87\xe7\xab\xa0\xe3\x81\xab\xe3\x81\xaf"
+  "\xe5\x8d\x98\xe8\xaa\x9e\xe3\x81\xae\xe9\x96\x93\xe3\x81\xab\xe7\xa9\xba\xe7\x99\xbd\xe3\x81\x8c"
+  "\xe3\x81\x82\xe3\x82\x8a\xe3\x81\xbe\xe3\x81\x9b\xe3\x82\x93\xe3\x80\x82";
+
+// NOTE(hampus): Long words with soft hyphens where they may be split, and
+// one right before the end of a paragraph, where it mustn't show
+static const char *corpus_soft_hyphens_utf8 =
+  "Hyphen\xc2\xad" "ation lets ex\xc2\xadtra\xc2\xador\xc2\xad" "di\xc2\xadnar\xc2\xadi\xc2\xadly long words "
+  "wrap in nar\xc2\xadrow col\xc2\xadumns with\xc2\xadout gaps, even at the end\xc2\xad\n";
+
+static const char *corpus_mixed_utf8 =
+  "Mixed line: \xd7\xa9\xd7\x9c\xd7\x95\xd7\x9d x -> y \xe6\xbc\xa2\xe5\xad\x97 caf\x65\xcc\x81 "
+  "\xf0\x9f\x98\x80 \xd9\x85\xd8\xb1\xd8\xad\xd8\xa8\xd8\xa7 a != b and more plain words here. ";
+
+////////////////////////////////////////////////////////////
+// hampus: measuring
+
+struct BenchmarkResult
+{
+  uint64_t call_count;
+  uint64_t char_count;
+  uint64_t glyph_count;
+  uint64_t total_ns;
+  uint64_t p50_ns;
+  uint64_t p99_ns;
+  double allocations_per_call;
+
+  // NOTE(hampus): Allocations that aren't blocks of the result's arena
+  double scratch_allocations_per_call;
+  uint64_t max_peak_bytes;
+};
+
+static int
+compare_u64(const void *a, const void *b)
+{
+  uint64_t lhs = *(const uint64_t *)a;
+  uint64_t rhs = *(const uint64_t *)b;
+  return lhs < rhs ? -1 : lhs > rhs ? 1 : 0;
+}
+
+static ShapingCaches
+benchmark_caches_alloc(void)
+{
+  ShapingCaches result = {};
+  result.word_cache = shaped_word_cache_alloc(MB(8));
+  result.fallback_cache = font_fallback_cache_alloc();
+  result.glyph_table_cache = glyph_table_cache_alloc();
+  return result;
+}
+
+static void
+benchmark_caches_release(ShapingCaches *caches)
+{
+  shaped_word_cache_release(caches->word_cache);
+  font_fallback_cache_release(caches->fallback_cache);
+  glyph_table_cache_release(caches->glyph_table_cache);
+}
+
+static uint64_t
+benchmark_arena_block_count(Arena *arena)
+{
+  uint64_t result = 0;
+  for(Arena *block = arena->current; block != 0; block = block->prev)
+  {
+    result += 1;
+  }
+  return result;
+}
+
+static void
+assert_results_match(const MapTextToGlyphsResult *a, const MapTextToGlyphsResult *b)
+{
+  // NOTE(hampus): Either result may have gaps from an edit, so glyphs and
+  // text are compared through their logical index.
+  ASSERT(a->text_length == b->text_length && a->segment_count == b->segment_count && a->glyph_count == b->glyph_count);
+  for(uint64_t segment_idx = 0; segment_idx < a->segment_count; ++segment_idx)
+  {
+    TextToGlyphsSegment *a_segment = &a->segments[segment_idx];
+    TextToGlyphsSegment *b_segment = &b->segments[segment_idx];
+    ASSERT(a_segment->font_id == b_segment->font_id && a_segment->bidi_level == b_segment->bidi_level &&
+           glyph_from_array_index(a, a_segment->first_glyph) == glyph_from_array_index(b, b_segment->first_glyph) &&
+           a_segment->glyph_count == b_segment->glyph_count &&
+           a_segment->text_offset == b_segment->text_offset && a_segment->text_length == b_segment->text_length &&
+           a_segment->run_width == b_segment->run_width);
+  }
+  ASSERT((a->glyph_positions == 0) == (b->glyph_positions == 0));
+  for(uint64_t glyph = 0; glyph < a->glyph_count; ++glyph)
+  {
+    uint64_t a_index = glyph_array_index(a, glyph);
+    uint64_t b_index = glyph_array_index(b, glyph);
+    ASSERT(a->glyph_indices[a_index] == b->glyph_indices[b_index]);
+    ASSERT(memory_match(&a->glyph_advances[a_index], &b->glyph_advances[b_index], sizeof(float)));
+    if(a->glyph_positions != 0)
+    {
+      ASSERT(memory_match(&a->glyph_positions[a_index], &b->glyph_positions[b_index], sizeof(float)));
+    }
+  }
+  ASSERT((a->line_breakpoints == 0) == (b->line_breakpoints == 0));
+  for(uint32_t text_position = 0; text_position < a->text_length; ++text_position)
+  {
+    uint32_t a_index = text_array_index(a, text_position);
+    uint32_t b_index = text_array_index(b, text_position);
+    ASSERT(glyph_from_array_index(a, a->cluster_map[a_index]) == glyph_from_array_index(b, b->cluster_map[b_index]));
+    if(a->line_breakpoints != 0)
+    {
+      ASSERT(memory_match(&a->line_breakpoints[a_index], &b->line_breakpoints[b_index], sizeof(LineBreakpoint)));
+    }
+  }
+}
+
+static void
+check_fallback_cache(const ShapingBackend *backend, const Corpus *corpus)
+{
+  // NOTE(hampus): Spaces, digits and punctuation take the font of the run
+  // they are in, so the fallback cache must not hand out whatever font one
+  // of them got the first time. Shapes the corpus with cold caches, warm
+  // caches and no caches and checks that all three agree. The advances the
+  // glyph table hands out have to match the shaped ones to the bit too, at
+  // sizes where the scale from design units isn't exact.
+  const utf16_char *locale = utf16_literal("en-us");
+  const utf16_char *base_family = utf16_literal("Fira Code");
+  const float font_sizes[] = {16.0f, 13.0f, 17.5f, 11.3f};
+
+  ShapingCaches caches = benchmark_caches_alloc();
+  for(uint32_t size_idx = 0; size_idx < sizeof(font_sizes) / sizeof(font_sizes[0]); ++size_idx)
+  {
+    float font_size = font_sizes[size_idx];
+    MapTextToGlyphsResult expected = map_text_to_glyphs(backend, locale, base_family, font_size, corpus->text, corpus->text_length);
+    for(uint32_t pass_idx = 0; pass_idx < 2; ++pass_idx)
+    {
+      MapTextToGlyphsResult cached = map_text_to_glyphs(backend, locale, base_family, font_size, corpus->text, corpus->text_length, &caches);
+      assert_results_match(&cached, &expected);
+      free_map_text_to_glyphs_result(&cached);
+    }
+    free_map_text_to_glyphs_result(&expected);
+  }
+  ASSERT(caches.fallback_cache->hit_count != 0 && caches.glyph_table_cache->table_char_count != 0);
+  benchmark_caches_release(&caches);
+}
+
+// NOTE(hampus): Shaping allocates a few arena blocks per call, for the
+// result and for scratch, never one per run or glyph. The 64K mixed corpus
+// needs 11 without caches.
+#define CHECK_SHAPING_MAX_ALLOCATION_COUNT 16
+
+static void
+check_shaping_memory(const ShapingBackend *backend, const Corpus *corpus)
+{
+  // NOTE(hampus): Shapes the corpus with and without caches and with every
+  // flag, and checks under the accounting allocator that once the result
+  // is freed, nothing a call allocated is still alive, and that each call
+  // allocated a bounded number of times. The cached calls run after one
+  // call that fills the caches, which keep what they hold.
+  const utf16_char *locale = utf16_literal("en-us");
+  const utf16_char *base_family = utf16_literal("Fira Code");
+  const uint32_t flag_sets[] = {0, MapTextToGlyphsFlag_GlyphPositions | MapTextToGlyphsFlag_LineBreakpoints};
+
+  static MemoryCallSite sites_before[MEMORY_ACCOUNTING_SITE_CAPACITY];
+  static MemoryCallSite sites_after[MEMORY_ACCOUNTING_SITE_CAPACITY];
+
+  for(uint32_t cache_idx = 0; cache_idx < 2; ++cache_idx)
+  {
+    ShapingCaches caches = {};
+    ShapingCaches *caches_ptr = 0;
+    ShapingContext *context = 0;
+    if(cache_idx == 1)
+    {
+      caches = benchmark_caches_alloc();
+      caches_ptr = &caches;
+      context = shaping_context_alloc();
+    }
+    for(uint32_t flags_idx = 0; flags_idx < sizeof(flag_sets) / sizeof(flag_sets[0]); ++flags_idx)
+    {
+      uint32_t flags = flag_sets[flags_idx];
+      if(caches_ptr != 0)
+      {
+        MapTextToGlyphsResult warmup = map_text_to_glyphs(backend, locale, base_family, 16.0f, corpus->text, corpus->text_length, caches_ptr, flags, context);
+        free_map_text_to_glyphs_result(&warmup);
+      }
+
+      MemoryAccountingStats stats_before = memory_accounting_stats(benchmark_memory_accounting);
+      uint32_t site_count_before = memory_accounting_call_sites(benchmark_memory_accounting, true, sites_before, MEMORY_ACCOUNTING_SITE_CAPACITY);
+
+      MapTextToGlyphsResult shaped = map_text_to_glyphs(backend, locale, base_family, 16.0f, corpus->text, corpus->text_length, caches_ptr, flags, context);
+      free_map_text_to_glyphs_result(&shaped);
+
+      MemoryAccountingStats stats_after = memory_accounting_stats(benchmark_memory_accounting);
+      uint32_t site_count_after = memory_accounting_call_sites(benchmark_memory_accounting, true, sites_after, MEMORY_ACCOUNTING_SITE_CAPACITY);
+
+      uint64_t allocation_count = stats_after.alloc_count - stats_before.alloc_count;
+      ASSERT(allocation_count <= CHECK_SHAPING_MAX_ALLOCATION_COUNT);
+      ASSERT(stats_after.free_count - stats_before.free_count == allocation_count);
+      ASSERT(stats_after.current_bytes == stats_before.current_bytes);
+      ASSERT(site_count_after == site_count_before);
+      for(uint32_t site_idx = 0; site_idx < site_count_after; ++site_idx)
+      {
+        ASSERT(sites_after[site_idx].line == sites_before[site_idx].line &&
+               sites_after[site_idx].live_count == sites_before[site_idx].live_count &&
+               sites_after[site_idx].live_bytes == sites_before[site_idx].live_bytes);
+      }
+    }
+    if(caches_ptr != 0)
+    {
+      shaping_context_release(context);
+      benchmark_caches_release(&caches);
+    }
+  }
+}
+
+static BenchmarkResult
+benchmark_corpus(const ShapingBackend *backend, const Corpus *corpus, bool use_caches, uint64_t min_char_count)
+{
+  // NOTE(hampus): Shapes the corpus over and over until at least
+  // min_char_count characters have been shaped. With caches, the caches are
+  // warmed up by one call that isn't measured, since that is the state an
+  // editor redrawing the same text is in. That call also warms up the
+  // shaping context the cached runs share, like a thread would keep one.
+  const utf16_char *locale = utf16_literal("en-us");
+  const utf16_char *base_family = utf16_literal("Fira Code");
+
+  ShapingCaches caches = {};
+  ShapingCaches *caches_ptr = 0;
+  ShapingContext *context = 0;
+  if(use_caches)
+  {
+    caches = benchmark_caches_alloc();
+    caches_ptr = &caches;
+    context = shaping_context_alloc();
+    MapTextToGlyphsResult warmup = map_text_to_glyphs(backend, locale, base_family, 16.0f, corpus->text, corpus->text_length, caches_ptr, 0, context);
+    free_map_text_to_glyphs_result(&warmup);
+  }
+
+  uint64_t call_count = (min_char_count + corpus->text_length - 1) / corpus->text_length;
+  if(call_count < 16)
+  {
+    call_count = 16;
+  }
+  uint64_t *latencies = (uint64_t *)malloc(sizeof(uint64_t) * call_count);
+
+  BenchmarkResult result = {};
+  uint64_t result_block_count = 0;
+  MemoryAccountingStats stats_before = memory_accounting_stats(benchmark_memory_accounting);
+  for(uint64_t call_idx = 0; call_idx < call_count; ++call_idx)
+  {
+    memory_accounting_reset_peak(benchmark_memory_accounting);
+    uint64_t bytes_before = memory_accounting_stats(benchmark_memory_accounting).current_bytes;
+
+    uint64_t begin = os_now_ns();
+    MapTextToGlyphsResult shaped = map_text_to_glyphs(backend, locale, base_family, 16.0f, corpus->text, corpus->text_length, caches_ptr, 0, context);
+    uint64_t end = os_now_ns();
+
+    latencies[call_idx] = end - begin;
+    result.total_ns += end - begin;
+    result.glyph_count += shaped.glyph_count;
+    result_block_count += benchmark_arena_block_count(shaped.arena);
+    free_map_text_to_glyphs_result(&shaped);
+
+    uint64_t peak_bytes = memory_accounting_stats(benchmark_memory_accounting).peak_bytes - bytes_before;
+    if(peak_bytes > result.max_peak_bytes)
+    {
+      result.max_peak_bytes = peak_bytes;
+    }
+  }
+  MemoryAccountingStats stats_after = memory_accounting_stats(benchmark_memory_accounting);
+
+  qsort(latencies, call_count, sizeof(uint64_t), compare_u64);
+  result.call_count = call_count;
+  result.char_count = call_count * corpus->text_length;
+  result.p50_ns = latencies[call_count / 2];
+  result.p99_ns = latencies[(call_count * 99) / 100];
+  uint64_t allocation_count = stats_after.alloc_count - stats_before.alloc_count;
+  result.allocations_per_call = (double)allocation_count / (double)call_count;
+  result.scratch_allocations_per_call = (double)(allocation_count - result_block_count) / (double)call_count;
+
+  // NOTE(hampus): With warm caches and a warm context, shaping the same text
+  // again must not allocate anything but the result
+  ASSERT(!use_caches || allocation_count == result_block_count);
+
+  free(latencies);
+  if(use_caches)
+  {
+    shaping_context_release(context);
+    benchmark_caches_release(&caches);
+  }
+  return result;
+}
+
+static void
+print_benchmark_result(const char *name, uint32_t text_length, bool use_caches, const BenchmarkResult *result)
+{
+  double ns_per_char = (double)result->total_ns / (double)result->char_count;
+  double glyphs_per_second = (double)result->glyph_count * 1e9 / (double)result->total_ns;
+  printf("%-8s %-8s %8u %10.2f %12.2f %10.2f %10.2f %10.1f %12.1f %12.1f\n",
+         name, use_caches ? "cached" : "cold", text_length,
+         ns_per_char, glyphs_per_second / 1e6, result->allocations_per_call, result->scratch_allocations_per_call, (double)result->max_peak_bytes / 1024.0,
+         (double)result->p50_ns / 1000.0, (double)result->p99_ns / 1000.0);
+}
+
+static void
+print_benchmark_header(const char *title)
+{
+  printf("\n%s\n", title);
+  printf("%-8s %-8s %8s %10s %12s %10s %10s %10s %12s %12s\n", "corpus", "caches", "length", "ns/char", "Mglyphs/s", "allocs", "scratch", "peak KB", "p50 us", "p99 us");
+}
+
+static void
+benchmark_glyph_atlas(const ShapingBackend *backend, const Corpus *corpus, uint32_t page_size, uint32_t page_count, uint32_t frame_count)
+{
+  // NOTE(hampus): Draws the corpus as 80 character lines at three font
+  // sizes, scrolling it by a fraction of a pixel every frame, and reports
+  // how well an atlas of the given size keeps up.
+  const utf16_char *locale = utf16_literal("en-us");
+  const utf16_char *base_family = utf16_literal("Fira Code");
+  const float font_sizes[] = {12.0f, 16.0f, 24.0f};
+  const uint32_t line_length = 80;
+  uint32_t line_count = corpus->text_length / line_length;
+  uint32_t result_count = line_count * (sizeof(font_sizes) / sizeof(font_sizes[0]));
+
+  MapTextToGlyphsResult *results = (MapTextToGlyphsResult *)malloc(sizeof(MapTextToGlyphsResult) * result_count);
+  for(uint32_t result_idx = 0; result_idx < result_count; ++result_idx)
+  {
+    uint32_t line_idx = result_idx % line_count;
+    float font_size = font_sizes[result_idx / line_count];
+    results[result_idx] = map_text_to_glyphs(backend, locale, base_family, font_size, corpus->text + line_idx * line_length, line_length);
+  }
+
+  GlyphAtlas *atlas = glyph_atlas_alloc(page_size, page_count, stub_rasterize_glyph, 0);
+  Arena *frame_arena = arena_alloc();
+  uint64_t quad_count = 0;
+  uint64_t begin = os_now_ns();
+  for(uint32_t frame_idx = 0; frame_idx < frame_count; ++frame_idx)
+  {
+    glyph_atlas_begin_generation(atlas);
+    float scroll_x = (float)frame_idx * 0.3f;
+    for(uint32_t result_idx = 0; result_idx < result_count; ++result_idx)
+    {
+      MapTextToGlyphsResult *result = &results[result_idx];
+      float baseline_x = 10.0f + scroll_x;
+      float baseline_y = 20.0f + (float)result_idx * 20.0f;
+      for(uint64_t segment_idx = 0; segment_idx < result->segment_count; ++segment_idx)
+      {
+        uint32_t segment_quad_count = 0;
+        glyph_atlas_quads_from_segment(atlas, frame_arena, result, &result->segments[segment_idx], baseline_x, baseline_y, 1.0f, &segment_quad_count);
+        quad_count += segment_quad_count;
+      }
+    }
+    for(uint32_t page_idx = 0; page_idx < atlas->page_count; ++page_idx)
+    {
+      glyph_atlas_page_clear_dirty(&atlas->pages[page_idx]);
+    }
+    arena_clear(frame_arena);
+  }
+  uint64_t end = os_now_ns();
+
+  GlyphAtlasStats *stats = &atlas->stats;
+  printf("%4ux%-4u %6u %10llu %10.2f %9.2f%% %10llu %10llu %10llu\n",
+         page_size, page_count, frame_count, (unsigned long long)quad_count,
+         (double)(end - begin) / (double)stats->lookup_count,
+         100.0 * (double)stats->hit_count / (double)stats->lookup_count,
+         (unsigned long long)stats->rasterize_count, (unsigned long long)stats->eviction_count, (unsigned long long)stats->failed_count);
+
+  arena_release(frame_arena);
+  glyph_atlas_release(atlas);
+  for(uint32_t result_idx = 0; result_idx < result_count; ++result_idx)
+  {
+    free_map_text_to_glyphs_result(&results[result_idx]);
+  }
+  free(results);
+}
+
+struct RecordingDrawListTarget
+{
+  // NOTE(hampus): Stands in for a device context and just keeps track of
+  // what it was asked to draw.
+  uint64_t run_count;
+  uint64_t color_layer_count;
+  uint64_t glyph_count;
+  double baseline_sum;
+};
+
+static void
+recording_draw_run(void *state, const DrawListRun *run)
+{
+  RecordingDrawListTarget *target = (RecordingDrawListTarget *)state;
+  target->run_count += 1;
+  target->color_layer_count += run->uses_foreground_color ? 0 : 1;
+  target->glyph_count += run->glyph_count;
+  target->baseline_sum += run->baseline_x + run->baseline_y;
+}
+
+static void
+benchmark_draw_list(const ShapingBackend *backend, const Corpus *corpus, uint32_t frame_count)
+{
+  // NOTE(hampus): Compares building the draw list, which is what every
+  // frame used to cost, with replaying it.
+  const utf16_char *locale = utf16_literal("en-us");
+  const utf16_char *base_family = utf16_literal("Fira Code");
+  const uint32_t line_length = 80;
+  uint32_t line_count = corpus->text_length / line_length;
+
+  MapTextToGlyphsResult *results = (MapTextToGlyphsResult *)malloc(sizeof(MapTextToGlyphsResult) * line_count);
+  for(uint32_t line_idx = 0; line_idx < line_count; ++line_idx)
+  {
+    results[line_idx] = map_text_to_glyphs(backend, locale, base_family, 16.0f, corpus->text + line_idx * line_length, line_length);
+  }
+
+  // NOTE(hampus): The first build fills the color glyph cache, the rest
+  // replay its layers.
+  ColorGlyphCache *color_glyph_cache = color_glyph_cache_alloc(backend->functions, stub_is_color_font, stub_decompose_color_glyph, 0);
+  uint64_t cold_build_begin = os_now_ns();
+  DrawList draw_list = draw_list_build(results, line_count, 50.0f, 50.0f, color_glyph_cache_translate_run, color_glyph_cache);
+  uint64_t cold_build_end = os_now_ns();
+  draw_list_release(&draw_list);
+
+  uint64_t build_begin = os_now_ns();
+  for(uint32_t frame_idx = 0; frame_idx < frame_count; ++frame_idx)
+  {
+    draw_list = draw_list_build(results, line_count, 50.0f, 50.0f, color_glyph_cache_translate_run, color_glyph_cache);
+    draw_list_release(&draw_list);
+  }
+  uint64_t build_end = os_now_ns();
+
+  draw_list = draw_list_build(results, line_count, 50.0f, 50.0f, color_glyph_cache_translate_run, color_glyph_cache);
+  RecordingDrawListTarget recording = {};
+  DrawListTarget target = {recording_draw_run, &recording};
+  uint64_t replay_begin = os_now_ns();
+  for(uint32_t frame_idx = 0; frame_idx < frame_count; ++frame_idx)
+  {
+    draw_list_replay(&draw_list, &target);
+  }
+  uint64_t replay_end = os_now_ns();
+
+  ColorGlyphCacheStats *stats = &color_glyph_cache->stats;
+  printf("%6u %6u %8u %10.2f %10.2f %10.2f %12.1f %12.1f %10llu %10llu\n",
+         line_count, frame_count, draw_list.run_count,
+         (double)(cold_build_end - cold_build_begin) / 1000.0,
+         (double)(build_end - build_begin) / ((double)frame_count * 1000.0),
+         (double)(replay_end - replay_begin) / ((double)frame_count * 1000.0),
+         (double)recording.color_layer_count / (double)frame_count,
+         (double)draw_list.height,
+         (unsigned long long)stats->decompose_count,
+         (unsigned long long)stats->glyph_hit_count);
+
+  draw_list_release(&draw_list);
+  color_glyph_cache_release(color_glyph_cache);
+  for(uint32_t line_idx = 0; line_idx < line_count; ++line_idx)
+  {
+    free_map_text_to_glyphs_result(&results[line_idx]);
+  }
+  free(results);
+}
+
+////////////////////////////////////////////////////////////
+// hampus: glyph positions
+
+static void
+benchmark_glyph_positions(const ShapingBackend *backend, const Corpus *corpus, uint32_t query_count)
+{
+  // NOTE(hampus): Hit tests a point in every segment, once by walking the
+  // advances and once by searching the glyph positions, and checks that
+  // every glyph is found again from the middle of its advance.
+  const utf16_char *locale = utf16_literal("en-us");
+  const utf16_char *base_family = utf16_literal("Fira Code");
+
+  uint64_t plain_begin = os_now_ns();
+  MapTextToGlyphsResult plain = map_text_to_glyphs(backend, locale, base_family, 16.0f, corpus->text, corpus->text_length);
+  uint64_t plain_end = os_now_ns();
+  MapTextToGlyphsResult result = map_text_to_glyphs(backend, locale, base_family, 16.0f, corpus->text, corpus->text_length, 0, MapTextToGlyphsFlag_GlyphPositions);
+  uint64_t positions_end = os_now_ns();
+
+  for(uint64_t segment_idx = 0; segment_idx < result.segment_count; ++segment_idx)
+  {
+    TextToGlyphsSegment *segment = &result.segments[segment_idx];
+    ASSERT(segment->run_width == plain.segments[segment_idx].run_width);
+    for(uint64_t glyph = segment->first_glyph; glyph < segment->first_glyph + segment->glyph_count; ++glyph)
+    {
+      if(result.glyph_advances[glyph] > 0)
+      {
+        float x = glyph_x_in_segment(&result, segment, glyph) + result.glyph_advances[glyph] * 0.5f;
+        ASSERT(glyph_from_segment_x(&result, segment, x) == glyph);
+      }
+    }
+  }
+
+  uint64_t walk_sum = 0;
+  uint64_t search_sum = 0;
+  uint64_t walk_begin = os_now_ns();
+  for(uint32_t query_idx = 0; query_idx < query_count; ++query_idx)
+  {
+    TextToGlyphsSegment *segment = &result.segments[query_idx % result.segment_count];
+    float x = segment->run_width * (float)((query_idx * 7919) % 1024) / 1024.0f;
+    float position = (segment->bidi_level & 1) ? segment->run_width - x : x;
+    uint64_t glyph = segment->first_glyph;
+    float pen = result.glyph_advances[glyph];
+    while(glyph + 1 < segment->first_glyph + segment->glyph_count && pen <= position)
+    {
+      glyph += 1;
+      pen += result.glyph_advances[glyph];
+    }
+    walk_sum += glyph;
+  }
+  uint64_t walk_end = os_now_ns();
+  for(uint32_t query_idx = 0; query_idx < query_count; ++query_idx)
+  {
+    TextToGlyphsSegment *segment = &result.segments[query_idx % result.segment_count];
+    float x = segment->run_width * (float)((query_idx * 7919) % 1024) / 1024.0f;
+    search_sum += glyph_from_segment_x(&result, segment, x);
+  }
+  uint64_t search_end = os_now_ns();
+
+  // NOTE(hampus): The walk sums the advances in a different order than the
+  // positions were computed in, so the two may only disagree when x is on a
+  // boundary between two glyphs, give or take the rounding of the sums.
+  uint32_t tie_count = 0;
+  int64_t tie_difference = 0;
+  for(uint32_t query_idx = 0; query_idx < query_count; ++query_idx)
+  {
+    TextToGlyphsSegment *segment = &result.segments[query_idx % result.segment_count];
+    float x = segment->run_width * (float)((query_idx * 7919) % 1024) / 1024.0f;
+    float position = (segment->bidi_level & 1) ? segment->run_width - x : x;
+    uint64_t walk_glyph = segment->first_glyph;
+    float pen = result.glyph_advances[walk_glyph];
+    while(walk_glyph + 1 < segment->first_glyph + segment->glyph_count && pen <= position)
+    {
+      walk_glyph += 1;
+      pen += result.glyph_advances[walk_glyph];
+    }
+    uint64_t search_glyph = glyph_from_segment_x(&result, segment, x);
+    if(walk_glyph != search_glyph)
+    {
+      uint64_t boundary_glyph = walk_glyph > search_glyph ? walk_glyph : search_glyph;
+      float tolerance = 1e-5f * segment->run_width + 1e-4f;
+      ASSERT(walk_glyph + 1 == boundary_glyph || search_glyph + 1 == boundary_glyph);
+      float distance = result.glyph_positions[boundary_glyph] - position;
+      ASSERT(-tolerance <= distance && distance <= tolerance);
+      tie_count += 1;
+      tie_difference += (int64_t)walk_glyph - (int64_t)search_glyph;
+    }
+  }
+  ASSERT((int64_t)(walk_sum - search_sum) == tie_difference);
+
+  printf("%8llu %8llu %14.2f %14.2f %12.1f %12.1f %10u\n",
+         (unsigned long long)result.glyph_count,
+         (unsigned long long)result.segment_count,
+         (double)(plain_end - plain_begin) / 1000.0,
+         (double)(positions_end - plain_end) / 1000.0,
+         (double)(walk_end - walk_begin) / query_count,
+         (double)(search_end - walk_end) / query_count,
+         tie_count);
+
+  free_map_text_to_glyphs_result(&result);
+  free_map_text_to_glyphs_result(&plain);
+}
+
+////////////////////////////////////////////////////////////
+// hampus: line wrapping
+
+static void
+benchmark_line_wrap(const ShapingBackend *backend, const Corpus *corpus, LineWrapMode mode, uint32_t width_count)
+{
+  // NOTE(hampus): Wraps the text at widths from 200 to 2000, like a window
+  // being dragged wider, and checks that the lines cover the text in order.
+  const utf16_char *locale = utf16_literal("en-us");
+  const utf16_char *base_family = utf16_literal("Fira Code");
+  MapTextToGlyphsResult result = map_text_to_glyphs(backend, locale, base_family, 16.0f, corpus->text, corpus->text_length, 0, MapTextToGlyphsFlag_LineBreakpoints);
+
+  uint64_t prepare_begin = os_now_ns();
+  LineWrapper *wrapper = line_wrapper_alloc(&result);
+  uint64_t prepare_end = os_now_ns();
+
+  Arena *arena = arena_alloc();
+  uint64_t total_ns = 0;
+  uint64_t max_ns = 0;
+  uint64_t total_line_count = 0;
+  uint64_t hyphen_count = 0;
+  for(uint32_t width_idx = 0; width_idx < width_count; ++width_idx)
+  {
+    float max_width = 200.0f + 1800.0f * (float)width_idx / (float)width_count;
+    uint32_t line_count = 0;
+    uint64_t begin = os_now_ns();
+    LineWrapLine *lines = line_wrap(wrapper, arena, max_width, mode, &line_count);
+    uint64_t end = os_now_ns();
+    total_ns += end - begin;
+    max_ns = end - begin > max_ns ? end - begin : max_ns;
+    total_line_count += line_count;
+
+    // NOTE(hampus): Lines that wrap after a soft hyphen inside a word, and
+    // only those, show a hyphen
+    uint32_t text_position = 0;
+    for(uint32_t line_idx = 0; line_idx < line_count; ++line_idx)
+    {
+      LineWrapLine *line = &lines[line_idx];
+      ASSERT(line->text_offset == text_position);
+      text_position += line->text_length;
+      bool ends_in_soft_hyphen = (line->text_length != 0 && corpus->text[text_position - 1] == 0x00AD &&
+                                  !result.line_breakpoints[text_position].is_whitespace);
+      ASSERT((line->hyphen_glyph != 0) == (ends_in_soft_hyphen && !line->ends_paragraph));
+      ASSERT(line->hyphen_x <= line->width);
+      hyphen_count += line->hyphen_glyph != 0 ? 1 : 0;
+    }
+    ASSERT(text_position == corpus->text_length);
+    arena_clear(arena);
+  }
+
+  printf("%-8s %-8s %8u %10u %12.1f %12.1f %12.1f %10.1f %10.1f\n",
+         corpus->name,
+         mode == LineWrapMode_Greedy ? "greedy" : "optimal",
+         corpus->text_length,
+         wrapper->break_count,
+         (double)(prepare_end - prepare_begin) / 1000.0,
+         (double)total_ns / width_count / 1000.0,
+         (double)max_ns / 1000.0,
+         (double)total_line_count / width_count,
+         (double)hyphen_count / width_count);
+
+  arena_release(arena);
+  line_wrapper_release(wrapper);
+  free_map_text_to_glyphs_result(&result);
+}
+
+////////////////////////////////////////////////////////////
+// hampus: incremental re-shaping
+
+static uint32_t
+random_text_position(uint32_t *state, const utf16_char *text, uint32_t text_length)
+{
+  // NOTE(hampus): Never between the halves of a surrogate pair
+  *state = *state * 1664525 + 1013904223;
+  uint32_t result = (*state >> 8) % (text_length + 1);
+  if(result > 0 && result < text_length && 0xDC00 <= text[result] && text[result] <= 0xDFFF)
+  {
+    result -= 1;
+  }
+  return result;
+}
+
+static void
+check_remap(const ShapingBackend *backend, const Corpus *corpus, uint32_t flags, uint32_t edit_count)
+{
+  // NOTE(hampus): Makes random edits of up to a few characters and checks
+  // after every one that the re-shaped result is the same as shaping the
+  // edited text from scratch.
+  const utf16_char *locale = utf16_literal("en-us");
+  const utf16_char *base_family = utf16_literal("Fira Code");
+
+  uint32_t text_capacity = corpus->text_length + edit_count * 8;
+  utf16_char *text = (utf16_char *)malloc(sizeof(utf16_char) * text_capacity);
+  memory_copy_typed(text, corpus->text, corpus->text_length);
+  uint32_t text_length = corpus->text_length;
+
+  ShapingContext *context = shaping_context_alloc();
+  MapTextToGlyphsResult result = map_text_to_glyphs(backend, locale, base_family, 16.0f, text, text_length, 0, flags);
+  uint32_t state = 0x2545F491;
+  for(uint32_t edit_idx = 0; edit_idx < edit_count; ++edit_idx)
+  {
+    uint32_t offset = random_text_position(&state, text, text_length);
+    uint32_t opl = offset + (state >> 4) % 8;
+    opl = opl < text_length ? opl : text_length;
+    if(opl < text_length && 0xDC00 <= text[opl] && text[opl] <= 0xDFFF)
+    {
+      opl += 1;
+    }
+    uint32_t inserted_offset = random_text_position(&state, corpus->text, corpus->text_length);
+    uint32_t inserted_opl = inserted_offset + (state >> 12) % 8;
+    inserted_opl = inserted_opl < corpus->text_length ? inserted_opl : corpus->text_length;
+    if(inserted_opl < corpus->text_length && 0xDC00 <= corpus->text[inserted_opl] && corpus->text[inserted_opl] <= 0xDFFF)
+    {
+      inserted_opl += 1;
+    }
+
+    TextEdit edit = {};
+    edit.offset = offset;
+    edit.removed_length = opl - offset;
+    edit.inserted_text = corpus->text + inserted_offset;
+    edit.inserted_length = inserted_opl - inserted_offset;
+    remap_text_to_glyphs_after_edit(&result, backend, locale, base_family, 16.0f, text, text_length, &edit, 0, flags, context);
+
+    memmove(text + offset + edit.inserted_length, text + opl, sizeof(utf16_char) * (text_length - opl));
+    memory_copy_typed(text + offset, edit.inserted_text, edit.inserted_length);
+    text_length = text_length - edit.removed_length + edit.inserted_length;
+
+    MapTextToGlyphsResult expected = map_text_to_glyphs(backend, locale, base_family, 16.0f, text, text_length, 0, flags);
+    assert_results_match(&result, &expected);
+
+    // NOTE(hampus): Every now and then the gaps are closed, which has to
+    // give the same result, and the next edits start from flat arrays.
+    if(edit_idx % 16 == 15)
+    {
+      close_text_to_glyphs_gaps(&result);
+      ASSERT(result.glyph_gap_length == 0 && result.text_gap_length == 0);
+      assert_results_match(&result, &expected);
+    }
+    free_map_text_to_glyphs_result(&expected);
+  }
+
+  free_map_text_to_glyphs_result(&result);
+  shaping_context_release(context);
+  free(text);
+}
+
+static void
+benchmark_remap(const ShapingBackend *backend, const Corpus *corpus, uint32_t edit_count)
+{
+  // NOTE(hampus): Types a character at a random place and deletes it again,
+  // like someone editing a long line, and compares that to shaping the
+  // whole text again. Then types edit_count characters in a row in the
+  // middle of the text and backspaces over them, which only moves the gaps
+  // along with the cursor.
+  const utf16_char *locale = utf16_literal("en-us");
+  const utf16_char *base_family = utf16_literal("Fira Code");
+  const uint32_t flags = MapTextToGlyphsFlag_GlyphPositions | MapTextToGlyphsFlag_LineBreakpoints;
+
+  utf16_char *text = (utf16_char *)malloc(sizeof(utf16_char) * (corpus->text_length + edit_count));
+  memory_copy_typed(text, corpus->text, corpus->text_length);
+  uint32_t text_length = corpus->text_length;
+
+  ShapingContext *context = shaping_context_alloc();
+  const uint32_t full_count = 8;
+  uint64_t full_begin = os_now_ns();
+  for(uint32_t full_idx = 0; full_idx < full_count; ++full_idx)
+  {
+    MapTextToGlyphsResult full = map_text_to_glyphs(backend, locale, base_family, 16.0f, text, text_length, 0, flags, context);
+    free_map_text_to_glyphs_result(&full);
+  }
+  uint64_t full_end = os_now_ns();
+  MapTextToGlyphsResult result = map_text_to_glyphs(backend, locale, base_family, 16.0f, text, text_length, 0, flags, context);
+
+  static const utf16_char typed = 'x';
+  uint32_t state = 0x9E3779B9;
+  uint64_t total_ns = 0;
+  for(uint32_t edit_idx = 0; edit_idx < edit_count; ++edit_idx)
+  {
+    uint32_t offset = random_text_position(&state, text, text_length);
+
+    TextEdit insert = {};
+    insert.offset = offset;
+    insert.inserted_text = &typed;
+    insert.inserted_length = 1;
+    uint64_t begin = os_now_ns();
+    remap_text_to_glyphs_after_edit(&result, backend, locale, base_family, 16.0f, text, text_length, &insert, 0, flags, context);
+    uint64_t end = os_now_ns();
+    total_ns += end - begin;
+    memmove(text + offset + 1, text + offset, sizeof(utf16_char) * (text_length - offset));
+    text[offset] = typed;
+    text_length += 1;
+
+    TextEdit remove = {};
+    remove.offset = offset;
+    remove.removed_length = 1;
+    begin = os_now_ns();
+    remap_text_to_glyphs_after_edit(&result, backend, locale, base_family, 16.0f, text, text_length, &remove, 0, flags, context);
+    end = os_now_ns();
+    total_ns += end - begin;
+    memmove(text + offset, text + offset + 1, sizeof(utf16_char) * (text_length - offset - 1));
+    text_length -= 1;
+  }
+
+  MapTextToGlyphsResult expected = map_text_to_glyphs(backend, locale, base_family, 16.0f, text, text_length, 0, flags);
+  assert_results_match(&result, &expected);
+
+  uint32_t cursor = text_length / 2;
+  if(0xDC00 <= text[cursor] && text[cursor] <= 0xDFFF)
+  {
+    cursor -= 1;
+  }
+  uint64_t typing_ns = 0;
+  for(uint32_t edit_idx = 0; edit_idx < 2 * edit_count; ++edit_idx)
+  {
+    bool is_backspace = edit_idx >= edit_count;
+    TextEdit edit = {};
+    edit.offset = is_backspace ? cursor - 1 : cursor;
+    edit.removed_length = is_backspace ? 1 : 0;
+    edit.inserted_text = &typed;
+    edit.inserted_length = is_backspace ? 0 : 1;
+    uint64_t begin = os_now_ns();
+    remap_text_to_glyphs_after_edit(&result, backend, locale, base_family, 16.0f, text, text_length, &edit, 0, flags, context);
+    uint64_t end = os_now_ns();
+    typing_ns += end - begin;
+    if(is_backspace)
+    {
+      memmove(text + cursor - 1, text + cursor, sizeof(utf16_char) * (text_length - cursor));
+      cursor -= 1;
+      text_length -= 1;
+    }
+    else
+    {
+      memmove(text + cursor + 1, text + cursor, sizeof(utf16_char) * (text_length - cursor));
+      text[cursor] = typed;
+      cursor += 1;
+      text_length += 1;
+    }
+  }
+  assert_results_match(&result, &expected);
+
+  printf("%-8s %8u %10u %12.2f %12.2f %12.2f\n",
+         corpus->name,
+         corpus->text_length,
+         2 * edit_count,
+         (double)(full_end - full_begin) / full_count / 1000.0,
+         (double)total_ns / (2 * edit_count) / 1000.0,
+         (double)typing_ns / (2 * edit_count) / 1000.0);
+
+  free_map_text_to_glyphs_result(&expected);
+  free_map_text_to_glyphs_result(&result);
+  shaping_context_release(context);
+  free(text);
+}
+
+////////////////////////////////////////////////////////////
+// hampus: streaming
+
+struct StreamCheckReader
+{
+  const utf16_char *text;
+  uint32_t text_length;
+  uint32_t position;
+  uint32_t state;
+  uint32_t max_chunk_length;
+};
+
+static uint32_t
+stream_check_read(void *user_data, utf16_char *buffer, uint32_t capacity)
+{
+  // NOTE(hampus): Hands out the text in chunks of random length, like a file
+  // or a socket would, never more than was asked for
+  StreamCheckReader *reader = (StreamCheckReader *)user_data;
+  reader->state = reader->state * 1664525 + 1013904223;
+  uint32_t length = 1 + (reader->state >> 8) % reader->max_chunk_length;
+  length = length < capacity ? length : capacity;
+  length = length < reader->text_length - reader->position ? length : reader->text_length - reader->position;
+  memory_copy_typed(buffer, reader->text + reader->position, length);
+  reader->position += length;
+  return length;
+}
+
+struct StreamCheck
+{
+  const MapTextToGlyphsResult *expected;
+  const utf16_char *text;
+  uint32_t text_length;
+  uint64_t window_text_offset;
+  uint32_t window_count;
+  uint64_t emitted_text_length;
+  uint64_t emitted_glyph_count;
+};
+
+static void
+stream_check_emit(void *user_data, const MapTextToGlyphsResult *window, const TextToGlyphsSegment *segment, uint64_t window_text_offset)
+{
+  // NOTE(hampus): Every segment has to have the same glyphs, fonts and
+  // clusters as the same text in the one-shot result, and every new window
+  // has to start on a grapheme cluster boundary.
+  StreamCheck *check = (StreamCheck *)user_data;
+  const MapTextToGlyphsResult *expected = check->expected;
+  if(check->window_count == 0 || window_text_offset != check->window_text_offset)
+  {
+    uint32_t cut = (uint32_t)window_text_offset;
+    if(cut > 0)
+    {
+      uint32_t codepoint = 0;
+      decode_utf16(check->text + cut, check->text_length - cut, &codepoint);
+      ASSERT(check->text[cut - 1] != 0x200D);
+      ASSERT(!is_cluster_extender(codepoint));
+      ASSERT(!(0xDC00 <= check->text[cut] && check->text[cut] <= 0xDFFF));
+    }
+    check->window_text_offset = window_text_offset;
+    check->window_count += 1;
+  }
+
+  uint32_t text_offset = (uint32_t)window_text_offset + segment->text_offset;
+  const TextToGlyphsSegment *expected_segment = segment_from_text_position(expected, text_offset);
+  ASSERT(expected_segment != 0);
+  ASSERT(text_offset + segment->text_length <= expected_segment->text_offset + expected_segment->text_length);
+  ASSERT(shaping_font_face_from_segment(window, segment) == shaping_font_face_from_segment(expected, expected_segment));
+  ASSERT(segment->bidi_level == expected_segment->bidi_level && segment->font_size_em == expected_segment->font_size_em);
+
+  uint64_t expected_first_glyph = glyph_from_text_position(expected, text_offset);
+  for(uint64_t idx = 0; idx < segment->glyph_count; ++idx)
+  {
+    ASSERT(window->glyph_indices[segment->first_glyph + idx] == expected->glyph_indices[expected_first_glyph + idx]);
+    ASSERT(window->glyph_advances[segment->first_glyph + idx] == expected->glyph_advances[expected_first_glyph + idx]);
+  }
+  for(uint32_t idx = 0; idx < segment->text_length; ++idx)
+  {
+    uint32_t window_glyph = window->cluster_map[segment->text_offset + idx] - (uint32_t)segment->first_glyph;
+    uint32_t expected_glyph = expected->cluster_map[text_offset + idx] - (uint32_t)expected_first_glyph;
+    ASSERT(window_glyph == expected_glyph);
+  }
+  check->emitted_text_length += segment->text_length;
+  check->emitted_glyph_count += segment->glyph_count;
+}
+
+static void
+check_stream(const ShapingBackend *backend, const char *name, const utf16_char *text, uint32_t text_length, uint32_t window_capacity, uint32_t max_chunk_length)
+{
+  // NOTE(hampus): Streams the text through a small window in random chunks
+  // and checks it against shaping the text in one go, and how much memory
+  // either of them needs at most.
+  const utf16_char *locale = utf16_literal("en-us");
+  const utf16_char *base_family = utf16_literal("Fira Code");
+
+  memory_accounting_reset_peak(benchmark_memory_accounting);
+  uint64_t bytes_before = memory_accounting_stats(benchmark_memory_accounting).current_bytes;
+  MapTextToGlyphsResult expected = map_text_to_glyphs(backend, locale, base_family, 16.0f, text, text_length);
+  uint64_t one_shot_peak_bytes = memory_accounting_stats(benchmark_memory_accounting).peak_bytes - bytes_before;
+
+  StreamCheckReader reader = {};
+  reader.text = text;
+  reader.text_length = text_length;
+  reader.state = 0x7F4A7C15;
+  reader.max_chunk_length = max_chunk_length;
+  StreamCheck check = {};
+  check.expected = &expected;
+  check.text = text;
+  check.text_length = text_length;
+
+  memory_accounting_reset_peak(benchmark_memory_accounting);
+  bytes_before = memory_accounting_stats(benchmark_memory_accounting).current_bytes;
+  map_text_stream_to_glyphs(backend, locale, base_family, 16.0f, stream_check_read, &reader, stream_check_emit, &check, window_capacity);
+  uint64_t stream_peak_bytes = memory_accounting_stats(benchmark_memory_accounting).peak_bytes - bytes_before;
+
+  ASSERT(reader.position == text_length);
+  ASSERT(check.emitted_glyph_count == expected.glyph_count);
+  uint64_t mapped_text_length = 0;
+  for(uint64_t segment_idx = 0; segment_idx < expected.segment_count; ++segment_idx)
+  {
+    mapped_text_length += expected.segments[segment_idx].text_length;
+  }
+  ASSERT(check.emitted_text_length == mapped_text_length);
+
+  printf("%-10s %8u %8u %8u %10u %14.1f %14.1f\n",
+         name,
+         text_length,
+         window_capacity,
+         max_chunk_length,
+         check.window_count,
+         (double)stream_peak_bytes / 1024.0,
+         (double)one_shot_peak_bytes / 1024.0);
+
+  free_map_text_to_glyphs_result(&expected);
+}
+
+////////////////////////////////////////////////////////////
+// hampus: batch shaping
+
+static void
+benchmark_batch(const ShapingBackend *backend, Arena *arena, const Corpus *corpus, uint32_t job_count, uint32_t round_count)
+{
+  // NOTE(hampus): Shapes strings of 8 to 263 characters one after the other
+  // and then as a batch on pools of 1, 2, 4 and one worker per logical
+  // processor. Every batch result has to be the same as shaping its job on
+  // its own. The rounds after the first shape over the results of the one
+  // before, like a caller that shapes the same strings every frame would.
+  MapTextToGlyphsJob *jobs = push_array(arena, MapTextToGlyphsJob, job_count);
+  uint64_t char_count = 0;
+  uint32_t position = 0;
+  for(uint32_t job_idx = 0; job_idx < job_count; ++job_idx)
+  {
+    uint32_t length = 8 + (job_idx * 7919) % 256;
+    if(position + length > corpus->text_length)
+    {
+      position = (job_idx * 104729) % (corpus->text_length / 2);
+    }
+    uint32_t begin = position;
+    uint32_t end = position + length;
+    if(corpus->text[begin] >= 0xDC00 && corpus->text[begin] < 0xE000)
+    {
+      begin += 1;
+    }
+    if(corpus->text[end - 1] >= 0xD800 && corpus->text[end - 1] < 0xDC00)
+    {
+      end -= 1;
+    }
+    MapTextToGlyphsJob *job = &jobs[job_idx];
+    job->text = corpus->text + begin;
+    job->text_length = end - begin;
+    job->base_family = utf16_literal("Fira Code");
+    job->font_size = 16.0f;
+    job->locale = utf16_literal("en-us");
+    job->flags = (job_idx % 3 == 0) ? MapTextToGlyphsFlag_GlyphPositions : 0;
+    char_count += job->text_length;
+    position = end;
+  }
+
+  MapTextToGlyphsResult *expected = push_array(arena, MapTextToGlyphsResult, job_count);
+  MapTextToGlyphsResult *results = push_array(arena, MapTextToGlyphsResult, job_count);
+  uint64_t serial_ns = 0;
+  for(uint32_t round_idx = 0; round_idx < round_count; ++round_idx)
+  {
+    uint64_t begin = os_now_ns();
+    for(uint32_t job_idx = 0; job_idx < job_count; ++job_idx)
+    {
+      const MapTextToGlyphsJob *job = &jobs[job_idx];
+      results[job_idx] = map_text_to_glyphs(backend, job->locale, job->base_family, job->font_size, job->text, job->text_length, 0, job->flags);
+    }
+    serial_ns += os_now_ns() - begin;
+    for(uint32_t job_idx = 0; job_idx < job_count; ++job_idx)
+    {
+      if(round_idx == 0)
+      {
+        expected[job_idx] = results[job_idx];
+        results[job_idx] = {};
+      }
+      else
+      {
+        free_map_text_to_glyphs_result(&results[job_idx]);
+      }
+    }
+  }
+  printf("%8s %8u %10.2f %12.2f %9.2fx %10s\n",
+         "serial",
+         job_count,
+         (double)serial_ns / round_count / 1e6,
+         (double)char_count * round_count * 1000.0 / (double)serial_ns,
+         1.0,
+         "");
+
+  uint32_t processor_count = os_logical_processor_count();
+  uint32_t worker_counts[] = {1, 2, 4, processor_count};
+  for(uint32_t count_idx = 0; count_idx < sizeof(worker_counts) / sizeof(worker_counts[0]); ++count_idx)
+  {
+    uint32_t worker_count = worker_counts[count_idx];
+    if(count_idx == 3 && processor_count <= 4)
+    {
+      break;
+    }
+    ShapingThreadPool *pool = shaping_thread_pool_alloc(worker_count);
+    uint64_t batch_ns = 0;
+    for(uint32_t round_idx = 0; round_idx < round_count; ++round_idx)
+    {
+      uint64_t begin = os_now_ns();
+      map_text_to_glyphs_batch(pool, backend, jobs, job_count, results);
+      batch_ns += os_now_ns() - begin;
+      for(uint32_t job_idx = 0; job_idx < job_count; ++job_idx)
+      {
+        assert_results_match(&results[job_idx], &expected[job_idx]);
+      }
+    }
+    for(uint32_t job_idx = 0; job_idx < job_count; ++job_idx)
+    {
+      free_map_text_to_glyphs_result(&results[job_idx]);
+    }
+    uint64_t completed_job_count = 0;
+    uint64_t stolen_job_count = 0;
+    for(uint32_t worker_idx = 0; worker_idx < worker_count; ++worker_idx)
+    {
+      completed_job_count += pool->workers[worker_idx].completed_job_count;
+      stolen_job_count += pool->workers[worker_idx].stolen_job_count;
+    }
+    ASSERT(completed_job_count == (uint64_t)job_count * round_count);
+    shaping_thread_pool_release(pool);
+
+    printf("%8u %8u %10.2f %12.2f %9.2fx %10.1f\n",
+           worker_count,
+           job_count,
+           (double)batch_ns / round_count / 1e6,
+           (double)char_count * round_count * 1000.0 / (double)batch_ns,
+           (double)serial_ns / (double)batch_ns,
+           (double)stolen_job_count / round_count);
+  }
+
+  for(uint32_t job_idx = 0; job_idx < job_count; ++job_idx)
+  {
+    free_map_text_to_glyphs_result(&expected[job_idx]);
+  }
+}
+
+////////////////////////////////////////////////////////////
+// hampus: disk cache
+
+struct DiskCacheRunResult
+{
+  uint64_t total_ns;
+  uint64_t open_ns;
+  uint64_t save_ns;
+  ShapingDiskCacheStats stats;
+};
+
+static DiskCacheRunResult
+benchmark_disk_cache_run(const ShapingBackend *backend, StubShapingBackend *stub_backend, const char *path, const Corpus *strings, uint32_t string_count, bool save)
+{
+  // NOTE(hampus): One launch of an app that shapes all of its UI strings
+  // before the first frame, checking every result against shaping it anew
+  const utf16_char *locale = utf16_literal("en-us");
+  const utf16_char *base_family = utf16_literal("Segoe UI");
+  uint32_t flags = MapTextToGlyphsFlag_GlyphPositions;
+  DiskCacheRunResult result = {};
+
+  uint64_t begin = os_now_ns();
+  ShapingDiskCache *cache = shaping_disk_cache_open(path, backend, &stub_font_file_functions, stub_backend);
+  uint64_t open_end = os_now_ns();
+  for(uint32_t string_idx = 0; string_idx < string_count; ++string_idx)
+  {
+    const Corpus *string = &strings[string_idx];
+    MapTextToGlyphsResult shaped = map_text_to_glyphs_with_disk_cache(cache, backend, locale, base_family, 14.0f, string->text, string->text_length, 0, flags);
+    free_map_text_to_glyphs_result(&shaped);
+  }
+  uint64_t end = os_now_ns();
+  result.open_ns = open_end - begin;
+  result.total_ns = end - begin;
+
+  for(uint32_t string_idx = 0; string_idx < string_count; ++string_idx)
+  {
+    const Corpus *string = &strings[string_idx];
+    MapTextToGlyphsResult expected = map_text_to_glyphs(backend, locale, base_family, 14.0f, string->text, string->text_length, 0, flags);
+    MapTextToGlyphsResult cached = {};
+    ASSERT(shaping_disk_cache_lookup(cache, locale, base_family, 14.0f, string->text, string->text_length, flags, &cached));
+    assert_results_match(&cached, &expected);
+    free_map_text_to_glyphs_result(&cached);
+    free_map_text_to_glyphs_result(&expected);
+  }
+  result.stats = cache->stats;
+  result.stats.hit_count -= string_count;
+
+  if(save)
+  {
+    uint64_t save_begin = os_now_ns();
+    ASSERT(shaping_disk_cache_save(cache));
+    result.save_ns = os_now_ns() - save_begin;
+  }
+  shaping_disk_cache_close(cache);
+  return result;
+}
+
+static void
+print_disk_cache_run(const char *name, uint32_t string_count, const DiskCacheRunResult *result)
+{
+  printf("%-12s %8u %10.1f %10.1f %10.1f %8llu %8llu %8llu\n",
+         name,
+         string_count,
+         (double)result->total_ns / 1000.0,
+         (double)result->open_ns / 1000.0,
+         (double)result->save_ns / 1000.0,
+         (unsigned long long)result->stats.hit_count,
+         (unsigned long long)result->stats.miss_count,
+         (unsigned long long)result->stats.stale_entry_count);
+}
+
+static void
+benchmark_disk_cache(const ShapingBackend *backend, StubShapingBackend *stub_backend, Arena *arena, const Corpus *corpus, uint32_t string_count)
+{
+  // NOTE(hampus): Cuts the corpus into short strings, then launches with no
+  // cache file, with the file the first launch wrote, after the emoji font
+  // was updated, and once more after that.
+  const char *path = "text_to_glyphs_disk_cache.bin";
+  remove(path);
+
+  Corpus *strings = push_array(arena, Corpus, string_count);
+  uint32_t position = 0;
+  for(uint32_t string_idx = 0; string_idx < string_count; ++string_idx)
+  {
+    uint32_t length = 8 + (string_idx * 7919) % 33;
+    if(position + length > corpus->text_length)
+    {
+      position = (string_idx * 104729) % (corpus->text_length / 2);
+    }
+    uint32_t begin = position;
+    uint32_t end = position + length;
+    if(corpus->text[begin] >= 0xDC00 && corpus->text[begin] < 0xE000)
+    {
+      begin += 1;
+    }
+    if(corpus->text[end - 1] >= 0xD800 && corpus->text[end - 1] < 0xDC00)
+    {
+      end -= 1;
+    }
+    strings[string_idx].name = corpus->name;
+    strings[string_idx].text = corpus->text + begin;
+    strings[string_idx].text_length = end - begin;
+    position = end;
+  }
+
+  DiskCacheRunResult uncached = {};
+  uint64_t uncached_begin = os_now_ns();
+  for(uint32_t string_idx = 0; string_idx < string_count; ++string_idx)
+  {
+    MapTextToGlyphsResult shaped = map_text_to_glyphs(backend, utf16_literal("en-us"), utf16_literal("Segoe UI"), 14.0f, strings[string_idx].text, strings[string_idx].text_length, 0, MapTextToGlyphsFlag_GlyphPositions);
+    free_map_text_to_glyphs_result(&shaped);
+  }
+  uncached.total_ns = os_now_ns() - uncached_begin;
+  uncached.stats.miss_count = string_count;
+  print_disk_cache_run("no cache", string_count, &uncached);
+
+  DiskCacheRunResult cold = benchmark_disk_cache_run(backend, stub_backend, path, strings, string_count, true);
+  // NOTE(hampus): The corpus repeats, so some strings hit what the same
+  // launch added before
+  ASSERT(cold.stats.miss_count != 0 && cold.stats.stale_entry_count == 0);
+  print_disk_cache_run("cold", string_count, &cold);
+
+  DiskCacheRunResult mapped = benchmark_disk_cache_run(backend, stub_backend, path, strings, string_count, true);
+  ASSERT(mapped.stats.miss_count == 0);
+  print_disk_cache_run("mapped", string_count, &mapped);
+
+  stub_backend->font_file_versions[StubFontKind_Emoji].modified_time += 1;
+  DiskCacheRunResult updated = benchmark_disk_cache_run(backend, stub_backend, path, strings, string_count, true);
+  ASSERT(updated.stats.stale_entry_count != 0 && updated.stats.miss_count != 0 && updated.stats.hit_count != 0);
+  print_disk_cache_run("font update", string_count, &updated);
+
+  DiskCacheRunResult resaved = benchmark_disk_cache_run(backend, stub_backend, path, strings, string_count, false);
+  ASSERT(resaved.stats.miss_count == 0 && resaved.stats.stale_entry_count == 0);
+  print_disk_cache_run("mapped", string_count, &resaved);
+
+  // NOTE(hampus): An entry whose cluster map points past the glyphs misses
+  // when it's looked up, the rest of the file is still used, and the entry
+  // is dropped on save
+  FILE *file = fopen(path, "r+b");
+  ASSERT(file != 0);
+  ShapingDiskCacheHeader header = {};
+  ShapingDiskCacheEntry entry = {};
+  ASSERT(fread(&header, sizeof(header), 1, file) == 1);
+  fseek(file, (long)header.entries_offset, SEEK_SET);
+  ASSERT(fread(&entry, sizeof(entry), 1, file) == 1);
+  uint32_t bad_cluster = (uint32_t)entry.glyph_count + 1;
+  fseek(file, (long)entry.cluster_map_offset, SEEK_SET);
+  fwrite(&bad_cluster, sizeof(bad_cluster), 1, file);
+  fclose(file);
+  ShapingDiskCache *cache = shaping_disk_cache_open(path, backend, &stub_font_file_functions, stub_backend);
+  ASSERT(cache->header != 0 && cache->header->entry_count == header.entry_count);
+  const utf16_char *bad_text = (const utf16_char *)(cache->mapping.data + entry.text_offset);
+  for(uint32_t lookup_idx = 0; lookup_idx < 2; ++lookup_idx)
+  {
+    MapTextToGlyphsResult cached = {};
+    ASSERT(!shaping_disk_cache_lookup(cache, utf16_literal("en-us"), utf16_literal("Segoe UI"), entry.font_size, bad_text, entry.text_length, entry.flags, &cached));
+    ASSERT(cache->stats.invalid_entry_count == 1);
+  }
+  ASSERT(shaping_disk_cache_save(cache));
+  ASSERT(cache->header != 0 && cache->header->entry_count == header.entry_count - 1);
+  shaping_disk_cache_close(cache);
+
+  remove(path);
+}
+
+////////////////////////////////////////////////////////////
+// hampus: utf-8 text
+
+static uint32_t
+utf8_from_corpus(Arena *arena, const Corpus *corpus, char **utf8)
+{
+  char *result = push_array_no_zero(arena, char, corpus->text_length * 3);
+  uint32_t size = 0;
+  for(uint32_t idx = 0; idx < corpus->text_length;)
+  {
+    uint32_t codepoint = 0;
+    idx += decode_utf16(corpus->text + idx, corpus->text_length - idx, &codepoint);
+    if(codepoint < 0x80)
+    {
+      result[size++] = (char)codepoint;
+    }
+    else if(codepoint < 0x800)
+    {
+      result[size++] = (char)(0xC0 | (codepoint >> 6));
+      result[size++] = (char)(0x80 | (codepoint & 0x3F));
+    }
+    else if(codepoint < 0x10000)
+    {
+      result[size++] = (char)(0xE0 | (codepoint >> 12));
+      result[size++] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
+      result[size++] = (char)(0x80 | (codepoint & 0x3F));
+    }
+    else
+    {
+      result[size++] = (char)(0xF0 | (codepoint >> 18));
+      result[size++] = (char)(0x80 | ((codepoint >> 12) & 0x3F));
+      result[size++] = (char)(0x80 | ((codepoint >> 6) & 0x3F));
+      result[size++] = (char)(0x80 | (codepoint & 0x3F));
+    }
+  }
+  *utf8 = result;
+  return size;
+}
+
+static void
+benchmark_utf8(const ShapingBackend *backend, Arena *arena, const char *name, const char *text, uint32_t text_size, const Corpus *expected, uint32_t iteration_count)
+{
+  // NOTE(hampus): Transcodes the text with the scalar path and the kernel,
+  // checks that they agree, with `expected` if it's given, and compares
+  // shaping the UTF-8 to shaping the same text as UTF-16.
+  uint64_t arena_pos_before = arena_pos(arena);
+  utf16_char *scalar_text = push_array_no_zero(arena, utf16_char, text_size);
+  utf16_char *kernel_text = push_array_no_zero(arena, utf16_char, text_size);
+  uint32_t *scalar_offsets = push_array_no_zero(arena, uint32_t, text_size + 1);
+  uint32_t *kernel_offsets = push_array_no_zero(arena, uint32_t, text_size + 1);
+
+  uint32_t scalar_length = 0;
+  uint32_t kernel_length = 0;
+  uint64_t scalar_begin = os_now_ns();
+  for(uint32_t iteration_idx = 0; iteration_idx < iteration_count; ++iteration_idx)
+  {
+    scalar_length = utf16_from_utf8_scalar(text, text_size, scalar_text, scalar_offsets);
+  }
+  uint64_t kernel_begin = os_now_ns();
+  for(uint32_t iteration_idx = 0; iteration_idx < iteration_count; ++iteration_idx)
+  {
+    kernel_length = utf16_from_utf8(text, text_size, kernel_text, kernel_offsets);
+  }
+  uint64_t kernel_end = os_now_ns();
+
+  ASSERT(scalar_length == kernel_length);
+  ASSERT(memory_match(scalar_text, kernel_text, kernel_length * sizeof(utf16_char)));
+  ASSERT(memory_match(scalar_offsets, kernel_offsets, (kernel_length + 1) * sizeof(uint32_t)));
+  if(expected != 0)
+  {
+    ASSERT(kernel_length == expected->text_length);
+    ASSERT(memory_match(kernel_text, expected->text, kernel_length * sizeof(utf16_char)));
+  }
+
+  //----------------------------------------------------------
+  // hampus: shaping
+
+  const utf16_char *locale = utf16_literal("en-us");
+  const utf16_char *base_family = utf16_literal("Fira Code");
+  ShapingContext *context = shaping_context_alloc();
+
+  uint64_t utf16_begin = os_now_ns();
+  MapTextToGlyphsResult utf16_result = map_text_to_glyphs(backend, locale, base_family, 16.0f, kernel_text, kernel_length, 0, 0, context);
+  uint64_t utf8_begin = os_now_ns();
+  MapTextToGlyphsResult utf8_result = map_utf8_text_to_glyphs(backend, locale, base_family, 16.0f, text, text_size, 0, MapTextToGlyphsFlag_Utf8Offsets, context);
+  uint64_t utf8_end = os_now_ns();
+
+  ASSERT(utf8_result.text_length == kernel_length);
+  ASSERT(utf8_result.glyph_count == utf16_result.glyph_count);
+  ASSERT(memory_match(utf8_result.utf8_offsets, kernel_offsets, (kernel_length + 1) * sizeof(uint32_t)));
+
+  printf("%-8s %8u %8u %14.3f %14.3f %10.2fx %10.1f %10.1f\n",
+         name,
+         text_size,
+         kernel_length,
+         (double)(kernel_begin - scalar_begin) / ((double)iteration_count * text_size),
+         (double)(kernel_end - kernel_begin) / ((double)iteration_count * text_size),
+         (double)(kernel_begin - scalar_begin) / (double)(kernel_end - kernel_begin),
+         (double)(utf8_begin - utf16_begin) / 1000.0,
+         (double)(utf8_end - utf8_begin) / 1000.0);
+
+  free_map_text_to_glyphs_result(&utf8_result);
+  free_map_text_to_glyphs_result(&utf16_result);
+  shaping_context_release(context);
+  arena_pop_to(arena, arena_pos_before);
+}
+
+////////////////////////////////////////////////////////////
+// hampus: frame scheduler simulation
+
+// NOTE(hampus): Runs the frame scheduler against a fake clock and a fake
+// presenter, through a scripted session, and compares the frames drawn with
+// redrawing on every vsync.
+
+struct SimulatedEvent
+{
+  uint64_t time_ns;
+  uint32_t invalidation_flags;
+  const char *name;
+};
+
+struct SimulatedPresenter
+{
+  uint64_t vsync_interval_ns;
+  uint64_t occluded_begin_ns;
+  uint64_t occluded_end_ns;
+};
+
+static bool
+simulated_presenter_is_occluded(const SimulatedPresenter *presenter, uint64_t now_ns)
+{
+  return now_ns >= presenter->occluded_begin_ns && now_ns < presenter->occluded_end_ns;
+}
+
+static void
+benchmark_frame_scheduler(void)
+{
+  const uint64_t second_ns = 1000ull * 1000 * 1000;
+  const uint64_t session_ns = 60 * second_ns;
+
+  // hampus: script
+
+  SimulatedEvent events[64] = {};
+  uint32_t event_count = 0;
+  for(uint32_t resize_idx = 0; resize_idx < 30; ++resize_idx)
+  {
+    // NOTE(hampus): A drag resize, 60 WM_SIZEs a second for half a second
+    events[event_count++] = {1 * second_ns + resize_idx * (second_ns / 60), FrameInvalidation_Size, "resize"};
+  }
+  events[event_count++] = {10 * second_ns, FrameInvalidation_Text, "text"};
+  events[event_count++] = {30 * second_ns, FrameInvalidation_Text, "text while occluded"};
+  events[event_count++] = {50 * second_ns, FrameInvalidation_Dpi, "dpi"};
+  events[event_count++] = {55 * second_ns, FrameInvalidation_Expose, "expose"};
+
+  SimulatedPresenter presenter = {};
+  presenter.vsync_interval_ns = second_ns / 60;
+  presenter.occluded_begin_ns = 20 * second_ns;
+  presenter.occluded_end_ns = 40 * second_ns;
+
+  // hampus: run
+
+  FrameScheduler scheduler = frame_scheduler_make(100 * 1000 * 1000);
+  uint64_t now_ns = 0;
+  uint32_t next_event_idx = 0;
+  uint64_t busy_ns = 0;
+  while(now_ns < session_ns)
+  {
+    for(; next_event_idx < event_count && events[next_event_idx].time_ns <= now_ns; ++next_event_idx)
+    {
+      frame_scheduler_invalidate(&scheduler, events[next_event_idx].invalidation_flags);
+    }
+
+    uint32_t invalidation_flags = 0;
+    uint64_t timeout_ns = 0;
+    FrameSchedulerAction action = frame_scheduler_next(&scheduler, now_ns, &invalidation_flags, &timeout_ns);
+    switch(action)
+    {
+      case FrameSchedulerAction_Wait:
+      {
+        // NOTE(hampus): Sleep until the next event or the timeout
+        uint64_t wake_ns = next_event_idx < event_count ? events[next_event_idx].time_ns : session_ns;
+        if(timeout_ns != FRAME_SCHEDULER_WAIT_FOREVER && now_ns + timeout_ns < wake_ns)
+        {
+          wake_ns = now_ns + timeout_ns;
+        }
+        now_ns = wake_ns;
+      }
+      break;
+      case FrameSchedulerAction_Draw:
+      {
+        // NOTE(hampus): Presenting blocks until the next vsync
+        busy_ns += presenter.vsync_interval_ns;
+        now_ns += presenter.vsync_interval_ns;
+        frame_scheduler_frame_presented(&scheduler, now_ns, simulated_presenter_is_occluded(&presenter, now_ns));
+      }
+      break;
+      case FrameSchedulerAction_TestOcclusion:
+      {
+        frame_scheduler_occlusion_tested(&scheduler, now_ns, simulated_presenter_is_occluded(&presenter, now_ns));
+      }
+      break;
+    }
+  }
+
+  uint64_t continuous_frame_count = session_ns / presenter.vsync_interval_ns;
+  FrameSchedulerStats *stats = &scheduler.stats;
+  printf("%10s %10s %10s %12s %10s %12s\n", "session s", "vsyncs", "frames", "occluded", "tests", "busy %");
+  printf("%10.1f %10llu %10llu %12llu %10llu %12.2f\n",
+         (double)session_ns / (double)second_ns,
+         (unsigned long long)continuous_frame_count,
+         (unsigned long long)stats->frame_count,
+         (unsigned long long)stats->occluded_frame_count,
+         (unsigned long long)stats->occlusion_test_count,
+         100.0 * (double)busy_ns / (double)session_ns);
+  ASSERT(!scheduler.is_occluded && scheduler.invalidation_flags == 0);
+}
+
+////////////////////////////////////////////////////////////
+// hampus: main
+
+int
+main(int argc, char **argv)
+{
+  // NOTE(hampus): Pass a number of characters to shape per corpus to trade
+  // run time for stable numbers.
+  uint64_t min_char_count = 4 << 20;
+  if(argc > 1)
+  {
+    min_char_count = strtoull(argv[1], 0, 10);
+  }
+
+  benchmark_memory_accounting = memory_accounting_alloc();
+  memory_set_allocator(memory_accounting_allocator(benchmark_memory_accounting));
+
+  StubShapingBackend stub_backend = {};
+  stub_shaping_backend_init(&stub_backend);
+  ShapingBackend backend = stub_shaping_backend(&stub_backend);
+
+  Arena *arena = arena_alloc();
+
+  //----------------------------------------------------------
+  // hampus: per corpus
+
+  const uint32_t corpus_length = 4096;
+  Corpus corpora[] =
+  {
+    corpus_from_utf8(arena, "ascii", corpus_ascii_utf8, corpus_length),
+    corpus_from_utf8(arena, "code", corpus_code_utf8, corpus_length),
+    corpus_from_utf8(arena, "bidi", corpus_bidi_utf8, corpus_length),
+    corpus_from_utf8(arena, "cjk", corpus_cjk_utf8, corpus_length),
+    corpus_from_utf8(arena, "emoji", corpus_emoji_utf8, corpus_length),
+    corpus_from_utf8(arena, "long", corpus_mixed_utf8, 1 << 16),
+  };
+
+  for(uint32_t corpus_idx = 0; corpus_idx < sizeof(corpora) / sizeof(corpora[0]); ++corpus_idx)
+  {
+    check_fallback_cache(&backend, &corpora[corpus_idx]);
+    check_shaping_memory(&backend, &corpora[corpus_idx]);
+  }
+  {
+    Corpus corpus = corpus_from_utf8(arena, "cjk latin", corpus_cjk_latin_utf8, 4096);
+    check_fallback_cache(&backend, &corpus);
+  }
+
+  print_benchmark_header("corpora");
+  for(uint32_t corpus_idx = 0; corpus_idx < sizeof(corpora) / sizeof(corpora[0]); ++corpus_idx)
+  {
+    Corpus *corpus = &corpora[corpus_idx];
+    for(uint32_t cache_idx = 0; cache_idx < 2; ++cache_idx)
+    {
+      BenchmarkResult result = benchmark_corpus(&backend, corpus, cache_idx == 1, min_char_count);
+      print_benchmark_result(corpus->name, corpus->text_length, cache_idx == 1, &result);
+    }
+  }
+
+  //----------------------------------------------------------
+  // hampus: scaling with input length
+
+  print_benchmark_header("scaling");
+  for(uint32_t text_length = 64; text_length <= (1 << 16); text_length *= 4)
+  {
+    Corpus corpus = corpus_from_utf8(arena, "mixed", corpus_mixed_utf8, text_length);
+    for(uint32_t cache_idx = 0; cache_idx < 2; ++cache_idx)
+    {
+      BenchmarkResult result = benchmark_corpus(&backend, &corpus, cache_idx == 1, min_char_count);
+      print_benchmark_result(corpus.name, corpus.text_length, cache_idx == 1, &result);
+    }
+  }
+
+  //----------------------------------------------------------
+  // hampus: glyph atlas
+
+  printf("\nglyph atlas\n");
+  printf("%-9s %6s %10s %10s %10s %10s %10s %10s\n", "pages", "frames", "quads", "ns/lookup", "hit rate", "rasterized", "evictions", "failed");
+  {
+    Corpus corpus = corpus_from_utf8(arena, "mixed", corpus_mixed_utf8, 80 * 64);
+    benchmark_glyph_atlas(&backend, &corpus, 1024, 2, 64);
+    benchmark_glyph_atlas(&backend, &corpus, 256, 4, 64);
+    benchmark_glyph_atlas(&backend, &corpus, 128, 4, 64);
+  }
+
+  //----------------------------------------------------------
+  // hampus: draw list
+
+  printf("\ndraw list\n");
+  printf("%6s %6s %8s %10s %10s %10s %12s %12s %10s %10s\n", "lines", "frames", "runs", "cold us", "build us", "replay us", "color runs", "height", "decomposed", "layer hits");
+  {
+    Corpus corpus = corpus_from_utf8(arena, "mixed", corpus_mixed_utf8, 80 * 256);
+    benchmark_draw_list(&backend, &corpus, 64);
+  }
+
+  //----------------------------------------------------------
+  // hampus: glyph positions
+
+  printf("\nglyph positions\n");
+  printf("%8s %8s %14s %14s %12s %12s %10s\n", "glyphs", "segments", "shape us", "+positions us", "walk ns", "search ns", "ties");
+  {
+    Corpus corpus = corpus_from_utf8(arena, "long", corpus_mixed_utf8, 1 << 16);
+    benchmark_glyph_positions(&backend, &corpora[0], 1 << 16);
+    benchmark_glyph_positions(&backend, &corpus, 1 << 16);
+  }
+
+  //----------------------------------------------------------
+  // hampus: line wrapping
+
+  printf("\nline wrapping\n");
+  printf("%-8s %-8s %8s %10s %12s %12s %12s %10s %10s\n", "corpus", "mode", "length", "breaks", "prepare us", "wrap us", "max wrap us", "lines", "hyphens");
+  {
+    Corpus corpus = corpus_from_utf8(arena, "long", corpus_mixed_utf8, 100000);
+    benchmark_line_wrap(&backend, &corpus, LineWrapMode_Greedy, 64);
+    benchmark_line_wrap(&backend, &corpus, LineWrapMode_Optimal, 64);
+    Corpus hyphens = corpus_from_utf8(arena, "hyphens", corpus_soft_hyphens_utf8, 100000);
+    benchmark_line_wrap(&backend, &hyphens, LineWrapMode_Greedy, 64);
+    benchmark_line_wrap(&backend, &hyphens, LineWrapMode_Optimal, 64);
+  }
+
+  //----------------------------------------------------------
+  // hampus: incremental re-shaping
+
+  {
+    Corpus corpus = corpus_from_utf8(arena, "cjk latin", corpus_cjk_latin_utf8, 1024);
+    check_remap(&backend, &corpora[0], MapTextToGlyphsFlag_GlyphPositions | MapTextToGlyphsFlag_LineBreakpoints, 200);
+    check_remap(&backend, &corpora[2], MapTextToGlyphsFlag_GlyphPositions | MapTextToGlyphsFlag_LineBreakpoints, 200);
+    check_remap(&backend, &corpora[4], 0, 200);
+    check_remap(&backend, &corpora[5], MapTextToGlyphsFlag_LineBreakpoints, 50);
+    check_remap(&backend, &corpus, MapTextToGlyphsFlag_GlyphPositions, 200);
+    Corpus unspaced = corpus_from_utf8(arena, "unspaced", corpus_unspaced_utf8, 1024);
+    check_remap(&backend, &unspaced, 0, 200);
+    check_remap(&backend, &unspaced, MapTextToGlyphsFlag_LineBreakpoints, 200);
+  }
+
+  printf("\nincremental re-shaping\n");
+  printf("%-8s %8s %10s %12s %12s %12s\n", "corpus", "length", "edits", "full us", "edit us", "typing us");
+  for(uint32_t text_length = 1024; text_length <= (1 << 16); text_length *= 4)
+  {
+    Corpus corpus = corpus_from_utf8(arena, "mixed", corpus_mixed_utf8, text_length);
+    benchmark_remap(&backend, &corpus, 256);
+  }
+  {
+    Corpus corpus = corpus_from_utf8(arena, "bidi", corpus_bidi_utf8, 1 << 16);
+    benchmark_remap(&backend, &corpus, 256);
+  }
+  for(uint32_t text_length = 1024; text_length <= (1 << 16); text_length *= 4)
+  {
+    Corpus corpus = corpus_from_utf8(arena, "unspaced", corpus_unspaced_utf8, text_length);
+    benchmark_remap(&backend, &corpus, 256);
+  }
+
+  //----------------------------------------------------------
+  // hampus: streaming
+
+  printf("\nstreaming\n");
+  printf("%-10s %8s %8s %8s %10s %14s %14s\n", "corpus", "length", "window", "chunk", "windows", "peak KB", "one-shot KB");
+  {
+    // NOTE(hampus): No spaces at all, so every cut falls back to a cluster
+    // boundary inside combining sequences and emoji ZWJ sequences
+    static const char *corpus_clusters_utf8 =
+      "eÌÌð¨âð©âð§"
+      "aÌðð½â¤ï¸";
+    Corpus clusters = corpus_from_utf8(arena, "clusters", corpus_clusters_utf8, 1 << 12);
+    Corpus mixed = corpus_from_utf8(arena, "mixed", corpus_mixed_utf8, 1 << 16);
+    check_stream(&backend, "emoji", corpora[4].text, corpora[4].text_length, 64, 7);
+    check_stream(&backend, "clusters", clusters.text, clusters.text_length, 32, 5);
+    check_stream(&backend, "mixed", mixed.text, mixed.text_length, 256, 37);
+    check_stream(&backend, "mixed", mixed.text, mixed.text_length, 4096, 1000);
+  }
+
+  //----------------------------------------------------------
+  // hampus: batch shaping
+
+  printf("\nbatch shaping\n");
+  printf("%8s %8s %10s %12s %10s %10s\n", "workers", "jobs", "ms", "Mchars/s", "speedup", "stolen");
+  {
+    Corpus corpus = corpus_from_utf8(arena, "mixed", corpus_mixed_utf8, 1 << 16);
+    benchmark_batch(&backend, arena, &corpus, 2048, 4);
+  }
+
+  //----------------------------------------------------------
+  // hampus: disk cache
+
+  printf("\ndisk cache\n");
+  printf("%-12s %8s %10s %10s %10s %8s %8s %8s\n", "launch", "strings", "total us", "open us", "save us", "hits", "misses", "stale");
+  {
+    Corpus corpus = corpus_from_utf8(arena, "mixed", corpus_mixed_utf8, 1 << 16);
+    benchmark_disk_cache(&backend, &stub_backend, arena, &corpus, 4096);
+  }
+
+  //----------------------------------------------------------
+  // hampus: utf-8 text
+
+  printf("\nutf-8 text\n");
+  printf("%-8s %8s %8s %14s %14s %11s %10s %10s\n", "corpus", "bytes", "units", "scalar ns/B", "kernel ns/B", "speedup", "utf-16 us", "utf-8 us");
+  for(uint32_t corpus_idx = 0; corpus_idx < sizeof(corpora) / sizeof(corpora[0]); ++corpus_idx)
+  {
+    char *text = 0;
+    uint32_t text_size = utf8_from_corpus(arena, &corpora[corpus_idx], &text);
+    benchmark_utf8(&backend, arena, corpora[corpus_idx].name, text, text_size, &corpora[corpus_idx], 256);
+  }
+  {
+    // NOTE(hampus): Mostly ASCII with bytes of every kind mixed in, most of
+    // which don't make up a well formed sequence
+    uint32_t text_size = 1 << 16;
+    char *text = push_array_no_zero(arena, char, text_size);
+    uint32_t state = 0x12345678;
+    for(uint32_t idx = 0; idx < text_size; ++idx)
+    {
+      state = state * 1664525 + 1013904223;
+      text[idx] = (char)((state >> 24) < 32 ? (state >> 16) : 'a' + (state >> 16) % 26);
+    }
+    benchmark_utf8(&backend, arena, "invalid", text, text_size, 0, 256);
+  }
+  {
+    // NOTE(hampus): The first and last codepoint of every length, and the
+    // sequences that are only malformed because of their value or because
+    // they stop early
+    static const char *sequences[] =
+    {
+      "\xc2\x80", "\xdf\xbf", "\xe0\xa0\x80", "\xed\x9f\xbf", "\xee\x80\x80", "\xef\xbf\xbf",
+      "\xf0\x90\x80\x80", "\xf4\x8f\xbf\xbf", "\xc1\xbf", "\xe0\x9f\xbf", "\xed\xa0\x80", "\xf0\x8f\xbf\xbf",
+      "\xf4\x90\x80\x80", "\xf5\x80\x80\x80", "\x80", "\xe3\x81", "\xf0\x9f\x98", "a",
+    };
+    uint32_t text_size = 1 << 16;
+    char *text = push_array_no_zero(arena, char, text_size);
+    uint32_t state = 0x12345678;
+    uint32_t text_idx = 0;
+    for(;;)
+    {
+      state = state * 1664525 + 1013904223;
+      const char *sequence = sequences[(state >> 16) % (sizeof(sequences) / sizeof(sequences[0]))];
+      uint32_t sequence_size = (uint32_t)strlen(sequence);
+      if(text_idx + sequence_size > text_size)
+      {
+        break;
+      }
+      memcpy(text + text_idx, sequence, sequence_size);
+      text_idx += sequence_size;
+    }
+    benchmark_utf8(&backend, arena, "edges", text, text_idx, 0, 256);
+  }
+
+  //----------------------------------------------------------
+  // hampus: frame scheduler
+
+  printf("\nframe scheduler\n");
+  benchmark_frame_scheduler();
+
+  printf("\nbackend calls: %d map_characters, %d analyze_script_and_bidi, %d shape_run\n", stub_backend.map_characters_count, stub_backend.analyze_count, stub_backend.shape_run_count);
+
+#if TEXT_TO_GLYPHS_TRACE
+  //----------------------------------------------------------
+  // hampus: trace
+
+  printf("\n%-24s %10s %12s %12s %10s\n", "phase", "calls", "chars", "glyphs", "ms");
+  for(uint32_t phase = 0; phase < TracePhase_COUNT; ++phase)
+  {
+    TracePhaseCounters counters = trace_phase_counters((TracePhase)phase);
+    printf("%-24s %10llu %12llu %12llu %10.2f\n", trace_phase_names[phase],
+           (unsigned long long)counters.call_count, (unsigned long long)counters.char_count,
+           (unsigned long long)counters.glyph_count, (double)counters.total_ns / 1e6);
+  }
+
+  uint64_t trace_json_size = 0;
+  char *trace_json = trace_export_chrome_json(arena, &trace_json_size);
+  FILE *trace_file = fopen("text_to_glyphs_trace.json", "wb");
+  if(trace_file != 0)
+  {
+    fwrite(trace_json, 1, trace_json_size, trace_file);
+    fclose(trace_file);
+    printf("wrote text_to_glyphs_trace.json\n");
+  }
+  trace_release();
+#endif
+
+  arena_release(arena);
+
+  //----------------------------------------------------------
+  // hampus: leaks
+
+  stub_shaping_backend_release(&stub_backend);
+  for(uint32_t kind = 0; kind < StubFontKind_COUNT; ++kind)
+  {
+    ASSERT(stub_backend.font_faces[kind].reference_count == 0);
+  }
+
+  MemoryCallSite leaks[32];
+  uint32_t leak_count = memory_accounting_call_sites(benchmark_memory_accounting, true, leaks, 32);
+  for(uint32_t leak_idx = 0; leak_idx < leak_count && leak_idx < 32; ++leak_idx)
+  {
+    MemoryCallSite *site = &leaks[leak_idx];
+    printf("leak: %s(%d): %llu bytes in %llu allocations\n", site->file, site->line, (unsigned long long)site->live_bytes, (unsigned long long)site->live_count);
+  }
+  ASSERT(leak_count == 0);
+
+  memory_set_allocator(0);
+  memory_accounting_release(benchmark_memory_accounting);
+
+  return 0;
+}